@@ -27,27 +27,148 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 #include <fcntl.h>
 #include "thyrion.h"
 
+static void
+usage(char *name) {
+   fprintf(stderr, "usage: %s [--layout <type> | --layout-all | --frames | "
+         "--size-report] <file>\n", name); 
+   fprintf(stderr, "       %s [-j <threads>] [--info] [--line] [--aranges] "
+         "[--abbrev] [--str] [--cu=<offset|name> | --address=<pc>] <file>\n", 
+         name); 
+   exit(1);
+}
+
+static dwarf_cu *
+select_cu(Dwarf *dwarf, char *cu_arg, char *address) {
+   unsigned long long val;
+   dwarf_cu *cu;
+   char *end;
+
+   if (address) {
+      val = strtoull(address, &end, 16);
+
+      if (*end || !(cu = dwarf_cu_at_addr(dwarf, val))) {
+         fprintf(stderr, "No CU covers address %s\n", address); 
+         return NULL;
+      }
+
+      return cu;
+   }
+
+   /* a number is taken as .debug_info offset, anything else as a name */
+   val = strtoull(cu_arg, &end, 0);
+
+   if (!*end && end != cu_arg) {
+      cu = dwarf_get_cu(dwarf, val);
+   } else {
+      cu = dwarf_cu_find(dwarf, cu_arg);
+   }
+
+   if (!cu) {
+      fprintf(stderr, "CU %s not found\n", cu_arg); 
+   }
+
+   return cu;
+}
+
 int
 main(int argc, char *argv[]) {
    Dwarf dwarf;
+   dwarf_type *type;
+   char *layout = NULL;
+   bool layout_all = false;
+   bool frames = false;
+   bool size_report = false;
+   uint32_t sects = 0;
+   int nthreads = 1;
+   char *cu_arg = NULL;
+   char *address = NULL;
+   dwarf_cu *cu = NULL;
+   dwarf_cfi *cfi;
    int rc;
+   int i;
+
+   for (i = 1; i < argc - 1; i++) {
+      if (!strcmp(argv[i], "--layout") && i + 1 < argc - 1) {
+         layout = argv[++i];
+      } else if (!strcmp(argv[i], "--layout-all")) {
+         layout_all = true;
+      } else if (!strcmp(argv[i], "--frames")) {
+         frames = true;
+      } else if (!strcmp(argv[i], "--size-report")) {
+         size_report = true;
+      } else if (!strcmp(argv[i], "-j") && i + 1 < argc - 1) {
+         nthreads = atoi(argv[++i]);
+      } else if (!strcmp(argv[i], "--info")) {
+         sects |= DWARF_DUMP_INFO;
+      } else if (!strcmp(argv[i], "--line")) {
+         sects |= DWARF_DUMP_LINE;
+      } else if (!strcmp(argv[i], "--aranges")) {
+         sects |= DWARF_DUMP_ARANGES;
+      } else if (!strcmp(argv[i], "--abbrev")) {
+         sects |= DWARF_DUMP_ABBREV;
+      } else if (!strcmp(argv[i], "--str")) {
+         sects |= DWARF_DUMP_STR;
+      } else if (!strncmp(argv[i], "--cu=", 5)) {
+         cu_arg = argv[i] + 5;
+      } else if (!strncmp(argv[i], "--address=", 10)) {
+         address = argv[i] + 10;
+      } else {
+         usage(argv[0]);
+      }
+   }
 
-   if (argc != 2) {
-      fprintf(stderr, "usage: %s <file>\n", argv[0]); 
-      exit(1);
+   if (argc < 2 || i != argc - 1 || (cu_arg && address)) {
+      usage(argv[0]);
    }
 
-   if ((rc = dwarf_open(&dwarf, argv[1]))) {
+   if ((rc = dwarf_open(&dwarf, argv[i]))) {
       fprintf(stderr, "Failed to read DWARF debugging information: rc=%d\n", rc); 
       return -1;
    }
 
-   dwarf_dump(&dwarf);
+   if (layout) {
+      if (!(type = dwarf_type_find(&dwarf, layout))) {
+         fprintf(stderr, "Type %s not found\n", layout); 
+         dwarf_free(&dwarf);
+         return -1;
+      }
+      dwarf_type_dump(type);
+   } else if (layout_all) {
+      dwarf_types_build(&dwarf, sysconf(_SC_NPROCESSORS_ONLN));
+      dwarf_types_dump(&dwarf);
+   } else if (frames) {
+      if (!(cfi = dwarf_get_cfi(&dwarf))) {
+         fprintf(stderr, "No call frame information found\n"); 
+         dwarf_free(&dwarf);
+         return -1;
+      }
+      dwarf_cfi_dump(cfi);
+   } else if (size_report) {
+      if (dwarf_size_report(&dwarf, stdout)) {
+         fprintf(stderr, "%s", dwarf.error ? dwarf.error : "");
+         dwarf_free(&dwarf);
+         return -1;
+      }
+   } else {
+      if ((cu_arg || address) && !(cu = select_cu(&dwarf, cu_arg, address))) {
+         dwarf_free(&dwarf);
+         return -1;
+      }
+
+      /* a single CU is most often wanted for its DIEs and line rows */
+      if (!sects) {
+         sects = cu ? DWARF_DUMP_INFO | DWARF_DUMP_LINE : DWARF_DUMP_ALL;
+      }
+
+      dwarf_dump_sects(&dwarf, sects, cu, nthreads);
+   }
+
    dwarf_free(&dwarf);
 
    return 0;
 }
-
@@ -26,71 +26,467 @@
  */
 
 #include <sys/mman.h>
+#include <ar.h>
+#include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "elf_util.h"
 
+void *
+elf_mem_realloc(Elf_Mem *mem, void *ptr, size_t size) {
+   if (mem->fn) {
+      return mem->fn(mem->ctx, ptr, size);
+   }
+
+   if (!size) {
+      free(ptr);
+      return NULL;
+   }
+
+   return realloc(ptr, size);
+}
+
+void *
+elf_mem_calloc(Elf_Mem *mem, size_t count, size_t size) {
+   void *ptr;
+
+   if (!mem->fn) {
+      return calloc(count, size);
+   }
+
+   if (size && count > SIZE_MAX / size) {
+      return NULL;
+   }
+
+   if ((ptr = mem->fn(mem->ctx, NULL, count * size))) {
+      memset(ptr, 0, count * size);
+   }
+
+   return ptr;
+}
+
+void
+elf_mem_free(Elf_Mem *mem, void *ptr) {
+   if (ptr) {
+      elf_mem_realloc(mem, ptr, 0);
+   }
+}
+
+static int
+elf_read_range(Elf *elf, size_t off, size_t len) {
+   ssize_t rc;
+
+   if (off > elf->size || len > elf->size - off) {
+      return EELFFMT;
+   }
+
+   while (len) {
+      if ((rc = pread(elf->fd, elf->buf + off, len, off)) <= 0) {
+         if (rc < 0 && errno == EINTR) {
+            continue;
+         }
+         return EELFOPEN;
+      }
+
+      off += rc;
+      len -= rc;
+   }
+
+   return 0;
+}
+
+/*
+ * Reads a section into its place in the buffer the first time it is 
+ * looked up, so offsets are the same as with a mapped file.
+ */
+static int
+elf_read_scn(Elf *elf, size_t idx, size_t off, size_t len) {
+   if (elf->loaded[idx]) {
+      return 0;
+   }
+
+   if (elf_read_range(elf, off, len)) {
+      return -1;
+   }
+
+   elf->loaded[idx] = 1;
+
+   return 0;
+}
+
+/* Header of section idx in host byte order, for either class. */
+static void
+elf_get_shdr(Elf *elf, size_t idx, Elf64_Shdr *shdr) {
+   Elf32_Shdr *shdr32;
+   Elf64_Shdr *shdr64;
+
+   if (elf->class == ELFCLASS32) {
+      shdr32 = (Elf32_Shdr *)(elf->buf + 
+            ELF_GET(elf, elf->ehdr.hdr32->e_shoff)) + idx;
+      shdr->sh_type = ELF_GET(elf, shdr32->sh_type);
+      shdr->sh_addr = ELF_GET(elf, shdr32->sh_addr);
+      shdr->sh_offset = ELF_GET(elf, shdr32->sh_offset);
+      shdr->sh_size = ELF_GET(elf, shdr32->sh_size);
+      shdr->sh_link = ELF_GET(elf, shdr32->sh_link);
+      shdr->sh_info = ELF_GET(elf, shdr32->sh_info);
+   } else {
+      shdr64 = (Elf64_Shdr *)(elf->buf + 
+            ELF_GET(elf, elf->ehdr.hdr64->e_shoff)) + idx;
+      shdr->sh_type = ELF_GET(elf, shdr64->sh_type);
+      shdr->sh_addr = ELF_GET(elf, shdr64->sh_addr);
+      shdr->sh_offset = ELF_GET(elf, shdr64->sh_offset);
+      shdr->sh_size = ELF_GET(elf, shdr64->sh_size);
+      shdr->sh_link = ELF_GET(elf, shdr64->sh_link);
+      shdr->sh_info = ELF_GET(elf, shdr64->sh_info);
+   }
+}
+
+/*
+ * Returns the size of the field written by a relocation, or 0 for types 
+ * that don't occur in debug sections.
+ */
+static size_t
+elf_reloc_size(uint16_t machine, uint32_t type) {
+   switch (machine) {
+      case EM_X86_64:
+         switch (type) {
+            case R_X86_64_64:
+            case R_X86_64_DTPOFF64:
+               return 8;
+            case R_X86_64_32:
+            case R_X86_64_32S:
+            case R_X86_64_DTPOFF32:
+               return 4;
+         }
+         break;
+      case EM_386:
+         switch (type) {
+            case R_386_32:
+            case R_386_TLS_LDO_32:
+               return 4;
+         }
+         break;
+      case EM_AARCH64:
+         switch (type) {
+            case R_AARCH64_ABS64:
+               return 8;
+            case R_AARCH64_ABS32:
+               return 4;
+         }
+         break;
+      case EM_ARM:
+         switch (type) {
+            case R_ARM_ABS32:
+            case R_ARM_TLS_LDO32:
+               return 4;
+         }
+         break;
+   }
+
+   return 0;
+}
+
+static uint64_t
+elf_peek(Elf *elf, char *pos, size_t size) {
+   uint32_t val32;
+   uint64_t val;
+
+   if (size == 4) {
+      memcpy(&val32, pos, 4);
+      return elf->swap ? __builtin_bswap32(val32) : val32;
+   }
+
+   memcpy(&val, pos, 8);
+   return elf->swap ? __builtin_bswap64(val) : val;
+}
+
+static void
+elf_poke(Elf *elf, char *pos, uint64_t val, size_t size) {
+   uint32_t val32 = val;
+
+   if (size == 4) {
+      val32 = elf->swap ? __builtin_bswap32(val32) : val32;
+      memcpy(pos, &val32, 4);
+   } else {
+      val = elf->swap ? __builtin_bswap64(val) : val;
+      memcpy(pos, &val, 8);
+   }
+}
+
+static bool
+elf_scn_in_file(Elf *elf, Elf64_Shdr *shdr) {
+   return shdr->sh_offset <= elf->size && 
+      shdr->sh_size <= elf->size - shdr->sh_offset;
+}
+
+/*
+ * Headers and tables are accessed in place, so their offsets must be 
+ * aligned for the class. buf itself is, see elf_open_mem().
+ */
+static bool
+elf_aligned(int class, uint64_t off) {
+   return !(off & (class == ELFCLASS32 ? 3 : 7));
+}
+
+/*
+ * Applies the relocations of a SHT_RELA or SHT_REL section to the copy of 
+ * the section they refer to. Symbol values are used as they are, so 
+ * addresses are relative to the start of the section defining them.
+ */
+static int
+elf_apply_relocs(Elf *elf, Elf64_Shdr *rel, char *copy, size_t size) {
+   uint16_t machine = elf->class == ELFCLASS32 ? 
+      ELF_GET(elf, elf->ehdr.hdr32->e_machine) : 
+      ELF_GET(elf, elf->ehdr.hdr64->e_machine);
+   bool rela = rel->sh_type == SHT_RELA;
+   size_t entsize;
+   size_t symsize;
+   size_t count;
+   size_t syms;
+   size_t i;
+   Elf64_Shdr symtab;
+   Elf32_Rela *rel32;
+   Elf64_Rela *rel64;
+   uint64_t off;
+   uint64_t info;
+   uint64_t sym;
+   uint64_t val;
+   int64_t addend;
+   size_t len;
+
+   if (rel->sh_link >= elf->shnum) {
+      return -1;
+   }
+
+   elf_get_shdr(elf, rel->sh_link, &symtab);
+
+   if (!elf_aligned(elf->class, rel->sh_offset) || 
+         !elf_aligned(elf->class, symtab.sh_offset) || 
+         !elf_scn_in_file(elf, &symtab) || (elf->pread && 
+            (elf_read_scn(elf, rel->sh_link, symtab.sh_offset, 
+                          symtab.sh_size)))) {
+      return -1;
+   }
+
+   if (elf->class == ELFCLASS32) {
+      entsize = rela ? sizeof(Elf32_Rela) : sizeof(Elf32_Rel);
+      symsize = sizeof(Elf32_Sym);
+   } else {
+      entsize = rela ? sizeof(Elf64_Rela) : sizeof(Elf64_Rel);
+      symsize = sizeof(Elf64_Sym);
+   }
+
+   count = rel->sh_size / entsize;
+   syms = symtab.sh_size / symsize;
+
+   for (i = 0; i < count; i++) {
+      /* Elf32_Rel and Elf64_Rel are prefixes of the Rela variants */
+      if (elf->class == ELFCLASS32) {
+         rel32 = (Elf32_Rela *)(elf->buf + rel->sh_offset + i * entsize);
+         off = ELF_GET(elf, rel32->r_offset);
+         info = ELF_GET(elf, rel32->r_info);
+         addend = rela ? ELF_GET(elf, rel32->r_addend) : 0;
+         sym = ELF32_R_SYM(info);
+         len = elf_reloc_size(machine, ELF32_R_TYPE(info));
+      } else {
+         rel64 = (Elf64_Rela *)(elf->buf + rel->sh_offset + i * entsize);
+         off = ELF_GET(elf, rel64->r_offset);
+         info = ELF_GET(elf, rel64->r_info);
+         addend = rela ? ELF_GET(elf, rel64->r_addend) : 0;
+         sym = ELF64_R_SYM(info);
+         len = elf_reloc_size(machine, ELF64_R_TYPE(info));
+      }
+
+      if (!len || off > size || len > size - off || sym >= syms) {
+         continue;
+      }
+
+      /* REL relocations keep the addend in the field they patch */
+      if (!rela) {
+         addend = elf_peek(elf, copy + off, len);
+      }
+
+      if (elf->class == ELFCLASS32) {
+         val = ELF_GET(elf, ((Elf32_Sym *)(elf->buf + symtab.sh_offset) + 
+                  sym)->st_value);
+      } else {
+         val = ELF_GET(elf, ((Elf64_Sym *)(elf->buf + symtab.sh_offset) + 
+                  sym)->st_value);
+      }
+
+      elf_poke(elf, copy + off, val + addend, len);
+   }
+
+   return 0;
+}
+
+/*
+ * Debug sections of relocatable files refer to other sections through 
+ * relocations, so their offsets into .debug_str, .debug_abbrev and the 
+ * like are all 0 until applied. The file is mapped read-only, so the 
+ * section is copied on first lookup and the copy kept in elf->relocated.
+ */
+static int
+elf_scn_relocate(Elf *elf, size_t idx, Elf_Scn *scn, char *name) {
+   uint16_t type = elf->class == ELFCLASS32 ? 
+      ELF_GET(elf, elf->ehdr.hdr32->e_type) : 
+      ELF_GET(elf, elf->ehdr.hdr64->e_type);
+   Elf64_Shdr rel;
+   char *copy;
+   size_t i;
+
+   if (type != ET_REL || strncmp(name, ".debug_", 7)) {
+      return 0;
+   }
+
+   if (elf->relocated && elf->relocated[idx]) {
+      scn->buf = elf->relocated[idx];
+      return 0;
+   }
+
+   for (i = 1; i < elf->shnum; i++) {
+      elf_get_shdr(elf, i, &rel);
+
+      if ((rel.sh_type == SHT_RELA || rel.sh_type == SHT_REL) && 
+            rel.sh_info == idx) {
+         break;
+      }
+   }
+
+   if (i == elf->shnum || !scn->size) {
+      return 0;
+   }
+
+   if (!elf_scn_in_file(elf, &rel) || 
+         (elf->pread && elf_read_scn(elf, i, rel.sh_offset, rel.sh_size))) {
+      return -1;
+   }
+
+   if ((!elf->relocated && 
+            !(elf->relocated = elf_mem_calloc(&elf->mem, elf->shnum, 
+                  sizeof(char *)))) ||
+         !(copy = elf_mem_realloc(&elf->mem, NULL, scn->size))) {
+      return -1;
+   }
+
+   memcpy(copy, scn->buf, scn->size);
+
+   if (elf_apply_relocs(elf, &rel, copy, scn->size)) {
+      elf_mem_free(&elf->mem, copy);
+      return -1;
+   }
+
+   elf->relocated[idx] = copy;
+   scn->buf = copy;
+
+   return 0;
+}
+
+/* Section names may not be terminated in corrupt files. */
+static bool
+elf_scn_name_eq(Elf *elf, size_t off, const char *name) {
+   size_t len = strlen(name) + 1;
+
+   return off < elf->sh_names_size && elf->sh_names_size - off >= len && 
+      !memcmp(elf->sh_names + off, name, len);
+}
+
+/*
+ * Fills in the data of section idx, which must lie within the file unless 
+ * it takes no space in it.
+ */
+static int
+elf_scn_load(Elf *elf, size_t idx, Elf_Scn *scn, char *name) {
+   Elf64_Shdr shdr;
+
+   elf_get_shdr(elf, idx, &shdr);
+
+   if (shdr.sh_type != SHT_NOBITS && (!elf_scn_in_file(elf, &shdr) || 
+            (elf->pread && elf_read_scn(elf, idx, shdr.sh_offset, 
+                                        shdr.sh_size)))) {
+      return -1;
+   }
+
+   scn->buf = elf->buf + shdr.sh_offset;
+   scn->size = shdr.sh_size;
+   scn->addr = shdr.sh_addr;
+
+   return elf_scn_relocate(elf, idx, scn, name);
+}
+
 int
 elf_get_scn32(Elf *elf, Elf_Scn *scn, char *name) {
-   Elf32_Shdr *shdr = (Elf32_Shdr *)(elf->buf + elf->ehdr.hdr32->e_shoff);
-   int i = 0;
+   Elf32_Shdr *shdr = (Elf32_Shdr *)(elf->buf + 
+         ELF_GET(elf, elf->ehdr.hdr32->e_shoff));
+   size_t i;
 
-   do {
+   for (i = 1; i < elf->shnum; i++) {
       shdr++; 
 
-      if (!strcmp(elf->sh_names + shdr->sh_name, name)) {
+      if (elf_scn_name_eq(elf, ELF_GET(elf, shdr->sh_name), name)) {
          scn->shdr.hdr32 = shdr; 
-         scn->buf = elf->buf + shdr->sh_offset;
-         scn->size = shdr->sh_size;
-         return 0;
+         return elf_scn_load(elf, i, scn, name);
       }
-   } while (++i < elf->ehdr.hdr32->e_shnum);
+   }
 
    return -1;
 }
 
 int
 elf_get_scn64(Elf *elf, Elf_Scn *scn, char *name) {
-   Elf64_Shdr *shdr = (Elf64_Shdr *)(elf->buf + elf->ehdr.hdr64->e_shoff);
-   int i = 0;
+   Elf64_Shdr *shdr = (Elf64_Shdr *)(elf->buf + 
+         ELF_GET(elf, elf->ehdr.hdr64->e_shoff));
+   size_t i;
 
-   do {
+   for (i = 1; i < elf->shnum; i++) {
       shdr++; 
 
-      if (!strcmp(elf->sh_names + shdr->sh_name, name)) {
+      if (elf_scn_name_eq(elf, ELF_GET(elf, shdr->sh_name), name)) {
          scn->shdr.hdr64 = shdr; 
-         scn->buf = elf->buf + shdr->sh_offset;
-         scn->size = shdr->sh_size;
-         return 0;
+         return elf_scn_load(elf, i, scn, name);
       }
-   } while (++i < elf->ehdr.hdr64->e_shnum);
+   }
 
    return -1;
 }
 
-int
-elf_open(Elf *elf, char *file) {
-   struct stat sb;
-
-   if ((elf->fd = open(file, O_RDONLY)) < 0) {
-      return EELFOPEN;
-   } 
+/*
+ * Files with SHN_LORESERVE or more sections keep the section count and 
+ * the index of the section name table in the first section header.
+ */
+#define ELF_SCN_COUNTS(elf, ehdr, shdr, shnum, shstrndx) do { \
+   (shnum) = ELF_GET(elf, (ehdr)->e_shnum) ? \
+      ELF_GET(elf, (ehdr)->e_shnum) : ELF_GET(elf, (shdr)->sh_size); \
+   (shstrndx) = ELF_GET(elf, (ehdr)->e_shstrndx) != SHN_XINDEX ? \
+      ELF_GET(elf, (ehdr)->e_shstrndx) : ELF_GET(elf, (shdr)->sh_link); \
+} while (0)
 
-   if (stat(file, &sb)) {
-      perror("stat"); 
-      return EELFOPEN;
-   }
+/* Multi-byte values in the file are swapped if its byte order differs. */
+static bool
+elf_swapped(const char *ident) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+   return ident[EI_DATA] == ELFDATA2LSB;
+#else
+   return ident[EI_DATA] == ELFDATA2MSB;
+#endif
+}
 
-   elf->size = sb.st_size;
+static int
+elf_read_hdr(Elf *elf) {
+   Elf64_Shdr names;
+   size_t shoff;
+   size_t shentsize;
+   size_t shstrndx;
 
-   if ((elf->buf = mmap(NULL, elf->size, PROT_READ, MAP_PRIVATE, elf->fd, 0)) ==
-         MAP_FAILED) {
-      return EELFOPEN;
+   if (elf->size < EI_NIDENT) {
+      return EELFFMT; 
    }
 
    if (elf->buf[EI_MAG0] != 0x7f || elf->buf[EI_MAG1] != 'E' ||
@@ -98,30 +494,440 @@ elf_open(Elf *elf, char *file) {
       return EELFFMT; 
    }
 
+   elf->swap = elf_swapped(elf->buf);
+
    if (elf->buf[EI_CLASS] == ELFCLASS32) {
       elf->class = ELFCLASS32;
       Elf32_Ehdr *ehdr = elf->ehdr.hdr32 = (Elf32_Ehdr *)elf->buf;
+      shoff = ELF_GET(elf, ehdr->e_shoff);
+      shentsize = sizeof(Elf32_Shdr);
 
-      if (!ehdr->e_shoff || ehdr->e_shoff >= elf->size - ehdr->e_shentsize) {
+      if (elf->size < sizeof(Elf32_Ehdr) || !shoff || 
+            shoff > elf->size - shentsize || !elf_aligned(elf->class, shoff)) {
          return EELFFMT; 
       }
 
-      elf->sh_names = elf->buf + ((Elf32_Shdr *)(elf->buf + ehdr->e_shoff + 
-            ehdr->e_shstrndx * ehdr->e_shentsize))->sh_offset;
+      ELF_SCN_COUNTS(elf, ehdr, (Elf32_Shdr *)(elf->buf + shoff), elf->shnum, 
+            shstrndx);
    } else if (elf->buf[EI_CLASS] == ELFCLASS64) {
       elf->class = ELFCLASS64;
       Elf64_Ehdr *ehdr = elf->ehdr.hdr64 = (Elf64_Ehdr *)elf->buf;
+      shoff = ELF_GET(elf, ehdr->e_shoff);
+      shentsize = sizeof(Elf64_Shdr);
 
-      if (!ehdr->e_shoff || ehdr->e_shoff >= elf->size - ehdr->e_shentsize) {
+      if (elf->size < sizeof(Elf64_Ehdr) || !shoff || 
+            shoff > elf->size - shentsize || !elf_aligned(elf->class, shoff)) {
          return EELFFMT; 
       }
 
-      elf->sh_names = elf->buf + ((Elf64_Shdr *)(elf->buf + ehdr->e_shoff + 
-            ehdr->e_shstrndx * ehdr->e_shentsize))->sh_offset;
+      ELF_SCN_COUNTS(elf, ehdr, (Elf64_Shdr *)(elf->buf + shoff), elf->shnum, 
+            shstrndx);
    } else {
       return EELFFMT; 
    }
 
+   if (shstrndx >= elf->shnum || 
+         elf->shnum > (elf->size - shoff) / shentsize) {
+      return EELFFMT;
+   }
+
+   elf_get_shdr(elf, shstrndx, &names);
+
+   if (!elf_scn_in_file(elf, &names)) {
+      return EELFFMT;
+   }
+
+   elf->sh_names = elf->buf + names.sh_offset;
+   elf->sh_names_size = names.sh_size;
+
+   return 0;
+}
+
+/*
+ * Maps the file behind fd. The descriptor remains owned by the caller.
+ */
+int
+elf_open_fd(Elf *elf, int fd) {
+   struct stat sb;
+
+   elf->fd = fd;
+   elf->owns_fd = false;
+   elf->owns_buf = false;
+   elf->pread = false;
+   elf->loaded = NULL;
+   elf->relocated = NULL;
+
+   if (fstat(fd, &sb)) {
+      return EELFOPEN;
+   }
+
+   elf->size = sb.st_size;
+
+   if ((elf->buf = mmap(NULL, elf->size, PROT_READ, MAP_PRIVATE, fd, 0)) ==
+         MAP_FAILED) {
+      elf->buf = NULL;
+      return EELFOPEN;
+   }
+
+   elf->owns_map = true;
+
+   /* lazily parsed handles mostly read at query time */
+   madvise(elf->buf, elf->size, MADV_RANDOM);
+
+   return elf_read_hdr(elf);
+}
+
+/*
+ * Uses an image that is already in memory, which must outlive the Elf. 
+ * Images not aligned for the 64-bit headers, such as ar members, which 
+ * are only 2-byte aligned, are copied.
+ */
+int
+elf_open_mem(Elf *elf, char *buf, size_t size) {
+   int rc;
+
+   elf->fd = -1;
+   elf->owns_fd = false;
+   elf->owns_map = false;
+   elf->owns_buf = false;
+   elf->pread = false;
+   elf->loaded = NULL;
+   elf->relocated = NULL;
+   elf->buf = buf;
+   elf->size = size;
+
+   if (((uintptr_t)buf & 7) && size) {
+      if (!(elf->buf = elf_mem_realloc(&elf->mem, NULL, size))) {
+         return EELFOPEN;
+      }
+
+      memcpy(elf->buf, buf, size);
+      elf->owns_buf = true;
+   }
+
+   if ((rc = elf_read_hdr(elf)) && elf->owns_buf) {
+      elf_mem_free(&elf->mem, elf->buf);
+      elf->owns_buf = false;
+      elf->buf = NULL;
+   }
+
+   return rc;
+}
+
+int
+elf_open(Elf *elf, char *file) {
+   int fd;
+   int rc;
+
+   if ((fd = open(file, O_RDONLY)) < 0) {
+      return EELFOPEN;
+   } 
+
+   rc = elf_open_fd(elf, fd);
+   elf->owns_fd = true;
+
+   return rc;
+}
+
+/*
+ * Reads the file with pread instead of mapping it, for file systems on 
+ * which page faults are slow. Only the headers and the sections that are 
+ * looked up are read into an anonymous mapping of the file's size.
+ */
+int
+elf_open_pread(Elf *elf, char *file) {
+   Elf_Mem mem = elf->mem;
+   struct stat sb;
+   Elf32_Shdr *shdr32;
+   Elf64_Shdr *shdr64;
+   size_t shoff;
+   size_t shnum;
+   size_t shentsize;
+   size_t shstrndx;
+   size_t off;
+   size_t len;
+   int rc;
+
+   memset(elf, 0, sizeof(Elf));
+   elf->mem = mem;
+
+   if ((elf->fd = open(file, O_RDONLY)) < 0) {
+      return EELFOPEN;
+   } 
+
+   elf->owns_fd = true;
+
+   if (fstat(elf->fd, &sb)) {
+      return EELFOPEN;
+   }
+
+   elf->size = sb.st_size;
+
+   if ((elf->buf = mmap(NULL, elf->size, PROT_READ | PROT_WRITE, 
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED) {
+      elf->buf = NULL;
+      return EELFOPEN;
+   }
+
+   elf->owns_map = true;
+   elf->pread = true;
+
+   if ((rc = elf_read_range(elf, 0, elf->size < sizeof(Elf64_Ehdr) ? 
+               elf->size : sizeof(Elf64_Ehdr)))) {
+      return rc;
+   }
+
+   if (elf->size < EI_NIDENT) {
+      return EELFFMT;
+   }
+
+   elf->swap = elf_swapped(elf->buf);
+
+   if (elf->buf[EI_CLASS] == ELFCLASS32) {
+      shoff = ELF_GET(elf, ((Elf32_Ehdr *)elf->buf)->e_shoff);
+      shentsize = sizeof(Elf32_Shdr);
+   } else {
+      shoff = ELF_GET(elf, ((Elf64_Ehdr *)elf->buf)->e_shoff);
+      shentsize = sizeof(Elf64_Shdr);
+   }
+
+   if (!elf_aligned(elf->buf[EI_CLASS], shoff)) {
+      return EELFFMT;
+   }
+
+   /* the first header holds the counts that overflow the ELF header */
+   if ((rc = elf_read_range(elf, shoff, shentsize))) {
+      return rc;
+   }
+
+   if (elf->buf[EI_CLASS] == ELFCLASS32) {
+      ELF_SCN_COUNTS(elf, (Elf32_Ehdr *)elf->buf, 
+            (Elf32_Shdr *)(elf->buf + shoff), shnum, shstrndx);
+   } else {
+      ELF_SCN_COUNTS(elf, (Elf64_Ehdr *)elf->buf, 
+            (Elf64_Shdr *)(elf->buf + shoff), shnum, shstrndx);
+   }
+
+   if (shstrndx >= shnum || shnum > (elf->size - shoff) / shentsize ||
+         (rc = elf_read_range(elf, shoff, shnum * shentsize))) {
+      return rc ? rc : EELFFMT;
+   }
+
+   elf->loaded = elf_mem_calloc(&elf->mem, shnum, 1);
+
+   if (elf->buf[EI_CLASS] == ELFCLASS32) {
+      shdr32 = (Elf32_Shdr *)(elf->buf + shoff) + shstrndx;
+      off = ELF_GET(elf, shdr32->sh_offset);
+      len = ELF_GET(elf, shdr32->sh_size);
+   } else {
+      shdr64 = (Elf64_Shdr *)(elf->buf + shoff) + shstrndx;
+      off = ELF_GET(elf, shdr64->sh_offset);
+      len = ELF_GET(elf, shdr64->sh_size);
+   }
+
+   if (elf_read_scn(elf, shstrndx, off, len)) {
+      return EELFFMT;
+   }
+
+   /* the buffer is only written by elf_read_scn() */
+   return elf_read_hdr(elf);
+}
+
+int
+elf_scn_advise(Elf *elf, Elf_Scn *scn, elf_advice advice) {
+   static const int madv[] = {
+      MADV_NORMAL, MADV_SEQUENTIAL, MADV_RANDOM, MADV_DONTNEED
+   };
+   static const int fadv[] = {
+      POSIX_FADV_NORMAL, POSIX_FADV_SEQUENTIAL, POSIX_FADV_RANDOM, 
+      POSIX_FADV_DONTNEED
+   };
+   uintptr_t page = sysconf(_SC_PAGESIZE);
+   char *start;
+   size_t len;
+
+   /* relocated copies are not part of the file */
+   if (!scn->size || !elf->owns_map || scn->buf < elf->buf || 
+         scn->buf >= elf->buf + elf->size) {
+      return 0;
+   }
+
+   /* read sections are anonymous memory, only the page cache is advised */
+   if (elf->pread) {
+      return posix_fadvise(elf->fd, scn->buf - elf->buf, scn->size, 
+            fadv[advice]);
+   }
+
+   start = (char *)((uintptr_t)scn->buf & ~(page - 1));
+   len = scn->buf + scn->size - start;
+
+   if (advice == ELF_ADV_SEQUENTIAL && madvise(start, len, MADV_WILLNEED)) {
+      return -1;
+   }
+
+   /* pages of a private read-only mapping are refaulted from the file */
+   return madvise(start, len, madv[advice]);
+}
+
+void
+elf_close(Elf *elf) {
+   size_t i;
+
+   if (elf->owns_map && elf->buf) {
+      munmap(elf->buf, elf->size);
+   } else if (elf->owns_buf) {
+      elf_mem_free(&elf->mem, elf->buf);
+   }
+
+   if (elf->owns_fd && elf->fd >= 0) {
+      close(elf->fd);
+   }
+
+   if (elf->relocated) {
+      for (i = 0; i < elf->shnum; i++) {
+         elf_mem_free(&elf->mem, elf->relocated[i]);
+      }
+   }
+
+   elf_mem_free(&elf->mem, elf->relocated);
+   elf_mem_free(&elf->mem, elf->loaded);
+   elf->relocated = NULL;
+   elf->loaded = NULL;
+   elf->buf = NULL;
+   elf->fd = -1;
+}
+
+bool
+elf_is_ar(char *buf, size_t size) {
+   return size >= SARMAG && !memcmp(buf, ARMAG, SARMAG);
+}
+
+int
+elf_ar_init(Elf_Ar *ar, char *buf, size_t size) {
+   memset(ar, 0, sizeof(Elf_Ar));
+
+   if (!elf_is_ar(buf, size)) {
+      return EELFFMT;
+   }
+
+   ar->buf = buf;
+   ar->size = size;
+   ar->off = SARMAG;
+
+   return 0;
+}
+
+/* Parses a decimal header field, which is padded with spaces. */
+static bool
+elf_ar_num(const char *field, size_t len, size_t *val) {
+   size_t i;
+
+   *val = 0;
+
+   for (i = 0; i < len && field[i] != ' '; i++) {
+      if (field[i] < '0' || field[i] > '9') {
+         return false;
+      }
+      *val = *val * 10 + field[i] - '0';
+   }
+
+   return i > 0;
+}
+
+/*
+ * Resolves the member name. GNU archives end short names in '/' and keep 
+ * longer ones in the "//" member, referenced as "/<offset>". BSD archives 
+ * store long names as "#1/<length>" in front of the member data.
+ */
+static int
+elf_ar_name(Elf_Ar *ar, struct ar_hdr *hdr, Elf_Ar_Member *member) {
+   char *name = hdr->ar_name;
+   size_t len = sizeof(hdr->ar_name);
+   size_t off;
+   char *end;
+
+   if (name[0] == '/' && name[1] >= '0' && name[1] <= '9') {
+      if (!elf_ar_num(name + 1, len - 1, &off) || off >= ar->names_size) {
+         return EELFFMT;
+      }
+
+      member->name = ar->names + off;
+      end = memchr(member->name, '\n', ar->names_size - off);
+      len = end ? (size_t)(end - member->name) : ar->names_size - off;
+   } else if (!strncmp(name, "#1/", 3)) {
+      if (!elf_ar_num(name + 3, len - 3, &len) || len > member->size) {
+         return EELFFMT;
+      }
+
+      member->name = member->buf;
+      member->buf += len;
+      member->size -= len;
+
+      /* BSD names may be padded with NULs */
+      end = memchr(member->name, '\0', len);
+      len = end ? (size_t)(end - member->name) : len;
+   } else {
+      member->name = name;
+
+      while (len && name[len - 1] == ' ') {
+         len--;
+      }
+   }
+
+   if (len && member->name[len - 1] == '/') {
+      len--;
+   }
+
+   member->name_len = len;
+
    return 0;
 }
 
+int
+elf_ar_next(Elf_Ar *ar, Elf_Ar_Member *member) {
+   struct ar_hdr *hdr;
+   size_t size;
+   int rc;
+
+   while (ar->off < ar->size) {
+      if (ar->size - ar->off < sizeof(struct ar_hdr)) {
+         return EELFFMT;
+      }
+
+      hdr = (struct ar_hdr *)(ar->buf + ar->off);
+
+      if (memcmp(hdr->ar_fmag, ARFMAG, sizeof(hdr->ar_fmag)) || 
+            !elf_ar_num(hdr->ar_size, sizeof(hdr->ar_size), &size) || 
+            size > ar->size - ar->off - sizeof(struct ar_hdr)) {
+         return EELFFMT;
+      }
+
+      member->buf = ar->buf + ar->off + sizeof(struct ar_hdr);
+      member->size = size;
+
+      /* members start at even offsets */
+      ar->off += sizeof(struct ar_hdr) + size + (size & 1);
+
+      if (!strncmp(hdr->ar_name, "// ", 3)) {
+         ar->names = member->buf;
+         ar->names_size = size;
+         continue;
+      }
+
+      if (!strncmp(hdr->ar_name, "/ ", 2) || 
+            !strncmp(hdr->ar_name, "/SYM64/ ", 8)) {
+         continue;
+      }
+
+      if ((rc = elf_ar_name(ar, hdr, member))) {
+         return rc;
+      }
+
+      /* the symbol table of BSD archives */
+      if (member->name_len < 9 || strncmp(member->name, "__.SYMDEF", 9)) {
+         return 0;
+      }
+   }
+
+   return ELF_AR_END;
+}
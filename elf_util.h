@@ -29,20 +29,49 @@
 #define _ELF_UTIL_H_
 
 #include <elf.h>
+#include <stdbool.h>
+#include <stddef.h>
 
 #define EELFOPEN -1
 #define EELFFMT  -2
 
+typedef enum {
+   ELF_ADV_NORMAL,
+   ELF_ADV_SEQUENTIAL,        /* about to be read front to back */
+   ELF_ADV_RANDOM,            /* read at query time */
+   ELF_ADV_DONTNEED           /* parsed, pages may be dropped */
+} elf_advice;
+
+/*
+ * Memory of an Elf and what is built from it. fn works like realloc() with 
+ * ctx as first argument and frees ptr if size is 0. A NULL fn uses the C 
+ * library.
+ */
+typedef struct {
+   void *(*fn)(void *ctx, void *ptr, size_t size);
+   void *ctx;
+} Elf_Mem;
+
 typedef struct {
    int class;
    int fd; 
+   bool owns_fd;              /* fd is closed by elf_close() */
+   bool owns_map;             /* buf is unmapped by elf_close() */
+   bool owns_buf;             /* buf is an aligned copy freed by elf_close() */
+   bool pread;                /* sections are read into buf on demand */
+   bool swap;                 /* byte order differs from the host's */
+   unsigned char *loaded;     /* sections read so far in pread mode */
+   char **relocated;          /* relocated debug sections of ET_REL files */
    size_t size;
+   size_t shnum;              /* number of section headers */
    union {
       Elf32_Ehdr *hdr32;
       Elf64_Ehdr *hdr64;
    } ehdr;
    char * sh_names;
+   size_t sh_names_size;
    char *buf;
+   Elf_Mem mem;               /* set before the elf_open functions */
 } Elf;
 
 typedef struct {
@@ -52,11 +81,77 @@ typedef struct {
    } shdr;
    char *buf;
    size_t size;
+   Elf64_Addr addr;           /* load address, 0 if not allocated */
 } Elf_Scn;
 
+static inline uint64_t
+elf_bswap(uint64_t val, size_t size) {
+   switch (size) {
+      case 2:
+         return __builtin_bswap16(val);
+      case 4:
+         return __builtin_bswap32(val);
+      case 8:
+         return __builtin_bswap64(val);
+      default:
+         return val;
+   }
+}
+
+/*
+ * Members of an ar archive are returned in place, without a copy. The 
+ * archive symbol table and the table of long names are skipped.
+ */
+#define ELF_AR_END 1
+
+typedef struct {
+   char *buf;
+   size_t size;
+   size_t off;                /* header of the next member */
+   char *names;               /* GNU table of long member names */
+   size_t names_size;
+} Elf_Ar;
+
+typedef struct {
+   char *name;                /* not terminated, see name_len */
+   size_t name_len;
+   char *buf;
+   size_t size;
+} Elf_Ar_Member;
+
+/* Reads a field of a header in the file in host byte order. */
+#define ELF_GET(elf, field)                                          \
+   ((elf)->swap ?                                                    \
+    (__typeof__(field))elf_bswap((field), sizeof(field)) : (field))
+
 int
 elf_open(Elf *elf, char *file);
 
+int
+elf_open_fd(Elf *elf, int fd);
+
+int
+elf_open_mem(Elf *elf, char *buf, size_t size);
+
+int
+elf_open_pread(Elf *elf, char *file);
+
+void
+elf_close(Elf *elf);
+
+void *
+elf_mem_realloc(Elf_Mem *mem, void *ptr, size_t size);
+
+void *
+elf_mem_calloc(Elf_Mem *mem, size_t count, size_t size);
+
+void
+elf_mem_free(Elf_Mem *mem, void *ptr);
+
+/*
+ * Looks up a section by name. The .debug_ sections of relocatable files 
+ * are returned as a copy with their relocations applied.
+ */
 #define elf_get_scn(elf, scn, name)   \
    ((elf)->class == ELFCLASS32 ?      \
     elf_get_scn32((elf), scn, name) : \
@@ -68,5 +163,21 @@ elf_get_scn32(Elf *elf, Elf_Scn *scn, char *name);
 int
 elf_get_scn64(Elf *elf, Elf_Scn *scn, char *name);
 
+int
+elf_scn_advise(Elf *elf, Elf_Scn *scn, elf_advice advice);
+
+bool
+elf_is_ar(char *buf, size_t size);
+
+int
+elf_ar_init(Elf_Ar *ar, char *buf, size_t size);
+
+/*
+ * Stores the next member in *member. Returns 0 on success, ELF_AR_END 
+ * after the last member and EELFFMT if the archive is malformed.
+ */
+int
+elf_ar_next(Elf_Ar *ar, Elf_Ar_Member *member);
+
 #endif // _ELF_UTIL_H_
 
@@ -35,8 +35,9 @@ int
 main(int argc, char **argv) {
    Dwarf dwarf;
    dwarf_sprog *sprog;
-   dwarf_sprog_file *file;
    dwarf_sm_regs *sm_regs;
+   uint32_t *ids;
+   uint32_t id_count;
    uint32_t file_idx;
    uint32_t line;
    char *colon;
@@ -47,7 +48,7 @@ main(int argc, char **argv) {
       return -1;
    }   
 
-   if ((colon = strstr(argv[1], ":"))) {
+   if ((colon = strrchr(argv[1], ':'))) {
       *colon = '\0';
       file_name = argv[1]; 
       line = atoi(colon+1);
@@ -61,26 +62,42 @@ main(int argc, char **argv) {
       return -1;
    }
 
+   /* any trailing part of the path selects the file, e.g. net/foo.c */
+   if (!(id_count = dwarf_paths_find(&dwarf, file_name, NULL, 0))) {
+      printf("File not found\n");
+      dwarf_free(&dwarf);
+      return -1;
+   }
+
+   ids = malloc(id_count * sizeof(uint32_t));
+   dwarf_paths_find(&dwarf, file_name, ids, id_count);
+
+   if (id_count > 1) {
+      fprintf(stderr, "%s is ambiguous, using %s\n", file_name, 
+            dwarf_path(&dwarf, ids[0]));
+   }
+
    for (sprog = dwarf.sprog; sprog != NULL; sprog = sprog->next) {
-      for (file = sprog->prologue->files, file_idx = 1; file != NULL; 
-            file = file->next, file_idx++) {
-         if (!strcmp(file_name, file->name)) {
-            for (sm_regs = sprog->sm_regs; sm_regs != NULL; 
-                  sm_regs = sm_regs->next) {
-               if (sm_regs->file == file_idx && sm_regs->line == line) {
-                  printf("0x%08lx\n", sm_regs->address);
-                  return 0;
-               }
-            }
+      for (file_idx = 1; file_idx <= sprog->file_count; file_idx++) {
+         if (dwarf_sprog_file_id(&dwarf, sprog, file_idx) != ids[0]) {
+            continue;
+         }
 
-            printf("Address not found\n");
-            return -1;
+         for (sm_regs = dwarf_sprog_get_regs(&dwarf, sprog); sm_regs != NULL; 
+               sm_regs = sm_regs->next) {
+            if (sm_regs->file == file_idx && sm_regs->line == line) {
+               printf("0x%08lx\n", sm_regs->address);
+               free(ids);
+               dwarf_free(&dwarf);
+               return 0;
+            }
          }
       }
    }
 
+   printf("Address not found\n");
+   free(ids);
    dwarf_free(&dwarf);
 
-   return 0;
+   return -1;
 }
-
@@ -0,0 +1,74 @@
+/*
+ *  Copyright (c) 2013, Adrian Moser
+ *  All rights reserved.
+ * 
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  * Neither the name of the author nor the
+ *  names of its contributors may be used to endorse or promote products
+ *  derived from this software without specific prior written permission.
+ * 
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "thyrion.h"
+
+int
+main(int argc, char **argv) {
+   const char *cache_dir = NULL;
+   Dwarf dwarf;
+   FILE *out = stdout;
+   int a = 1;
+   int rc;
+
+   if (argc > 1 && !strncmp(argv[1], "--cache=", 8)) {
+      cache_dir = argv[1] + 8;
+      a++;
+   }
+
+   if (argc - a != 1 && argc - a != 2) {
+      fprintf(stderr, "usage: %s [--cache=<dir>] <executable> "
+            "[<symbol file>]\n", argv[0]); 
+      return -1;
+   }   
+
+   if (dwarf_open(&dwarf, argv[a])) {
+      fprintf(stderr, "Failed to read DWARF\n"); 
+      return -1;
+   }
+
+   if (argc - a == 2 && !(out = fopen(argv[a + 1], "w"))) {
+      fprintf(stderr, "Failed to open %s\n", argv[a + 1]); 
+      dwarf_free(&dwarf);
+      return -1;
+   }
+
+   if ((rc = dwarf_export_cached(&dwarf, out, argv[a], cache_dir))) {
+      fprintf(stderr, "Failed to write symbol file\n"); 
+   }
+
+   if (out != stdout) {
+      fclose(out);
+   }
+
+   dwarf_free(&dwarf);
+
+   return rc;
+}
@@ -0,0 +1,789 @@
+/*
+ *  Copyright (c) 2013, Adrian Moser
+ *  All rights reserved.
+ * 
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  * Neither the name of the author nor the
+ *  names of its contributors may be used to endorse or promote products
+ *  derived from this software without specific prior written permission.
+ * 
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Aggregates profiler samples by function, by line and by call stack. Each 
+ * input line holds a sample as
+ *
+ *    <binary> <pc> [<return address>...]
+ *
+ * with hexadecimal addresses relative to the binary, innermost frame 
+ * first. Samples are read in chunks, each chunk is symbolized with one 
+ * dwarf_addr2line_batch() call per binary and counted on worker threads 
+ * into tables merged at the end.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "thyrion.h"
+
+#define PROF_CHUNK (1 << 20)       /* samples symbolized at a time */
+#define PROF_SLICE 4096            /* samples counted per task */
+
+typedef struct {
+   char *path;
+   Dwarf dwarf;
+   bool ok;
+} prof_binary;
+
+typedef struct {
+   uint32_t bin;
+   uint32_t first;            /* index of the innermost frame */
+   uint32_t depth;
+} prof_sample;
+
+typedef struct {
+   uint64_t k1;
+   uint64_t k2;
+   uint64_t self;             /* samples with the key in the innermost frame */
+   uint64_t total;            /* samples with the key in any frame */
+} prof_ent;
+
+/*
+ * Open addressing table of counters. Slots that were never counted have a 
+ * total of 0.
+ */
+typedef struct {
+   prof_ent *ents;
+   uint32_t size;
+   uint32_t count;
+} prof_tab;
+
+typedef struct {
+   uint64_t hash;
+   uint32_t frames;           /* offset of the outermost frame in the pool */
+   uint32_t depth;
+   uint64_t count;
+} prof_stack;
+
+typedef struct {
+   prof_stack *stacks;
+   uint32_t size;
+   uint32_t count;
+   uint64_t *pool;            /* frame keys of all stacks, outermost first */
+   uint32_t pool_len;
+   uint32_t pool_count;
+} prof_stack_tab;
+
+typedef struct {
+   prof_tab funcs;
+   prof_tab lines;
+   prof_stack_tab stacks;
+   uint64_t *keys;            /* frame keys of the current sample */
+   uint32_t keys_len;
+} prof_counts;
+
+typedef struct {
+   prof_binary **bins;
+   uint32_t bin_count;
+   prof_sample *samples;
+   uint32_t sample_count;
+   uint64_t *frames;          /* return addresses are moved into the call */
+   uint32_t frame_count;
+   uint32_t frames_len;
+   dwarf_addr_info *infos;    /* symbol of each frame */
+   prof_counts *counts;       /* one per thread */
+   bool folded;
+   uint32_t next_counts;
+   uint32_t next_slice;
+} prof_job;
+
+static void
+usage(char *name) {
+   fprintf(stderr, "usage: %s [-j <threads>] [--funcs] [--lines] [--folded] "
+         "[--top <n>] [<samples>]\n", name); 
+   exit(1);
+}
+
+static uint64_t
+hash_mix(uint64_t hash, uint64_t val) {
+   hash ^= val + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2);
+   return hash;
+}
+
+static uint32_t
+tab_slot(prof_tab *tab, uint64_t k1, uint64_t k2) {
+   uint32_t i = hash_mix(k1, k2) & (tab->size - 1);
+
+   while (tab->ents[i].total && 
+         (tab->ents[i].k1 != k1 || tab->ents[i].k2 != k2)) {
+      i = (i + 1) & (tab->size - 1);
+   }
+
+   return i;
+}
+
+static prof_ent *
+tab_get(prof_tab *tab, uint64_t k1, uint64_t k2) {
+   prof_ent *old = tab->ents;
+   uint32_t old_size = tab->size;
+   prof_ent *ent;
+   uint32_t i;
+
+   /* grows at 50% load */
+   if (tab->count * 2 >= tab->size) {
+      tab->size = tab->size ? tab->size << 1 : 1024;
+      tab->ents = calloc(tab->size, sizeof(prof_ent));
+
+      for (i = 0; i < old_size; i++) {
+         if (old[i].total) {
+            tab->ents[tab_slot(tab, old[i].k1, old[i].k2)] = old[i];
+         }
+      }
+
+      free(old);
+   }
+
+   ent = &tab->ents[tab_slot(tab, k1, k2)];
+
+   if (!ent->total) {
+      ent->k1 = k1;
+      ent->k2 = k2;
+      tab->count++;
+   }
+
+   return ent;
+}
+
+static void
+tab_add(prof_tab *tab, uint64_t k1, uint64_t k2, uint64_t self, 
+      uint64_t total) {
+   prof_ent *ent = tab_get(tab, k1, k2);
+
+   ent->self += self;
+   ent->total += total;
+}
+
+static void
+stacks_add(prof_stack_tab *tab, uint64_t *keys, uint32_t depth, 
+      uint64_t count) {
+   prof_stack *old = tab->stacks;
+   uint32_t old_size = tab->size;
+   prof_stack *stack;
+   uint64_t hash = depth;
+   uint32_t i, j;
+
+   if (tab->count * 2 >= tab->size) {
+      tab->size = tab->size ? tab->size << 1 : 1024;
+      tab->stacks = calloc(tab->size, sizeof(prof_stack));
+
+      for (i = 0; i < old_size; i++) {
+         if (!old[i].count) {
+            continue;
+         }
+
+         for (j = old[i].hash & (tab->size - 1); tab->stacks[j].count; 
+               j = (j + 1) & (tab->size - 1));
+         tab->stacks[j] = old[i];
+      }
+
+      free(old);
+   }
+
+   for (i = 0; i < depth; i++) {
+      hash = hash_mix(hash, keys[i]);
+   }
+
+   for (i = hash & (tab->size - 1); tab->stacks[i].count; 
+         i = (i + 1) & (tab->size - 1)) {
+      stack = &tab->stacks[i];
+
+      if (stack->hash == hash && stack->depth == depth && 
+            !memcmp(tab->pool + stack->frames, keys, 
+               depth * sizeof(uint64_t))) {
+         stack->count += count;
+         return;
+      }
+   }
+
+   if (tab->pool_count + depth > tab->pool_len) {
+      while (tab->pool_count + depth > tab->pool_len) {
+         tab->pool_len = tab->pool_len ? tab->pool_len << 1 : 4096;
+      }
+      tab->pool = realloc(tab->pool, tab->pool_len * sizeof(uint64_t));
+   }
+
+   stack = &tab->stacks[i];
+   stack->hash = hash;
+   stack->frames = tab->pool_count;
+   stack->depth = depth;
+   stack->count = count;
+   memcpy(tab->pool + tab->pool_count, keys, depth * sizeof(uint64_t));
+   tab->pool_count += depth;
+   tab->count++;
+}
+
+/*
+ * Frames without a function are keyed by their binary, so they are counted 
+ * as one unknown function per binary.
+ */
+static uint64_t
+frame_key(prof_job *job, prof_sample *sample, uint32_t frame) {
+   dwarf_func *func = job->infos[sample->first + frame].func;
+
+   return func ? (uint64_t)(uintptr_t)func : sample->bin;
+}
+
+static void
+count_sample(prof_job *job, prof_counts *counts, prof_sample *sample) {
+   const dwarf_line *line = job->infos[sample->first].line;
+   uint64_t key;
+   uint32_t i, j;
+
+   if (sample->depth > counts->keys_len) {
+      counts->keys_len = sample->depth;
+      counts->keys = realloc(counts->keys, 
+            counts->keys_len * sizeof(uint64_t));
+   }
+
+   if (line) {
+      tab_add(&counts->lines, sample->bin, 
+            (uint64_t)line->file_id << 32 | line->line, 1, 1);
+   }
+
+   /* keys are stored outermost first, as folded stacks are written */
+   for (i = 0; i < sample->depth; i++) {
+      key = frame_key(job, sample, i);
+      counts->keys[sample->depth - 1 - i] = key;
+
+      /* recursive calls count once towards the total */
+      for (j = 0; j < i && frame_key(job, sample, j) != key; j++);
+
+      if (j == i) {
+         tab_add(&counts->funcs, key, 0, !i, 1);
+      }
+   }
+
+   if (job->folded) {
+      stacks_add(&counts->stacks, counts->keys, sample->depth, 1);
+   }
+}
+
+static void *
+count_worker(void *arg) {
+   prof_job *job = arg;
+   prof_counts *counts;
+   uint32_t slices = (job->sample_count + PROF_SLICE - 1) / PROF_SLICE;
+   uint32_t idx;
+   uint32_t end;
+   uint32_t i;
+
+   counts = &job->counts[__atomic_fetch_add(&job->next_counts, 1, 
+         __ATOMIC_RELAXED)];
+
+   while ((idx = __atomic_fetch_add(&job->next_slice, 1, __ATOMIC_RELAXED)) < 
+         slices) {
+      end = job->sample_count - idx * PROF_SLICE > PROF_SLICE ? 
+            (idx + 1) * PROF_SLICE : job->sample_count;
+
+      for (i = idx * PROF_SLICE; i < end; i++) {
+         count_sample(job, counts, &job->samples[i]);
+      }
+   }
+
+   return NULL;
+}
+
+static uint32_t
+find_binary(prof_job *job, const char *path) {
+   prof_binary *bin;
+   uint32_t i;
+
+   for (i = 0; i < job->bin_count; i++) {
+      if (!strcmp(job->bins[i]->path, path)) {
+         return i;
+      }
+   }
+
+   bin = calloc(1, sizeof(prof_binary));
+   bin->path = strdup(path);
+
+   /* the indexes are built here, so the counting threads only read them */
+   if (!(bin->ok = !dwarf_open(&bin->dwarf, bin->path))) {
+      fprintf(stderr, "Failed to read DWARF of %s\n", path); 
+   } else if (dwarf_lines_build(&bin->dwarf) || 
+         dwarf_funcs_build(&bin->dwarf)) {
+      fprintf(stderr, "Failed to index %s\n", path); 
+      dwarf_free(&bin->dwarf);
+      bin->ok = false;
+   }
+
+   job->bins = realloc(job->bins, (i + 1) * sizeof(prof_binary *));
+   job->bins[i] = bin;
+   job->bin_count++;
+
+   return i;
+}
+
+/*
+ * Reads up to PROF_CHUNK samples. Returns the number of malformed lines 
+ * skipped.
+ */
+static uint64_t
+read_chunk(prof_job *job, FILE *in, char **line, size_t *len) {
+   uint64_t skipped = 0;
+   prof_sample *sample;
+   uint32_t last = UINT32_MAX;
+   uint64_t addr;
+   char *name;
+   char *pos;
+   char *end;
+
+   job->sample_count = 0;
+   job->frame_count = 0;
+
+   while (job->sample_count < PROF_CHUNK && getline(line, len, in) >= 0) {
+      for (name = *line; *name == ' ' || *name == '\t'; name++);
+
+      if (!*name || *name == '\n' || *name == '#') {
+         continue;
+      }
+
+      for (pos = name; *pos && *pos != ' ' && *pos != '\t' && *pos != '\n'; 
+            pos++);
+
+      if (!*pos || *pos == '\n') {
+         skipped++;
+         continue;
+      }
+
+      *pos++ = '\0';
+
+      /* samples mostly come in runs from the same binary */
+      if (last == UINT32_MAX || strcmp(job->bins[last]->path, name)) {
+         last = find_binary(job, name);
+      }
+
+      sample = &job->samples[job->sample_count];
+      sample->bin = last;
+      sample->first = job->frame_count;
+      sample->depth = 0;
+
+      while (true) {
+         addr = strtoull(pos, &end, 16);
+
+         if (end == pos) {
+            break;
+         }
+
+         if (job->frame_count == job->frames_len) {
+            job->frames_len = job->frames_len ? job->frames_len << 1 : 
+                  PROF_CHUNK;
+            job->frames = realloc(job->frames, 
+                  job->frames_len * sizeof(uint64_t));
+         }
+
+         /* return addresses point behind the call instruction */
+         job->frames[job->frame_count++] = sample->depth++ && addr ? 
+               addr - 1 : addr;
+         pos = end;
+      }
+
+      while (*pos == ' ' || *pos == '\t' || *pos == '\n') {
+         pos++;
+      }
+
+      if (*pos || !sample->depth) {
+         job->frame_count = sample->first;
+         skipped++;
+         continue;
+      }
+
+      job->sample_count++;
+   }
+
+   return skipped;
+}
+
+static void
+symbolize(prof_job *job, int nthreads) {
+   dwarf_addr_info *infos;
+   prof_sample *sample;
+   uint64_t *addrs;
+   uint32_t *frames;
+   uint32_t count;
+   uint32_t b, i, j;
+
+   job->infos = realloc(job->infos, 
+         (job->frames_len ? job->frames_len : 1) * sizeof(dwarf_addr_info));
+   memset(job->infos, 0, job->frame_count * sizeof(dwarf_addr_info));
+
+   if (job->bin_count == 1) {
+      if (job->bins[0]->ok) {
+         dwarf_addr2line_batch(&job->bins[0]->dwarf, job->frames, 
+               job->frame_count, job->infos, nthreads);
+      }
+      return;
+   }
+
+   addrs = malloc((job->frame_count ? job->frame_count : 1) * 
+         sizeof(uint64_t));
+   frames = malloc((job->frame_count ? job->frame_count : 1) * 
+         sizeof(uint32_t));
+   infos = malloc((job->frame_count ? job->frame_count : 1) * 
+         sizeof(dwarf_addr_info));
+
+   for (b = 0; b < job->bin_count; b++) {
+      if (!job->bins[b]->ok) {
+         continue;
+      }
+
+      count = 0;
+
+      for (i = 0; i < job->sample_count; i++) {
+         sample = &job->samples[i];
+
+         if (sample->bin != b) {
+            continue;
+         }
+
+         for (j = sample->first; j < sample->first + sample->depth; j++) {
+            frames[count] = j;
+            addrs[count++] = job->frames[j];
+         }
+      }
+
+      if (!count) {
+         continue;
+      }
+
+      dwarf_addr2line_batch(&job->bins[b]->dwarf, addrs, count, infos, 
+            nthreads);
+
+      for (i = 0; i < count; i++) {
+         job->infos[frames[i]] = infos[i];
+      }
+   }
+
+   free(addrs);
+   free(frames);
+   free(infos);
+}
+
+static void
+count_chunk(prof_job *job, int nthreads) {
+   pthread_t *threads = calloc(nthreads, sizeof(pthread_t));
+   int started;
+
+   job->next_counts = 0;
+   job->next_slice = 0;
+
+   for (started = 0; started < nthreads - 1; started++) {
+      if (pthread_create(&threads[started], NULL, count_worker, job)) {
+         break;
+      }
+   }
+
+   count_worker(job);
+
+   while (started--) {
+      pthread_join(threads[started], NULL);
+   }
+
+   free(threads);
+}
+
+static void
+merge_counts(prof_counts *into, prof_counts *from) {
+   prof_stack *stack;
+   prof_ent *ent;
+   uint32_t i;
+
+   for (i = 0; i < from->funcs.size; i++) {
+      ent = &from->funcs.ents[i];
+      if (ent->total) {
+         tab_add(&into->funcs, ent->k1, ent->k2, ent->self, ent->total);
+      }
+   }
+
+   for (i = 0; i < from->lines.size; i++) {
+      ent = &from->lines.ents[i];
+      if (ent->total) {
+         tab_add(&into->lines, ent->k1, ent->k2, ent->self, ent->total);
+      }
+   }
+
+   for (i = 0; i < from->stacks.size; i++) {
+      stack = &from->stacks.stacks[i];
+      if (stack->count) {
+         stacks_add(&into->stacks, from->stacks.pool + stack->frames, 
+               stack->depth, stack->count);
+      }
+   }
+}
+
+static void
+free_counts(prof_counts *counts) {
+   free(counts->funcs.ents);
+   free(counts->lines.ents);
+   free(counts->stacks.stacks);
+   free(counts->stacks.pool);
+   free(counts->keys);
+}
+
+static const char *
+key_name(prof_job *job, uint64_t key, char *buf, size_t len) {
+   dwarf_func *func = (dwarf_func *)(uintptr_t)key;
+   const char *path;
+   const char *slash;
+
+   if (key >= job->bin_count && func->name) {
+      return func->name;
+   }
+
+   if (key >= job->bin_count || job->bin_count == 1) {
+      return "??";
+   }
+
+   /* unknown code of one of several binaries is named by the binary */
+   path = job->bins[key]->path;
+   slash = strrchr(path, '/');
+   snprintf(buf, len, "[%s]", slash ? slash + 1 : path);
+
+   return buf;
+}
+
+static int
+ent_cmp(const void *a, const void *b) {
+   const prof_ent *ea = *(prof_ent * const *)a;
+   const prof_ent *eb = *(prof_ent * const *)b;
+
+   if (ea->self != eb->self) {
+      return ea->self > eb->self ? -1 : 1;
+   }
+   if (ea->total != eb->total) {
+      return ea->total > eb->total ? -1 : 1;
+   }
+
+   return 0;
+}
+
+static int
+stack_cmp(const void *a, const void *b) {
+   const prof_stack *sa = *(prof_stack * const *)a;
+   const prof_stack *sb = *(prof_stack * const *)b;
+
+   return sa->count > sb->count ? -1 : sa->count < sb->count;
+}
+
+static prof_ent **
+sorted_ents(prof_tab *tab) {
+   prof_ent **ents = malloc((tab->count ? tab->count : 1) * 
+         sizeof(prof_ent *));
+   uint32_t count = 0;
+   uint32_t i;
+
+   for (i = 0; i < tab->size; i++) {
+      if (tab->ents[i].total) {
+         ents[count++] = &tab->ents[i];
+      }
+   }
+
+   qsort(ents, count, sizeof(prof_ent *), ent_cmp);
+
+   return ents;
+}
+
+static void
+print_funcs(prof_job *job, prof_tab *tab, uint64_t samples, uint32_t top) {
+   prof_ent **ents = sorted_ents(tab);
+   char buf[256];
+   uint32_t i;
+
+   printf("%10s %7s %10s %7s  %s\n", "self", "", "total", "", "function");
+
+   for (i = 0; i < tab->count && i < top; i++) {
+      printf("%10" PRIu64 " %6.2f%% %10" PRIu64 " %6.2f%%  %s\n", 
+            ents[i]->self, 100.0 * ents[i]->self / samples, ents[i]->total, 
+            100.0 * ents[i]->total / samples, 
+            key_name(job, ents[i]->k1, buf, sizeof(buf)));
+   }
+
+   free(ents);
+}
+
+static void
+print_lines(prof_job *job, prof_tab *tab, uint64_t samples, uint32_t top) {
+   prof_ent **ents = sorted_ents(tab);
+   const char *path;
+   uint32_t i;
+
+   printf("%10s %7s  %s\n", "samples", "", "line");
+
+   for (i = 0; i < tab->count && i < top; i++) {
+      path = dwarf_path(&job->bins[ents[i]->k1]->dwarf, ents[i]->k2 >> 32);
+      printf("%10" PRIu64 " %6.2f%%  %s:%u\n", ents[i]->self, 
+            100.0 * ents[i]->self / samples, path ? path : "??", 
+            (uint32_t)ents[i]->k2);
+   }
+
+   free(ents);
+}
+
+static void
+print_folded(prof_job *job, prof_stack_tab *tab) {
+   prof_stack **stacks = malloc((tab->count ? tab->count : 1) * 
+         sizeof(prof_stack *));
+   uint32_t count = 0;
+   char buf[256];
+   uint32_t i, j;
+
+   for (i = 0; i < tab->size; i++) {
+      if (tab->stacks[i].count) {
+         stacks[count++] = &tab->stacks[i];
+      }
+   }
+
+   qsort(stacks, count, sizeof(prof_stack *), stack_cmp);
+
+   for (i = 0; i < count; i++) {
+      for (j = 0; j < stacks[i]->depth; j++) {
+         fputs(key_name(job, tab->pool[stacks[i]->frames + j], buf, 
+                  sizeof(buf)), stdout);
+         putchar(j + 1 < stacks[i]->depth ? ';' : ' ');
+      }
+      printf("%" PRIu64 "\n", stacks[i]->count);
+   }
+
+   free(stacks);
+}
+
+int
+main(int argc, char **argv) {
+   prof_job job;
+   FILE *in = stdin;
+   bool funcs = false;
+   bool lines = false;
+   uint32_t top = UINT32_MAX;
+   int nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+   uint64_t samples = 0;
+   uint64_t skipped = 0;
+   char *line = NULL;
+   size_t len = 0;
+   uint32_t i;
+   int a;
+
+   memset(&job, 0, sizeof(job));
+
+   for (a = 1; a < argc && argv[a][0] == '-' && argv[a][1]; a++) {
+      if (!strcmp(argv[a], "-j") && a + 1 < argc) {
+         nthreads = atoi(argv[++a]);
+      } else if (!strcmp(argv[a], "--funcs")) {
+         funcs = true;
+      } else if (!strcmp(argv[a], "--lines")) {
+         lines = true;
+      } else if (!strcmp(argv[a], "--folded")) {
+         job.folded = true;
+      } else if (!strcmp(argv[a], "--top") && a + 1 < argc) {
+         top = atoi(argv[++a]);
+      } else {
+         usage(argv[0]);
+      }
+   }
+
+   if (a < argc - 1 || nthreads < 1) {
+      usage(argv[0]);
+   }
+
+   if (a == argc - 1 && strcmp(argv[a], "-") && !(in = fopen(argv[a], "r"))) {
+      fprintf(stderr, "Failed to open %s\n", argv[a]); 
+      return -1;
+   }
+
+   if (!funcs && !lines && !job.folded) {
+      funcs = true;
+   }
+
+   job.samples = malloc(PROF_CHUNK * sizeof(prof_sample));
+   job.counts = calloc(nthreads, sizeof(prof_counts));
+
+   while (!feof(in) && !ferror(in)) {
+      skipped += read_chunk(&job, in, &line, &len);
+
+      if (!job.sample_count) {
+         continue;
+      }
+
+      symbolize(&job, nthreads);
+      count_chunk(&job, nthreads);
+      samples += job.sample_count;
+   }
+
+   if (skipped) {
+      fprintf(stderr, "Skipped %" PRIu64 " malformed lines\n", skipped); 
+   }
+
+   for (i = 1; i < (uint32_t)nthreads; i++) {
+      merge_counts(&job.counts[0], &job.counts[i]);
+      free_counts(&job.counts[i]);
+   }
+
+   if (samples && funcs) {
+      print_funcs(&job, &job.counts[0].funcs, samples, top);
+   }
+
+   if (samples && lines) {
+      if (funcs) {
+         putchar('\n');
+      }
+      print_lines(&job, &job.counts[0].lines, samples, top);
+   }
+
+   if (samples && job.folded) {
+      if (funcs || lines) {
+         putchar('\n');
+      }
+      print_folded(&job, &job.counts[0].stacks);
+   }
+
+   free_counts(&job.counts[0]);
+   free(job.counts);
+
+   for (i = 0; i < job.bin_count; i++) {
+      if (job.bins[i]->ok) {
+         dwarf_free(&job.bins[i]->dwarf);
+      }
+      free(job.bins[i]->path);
+      free(job.bins[i]);
+   }
+
+   free(job.bins);
+   free(job.samples);
+   free(job.frames);
+   free(job.infos);
+   free(line);
+
+   if (in != stdin) {
+      fclose(in);
+   }
+
+   return 0;
+}
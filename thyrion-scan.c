@@ -0,0 +1,129 @@
+/*
+ *  Copyright (c) 2013, Adrian Moser
+ *  All rights reserved.
+ * 
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  * Neither the name of the author nor the
+ *  names of its contributors may be used to endorse or promote products
+ *  derived from this software without specific prior written permission.
+ * 
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "thyrion.h"
+
+/*
+ * Lists the compile units of all ELF files and archive members under the 
+ * given paths, one line per unit:
+ *
+ *    <file>[(<member>)] <offset> <version> <name> <producer>
+ *
+ * with tab separated fields. Objects that cannot be read are listed as
+ *
+ *    <file>[(<member>)] error <reason>
+ */
+static void
+usage(char *name) {
+   fprintf(stderr, "usage: %s [-j <threads>] <path>...\n", name); 
+   exit(1);
+}
+
+static void
+print_object(FILE *out, const char *path, const char *member) {
+   if (member) {
+      fprintf(out, "%s(%s)\t", path, member);
+   } else {
+      fprintf(out, "%s\t", path);
+   }
+}
+
+static void
+scan_object(Dwarf *dwarf, int rc, const char *path, const char *member, 
+      FILE *out, void *arg) {
+   dwarf_die_filter filter = { NULL, 0, 1, false };
+   bool *failed = arg;
+   dwarf_die_entry entry;
+   dwarf_die_iter iter;
+   dwarf_die *root;
+   char *producer;
+   char *name;
+
+   if (rc) {
+      print_object(out, path, member);
+      /* errors of the library end in a newline */
+      fprintf(out, "error\t%s", dwarf->error ? dwarf->error : 
+            rc == EELFOPEN ? "Failed to open file\n" : "Not an ELF file\n");
+      __atomic_store_n(failed, true, __ATOMIC_RELAXED);
+      return;
+   }
+
+   dwarf_die_iter_init(&iter, dwarf, NULL, &filter);
+
+   while ((rc = dwarf_die_iter_next(&iter, &entry)) == 1) {
+      name = producer = NULL;
+
+      if ((root = dwarf_die_iter_get_die(&iter))) {
+         name = dwarf_die_get_name(dwarf, root);
+         producer = dwarf_die_get_str(dwarf, root, DW_AT_producer);
+      }
+
+      print_object(out, path, member);
+      fprintf(out, "0x%" PRIx64 "\t%u\t%s\t%s\n", entry.cu->offset, 
+            entry.cu->hdr.version, name ? name : "", producer ? producer : "");
+   }
+
+   if (rc < 0) {
+      print_object(out, path, member);
+      fprintf(out, "error\tMalformed .debug_info\n");
+      __atomic_store_n(failed, true, __ATOMIC_RELAXED);
+   }
+
+   dwarf_die_iter_free(&iter);
+}
+
+int
+main(int argc, char **argv) {
+   int nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+   bool failed = false;
+   int a;
+
+   for (a = 1; a < argc && argv[a][0] == '-' && argv[a][1]; a++) {
+      if (!strcmp(argv[a], "-j") && a + 1 < argc) {
+         nthreads = atoi(argv[++a]);
+      } else {
+         usage(argv[0]);
+      }
+   }
+
+   if (a == argc || nthreads < 1) {
+      usage(argv[0]);
+   }
+
+   if (dwarf_scan(argv + a, argc - a, nthreads, scan_object, &failed, 
+            stdout)) {
+      fprintf(stderr, "Failed to scan\n"); 
+      return -1;
+   }
+
+   return failed ? 1 : 0;
+}
@@ -31,8 +31,13 @@
 #include <string.h>
 #include <stdarg.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <fcntl.h>
-#include <stack.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <hex_dump.h>
 
 #include "thyrion.h"
@@ -129,66 +134,516 @@ static const dwarf_form const dwarf_forms[] = {
    MK_FORM(DW_FORM_indirect), MK_FORM(0)
 };
 
+static const dwarf_op dwarf_ops[] = {
+   MK_OP(DW_OP_addr), MK_OP(DW_OP_deref),
+   MK_OP(DW_OP_const1u), MK_OP(DW_OP_const1s),
+   MK_OP(DW_OP_const2u), MK_OP(DW_OP_const2s),
+   MK_OP(DW_OP_const4u), MK_OP(DW_OP_const4s),
+   MK_OP(DW_OP_const8u), MK_OP(DW_OP_const8s),
+   MK_OP(DW_OP_constu), MK_OP(DW_OP_consts),
+   MK_OP(DW_OP_dup), MK_OP(DW_OP_drop),
+   MK_OP(DW_OP_over), MK_OP(DW_OP_pick),
+   MK_OP(DW_OP_swap), MK_OP(DW_OP_rot),
+   MK_OP(DW_OP_xderef), MK_OP(DW_OP_abs),
+   MK_OP(DW_OP_and), MK_OP(DW_OP_div),
+   MK_OP(DW_OP_minus), MK_OP(DW_OP_mod),
+   MK_OP(DW_OP_mul), MK_OP(DW_OP_neg),
+   MK_OP(DW_OP_not), MK_OP(DW_OP_or),
+   MK_OP(DW_OP_plus), MK_OP(DW_OP_plus_uconst),
+   MK_OP(DW_OP_shl), MK_OP(DW_OP_shr),
+   MK_OP(DW_OP_shra), MK_OP(DW_OP_xor),
+   MK_OP(DW_OP_bra), MK_OP(DW_OP_eq),
+   MK_OP(DW_OP_ge), MK_OP(DW_OP_gt),
+   MK_OP(DW_OP_le), MK_OP(DW_OP_lt),
+   MK_OP(DW_OP_ne), MK_OP(DW_OP_skip),
+   MK_OP(DW_OP_regx), MK_OP(DW_OP_fbreg),
+   MK_OP(DW_OP_bregx), MK_OP(DW_OP_piece),
+   MK_OP(DW_OP_deref_size), MK_OP(DW_OP_xderef_size),
+   MK_OP(DW_OP_nop), MK_OP(DW_OP_push_object_address),
+   MK_OP(DW_OP_call2), MK_OP(DW_OP_call4),
+   MK_OP(DW_OP_call_ref), MK_OP(DW_OP_form_tls_address),
+   MK_OP(DW_OP_call_frame_cfa), MK_OP(DW_OP_bit_piece),
+   MK_OP(DW_OP_implicit_value), MK_OP(DW_OP_stack_value),
+   MK_OP(DW_OP_GNU_push_tls_address), MK_OP(0)
+};
+
+static void *
+dwarf_libc_alloc(void *ctx, size_t size) {
+   (void)ctx;
+
+   return malloc(size);
+}
+
+static void *
+dwarf_libc_realloc(void *ctx, void *ptr, size_t size) {
+   (void)ctx;
+
+   return realloc(ptr, size);
+}
+
+static void
+dwarf_libc_free(void *ctx, void *ptr) {
+   (void)ctx;
+
+   free(ptr);
+}
+
+static const dwarf_allocator dwarf_libc_allocator = {
+   dwarf_libc_alloc, dwarf_libc_realloc, dwarf_libc_free, NULL
+};
+
+/*
+ * All memory of a Dwarf goes through these. The counters are updated from 
+ * worker threads as well.
+ */
+static inline void
+dwarf_mem_count(uint64_t *counter, uint64_t val) {
+   __atomic_fetch_add(counter, val, __ATOMIC_RELAXED);
+}
+
+/*
+ * Allocations are made on worker threads and before public functions set 
+ * dwarf->env, so running out of memory can't unwind like a parse error.
+ */
+static void
+dwarf_mem_exhausted(size_t size) {
+   fprintf(stderr, "Out of memory allocating %zu bytes\n", size);
+   abort();
+}
+
+static void *
+dwarf_mem_alloc(Dwarf *dwarf, size_t size) {
+   void *ptr = dwarf->alloc.alloc(dwarf->alloc.ctx, size);
+
+   if (!ptr && size) {
+      dwarf_mem_exhausted(size);
+   }
+
+   dwarf_mem_count(&dwarf->mem_stats.allocs, 1);
+   dwarf_mem_count(&dwarf->mem_stats.bytes, size);
+
+   return ptr;
+}
+
+static void *
+dwarf_mem_calloc(Dwarf *dwarf, size_t count, size_t size) {
+   void *ptr;
+
+   if (size && count > SIZE_MAX / size) {
+      dwarf_mem_exhausted(SIZE_MAX);
+   }
+
+   /* calloc() can skip clearing pages that are fresh from the kernel */
+   if (dwarf->alloc.alloc == dwarf_libc_alloc) {
+      ptr = calloc(count, size);
+   } else if ((ptr = dwarf->alloc.alloc(dwarf->alloc.ctx, count * size))) {
+      memset(ptr, 0, count * size);
+   }
+
+   if (!ptr && count && size) {
+      dwarf_mem_exhausted(count * size);
+   }
+
+   dwarf_mem_count(&dwarf->mem_stats.allocs, 1);
+   dwarf_mem_count(&dwarf->mem_stats.bytes, count * size);
+
+   return ptr;
+}
+
+void
+dwarf_mem_free(Dwarf *dwarf, void *ptr) {
+   if (ptr) {
+      dwarf_mem_count(&dwarf->mem_stats.frees, 1);
+      dwarf->alloc.free(dwarf->alloc.ctx, ptr);
+   }
+}
+
+/* Frees ptr and returns NULL if size is 0, as glibc's realloc() does. */
+static void *
+dwarf_mem_realloc(Dwarf *dwarf, void *ptr, size_t size) {
+   void *res;
+
+   if (!ptr) {
+      return dwarf_mem_alloc(dwarf, size);
+   }
+
+   if (!size) {
+      dwarf_mem_free(dwarf, ptr);
+      return NULL;
+   }
+
+   if (!(res = dwarf->alloc.realloc(dwarf->alloc.ctx, ptr, size))) {
+      dwarf_mem_exhausted(size);
+   }
+
+   dwarf_mem_count(&dwarf->mem_stats.reallocs, 1);
+   dwarf_mem_count(&dwarf->mem_stats.bytes, size);
+
+   return res;
+}
+
+static char *
+dwarf_mem_strdup(Dwarf *dwarf, const char *str) {
+   size_t len = strlen(str) + 1;
+   char *res = dwarf_mem_alloc(dwarf, len);
+
+   if (res) {
+      memcpy(res, str, len);
+   }
+
+   return res;
+}
+
+static char *
+dwarf_mem_vasprintf(Dwarf *dwarf, const char *fmt, va_list args) {
+   va_list copy;
+   char *res;
+   int len;
+
+   va_copy(copy, args);
+   len = vsnprintf(NULL, 0, fmt, copy);
+   va_end(copy);
+
+   if (len < 0 || !(res = dwarf_mem_alloc(dwarf, len + 1))) {
+      return NULL;
+   }
+
+   vsnprintf(res, len + 1, fmt, args);
+
+   return res;
+}
+
+static char *
+dwarf_mem_asprintf(Dwarf *dwarf, const char *fmt, ...) {
+   va_list args;
+   char *res;
+
+   va_start(args, fmt);
+   res = dwarf_mem_vasprintf(dwarf, fmt, args);
+   va_end(args);
+
+   return res;
+}
+
+/* The memory hook of the Elf of a Dwarf, so that its copies are counted. */
+static void *
+dwarf_mem_elf_fn(void *ctx, void *ptr, size_t size) {
+   return dwarf_mem_realloc(ctx, ptr, size);
+}
+
+void
+dwarf_get_mem_stats(Dwarf *dwarf, dwarf_mem_stats *stats) {
+   stats->allocs = __atomic_load_n(&dwarf->mem_stats.allocs, __ATOMIC_RELAXED);
+   stats->reallocs = __atomic_load_n(&dwarf->mem_stats.reallocs, 
+         __ATOMIC_RELAXED);
+   stats->frees = __atomic_load_n(&dwarf->mem_stats.frees, __ATOMIC_RELAXED);
+   stats->bytes = __atomic_load_n(&dwarf->mem_stats.bytes, __ATOMIC_RELAXED);
+}
+
 static inline void
 fail(Dwarf *dwarf, const char *fmt, ...) {
    va_list args;
 
-   if (dwarf->error) {
-      free(dwarf->error); 
-   }
+   dwarf_mem_free(dwarf, dwarf->error); 
 
    va_start(args, fmt);
-   asprintf(&dwarf->error, fmt, args);
+   dwarf->error = dwarf_mem_vasprintf(dwarf, fmt, args);
    va_end(args);
 
    longjmp(dwarf->env, 1);
 }
 
-static int
-decode_uleb128(char * const buf, uint32_t *res) {
-   char *pos = buf;
-   uint32_t shift = 0;
-   int consumed = 0;
-   uint32_t byte;
-   *res = 0;
+/*
+ * Section reads go through a cursor bounded by the end of the section or 
+ * unit. Decoders check once per block, such as a DIE or a line program 
+ * opcode, that the largest encoding of its fields fits and then read them 
+ * with checked set to false. Near the end each read is checked and fails 
+ * if it would pass the end. Strings and blocks are always checked.
+ */
+#define DWARF_LEB_MAX 10           /* bytes of a 64-bit LEB128 value */
+#define DWARF_HOST_BE (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
 
-   while (true) {
-      byte = *pos++;
-      consumed++;
-      *res |= ((byte & 0x7F) << shift);
-      if ((byte & 0x80) == 0) {
-         break;
+/* for decoders instantiated with constant sizes and byte order */
+#define DWARF_INLINE static inline __attribute__((always_inline))
+
+typedef struct {
+   Dwarf *dwarf;
+   const char *sect;          /* section name for errors */
+   char *start;               /* start of the section */
+   char *pos;
+   char *end;
+   bool swap;                 /* byte order differs from the host's */
+} dwarf_cursor;
+
+static void
+dwarf_cur_init(dwarf_cursor *cur, Dwarf *dwarf, const char *sect, 
+      char *start, char *pos, char *end) {
+   cur->dwarf = dwarf;
+   cur->sect = sect;
+   cur->start = start;
+   cur->pos = pos;
+   cur->end = end;
+   cur->swap = dwarf->elf && dwarf->elf->swap;
+}
+
+static void
+dwarf_cur_fail(dwarf_cursor *cur) {
+   fail(cur->dwarf, "Truncated %s at offset %" PRIu64 "\n", cur->sect, 
+         (uint64_t)(cur->pos - cur->start));
+}
+
+static inline char *
+dwarf_cur_take(dwarf_cursor *cur, uint64_t len, bool checked) {
+   char *pos = cur->pos;
+
+   if (checked && (uint64_t)(cur->end - pos) < len) {
+      dwarf_cur_fail(cur);
+   }
+
+   cur->pos += len;
+
+   return pos;
+}
+
+/*
+ * Reads a value of at most 8 bytes. Specialized decoders pass a constant 
+ * size and swap, which leaves a single load and at most a byte swap.
+ */
+DWARF_INLINE uint64_t
+dwarf_cur_fixed(dwarf_cursor *cur, uint32_t size, bool swap, bool checked) {
+   char *pos = dwarf_cur_take(cur, size, checked);
+   uint16_t val16;
+   uint32_t val32;
+   uint64_t val = 0;
+   uint32_t i;
+
+   switch (size) {
+      case 1:
+         return *(uint8_t *)pos;
+      case 2:
+         memcpy(&val16, pos, 2);
+         return swap ? __builtin_bswap16(val16) : val16;
+      case 4:
+         memcpy(&val32, pos, 4);
+         return swap ? __builtin_bswap32(val32) : val32;
+      case 8:
+         memcpy(&val, pos, 8);
+         return swap ? __builtin_bswap64(val) : val;
+      default:
+         /* other address sizes are put together in the file's byte order */
+         for (i = 0; i < size; i++) {
+            val |= (uint64_t)(uint8_t)pos[i] << 
+               8 * (swap != DWARF_HOST_BE ? size - 1 - i : i);
+         }
+         return val;
+   }
+}
+
+static inline uint8_t
+dwarf_cur_u8(dwarf_cursor *cur, bool checked) {
+   return *(uint8_t *)dwarf_cur_take(cur, 1, checked);
+}
+
+static inline uint16_t
+dwarf_cur_u16(dwarf_cursor *cur, bool checked) {
+   return dwarf_cur_fixed(cur, 2, cur->swap, checked);
+}
+
+static inline uint32_t
+dwarf_cur_u32(dwarf_cursor *cur, bool checked) {
+   return dwarf_cur_fixed(cur, 4, cur->swap, checked);
+}
+
+static inline uint64_t
+dwarf_cur_u64(dwarf_cursor *cur, bool checked) {
+   return dwarf_cur_fixed(cur, 8, cur->swap, checked);
+}
+
+/*
+ * Reads an address or offset of the given size, which is at most 8.
+ */
+static inline uint64_t
+dwarf_cur_uint(dwarf_cursor *cur, uint32_t size, bool checked) {
+   return dwarf_cur_fixed(cur, size, cur->swap, checked);
+}
+
+static uint64_t
+dwarf_cur_uleb_slow(dwarf_cursor *cur, uint64_t val, uint32_t shift) {
+   uint8_t byte;
+
+   do {
+      byte = dwarf_cur_u8(cur, true);
+      if (shift < 64) {
+         val |= (uint64_t)(byte & 0x7f) << shift;
       }
       shift += 7;
+   } while (byte & 0x80);
+
+   return val;
+}
+
+static inline uint64_t
+dwarf_cur_uleb(dwarf_cursor *cur, bool checked) {
+   uint8_t *pos = (uint8_t *)cur->pos;
+   uint64_t val = 0;
+   uint32_t shift;
+   uint8_t byte;
+
+   if (checked && cur->end - cur->pos < DWARF_LEB_MAX) {
+      return dwarf_cur_uleb_slow(cur, 0, 0);
+   }
+
+   for (shift = 0; shift < 7 * DWARF_LEB_MAX; shift += 7) {
+      byte = *pos++;
+      val |= (uint64_t)(byte & 0x7f) << shift;
+
+      if (!(byte & 0x80)) {
+         cur->pos = (char *)pos;
+         return val;
+      }
+   }
+
+   /* padded values may be longer than any 64-bit value needs */
+   cur->pos = (char *)pos;
+
+   return dwarf_cur_uleb_slow(cur, val, shift);
+}
+
+static inline int64_t
+dwarf_cur_sleb(dwarf_cursor *cur, bool checked) {
+   char *start = cur->pos;
+   uint64_t val = dwarf_cur_uleb(cur, checked);
+   uint64_t shift = 7 * (uint64_t)(cur->pos - start);
+
+   if (shift < 64 && (cur->pos[-1] & 0x40)) {
+      val |= -((uint64_t)1 << shift);
    }
 
-   return consumed;
+   return (int64_t)val;
 }
 
-static int
-decode_sleb128(char * const buf, int32_t *res) {
-   char *pos = buf;
+static inline char *
+dwarf_cur_str(dwarf_cursor *cur) {
+   char *str = cur->pos;
+   char *nul = memchr(str, '\0', cur->end - str);
+
+   if (!nul) {
+      dwarf_cur_fail(cur);
+   }
+
+   cur->pos = nul + 1;
+
+   return str;
+}
+
+/*
+ * Reads the initial length field of a unit. The 64-bit DWARF format 
+ * escapes an 8 byte length with 0xffffffff and uses 8 byte section 
+ * offsets in the unit, which is stored in *offset_size.
+ */
+static uint64_t
+dwarf_cur_length(dwarf_cursor *cur, uint8_t *offset_size) {
+   uint32_t len32;
+   uint64_t len = 0;
+
+   if (cur->end - cur->pos < 4) {
+      fail(cur->dwarf, "Truncated unit length\n");
+   }
+
+   len32 = dwarf_cur_u32(cur, false);
+
+   if (len32 < 0xfffffff0) {
+      *offset_size = 4;
+      len = len32;
+   } else if (len32 == 0xffffffff && cur->end - cur->pos >= 8) {
+      *offset_size = 8;
+      len = dwarf_cur_u64(cur, false);
+   } else {
+      fail(cur->dwarf, "Invalid unit length 0x%x\n", len32);
+   }
+
+   if (len > (uint64_t)(cur->end - cur->pos)) {
+      fail(cur->dwarf, "Unit length exceeds its section\n");
+   }
+
+   return len;
+}
+
+/*
+ * Checked reads that report truncation instead of calling fail(), for 
+ * expressions and for iterators, which may run on worker threads.
+ */
+static bool
+dwarf_read_uleb(char **pos, char *end, uint64_t *val) {
    uint32_t shift = 0;
-   int consumed = 0;
-   uint8_t size = 8 * sizeof(int32_t);
    uint8_t byte;
-   *res = 0;
 
-   while (true) {
-      byte = *pos++;
-      consumed++;
-      *res |= ((byte & 0x7F) << shift);
+   *val = 0;
+
+   do {
+      if (*pos >= end) {
+         return false;
+      }
+      byte = *(*pos)++;
+      if (shift < 64) {
+         *val |= (uint64_t)(byte & 0x7f) << shift;
+      }
       shift += 7;
-      if ((byte & 0x80) == 0) {
-         break;
+   } while (byte & 0x80);
+
+   return true;
+}
+
+static bool
+dwarf_read_sleb(char **pos, char *end, int64_t *val) {
+   uint32_t shift = 0;
+   uint64_t res = 0;
+   uint8_t byte;
+
+   do {
+      if (*pos >= end) {
+         return false;
       }
+      byte = *(*pos)++;
+      if (shift < 64) {
+         res |= (uint64_t)(byte & 0x7f) << shift;
+      }
+      shift += 7;
+   } while (byte & 0x80);
+
+   if (shift < 64 && (byte & 0x40)) {
+      res |= -((uint64_t)1 << shift);
+   }
+
+   *val = (int64_t)res;
+
+   return true;
+}
+
+static bool
+dwarf_read_fixed(char **pos, char *end, uint32_t size, uint64_t *val) {
+   if (end - *pos < (long)size || size > sizeof(uint64_t)) {
+      return false;
    }
 
-   if (shift < size && byte & 0x40) {
-      *res |= -(1<<shift); 
+   *val = 0;
+   memcpy(val, *pos, size);
+   *pos += size;
+
+   return true;
+}
+
+static bool
+dwarf_read_fixed_signed(char **pos, char *end, uint32_t size, uint64_t *val) {
+   if (!dwarf_read_fixed(pos, end, size, val)) {
+      return false;
+   }
+
+   if (size < sizeof(uint64_t) && (*val >> (size * 8 - 1)) & 1) {
+      *val |= -((uint64_t)1 << (size * 8));
    }
 
-   return consumed;
+   return true;
 }
 
 static const dwarf_tag *
@@ -230,72 +685,211 @@ get_form(dwarf_form_id form) {
    return NULL;
 }
 
+static const dwarf_op *
+get_op(dwarf_op_id op) {
+   int i;
+
+   for (i = 0; dwarf_ops[i].id != 0 && dwarf_ops[i].id != op; i++); 
+
+   if (dwarf_ops[i].id == op) {
+      return &dwarf_ops[i];
+   } 
+
+   return NULL;
+}
+
+/*
+ * Returns the size of a value of the given form in a unit, or 
+ * DWARF_SIZE_VARIABLE if the size is encoded in the value. Without a unit 
+ * header, forms whose size depends on the unit are variable as well.
+ */
+static uint32_t
+dwarf_form_size(const dwarf_form *form, dwarf_cu_header *hdr) {
+   if (!form) {
+      return DWARF_SIZE_VARIABLE;
+   }
+
+   switch (form->id) {
+      case DW_FORM_addr: 
+         return hdr ? hdr->addr_size : DWARF_SIZE_VARIABLE;
+      case DW_FORM_strp: 
+         return hdr ? hdr->offset_size : DWARF_SIZE_VARIABLE;
+      case DW_FORM_ref_addr: 
+         return hdr ? hdr->ref_addr_size : DWARF_SIZE_VARIABLE;
+      case DW_FORM_data1: // fall through
+      case DW_FORM_ref1: // fall through
+      case DW_FORM_flag: 
+         return 1;
+      case DW_FORM_data2: // fall through
+      case DW_FORM_ref2: 
+         return 2;
+      case DW_FORM_data4: // fall through
+      case DW_FORM_ref4: 
+         return 4;
+      case DW_FORM_data8: // fall through
+      case DW_FORM_ref8: 
+         return 8;
+      default:
+         return DWARF_SIZE_VARIABLE;
+   }
+}
+
+/*
+ * Upper bound of the bytes a value of the form takes in any unit, not 
+ * counting the characters of strings and the contents of blocks.
+ */
+static uint32_t
+dwarf_form_max_size(const dwarf_form *form) {
+   uint32_t size = dwarf_form_size(form, NULL);
+
+   if (!form || size != DWARF_SIZE_VARIABLE) {
+      return form ? size : 0;
+   }
+
+   switch (form->id) {
+      case DW_FORM_addr: // fall through
+      case DW_FORM_strp: // fall through
+      case DW_FORM_ref_addr: 
+         return 8;
+      case DW_FORM_block1: 
+         return 1;
+      case DW_FORM_block2: 
+         return 2;
+      case DW_FORM_block4: 
+         return 4;
+      case DW_FORM_block: // fall through
+      case DW_FORM_sdata: // fall through
+      case DW_FORM_udata: // fall through
+      case DW_FORM_ref_udata: 
+         return DWARF_LEB_MAX;
+      default:
+         return 0;
+   }
+}
+
+static void
+dwarf_free_abbrevs(Dwarf *dwarf, dwarf_abbrevs *abbrevs);
+
 static dwarf_abbrevs *
-dwarf_read_abbrev(char *buf, long buf_len) {
-   uint32_t uleb128_tmp;
-   dwarf_abbrevs *abbrev = NULL;
-   dwarf_abbrevs **cur_abbrev = &abbrev;
-   dwarf_abbrev_tab **cur_tab = NULL;
+dwarf_read_abbrev(Dwarf *dwarf, uint64_t offset) {
+   uint64_t code;
+   dwarf_abbrevs *abbrev;
+   dwarf_abbrev_tab **cur_tab;
    dwarf_att_id att_id;
    dwarf_form_id form_id;
    dwarf_att_spec **atts;
-   char *buf_start = buf;
-   char *buf_end = buf_start + buf_len;
+   dwarf_att_spec *spec;
+   uint32_t size;
+   dwarf_cursor cur;
+   char *decl;
 
-   while (buf < buf_end) {
-      if (!*cur_abbrev) {
-         *cur_abbrev = (dwarf_abbrevs *)calloc(1, sizeof(dwarf_abbrevs));
-         (*cur_abbrev)->offset = buf - buf_start;
-         cur_tab = &(*cur_abbrev)->tab;
-      }
+   dwarf_cur_init(&cur, dwarf, ".debug_abbrev", dwarf->abbrev.buf, 
+         dwarf->abbrev.buf + offset, dwarf->abbrev.buf + dwarf->abbrev.size);
 
-      buf += decode_uleb128(buf, &uleb128_tmp);
+   abbrev = (dwarf_abbrevs *)dwarf_mem_calloc(dwarf, 1, sizeof(dwarf_abbrevs));
+   abbrev->offset = offset;
+   cur_tab = &abbrev->tab;
 
-      if (uleb128_tmp == 0) {
-         cur_abbrev = &(*cur_abbrev)->next;
-         continue;
+   while (cur.pos < cur.end) {
+      decl = cur.pos;
+      code = dwarf_cur_uleb(&cur, true);
+
+      if (code == 0) {
+         break;
       } 
 
-      *cur_tab = (dwarf_abbrev_tab *)calloc(1, sizeof(dwarf_abbrev_tab));
+      *cur_tab = (dwarf_abbrev_tab *)dwarf_mem_calloc(dwarf, 1, 
+            sizeof(dwarf_abbrev_tab));
       atts = &((*cur_tab)->atts);
 
-      (*cur_tab)->id = uleb128_tmp;
-      buf += decode_uleb128(buf, &uleb128_tmp);
-      (*cur_tab)->tag = get_tag(uleb128_tmp); 
-      (*cur_tab)->has_children = (uint8_t)*buf++;
+      (*cur_tab)->id = code;
+      (*cur_tab)->tag_id = dwarf_cur_uleb(&cur, true);
+      (*cur_tab)->tag = get_tag((*cur_tab)->tag_id); 
+      (*cur_tab)->has_children = dwarf_cur_u8(&cur, true);
 
       /* read attributes */
       while (true) {
-         buf += decode_uleb128(buf, &uleb128_tmp);
-         att_id = uleb128_tmp;
-         buf += decode_uleb128(buf, &uleb128_tmp);
-         form_id = uleb128_tmp;
+         att_id = dwarf_cur_uleb(&cur, true);
+         form_id = dwarf_cur_uleb(&cur, true);
 
          if (att_id == 0 && form_id == 0) {
             break;
          }
 
-         *atts = calloc(1, sizeof(dwarf_att_spec));
+         /* values of unknown forms can't be skipped */
+         if (!get_form(form_id)) {
+            dwarf_free_abbrevs(dwarf, abbrev);
+            fail(dwarf, "Unknown form 0x%x in abbreviation table at offset "
+                  "%" PRIu64 "\n", form_id, offset);
+         }
+
+         *atts = dwarf_mem_calloc(dwarf, 1, sizeof(dwarf_att_spec));
+         (*atts)->id = att_id;
          (*atts)->att = get_att(att_id);
          (*atts)->form = get_form(form_id);
+         size = dwarf_form_size((*atts)->form, NULL);
+         (*cur_tab)->max_size += dwarf_form_max_size((*atts)->form);
+         (*cur_tab)->att_count++;
          atts = &(*atts)->next;
+
+         /* address and offset sizes are known once a unit uses the table */
+         if (form_id == DW_FORM_addr) {
+            (*cur_tab)->addr_count++;
+         } else if (form_id == DW_FORM_strp) {
+            (*cur_tab)->offset_count++;
+         } else if (form_id == DW_FORM_ref_addr) {
+            (*cur_tab)->ref_addr_count++;
+         } else if (size == DWARF_SIZE_VARIABLE) {
+            (*cur_tab)->fixed_size = DWARF_SIZE_VARIABLE;
+         } else if ((*cur_tab)->fixed_size != DWARF_SIZE_VARIABLE) {
+            (*cur_tab)->fixed_size += size;
+         }
+      }
+
+      size = (*cur_tab)->max_size;
+
+      for (spec = (*cur_tab)->atts; spec; spec = spec->next) {
+         size -= dwarf_form_max_size(spec->form);
+         spec->rest_size = size;
       }
 
+      (*cur_tab)->decl_size = cur.pos - decl;
+
       cur_tab = &(*cur_tab)->next;
    }
 
+   abbrev->size = cur.pos - (dwarf->abbrev.buf + offset);
+
    return abbrev;
 }
 
+/*
+ * Abbreviation tables are read when the first CU using them is parsed and 
+ * kept sorted by offset.
+ */
 static dwarf_abbrevs *
-dwarf_get_abbrevs(dwarf_abbrevs *abbrevs, uint32_t offset) {
-   while (abbrevs) {
-      if(abbrevs->offset == offset) {
-         return abbrevs;
-      }
-      abbrevs = abbrevs->next; 
+dwarf_get_abbrevs(Dwarf *dwarf, uint64_t offset) {
+   dwarf_abbrevs **abbrevs = &dwarf->abbrevs;
+   dwarf_abbrevs *abbrev;
+
+   while (*abbrevs && (*abbrevs)->offset < offset) {
+      abbrevs = &(*abbrevs)->next; 
    }
-   return NULL;
+
+   if (*abbrevs && (*abbrevs)->offset == offset) {
+      return *abbrevs;
+   }
+
+   if (offset >= dwarf->abbrev.size) {
+      fail(dwarf, "Abbreviation table at offset %" PRIu64 " missing\n", 
+            offset); 
+   }
+
+   abbrev = dwarf_read_abbrev(dwarf, offset);
+   abbrev->next = *abbrevs;
+   *abbrevs = abbrev;
+
+   return abbrev;
 }
 
 static dwarf_abbrev_tab *
@@ -311,268 +905,545 @@ dwarf_get_abbrev_tab(dwarf_abbrev_tab *atab, uint32_t abbrev_code) {
 }
 
 static dwarf_block *
-dwarf_read_block(char **buf, long size_len, long buf_len) {
-   dwarf_block *block = calloc(1, sizeof(dwarf_block));
-   block->len = buf_len;
-   block->buf = (*buf) += size_len;
-   (*buf) += buf_len;
+dwarf_read_block(dwarf_cursor *cur, uint64_t len) {
+   dwarf_block *block = dwarf_mem_calloc(cur->dwarf, 1, sizeof(dwarf_block));
+   block->len = len;
+   block->buf = dwarf_cur_take(cur, len, true);
    return block;
 }
 
-static dwarf_die_att *
-dwarf_read_die_att(Dwarf *dwarf, char **buf, dwarf_att_spec *att_spec, 
-      dwarf_cu_header *cu_hdr) {
-   uint32_t size_len;
-   uint32_t buf_len;
-   dwarf_die_att *die_att = calloc(1, sizeof(dwarf_die_att));
+/*
+ * Reads one attribute value. Returns true for strings and blocks, after 
+ * which the caller checks again how much of the unit is left.
+ */
+DWARF_INLINE bool
+dwarf_read_die_att(dwarf_cursor *cur, dwarf_att_spec *att_spec, 
+      dwarf_die_att *die_att, bool checked, uint8_t addr_size, 
+      uint8_t offset_size, uint8_t ref_addr_size, bool swap) {
    die_att->att_spec = att_spec;
+   die_att->next_att = NULL;
+
+   if (!att_spec->form) {
+      fail(cur->dwarf, "Unknown form in DIE attribute\n");
+   }
 
    switch (att_spec->form->id) {
       case DW_FORM_string:
-         die_att->value.s_val = *buf;
-         while (*(*buf)++ != '\0'); 
+         die_att->value.s_val = dwarf_cur_str(cur);
+         return true;
+      case DW_FORM_strp: 
+         die_att->value.ul_val = dwarf_cur_fixed(cur, offset_size, swap, 
+               checked);
          break;
-      case DW_FORM_strp: // fall through
-      case DW_FORM_ref_addr: // fall through
-         die_att->value.ul_val = *(uint32_t *)(*buf);
-         (*buf) += sizeof(uint32_t);
+      case DW_FORM_ref_addr: 
+         die_att->value.ul_val = dwarf_cur_fixed(cur, ref_addr_size, swap, 
+               checked);
          break;
       case DW_FORM_addr: 
-         memcpy(&die_att->value.ul_val, *buf, cu_hdr->addr_size);
-         (*buf) += cu_hdr->addr_size;
+         die_att->value.ul_val = dwarf_cur_fixed(cur, addr_size, swap, 
+               checked);
          break;
       case DW_FORM_block: 
-         size_len = decode_uleb128(*buf, &buf_len);
-         die_att->value.b_val = dwarf_read_block(buf, size_len, buf_len);
-         break;
+         die_att->value.b_val = dwarf_read_block(cur, 
+               dwarf_cur_uleb(cur, checked));
+         return true;
       case DW_FORM_block1: 
-         die_att->value.b_val = dwarf_read_block(buf, 1, (*(uint8_t *)(*buf)));
-         break;
+         die_att->value.b_val = dwarf_read_block(cur, 
+               dwarf_cur_u8(cur, checked));
+         return true;
       case DW_FORM_block2: 
-         die_att->value.b_val = dwarf_read_block(buf, 2, (*(uint16_t *)(*buf)));
-         break;
+         die_att->value.b_val = dwarf_read_block(cur, 
+               dwarf_cur_fixed(cur, 2, swap, checked));
+         return true;
       case DW_FORM_block4: 
-         die_att->value.b_val = dwarf_read_block(buf, 4, (*(uint32_t *)(*buf)));
-         break;
+         die_att->value.b_val = dwarf_read_block(cur, 
+               dwarf_cur_fixed(cur, 4, swap, checked));
+         return true;
       case DW_FORM_ref1: // fall through
-      case DW_FORM_data1: 
-         die_att->value.ul_val = *(uint8_t *)(*buf);
-         (*buf) += 1;
+      case DW_FORM_data1: // fall through
+      case DW_FORM_flag: 
+         die_att->value.ul_val = dwarf_cur_u8(cur, checked);
          break;
       case DW_FORM_ref2: // fall through
       case DW_FORM_data2: 
-         die_att->value.ul_val = *(uint16_t *)(*buf);
-         (*buf) += 2;
+         die_att->value.ul_val = dwarf_cur_fixed(cur, 2, swap, checked);
          break;
       case DW_FORM_ref4: // fall through
       case DW_FORM_data4: 
-         die_att->value.ul_val = *(uint32_t *)(*buf);
-         (*buf) += 4;
+         die_att->value.ul_val = dwarf_cur_fixed(cur, 4, swap, checked);
          break;
       case DW_FORM_ref8: // fall through
       case DW_FORM_data8: 
-         die_att->value.ul_val = *(uint64_t *)(*buf);
-         (*buf) += 8;
+         die_att->value.ul_val = dwarf_cur_fixed(cur, 8, swap, checked);
          break;
       case DW_FORM_sdata: 
-         (*buf) += decode_sleb128(*buf, &die_att->value.sl_val);
+         die_att->value.sl_val = dwarf_cur_sleb(cur, checked);
          break;
       case DW_FORM_ref_udata: // fall through
       case DW_FORM_udata: 
-         (*buf) += decode_uleb128(*buf, &die_att->value.ul_val);
-         break;
-      case DW_FORM_flag: 
-         die_att->value.ul_val = *(uint8_t *)(*buf);
-         (*buf) += 1;
+         die_att->value.ul_val = dwarf_cur_uleb(cur, checked);
          break;
       case DW_FORM_indirect: // fall through
       default:
-         fail(dwarf, "Unsupported form in DIE attribute: %s\n", 
+         fail(cur->dwarf, "Unsupported form in DIE attribute: %s\n", 
                att_spec->form->name);
    }
 
-   return die_att;
+   return false;
+}
+
+/*
+ * Reads the attributes of a DIE into atts. When the largest encoding of 
+ * the bounded values fits in what is left of the unit, they are read 
+ * without checking each of them.
+ */
+DWARF_INLINE void
+dwarf_read_die_atts_enc(dwarf_cursor *cur, dwarf_abbrev_tab *die_abbrevs, 
+      dwarf_die_att *atts, uint8_t addr_size, uint8_t offset_size, 
+      uint8_t ref_addr_size, bool swap) {
+   dwarf_att_spec *att_spec;
+   bool checked = (uint64_t)(cur->end - cur->pos) < die_abbrevs->max_size;
+
+   for (att_spec = die_abbrevs->atts; att_spec; att_spec = att_spec->next) {
+      if (dwarf_read_die_att(cur, att_spec, atts++, checked, addr_size, 
+               offset_size, ref_addr_size, swap)) {
+         checked = (uint64_t)(cur->end - cur->pos) < att_spec->rest_size;
+      }
+   }
+}
+
+typedef void (*dwarf_die_atts_fn)(dwarf_cursor *cur, 
+      dwarf_abbrev_tab *die_abbrevs, dwarf_cu_header *cu_hdr, 
+      dwarf_die_att *atts);
+
+#define DWARF_DIE_ATTS(name, addr_size, offset_size, ref_addr_size, swap)   \
+static void                                                                 \
+name(dwarf_cursor *cur, dwarf_abbrev_tab *die_abbrevs,                      \
+      dwarf_cu_header *cu_hdr, dwarf_die_att *atts) {                       \
+   (void)cu_hdr;                                                            \
+   dwarf_read_die_atts_enc(cur, die_abbrevs, atts, addr_size, offset_size,  \
+         ref_addr_size, swap);                                              \
+}
+
+DWARF_DIE_ATTS(dwarf_read_die_atts_a4o4, 4, 4, 4, false)
+DWARF_DIE_ATTS(dwarf_read_die_atts_a8o4, 8, 4, 4, false)
+DWARF_DIE_ATTS(dwarf_read_die_atts_a4o8, 4, 8, 8, false)
+DWARF_DIE_ATTS(dwarf_read_die_atts_a8o8, 8, 8, 8, false)
+DWARF_DIE_ATTS(dwarf_read_die_atts_a4o4_swap, 4, 4, 4, true)
+DWARF_DIE_ATTS(dwarf_read_die_atts_a8o4_swap, 8, 4, 4, true)
+DWARF_DIE_ATTS(dwarf_read_die_atts_a4o8_swap, 4, 8, 8, true)
+DWARF_DIE_ATTS(dwarf_read_die_atts_a8o8_swap, 8, 8, 8, true)
+DWARF_DIE_ATTS(dwarf_read_die_atts_a8o4r8, 8, 4, 8, false)
+DWARF_DIE_ATTS(dwarf_read_die_atts_a8o4r8_swap, 8, 4, 8, true)
+DWARF_DIE_ATTS(dwarf_read_die_atts_any, cu_hdr->addr_size, 
+      cu_hdr->offset_size, cu_hdr->ref_addr_size, cur->swap)
+
+#define DWARF_ENC_A8O4R8 8
+#define DWARF_ENC_ANY 10
+
+/* indexed by the enc field of the unit header, see dwarf_unit_enc() */
+static const dwarf_die_atts_fn dwarf_die_atts_readers[] = {
+   dwarf_read_die_atts_a4o4, dwarf_read_die_atts_a8o4, 
+   dwarf_read_die_atts_a4o8, dwarf_read_die_atts_a8o8, 
+   dwarf_read_die_atts_a4o4_swap, dwarf_read_die_atts_a8o4_swap, 
+   dwarf_read_die_atts_a4o8_swap, dwarf_read_die_atts_a8o8_swap, 
+   dwarf_read_die_atts_a8o4r8, dwarf_read_die_atts_a8o4r8_swap, 
+   dwarf_read_die_atts_any
+};
+
+/*
+ * Picks the DIE decoder of a unit once, when its header is read. Units 
+ * with addresses other than 4 or 8 bytes use the generic one, as do 
+ * units with DW_FORM_ref_addr values of neither the address nor the 
+ * offset size. DWARF 2 units with 8 byte addresses have their own.
+ */
+static uint8_t
+dwarf_unit_enc(dwarf_cu_header *hdr, bool swap) {
+   if (hdr->addr_size != 4 && hdr->addr_size != 8) {
+      return DWARF_ENC_ANY;
+   }
+
+   if (hdr->ref_addr_size != hdr->offset_size) {
+      return hdr->addr_size == 8 && hdr->offset_size == 4 ? 
+         DWARF_ENC_A8O4R8 | swap : DWARF_ENC_ANY;
+   }
+
+   return (hdr->addr_size == 8) | (hdr->offset_size == 8) << 1 | swap << 2;
+}
+
+static inline void
+dwarf_read_die_atts(dwarf_cursor *cur, dwarf_abbrev_tab *die_abbrevs, 
+      dwarf_cu_header *cu_hdr, dwarf_die_att *atts) {
+   dwarf_die_atts_readers[cu_hdr->enc](cur, die_abbrevs, cu_hdr, atts);
 }
 
+/*
+ * Reads a single DIE with its attributes in one array, outside of any CU 
+ * array. The caller frees it with dwarf_free_die().
+ */
 static dwarf_die *
-dwarf_read_die(Dwarf *dwarf, char **buf, dwarf_abbrev_tab *die_abbrevs, 
+dwarf_read_die(dwarf_cursor *cur, dwarf_abbrev_tab *die_abbrevs, 
       dwarf_cu_header *cu_hdr) {
-   dwarf_att_spec *att_spec = die_abbrevs->atts;
-   dwarf_die *die = calloc(1, sizeof(dwarf_die));
-   dwarf_die_att **att = &die->att;
+   dwarf_die *die = dwarf_mem_calloc(cur->dwarf, 1, sizeof(dwarf_die));
+   uint32_t i;
    
    die->tag = die_abbrevs->tag;
+   die->parent = DWARF_DIE_NONE;
+   die->next = DWARF_DIE_NONE;
+   die->size = 1;
+   die->att_count = die_abbrevs->att_count;
+
+   if (die->att_count) {
+      die->att = dwarf_mem_calloc(cur->dwarf, die->att_count, 
+            sizeof(dwarf_die_att));
+      dwarf_read_die_atts(cur, die_abbrevs, cu_hdr, die->att);
+   }
 
-   while (att_spec) {
-      *att = dwarf_read_die_att(dwarf, buf, att_spec, cu_hdr);
-      att = &(*att)->next_att;
-      att_spec = att_spec->next; 
+   for (i = 1; i < die->att_count; i++) {
+      die->att[i - 1].next_att = &die->att[i];
    }
 
    return die; 
 }
 
-static dwarf_die *
-dwarf_read_cu_body(Dwarf *dwarf, char **buf, uint32_t len, 
-      dwarf_abbrev_tab *atab, dwarf_cu_header *cu_hdr) {
-   dwarf_die *first_die;
-   dwarf_die **die = &first_die;
-   uint32_t abbrev_code;
+/*
+ * Reads all DIEs of a CU into one preorder array and their attributes into 
+ * a second one. The child, sibling and att pointers are set once both 
+ * arrays have their final size.
+ */
+static void
+dwarf_read_cu_body(Dwarf *dwarf, dwarf_cu *cu) {
+   uint64_t abbrev_code;
+   uint64_t offset;
+   uint32_t dies_len = 0;
+   uint32_t atts_len = 0;
+   uint32_t parent = DWARF_DIE_NONE;
+   uint32_t prev = DWARF_DIE_NONE;
+   uint32_t pos = 0;
+   uint32_t i, j;
    dwarf_abbrev_tab *die_abbrevs;
-   stack *path = stack_create();
-   long *body_end = (long *)(*buf + len);
+   dwarf_die *die;
+   dwarf_cursor cur;
 
-   while ((long *)*buf < body_end) {
-      *buf += decode_uleb128(*buf, &abbrev_code);
+   dwarf_cur_init(&cur, dwarf, ".debug_info", dwarf->info.buf, cu->body, 
+         cu->body + cu->body_len);
 
-      if (abbrev_code) {
-         die_abbrevs = dwarf_get_abbrev_tab(atab, abbrev_code);
+   cu->die = NULL;
+   cu->dies = NULL;
+   cu->die_count = 0;
+   cu->atts = NULL;
+   cu->att_count = 0;
 
-         if (!die_abbrevs) {
-            fail(dwarf, "Abbreviation table for id %d missing\n", 
-                  abbrev_code); 
+   if (!cu->atab) {
+      cu->atab = dwarf_get_abbrevs(dwarf, cu->hdr.abbrev_off)->tab;
+   }
+
+   while (cur.pos < cur.end) {
+      offset = cur.pos - cur.start;
+      abbrev_code = dwarf_cur_uleb(&cur, true);
+
+      if (!abbrev_code) {
+         /* end of the children of parent */
+         if (parent != DWARF_DIE_NONE) {
+            cu->dies[parent].size = cu->die_count - parent;
+            prev = parent;
+            parent = cu->dies[parent].parent;
          }
+         continue;
+      }
 
-         *die = dwarf_read_die(dwarf, buf, die_abbrevs, cu_hdr);
+      die_abbrevs = dwarf_get_abbrev_tab(cu->atab, abbrev_code);
 
-         if (die_abbrevs->has_children == yes) {
-            stack_push(path, die);
-            die = &(*die)->child;
-         } else {
-            die = &(*die)->sibling;
+      if (!die_abbrevs) {
+         fail(dwarf, "Abbreviation table for id %" PRIu64 " missing\n", 
+               abbrev_code); 
+      }
+
+      /* DIEs are read in preorder, so the array is sorted by offset */
+      if (cu->die_count == dies_len) {
+         dies_len = dies_len ? dies_len << 1 : 64;
+         cu->dies = dwarf_mem_realloc(dwarf, cu->dies, 
+               dies_len * sizeof(dwarf_die));
+      }
+
+      die = &cu->dies[cu->die_count];
+      memset(die, 0, sizeof(dwarf_die));
+      die->offset = offset;
+      die->abbrev_code = abbrev_code;
+      die->tag = die_abbrevs->tag;
+      die->parent = parent;
+      die->next = DWARF_DIE_NONE;
+      die->size = 1;
+
+      if (prev != DWARF_DIE_NONE) {
+         cu->dies[prev].next = cu->die_count;
+      }
+
+      if (cu->att_count + die_abbrevs->att_count > atts_len) {
+         while (cu->att_count + die_abbrevs->att_count > atts_len) {
+            atts_len = atts_len ? atts_len << 1 : 256;
          }
+         cu->atts = dwarf_mem_realloc(dwarf, cu->atts, 
+               atts_len * sizeof(dwarf_die_att));
+      }
+
+      dwarf_read_die_atts(&cur, die_abbrevs, &cu->hdr, 
+            &cu->atts[cu->att_count]);
+      die->att_count = die_abbrevs->att_count;
+      cu->att_count += die->att_count;
+
+      if (die_abbrevs->has_children == yes) {
+         parent = cu->die_count;
+         prev = DWARF_DIE_NONE;
       } else {
-         if (!stack_is_empty(path)) {
-            // TODO: what about this die?
-            die = (dwarf_die* *)stack_pop(path); 
-         }
+         prev = cu->die_count;
+      }
+
+      cu->die_count++;
+   }
+
+   /* subtrees that were not terminated end with the CU */
+   for (; parent != DWARF_DIE_NONE; parent = cu->dies[parent].parent) {
+      cu->dies[parent].size = cu->die_count - parent;
+   }
+
+   for (i = 0; i < cu->die_count; i++) {
+      die = &cu->dies[i];
+      die->att = die->att_count ? &cu->atts[pos] : NULL;
+
+      for (j = 1; j < die->att_count; j++) {
+         cu->atts[pos + j - 1].next_att = &cu->atts[pos + j];
       }
+
+      pos += die->att_count;
+      die->child = die->size > 1 ? die + 1 : NULL;
+      die->sibling = die->next != DWARF_DIE_NONE ? &cu->dies[die->next] : NULL;
+   }
+
+   cu->die = cu->die_count ? cu->dies : NULL;
+}
+
+/*
+ * Reads only the root DIE of a CU, which is all that lookups by name or 
+ * line program need. The caller frees it with dwarf_free_die().
+ */
+static dwarf_die *
+dwarf_read_cu_root(Dwarf *dwarf, dwarf_cu *cu) {
+   dwarf_abbrev_tab *die_abbrevs;
+   uint64_t abbrev_code;
+   dwarf_cursor cur;
+
+   if (!cu->body_len) {
+      return NULL;
+   }
+
+   if (!cu->atab) {
+      cu->atab = dwarf_get_abbrevs(dwarf, cu->hdr.abbrev_off)->tab;
    }
 
-   stack_destroy(path);
+   dwarf_cur_init(&cur, dwarf, ".debug_info", dwarf->info.buf, cu->body, 
+         cu->body + cu->body_len);
+   abbrev_code = dwarf_cur_uleb(&cur, true);
+
+   if (!abbrev_code || 
+         !(die_abbrevs = dwarf_get_abbrev_tab(cu->atab, abbrev_code))) {
+      return NULL;
+   }
 
-   return first_die;
+   return dwarf_read_die(&cur, die_abbrevs, &cu->hdr);
 }
 
+/*
+ * Reads the headers of all units in .debug_info. Units in the 32-bit and 
+ * the 64-bit format may be mixed.
+ */
 static dwarf_cu *
-dwarf_read_cu(Dwarf *dwarf, char *buf, uint32_t len) {
-   char *buf_end = buf + len;
-   dwarf_cu *first_cu; 
-   dwarf_cu **cu = &first_cu;
-   uint32_t body_len;
-   dwarf_abbrevs *cu_abbrevs;
+dwarf_read_cu(Dwarf *dwarf, char *buf, uint64_t len) {
+   char *unit_start;
+   char *unit_end;
+   dwarf_cu_header *hdr;
+   dwarf_cu **cu = &dwarf->cu;
+   uint32_t cus_len = 0;
+   dwarf_cursor cur;
+
+   dwarf_cur_init(&cur, dwarf, ".debug_info", buf, buf, buf + len);
+
+   while (cur.pos < cur.end) {
+      *cu = (dwarf_cu *)dwarf_mem_calloc(dwarf, 1, sizeof(dwarf_cu));
+      hdr = &(*cu)->hdr;
+      unit_start = cur.pos;
+      hdr->length = dwarf_cur_length(&cur, &hdr->offset_size);
+      unit_end = cur.pos + hdr->length;
+
+      if (unit_end - cur.pos < 2 + hdr->offset_size + 1) {
+         fail(dwarf, "Invalid unit header at offset %" PRIu64 "\n", 
+               (uint64_t)(unit_start - cur.start));
+      }
 
-   while (buf < buf_end) {
-      *cu = (dwarf_cu *)calloc(1, sizeof(dwarf_cu));
-      memcpy(&(*cu)->hdr, buf, sizeof(dwarf_cu_header));
-      buf += sizeof(dwarf_cu_header);
-      body_len = (*cu)->hdr.length - sizeof((*cu)->hdr) + 
-         sizeof((*cu)->hdr.length);
-      cu_abbrevs = dwarf_get_abbrevs(dwarf->abbrevs, (*cu)->hdr.abbrev_off);
+      hdr->version = dwarf_cur_u16(&cur, false);
+      hdr->abbrev_off = dwarf_cur_uint(&cur, hdr->offset_size, false);
+      hdr->addr_size = dwarf_cur_u8(&cur, false);
+      hdr->size = cur.pos - unit_start;
 
-      if (!cu_abbrevs) {
-         fail(dwarf, "Abbreviation table at offset %d missing\n", 
-               (*cu)->hdr.abbrev_off); 
+      if (hdr->addr_size < 1 || hdr->addr_size > 8) {
+         fail(dwarf, "Invalid address size %u at offset %" PRIu64 "\n", 
+               hdr->addr_size, (uint64_t)(unit_start - cur.start));
       }
 
-      (*cu)->die = dwarf_read_cu_body(dwarf, &buf, body_len, cu_abbrevs->tab, 
-            &(*cu)->hdr);
+      hdr->ref_addr_size = hdr->version <= 2 ? hdr->addr_size : 
+         hdr->offset_size;
+      hdr->enc = dwarf_unit_enc(hdr, cur.swap);
+
+      /* the body is parsed on demand by dwarf_cu_get_die() */
+      (*cu)->offset = unit_start - cur.start;
+      (*cu)->body = cur.pos;
+      (*cu)->body_len = unit_end - cur.pos;
+      (*cu)->cache.kind = DWARF_CACHE_CU;
+      cur.pos = unit_end;
+
+      if (dwarf->cu_count == cus_len) {
+         cus_len = cus_len ? cus_len << 1 : 16;
+         dwarf->cus = dwarf_mem_realloc(dwarf, dwarf->cus, 
+               cus_len * sizeof(dwarf_cu *));
+      }
 
+      dwarf->cus[dwarf->cu_count++] = *cu;
       cu = &(*cu)->next_cu;
    }
 
-   return first_cu;
-}
-
-static void
-skip_string(char **buf) {
-   while (*(*buf)++ != '\0'); 
+   return dwarf->cu;
 }
 
 static dwarf_sprog_dir *
-dwarf_read_pro_incl_dirs(char **buf) {
+dwarf_read_pro_incl_dirs(dwarf_cursor *cur) {
    dwarf_sprog_dir *first_dir = NULL;
    dwarf_sprog_dir **cur_dir = &first_dir;
 
-   while (**buf) {
-      *cur_dir = (dwarf_sprog_dir *)calloc(1, sizeof(dwarf_sprog_dir));
-      (*cur_dir)->name = *buf;
-      skip_string(buf);
+   while (cur->pos < cur->end && *cur->pos) {
+      *cur_dir = (dwarf_sprog_dir *)dwarf_mem_calloc(cur->dwarf, 1, 
+            sizeof(dwarf_sprog_dir));
+      (*cur_dir)->name = dwarf_cur_str(cur);
       cur_dir = &(*cur_dir)->next;
    }
 
-   (*buf)++;
+   /* the list ends with an empty name */
+   dwarf_cur_u8(cur, true);
 
    return first_dir;
 }
 
 static dwarf_sprog_file *
-dwarf_read_file(char **buf) {
-   dwarf_sprog_file *file = calloc(1, sizeof(dwarf_sprog_file));
-   file->name = *buf;
-   skip_string(buf);
-   *buf += decode_uleb128(*buf, &file->dir_idx);
-   *buf += decode_uleb128(*buf, &file->mtime);
-   *buf += decode_uleb128(*buf, &file->size);
+dwarf_read_file(dwarf_cursor *cur) {
+   dwarf_sprog_file *file = dwarf_mem_calloc(cur->dwarf, 1, 
+         sizeof(dwarf_sprog_file));
+   file->name = dwarf_cur_str(cur);
+   file->dir_idx = dwarf_cur_uleb(cur, true);
+   file->mtime = dwarf_cur_uleb(cur, true);
+   file->size = dwarf_cur_uleb(cur, true);
    return file;
 }
 
 static dwarf_sprog_file *
-dwarf_read_pro_files(char **buf) {
+dwarf_read_pro_files(dwarf_cursor *cur) {
    dwarf_sprog_file *first_file = NULL;
    dwarf_sprog_file **cur_file = &first_file;
 //TODO: file struct correct?
-   while (**buf) {
-      *cur_file = dwarf_read_file(buf);
+   while (cur->pos < cur->end && *cur->pos) {
+      *cur_file = dwarf_read_file(cur);
       cur_file = &(*cur_file)->next;
    }
 
-   (*buf)++;
+   /* the list ends with an empty name */
+   dwarf_cur_u8(cur, true);
 
    return first_file;
 }
 
+/*
+ * Reads the prologue at cur, which ends with the unit. The cursor is left 
+ * at the first opcode of the line program.
+ */
 static void 
-dwarf_read_sprog_prologue(Dwarf *dwarf, char **buf, 
-      dwarf_sprog_pro **prologue_hdl) {
+dwarf_read_sprog_prologue(dwarf_cursor *cur, dwarf_sprog_pro **prologue_hdl) {
+   Dwarf *dwarf = cur->dwarf;
    dwarf_sprog_pro *prologue;
-   char *prologue_end; 
+   char *unit_end = cur->end;
    int i;
 
-   *prologue_hdl = calloc(1, sizeof(dwarf_sprog_pro));
+   *prologue_hdl = dwarf_mem_calloc(dwarf, 1, sizeof(dwarf_sprog_pro));
    prologue = *prologue_hdl;
 
-   prologue->total_len = *(uint32_t *)*buf;
-   (*buf) += sizeof(uint32_t);
-   prologue->version = *(uint16_t *)*buf;
-   (*buf) += sizeof(uint16_t);
-   prologue->prologue_len = *(uint32_t *)*buf;
-   (*buf) += sizeof(uint32_t);
-   prologue_end = *buf + prologue->prologue_len;
-   prologue->min_inst_len = *(uint8_t *)*buf;
-   (*buf)++;
-   prologue->dflt_is_stmt = *(uint8_t *)*buf;
-   (*buf)++;
-   prologue->line_base = *(int8_t *)(*buf);
-   (*buf)++;
-   prologue->line_range = *(int8_t *)(*buf);
-   (*buf)++;
-   prologue->opcode_base = *(int8_t *)(*buf);
-   (*buf)++;
-
-   prologue->std_opcode_len = calloc(1, prologue->opcode_base);
+   prologue->total_len = dwarf_cur_length(cur, &prologue->offset_size);
+
+   if (unit_end - cur->pos < 2 + prologue->offset_size) {
+      fail(dwarf, "Invalid prologue in section .debug_line\n"); 
+   }
+
+   prologue->version = dwarf_cur_u16(cur, false);
+   prologue->prologue_len = dwarf_cur_uint(cur, prologue->offset_size, false);
+
+   /* DWARF 5 describes its directory and file tables with formats */
+   if (prologue->version < 2 || prologue->version > 4) {
+      fail(dwarf, "Unsupported line program version %u\n", 
+            prologue->version);
+   }
+
+   if (prologue->prologue_len > (uint64_t)(unit_end - cur->pos)) {
+      fail(dwarf, "Invalid length of prologue in section .debug_line\n"); 
+   }
+
+   /* the tables of the prologue must not run into the line program */
+   cur->end = cur->pos + prologue->prologue_len;
+   prologue->min_inst_len = dwarf_cur_u8(cur, true);
+   prologue->max_ops = prologue->version >= 4 ? dwarf_cur_u8(cur, true) : 1;
+   prologue->dflt_is_stmt = dwarf_cur_u8(cur, true);
+   prologue->line_base = (int8_t)dwarf_cur_u8(cur, true);
+   prologue->line_range = dwarf_cur_u8(cur, true);
+   prologue->opcode_base = dwarf_cur_u8(cur, true);
+
+   if (!prologue->line_range || !prologue->opcode_base) {
+      fail(dwarf, "Invalid prologue in section .debug_line\n"); 
+   }
+
+   /* the op_index register of VLIW line programs is not tracked */
+   if (prologue->max_ops != 1) {
+      fail(dwarf, "Unsupported maximum_operations_per_instruction %u\n", 
+            prologue->max_ops);
+   }
+
+   prologue->std_opcode_len = dwarf_mem_calloc(dwarf, 1, prologue->opcode_base);
 
    for (i=1; i<prologue->opcode_base; i++) {
-      prologue->std_opcode_len[i] = (int8_t)*(*buf)++;
+      prologue->std_opcode_len[i] = (int8_t)dwarf_cur_u8(cur, true);
    }
 
-   prologue->incl_dirs = dwarf_read_pro_incl_dirs(buf);
-   prologue->files = dwarf_read_pro_files(buf);
+   prologue->incl_dirs = dwarf_read_pro_incl_dirs(cur);
+   prologue->files = dwarf_read_pro_files(cur);
 
-   if (*buf != prologue_end) {
+   if (cur->pos != cur->end) {
       fail(dwarf, "Invalid length of prologue in section .debug_line\n"); 
    }
 
+   cur->end = unit_end;
+}
+
+static dwarf_sprog_pro *
+dwarf_load_sprog_pro(Dwarf *dwarf, dwarf_sprog *sprog) {
+   dwarf_sprog_pro *prologue;
+   dwarf_cursor cur;
+
+   if (!sprog->prologue) {
+      dwarf_cur_init(&cur, dwarf, ".debug_line", dwarf->line.buf, sprog->hdr, 
+            sprog->hdr + sprog->unit_len);
+      dwarf_read_sprog_prologue(&cur, &prologue);
+
+      /* the state machine is run on demand by dwarf_sprog_get_regs() */
+      sprog->sm = cur.pos;
+      sprog->sm_len = cur.end - cur.pos;
+      sprog->prologue = prologue;
+   }
+
+   return sprog->prologue;
 }
 
 static void
@@ -585,58 +1456,72 @@ dwarf_sprog_append_file(dwarf_sprog_pro *prologue, dwarf_sprog_file *file) {
 }
 
 static dwarf_sm_regs *
-dwarf_copy_sm_reg(dwarf_sm_regs *reg) {
-   dwarf_sm_regs *new_regs = calloc(1, sizeof(dwarf_sm_regs));
+dwarf_copy_sm_reg(Dwarf *dwarf, dwarf_sm_regs *reg) {
+   dwarf_sm_regs *new_regs = dwarf_mem_calloc(dwarf, 1, sizeof(dwarf_sm_regs));
    memcpy(new_regs, reg, sizeof(dwarf_sm_regs));
    return new_regs;
 }
 
 static dwarf_sm_regs *
-dwarf_read_sprog_sm(Dwarf *dwarf, char **buf, char **sm_hdl, size_t sm_len, 
-      dwarf_sprog_pro *prologue) {
-   *sm_hdl = *buf;
+dwarf_new_sm_regs(Dwarf *dwarf, dwarf_sprog_pro *prologue) {
+   dwarf_sm_regs *regs = (dwarf_sm_regs *)dwarf_mem_calloc(dwarf, 1, 
+         sizeof(dwarf_sm_regs));
+   regs->file = 1;
+   regs->line = 1;
+   regs->is_stmt = prologue->dflt_is_stmt;
+   return regs;
+}
 
+/* largest opcode other than define_file, which is always read checked */
+#define DWARF_SM_OP_MAX (2 + 2 * DWARF_LEB_MAX)
+
+DWARF_INLINE dwarf_sm_regs *
+dwarf_read_sprog_sm_enc(Dwarf *dwarf, char *buf, size_t sm_len, 
+      dwarf_sprog_pro *prologue, bool swap) {
    dwarf_sm_regs *first_sm_regs = NULL;
    dwarf_sm_regs **cur_sm_regs = &first_sm_regs;
-   uint32_t uarg1;
-   int32_t arg1;
-   uint32_t inst_len;
-
-   *cur_sm_regs = (dwarf_sm_regs *)calloc(1, sizeof(dwarf_sm_regs));
-   (*cur_sm_regs)->file = 1;
-   (*cur_sm_regs)->line = prologue->dflt_is_stmt;
-   (*cur_sm_regs)->basic_block = false;
-   (*cur_sm_regs)->end_sequence = false;
-   (*cur_sm_regs)->prologue_end = false;
-   (*cur_sm_regs)->epilogue_begin = false;
-   (*cur_sm_regs)->isa = 0;
-   (*cur_sm_regs)->discriminator = 0;
+   uint64_t inst_len;
+   bool checked;
+   dwarf_cursor cur;
 
-   while (true) {
-      uint8_t opcode = *(uint8_t *)(*buf)++;
+   dwarf_cur_init(&cur, dwarf, ".debug_line", dwarf->line.buf, buf, 
+         buf + sm_len);
+   *cur_sm_regs = dwarf_new_sm_regs(dwarf, prologue);
 
+   while (cur.pos < cur.end) {
+      uint8_t opcode = dwarf_cur_u8(&cur, false);
+
+      checked = cur.end - cur.pos < DWARF_SM_OP_MAX;
       (*cur_sm_regs)->opcode = opcode;
 
       switch(opcode) {
          case 0: // extended opcode
-            *buf += decode_uleb128(*buf, &inst_len); 
-            (*cur_sm_regs)->ext_opcode = *(uint8_t *)(*buf);
-            (*buf)++;
+            inst_len = dwarf_cur_uleb(&cur, checked);
+            (*cur_sm_regs)->ext_opcode = dwarf_cur_u8(&cur, checked);
 
             switch ((*cur_sm_regs)->ext_opcode) {
                case DW_LNE_end_sequence:
-                  goto end;
-                  break;
+                  (*cur_sm_regs)->end_sequence = true;
+                  if (cur.pos < cur.end) {
+                     (*cur_sm_regs)->next = dwarf_new_sm_regs(dwarf, prologue);
+                     cur_sm_regs = &(*cur_sm_regs)->next;
+                  }
+                  continue;
                case DW_LNE_set_address:
-                  (*cur_sm_regs)->address = *(uintptr_t *)(*buf); 
-                  *buf += sizeof(uintptr_t);
+                  if (inst_len < 2 || inst_len > 9) {
+                     fail(dwarf, "Invalid length %" PRIu64 " of set_address\n", 
+                           inst_len);
+                  }
+                  (*cur_sm_regs)->address = inst_len == 9 ? 
+                     dwarf_cur_fixed(&cur, 8, swap, checked) : inst_len == 5 ? 
+                     dwarf_cur_fixed(&cur, 4, swap, checked) :
+                     dwarf_cur_fixed(&cur, inst_len - 1, swap, checked);
                   break;
                case DW_LNE_define_file:
-                  dwarf_sprog_append_file(prologue, dwarf_read_file(buf));
+                  dwarf_sprog_append_file(prologue, dwarf_read_file(&cur));
                   break;
                case DW_LNE_set_discriminator:
-                  *buf += decode_uleb128(*buf, &uarg1);
-                  (*cur_sm_regs)->discriminator = uarg1;
+                  (*cur_sm_regs)->discriminator = dwarf_cur_uleb(&cur, checked);
                   break;
                default:
                   fail(dwarf, "Unknown extended opcode %d\n", 
@@ -647,20 +1532,17 @@ dwarf_read_sprog_sm(Dwarf *dwarf, char **buf, char **sm_hdl, size_t sm_len,
             (*cur_sm_regs)->basic_block = false;
             break;
          case DW_LNS_advance_pc:
-            *buf += decode_uleb128(*buf, &uarg1);
-            (*cur_sm_regs)->address += uarg1 * prologue->min_inst_len;
+            (*cur_sm_regs)->address += dwarf_cur_uleb(&cur, checked) * 
+               prologue->min_inst_len;
             break;
          case DW_LNS_advance_line:
-            *buf += decode_sleb128(*buf, &arg1); 
-            (*cur_sm_regs)->line += arg1; 
+            (*cur_sm_regs)->line += dwarf_cur_sleb(&cur, checked); 
             break;
          case DW_LNS_set_file:
-            *buf += decode_uleb128(*buf, &uarg1); 
-            (*cur_sm_regs)->file = uarg1;
+            (*cur_sm_regs)->file = dwarf_cur_uleb(&cur, checked);
             break;
          case DW_LNS_set_column:
-            *buf += decode_uleb128(*buf, &uarg1); 
-            (*cur_sm_regs)->column = uarg1;
+            (*cur_sm_regs)->column = dwarf_cur_uleb(&cur, checked);
             break;
          case DW_LNS_negate_stmt:
             (*cur_sm_regs)->is_stmt = !(*cur_sm_regs)->is_stmt;
@@ -673,9 +1555,7 @@ dwarf_read_sprog_sm(Dwarf *dwarf, char **buf, char **sm_hdl, size_t sm_len,
                prologue->line_range;
             break;
          case DW_LNS_fixed_advance_pc:
-            uarg1 = *(uint16_t *)*buf;
-            *buf += 2;
-            (*cur_sm_regs)->address += uarg1;
+            (*cur_sm_regs)->address += dwarf_cur_fixed(&cur, 2, swap, checked);
             break;
          case DW_LNS_set_prologue_end:
             (*cur_sm_regs)->prologue_end = true;
@@ -684,8 +1564,7 @@ dwarf_read_sprog_sm(Dwarf *dwarf, char **buf, char **sm_hdl, size_t sm_len,
             (*cur_sm_regs)->epilogue_begin = true;
             break;
          case DW_LNS_set_isa:
-            *buf += decode_uleb128(*buf, &uarg1); 
-            (*cur_sm_regs)->isa = uarg1;
+            (*cur_sm_regs)->isa = dwarf_cur_uleb(&cur, checked);
             break;
          default:
             if (opcode < prologue->opcode_base) {
@@ -704,88 +1583,187 @@ dwarf_read_sprog_sm(Dwarf *dwarf, char **buf, char **sm_hdl, size_t sm_len,
             break;
       } 
 
-      (*cur_sm_regs)->next = dwarf_copy_sm_reg(*cur_sm_regs);
-      cur_sm_regs = &(*cur_sm_regs)->next;
+      if (cur.pos < cur.end) {
+         (*cur_sm_regs)->next = dwarf_copy_sm_reg(dwarf, *cur_sm_regs);
+         cur_sm_regs = &(*cur_sm_regs)->next;
+      }
    }
 
-end:
    return first_sm_regs;
 }
 
+static dwarf_sm_regs *
+dwarf_read_sprog_sm_native(Dwarf *dwarf, char *buf, size_t sm_len, 
+      dwarf_sprog_pro *prologue) {
+   return dwarf_read_sprog_sm_enc(dwarf, buf, sm_len, prologue, false);
+}
+
+static dwarf_sm_regs *
+dwarf_read_sprog_sm_swap(Dwarf *dwarf, char *buf, size_t sm_len, 
+      dwarf_sprog_pro *prologue) {
+   return dwarf_read_sprog_sm_enc(dwarf, buf, sm_len, prologue, true);
+}
+
+static dwarf_sm_regs *
+dwarf_read_sprog_sm(Dwarf *dwarf, char *buf, size_t sm_len, 
+      dwarf_sprog_pro *prologue) {
+   if (dwarf->elf && dwarf->elf->swap) {
+      return dwarf_read_sprog_sm_swap(dwarf, buf, sm_len, prologue);
+   }
+   return dwarf_read_sprog_sm_native(dwarf, buf, sm_len, prologue);
+}
+
 static dwarf_sprog *
-dwarf_read_sprog(Dwarf *dwarf, char *buf, uint32_t len) {
-   dwarf_sprog *first_sprog = NULL;
-   dwarf_sprog **cur_sprog = &first_sprog;
-   char *buf_end = buf + len;
-
-   while (buf < buf_end) {
-      *cur_sprog = (dwarf_sprog *)calloc(1, sizeof(dwarf_sprog));
-      dwarf_read_sprog_prologue(dwarf, &buf, &(*cur_sprog)->prologue);
-      (*cur_sprog)->sm_len = (*cur_sprog)->prologue->total_len 
-         + sizeof((*cur_sprog)->prologue->total_len) 
-         - (*cur_sprog)->prologue->prologue_len; 
-      (*cur_sprog)->sm_regs =
-         dwarf_read_sprog_sm(dwarf, &buf, &(*cur_sprog)->sm, 
-               (*cur_sprog)->sm_len, (*cur_sprog)->prologue);
+dwarf_read_sprog(Dwarf *dwarf, char *buf, uint64_t len) {
+   dwarf_sprog **cur_sprog = &dwarf->sprog;
+   uint32_t sprogs_len = 0;
+   uint64_t unit_len;
+   uint8_t offset_size;
+   dwarf_cursor cur;
+
+   dwarf_cur_init(&cur, dwarf, ".debug_line", buf, buf, buf + len);
+
+   while (cur.pos < cur.end) {
+      *cur_sprog = (dwarf_sprog *)dwarf_mem_calloc(dwarf, 1, 
+            sizeof(dwarf_sprog));
+      (*cur_sprog)->offset = cur.pos - cur.start;
+
+      /* the prologue is read by dwarf_sprog_get_pro() */
+      (*cur_sprog)->hdr = cur.pos;
+      (*cur_sprog)->cache.kind = DWARF_CACHE_SPROG;
+      unit_len = dwarf_cur_length(&cur, &offset_size);
+      cur.pos += unit_len;
+      (*cur_sprog)->unit_len = cur.pos - (*cur_sprog)->hdr;
+
+      if (dwarf->sprog_count == sprogs_len) {
+         sprogs_len = sprogs_len ? sprogs_len << 1 : 16;
+         dwarf->sprogs = dwarf_mem_realloc(dwarf, dwarf->sprogs, 
+               sprogs_len * sizeof(dwarf_sprog *));
+      }
+
+      dwarf->sprogs[dwarf->sprog_count++] = *cur_sprog;
       cur_sprog = &(*cur_sprog)->next;
    }
 
-   return first_sprog;
+   return dwarf->sprog;
 }
 
 static dwarf_str *
-dwarf_read_str(char *buf, uint32_t len) {
-   dwarf_str *str = calloc(1, sizeof(dwarf_str));
+dwarf_read_str(Dwarf *dwarf, char *buf, uint64_t len) {
+   dwarf_str *str = dwarf_mem_calloc(dwarf, 1, sizeof(dwarf_str));
    str->table = buf;
    str->length = len;
    return str; 
 }
 
+/*
+ * Returns the string at off in .debug_str, or NULL if off is outside the 
+ * section or the string is not terminated within it.
+ */
+static char *
+dwarf_str_at(Dwarf *dwarf, uint64_t off) {
+   dwarf_str *str = dwarf->str;
+
+   if (!str || off >= str->length || 
+         !memchr(str->table + off, '\0', str->length - off)) {
+      return NULL;
+   }
+
+   return str->table + off;
+}
+
 static dwarf_aranges *
-dwarf_read_aranges(Dwarf *dwarf, char *buf, uint32_t len) {
+dwarf_read_aranges(Dwarf *dwarf, char *buf, uint64_t len) {
    dwarf_aranges *first_aranges = NULL;
    dwarf_aranges **cur_aranges = &first_aranges;
    dwarf_arange **cur_arange; 
-   char *buf_end = buf + len;
+   dwarf_ar_header *hdr;
+   char *set_start;
    char *set_end;
-   uint32_t off = 0;
-   uint32_t align = 0;
    uint32_t arange_size;
    uint32_t addr_size;
+   dwarf_cursor cur;
+
+   dwarf_cur_init(&cur, dwarf, ".debug_aranges", buf, buf, buf + len);
+
+   while (cur.pos < cur.end) {
+      *cur_aranges = (dwarf_aranges *)dwarf_mem_calloc(dwarf, 1, 
+            sizeof(dwarf_aranges));
+      hdr = &(*cur_aranges)->hdr;
+      set_start = cur.pos;
+      hdr->length = dwarf_cur_length(&cur, &hdr->offset_size);
+      set_end = cur.pos + hdr->length;
+
+      if (set_end - cur.pos < 2 + hdr->offset_size + 2) {
+         fail(dwarf, "Invalid address range set at offset %" PRIu64 "\n", 
+               (uint64_t)(set_start - cur.start));
+      }
 
-   while (buf < buf_end) {
-      *cur_aranges = (dwarf_aranges *)calloc(1, sizeof(dwarf_aranges));
-      memcpy(&(*cur_aranges)->hdr, buf, sizeof(dwarf_ar_header));
-      set_end = buf + (*cur_aranges)->hdr.length + 4 /* length field */;
-      off += sizeof(dwarf_ar_header);
-      buf += sizeof(dwarf_ar_header);
-      addr_size = (*cur_aranges)->hdr.addr_size;
+      hdr->version = dwarf_cur_u16(&cur, false);
+      hdr->info_off = dwarf_cur_uint(&cur, hdr->offset_size, false);
+      hdr->addr_size = dwarf_cur_u8(&cur, false);
+      hdr->seg_size = dwarf_cur_u8(&cur, false);
+      hdr->size = cur.pos - set_start;
+      addr_size = hdr->addr_size;
       arange_size = addr_size << 1;
-      align = arange_size - (off & (arange_size - 1));
-      buf += align;
-      off += align;
+
+      if (addr_size != 4 && addr_size != 8) {
+         fail(dwarf, "Invalid address range set at offset %" PRIu64 "\n", 
+               (uint64_t)(set_start - cur.start));
+      }
+
+      /* the tuples are aligned to their size from the start of the set */
+      cur.pos = set_start + 
+         ((hdr->size + arange_size - 1) & ~(arange_size - 1));
 
       cur_arange = &(*cur_aranges)->arange;
 
-      while (buf < set_end) {
-         *cur_arange = calloc(1, sizeof(dwarf_arange));
-         memcpy(&(*cur_arange )->address, buf, addr_size);
-         memcpy(&(*cur_arange )->length, buf + addr_size, addr_size);
-         buf += arange_size;
+      /* the loop condition bounds both reads of a tuple */
+      while (set_end - cur.pos >= arange_size) {
+         *cur_arange = dwarf_mem_calloc(dwarf, 1, sizeof(dwarf_arange));
+         (*cur_arange)->address = dwarf_cur_uint(&cur, addr_size, false);
+         (*cur_arange)->length = dwarf_cur_uint(&cur, addr_size, false);
          
          if ((*cur_arange)->address == 0 && (*cur_arange)->length == 0) {
-            free(*cur_arange);
+            dwarf_mem_free(dwarf, *cur_arange);
             *cur_arange = NULL;
             break; 
          }
 
          cur_arange = &(*cur_arange)->next_ar;
       }
+
+      cur.pos = set_end;
+      cur_aranges = &(*cur_aranges)->next_ars;
    }
 
    return first_aranges; 
 }
 
+dwarf_aranges *
+dwarf_get_aranges(Dwarf *dwarf) {
+   if (dwarf->aranges || 
+         elf_get_scn(dwarf->elf, &dwarf->arange, ".debug_aranges")) {
+      return dwarf->aranges;
+   }
+
+   if (setjmp(dwarf->env)) {
+      return NULL;
+   }
+
+   elf_scn_advise(dwarf->elf, &dwarf->arange, ELF_ADV_SEQUENTIAL);
+   dwarf->aranges = dwarf_read_aranges(dwarf, dwarf->arange.buf, 
+         dwarf->arange.size);
+   elf_scn_advise(dwarf->elf, &dwarf->arange, ELF_ADV_DONTNEED);
+
+   return dwarf->aranges;
+}
+
+static const char *
+dwarf_att_name(dwarf_att_spec *spec) {
+   return spec->att ? spec->att->name : "DW_AT_<unknown>";
+}
+
 void
 dwarf_abbrev_dump_atts(dwarf_att_spec *spec) {
    bool first = true;
@@ -793,77 +1771,104 @@ dwarf_abbrev_dump_atts(dwarf_att_spec *spec) {
    while (spec) {
       if (first) {
          printf("%-30s: 0x%02x %-20s 0x%02x %-20s\n", "attributes", 
-               spec->att->id, spec->att->name, spec->form->id, spec->form->name);
+               spec->id, dwarf_att_name(spec), spec->form->id, 
+               spec->form->name);
          first = false;
       } else {
          printf("%-30s: 0x%02x %-20s 0x%02x %-20s\n", "", 
-               spec->att->id, spec->att->name, spec->form->id, spec->form->name);
+               spec->id, dwarf_att_name(spec), spec->form->id, 
+               spec->form->name);
       }
       spec = spec->next; 
    }
 }
 
 static void
-dwarf_abbrev_dump(Dwarf *dwarf) {
-   dwarf_abbrevs *abbrevs = dwarf->abbrevs;
-   dwarf_abbrev_tab *tab;
+dwarf_abbrevs_dump(dwarf_abbrevs *abbrevs) {
+   dwarf_abbrev_tab *tab = abbrevs->tab;
+
+   printf("%-30s: 0x%08" PRIx64 "\n", "offset", abbrevs->offset);
+
+   while (tab) {
+      printf("%-30s: %d\n", "id", tab->id);
+      printf("%-30s: 0x%02x %s\n", "tag", tab->tag_id, 
+            tab->tag ? tab->tag->name : "DW_TAG_<unknown>");
+      printf("%-30s: %s\n", "children?", 
+            tab->has_children == yes ? "yes" : "no");
+      dwarf_abbrev_dump_atts(tab->atts);
+      printf("\n");
+      tab = tab->next; 
+   }
+}
+
+static void
+dwarf_abbrev_dump(Dwarf *dwarf, dwarf_cu *cu) {
+   dwarf_abbrevs *abbrevs;
+   volatile uint64_t offset = 0;
 
    printf("Section: .debug_abbrev\n");
 
-   while (abbrevs) {
-      printf("%-30s: 0x%08x\n", "offset", abbrevs->offset);
-      tab = abbrevs->tab;
-      while (tab) {
-         printf("%-30s: %d\n", "id", tab->id);
-         printf("%-30s: 0x%02x %s\n", "tag", tab->tag->id, tab->tag->name);
-         printf("%-30s: %s\n", "children?", 
-               tab->has_children == yes ? "yes" : "no");
-         dwarf_abbrev_dump_atts(tab->atts);
-         printf("\n");
-         tab = tab->next; 
-      }
-      abbrevs = abbrevs->next;
+   if (setjmp(dwarf->env)) {
+      fprintf(stderr, "%s", dwarf->error);
+      return;
+   }
+
+   if (cu) {
+      dwarf_abbrevs_dump(dwarf_get_abbrevs(dwarf, cu->hdr.abbrev_off));
+      return;
+   }
+
+   /* tables no CU refers to are read as well */
+   while (offset < dwarf->abbrev.size) {
+      abbrevs = dwarf_get_abbrevs(dwarf, offset);
+      dwarf_abbrevs_dump(abbrevs);
+      offset += abbrevs->size;
    }
 }
 
 static void
-dwarf_value_dump(Dwarf *dwarf, const dwarf_form *form, dwarf_value value) {
+dwarf_value_dump(Dwarf *dwarf, FILE *out, const dwarf_form *form, 
+      dwarf_value value) {
+   char *str;
+
    switch (form->id) {
       case DW_FORM_string:
-         printf("%s", value.s_val);
+         fprintf(out, "%s", value.s_val);
          break;
       case DW_FORM_strp:
-         printf("%s [0x%08x]", dwarf->str->table + value.ul_val, value.ul_val);
+         str = dwarf_str_at(dwarf, value.ul_val);
+         fprintf(out, "%s [0x%08" PRIx64 "]", str ? str : "<invalid offset>", 
+               value.ul_val);
          break;
       case DW_FORM_ref_addr: // fall through
       case DW_FORM_addr: 
-         printf("0x%08x", value.ul_val);
+         fprintf(out, "0x%08" PRIx64, value.ul_val);
          break;
       case DW_FORM_block:  // fall through
       case DW_FORM_block1: // fall through
       case DW_FORM_block2: // fall through
       case DW_FORM_block4: 
-         printf("%0d bytes of binary data", value.b_val->len);
+         fprintf(out, "%0d bytes of binary data", value.b_val->len);
          break;
       case DW_FORM_data1: // fall through
       case DW_FORM_data2: // fall through
       case DW_FORM_data4: // fall through
       case DW_FORM_data8: // fall through
       case DW_FORM_udata: 
-         printf("%d", value.ul_val);
+         fprintf(out, "%" PRIu64, value.ul_val);
          break;
       case DW_FORM_sdata: 
-         printf("%d", value.sl_val);
+         fprintf(out, "%" PRId64, value.sl_val);
          break;
       case DW_FORM_flag: 
-         printf("%d", (uint8_t)value.ul_val);
+         fprintf(out, "%d", (uint8_t)value.ul_val);
          break;
       case DW_FORM_ref1: // fall through
       case DW_FORM_ref2: // fall through
       case DW_FORM_ref4: // fall through
       case DW_FORM_ref8: // fall through
       case DW_FORM_ref_udata: 
-         printf("%x", value.ul_val);
+         fprintf(out, "%" PRIx64, value.ul_val);
          break;
       case DW_FORM_indirect: 
       default:
@@ -872,61 +1877,121 @@ dwarf_value_dump(Dwarf *dwarf, const dwarf_form *form, dwarf_value value) {
 
 }
 
+static bool
+dwarf_att_is_expr(dwarf_die_att *att) {
+   switch (att->att_spec->form->id) {
+      case DW_FORM_block:
+      case DW_FORM_block1:
+      case DW_FORM_block2:
+      case DW_FORM_block4:
+         break;
+      default:
+         return false;
+   }
+
+   switch (att->att_spec->id) {
+      case DW_AT_location:
+      case DW_AT_frame_base:
+      case DW_AT_data_member_location:
+      case DW_AT_vtable_elem_location:
+      case DW_AT_static_link:
+      case DW_AT_use_location:
+      case DW_AT_return_addr:
+      case DW_AT_string_length:
+      case DW_AT_data_location:
+         return true;
+      default:
+         return false;
+   }
+}
+
+static dwarf_expr *
+dwarf_expr_new(Elf_Mem *mem, char *buf, uint32_t len, uint8_t addr_size);
+
 static void
-dwarf_die_dump(Dwarf *dwarf, dwarf_die *die, char *prefix) {
+dwarf_die_dump(Dwarf *dwarf, FILE *out, dwarf_die *die, char *prefix, 
+      uint8_t addr_size) {
    dwarf_die_att *att = die->att;
+   dwarf_expr *expr;
 
-   printf("%s%-30s\n", prefix, die->tag->name);
+   fprintf(out, "%s%-30s\n", prefix, 
+         die->tag ? die->tag->name : "DW_TAG_<unknown>");
 
    while (att) {
-      printf("%s%-30s: ", prefix, att->att_spec->att->name);
-      dwarf_value_dump(dwarf, att->att_spec->form, att->value);
-      printf(" (%s)\n", att->att_spec->form->name);
+      fprintf(out, "%s%-30s: ", prefix, dwarf_att_name(att->att_spec));
+
+      if (dwarf_att_is_expr(att) && (expr = dwarf_expr_new(
+                  &dwarf->elf->mem, att->value.b_val->buf, 
+                  att->value.b_val->len, addr_size))) {
+         dwarf_expr_dump(out, expr);
+         dwarf_mem_free(dwarf, expr);
+      } else {
+         dwarf_value_dump(dwarf, out, att->att_spec->form, att->value);
+      }
+
+      fprintf(out, " (%s)\n", att->att_spec->form->name);
       att = att->next_att;
    }
 
-   printf("\n");
+   fprintf(out, "\n");
 }
 
 static void
-dwarf_info_dump(Dwarf *dwarf) {
-   dwarf_cu *cu = dwarf->cu;
-   stack *path; 
+dwarf_cu_dump(Dwarf *dwarf, FILE *out, dwarf_cu *cu) {
    char *prefix = "                                                                                "; 
    size_t prefix_len = strlen(prefix);
+   uint32_t *ends = NULL;     /* end of each open subtree */
+   uint32_t ends_len = 0;
+   uint32_t level = 0;
+   uint32_t i;
    dwarf_die *die;
-   int level = 0;
 
-   printf("Section: .debug_info\n");
+   fprintf(out, "%-30s: 0x%08" PRIx64 "\n", "length", cu->hdr.length);
+   fprintf(out, "%-30s: 0x%04x\n", "version", cu->hdr.version);
+   fprintf(out, "%-30s: 0x%08" PRIx64 "\n", "abbrev_offset", 
+         cu->hdr.abbrev_off);
+   fprintf(out, "%-30s: 0x%02x\n", "addr_size", cu->hdr.addr_size);
+   fprintf(out, "\n");
 
-   while (cu) {
-      path = stack_create();
+   if (!cu->die) {
+      return;
+   }
 
-      printf("%-30s: 0x%08x\n", "length", cu->hdr.length);
-      printf("%-30s: 0x%04x\n", "version", cu->hdr.version);
-      printf("%-30s: 0x%08x\n", "abbrev_offset", cu->hdr.abbrev_off);
-      printf("%-30s: 0x%02x\n", "addr_size", cu->hdr.addr_size);
-      printf("\n");
+   /* the array is already in the order the DIEs are printed */
+   for (i = 0; i < cu->die_count; i++) {
+      die = &cu->dies[i];
+
+      while (level && i >= ends[level - 1]) {
+         level--;
+      }
 
-      die = cu->die;
+      dwarf_die_dump(dwarf, out, die, 
+            prefix + prefix_len - (level < prefix_len ? level : prefix_len), 
+            cu->hdr.addr_size);
 
-      while (die) {
-         dwarf_die_dump(dwarf, die, prefix+prefix_len-level);
-         if (die->child) {
-            stack_push(path, die);
-            level++;
-            die = die->child;
-         } else if (die->sibling) {
-            die = die->sibling;
-         } else if (!stack_is_empty(path)) {
-            die = stack_pop(path); 
-            level--;
-            die = die->sibling;
+      if (die->size > 1) {
+         if (level == ends_len) {
+            ends_len = ends_len ? ends_len << 1 : 16;
+            ends = dwarf_mem_realloc(dwarf, ends, ends_len * sizeof(uint32_t));
          }
+
+         ends[level++] = i + die->size;
       }
+   }
+
+   dwarf_mem_free(dwarf, ends);
+}
+
+static void
+dwarf_info_dump(Dwarf *dwarf, FILE *out, dwarf_cu *only) {
+   dwarf_cu *cu = only ? only : dwarf->cu;
+
+   fprintf(out, "Section: .debug_info\n");
 
-      stack_destroy(path);
-      cu = cu->next_cu; 
+   while (cu) {
+      dwarf_cu_get_die(dwarf, cu);
+      dwarf_cu_dump(dwarf, out, cu);
+      cu = only ? NULL : cu->next_cu; 
    }
 }
 
@@ -953,41 +2018,50 @@ dwarf_get_dir(dwarf_sprog_pro *prologue, uint32_t dir_idx) {
 }
 
 static void
-dwarf_sprog_pro_incl_dirs_dump(dwarf_sprog_dir *dir) {
+dwarf_sprog_pro_incl_dirs_dump(FILE *out, dwarf_sprog_dir *dir) {
    while(dir) {
-      printf("%-30s: %s\n", "include_directories", dir->name); 
+      fprintf(out, "%-30s: %s\n", "include_directories", dir->name); 
       dir = dir->next; 
    }
 }
 
 static void
-dwarf_sprog_pro_files_dump(dwarf_sprog_pro *prologue) {
+dwarf_sprog_pro_files_dump(FILE *out, dwarf_sprog_pro *prologue) {
    dwarf_sprog_file *file = prologue->files;
 
    while(file) {
       char *dir = dwarf_get_dir(prologue, file->dir_idx);
-      printf("%-30s: %s/%s (%d,%d,%d)\n", "file_names", dir, file->name, 
+      fprintf(out, "%-30s: %s/%s (%d,%d,%d)\n", "file_names", dir, file->name, 
             file->dir_idx, file->mtime, file->size); 
       file = file->next; 
    }
 }
 
 static void
-dwarf_sprog_pro_dump(dwarf_sprog_pro *prologue) {
-   printf("%-30s: 0x%08x\n", "total_length", prologue->total_len);
-   printf("%-30s: 0x%04x\n", "version", prologue->version);
-   printf("%-30s: 0x%08x\n", "prologue_length", prologue->prologue_len);
-   printf("%-30s: 0x%02x\n", "minimum_instruction_length", 
+dwarf_sprog_pro_dump(Dwarf *dwarf, FILE *out, dwarf_sprog_pro *prologue) {
+   fprintf(out, "%-30s: 0x%08" PRIx64 "\n", "total_length", 
+         prologue->total_len);
+   fprintf(out, "%-30s: 0x%04x\n", "version", prologue->version);
+   fprintf(out, "%-30s: 0x%08" PRIx64 "\n", "prologue_length", 
+         prologue->prologue_len);
+   fprintf(out, "%-30s: 0x%02x\n", "minimum_instruction_length", 
          prologue->min_inst_len);
-   printf("%-30s: 0x%02x\n", "default_is_stmt", prologue->dflt_is_stmt);
-   printf("%-30s: 0x%02x (%d)\n", "line_base", prologue->line_base, 
+
+   if (prologue->version >= 4) {
+      fprintf(out, "%-30s: 0x%02x\n", "maximum_operations_per_instruction", 
+            prologue->max_ops);
+   }
+
+   fprintf(out, "%-30s: 0x%02x\n", "default_is_stmt", prologue->dflt_is_stmt);
+   fprintf(out, "%-30s: 0x%02x (%d)\n", "line_base", prologue->line_base, 
          prologue->line_base);
-   printf("%-30s: 0x%02x\n", "line_range", prologue->line_range);
-   printf("%-30s: 0x%02x (%d)\n", "opcode_base", prologue->opcode_base, 
+   fprintf(out, "%-30s: 0x%02x\n", "line_range", prologue->line_range);
+   fprintf(out, "%-30s: 0x%02x (%d)\n", "opcode_base", prologue->opcode_base, 
          prologue->opcode_base);
 
    int i;
-   char *opcode_lengths = calloc(1, prologue->opcode_base * 3 - 1);
+   char *opcode_lengths = dwarf_mem_calloc(dwarf, 1, 
+         prologue->opcode_base * 3 - 1);
    char *opcode_lengths_pos = opcode_lengths;
 
    for (i = 1; i < prologue->opcode_base; i++) {
@@ -999,11 +2073,11 @@ dwarf_sprog_pro_dump(dwarf_sprog_pro *prologue) {
    } 
 
    opcode_lengths_pos = '\0';
-   printf("%-30s: %s\n", "standard_opcode_length", opcode_lengths);
-   free(opcode_lengths);
+   fprintf(out, "%-30s: %s\n", "standard_opcode_length", opcode_lengths);
+   dwarf_mem_free(dwarf, opcode_lengths);
 
-   dwarf_sprog_pro_incl_dirs_dump(prologue->incl_dirs);
-   dwarf_sprog_pro_files_dump(prologue);
+   dwarf_sprog_pro_incl_dirs_dump(out, prologue->incl_dirs);
+   dwarf_sprog_pro_files_dump(out, prologue);
 }
 
 static char *ext_opcode_names[] = {
@@ -1032,9 +2106,10 @@ static char *opcode_names[] = {
 };
 
 static void
-dwarf_sprog_sm_regs_dump(dwarf_sprog_pro *prologue, dwarf_sm_regs *reg) {
+dwarf_sprog_sm_regs_dump(FILE *out, dwarf_sprog_pro *prologue, 
+      dwarf_sm_regs *reg) {
    char *op = NULL;
-   char *sop = NULL;
+   char sop[32];
 
    if (reg->opcode == 0) {
       // extended opcode
@@ -1042,47 +2117,45 @@ dwarf_sprog_sm_regs_dump(dwarf_sprog_pro *prologue, dwarf_sm_regs *reg) {
    } else if (reg->opcode <= DW_LNS_set_isa) {
       op = opcode_names[reg->opcode];
    } else if (reg->opcode >= prologue->opcode_base) {
-      sop = malloc(20);
-      sprintf(sop, "special op %d", reg->opcode - prologue->opcode_base); 
-   } else {
-      op = "unknown"; 
+      snprintf(sop, sizeof(sop), "special op %d", 
+            reg->opcode - prologue->opcode_base); 
+      op = sop;
    }
 
-   if (op) {
-      printf("%-25s 0x%08lx %6d %5d %4d\n", op, reg->address, reg->line, 
-            reg->column, reg->file);
-   } else {
-      printf("%-25s 0x%08lx %6d %5d %4d\n", sop, reg->address, reg->line, 
-            reg->column, reg->file);
-      free(sop);
-   }
+   fprintf(out, "%-25s 0x%08lx %6d %5d %4d\n", op ? op : "unknown", 
+         reg->address, reg->line, reg->column, reg->file);
 }
 
 static void
-dwarf_sprog_sm_dump(dwarf_sprog_pro *prologue, dwarf_sm_regs *regs) {
-   printf("%-30s:\n", "state_machine:");
+dwarf_sprog_sm_dump(FILE *out, dwarf_sprog_pro *prologue, 
+      dwarf_sm_regs *regs) {
+   fprintf(out, "%-30s:\n", "state_machine:");
 
-   printf("%-25s %10s %6s %5s %4s\n", "operation", "address", "line", "col", 
-         "file");
+   fprintf(out, "%-25s %10s %6s %5s %4s\n", "operation", "address", "line", 
+         "col", "file");
 
    while (regs) {
-      dwarf_sprog_sm_regs_dump(prologue, regs);
+      dwarf_sprog_sm_regs_dump(out, prologue, regs);
       regs = regs->next;  
    }
    
-   printf("\n");
+   fprintf(out, "\n");
 }
 
 static void 
-dwarf_line_dump(Dwarf *dwarf) {
-   dwarf_sprog *sprog = dwarf->sprog;
+dwarf_line_dump(Dwarf *dwarf, FILE *out, dwarf_cu *cu) {
+   dwarf_sprog *sprog = cu ? dwarf_cu_get_sprog(dwarf, cu) : dwarf->sprog;
+   dwarf_sprog_pro *prologue;
 
-   printf("Section: .debug_line\n");
+   fprintf(out, "Section: .debug_line\n");
 
    while (sprog) {
-      dwarf_sprog_pro_dump(sprog->prologue); 
-      dwarf_sprog_sm_dump(sprog->prologue, sprog->sm_regs);
-      sprog = sprog->next;
+      if ((prologue = dwarf_sprog_get_pro(dwarf, sprog))) {
+         dwarf_sprog_pro_dump(dwarf, out, prologue); 
+         dwarf_sprog_sm_dump(out, prologue, dwarf_sprog_get_regs(dwarf, 
+               sprog));
+      }
+      sprog = cu ? NULL : sprog->next;
    }
 }
 
@@ -1121,249 +2194,7864 @@ dwarf_arange_dump(dwarf_aranges *aranges) {
 
 static void
 dwarf_ar_header_dump(dwarf_ar_header *hdr) {
-   printf("Length:                  %d\n", hdr->length);
+   printf("Length:                  %" PRIu64 "\n", hdr->length);
    printf("Version:                 %d\n", hdr->version);
-   printf("Offset into .debug_info: %d\n", hdr->info_off);
+   printf("Offset into .debug_info: %" PRIu64 "\n", hdr->info_off);
    printf("Address size:            %d\n", hdr->addr_size);
    printf("Segment size:            %d\n", hdr->seg_size);
 }
 
 static void 
-dwarf_aranges_dump(Dwarf *dwarf) {
-   dwarf_aranges *aranges = dwarf->aranges;
+dwarf_aranges_dump(Dwarf *dwarf, dwarf_cu *cu) {
+   dwarf_aranges *aranges = dwarf_get_aranges(dwarf);
 
    printf("Section: .debug_aranges\n");
 
    while (aranges) {
-      dwarf_ar_header_dump(&aranges->hdr);
-      dwarf_arange_dump(aranges);
+      if (!cu || aranges->hdr.info_off == cu->offset) {
+         dwarf_ar_header_dump(&aranges->hdr);
+         dwarf_arange_dump(aranges);
+      }
       aranges = aranges->next_ars;   
    }
 }
 
-void
-dwarf_dump(Dwarf *dwarf) {
-   dwarf_aranges_dump(dwarf);
-   printf("\n");
-   dwarf_abbrev_dump(dwarf);
-   printf("\n");
-   dwarf_info_dump(dwarf);
-   printf("\n");
-   dwarf_line_dump(dwarf);
-   printf("\n");
-   dwarf_str_dump(dwarf);
-   printf("\n");
+/*
+ * Passes over all CUs read .debug_info and .debug_line front to back, 
+ * while lookups touch a few pages at a time.
+ */
+static void
+dwarf_advise(Dwarf *dwarf, elf_advice advice) {
+   elf_scn_advise(dwarf->elf, &dwarf->info, advice);
+   elf_scn_advise(dwarf->elf, &dwarf->line, advice);
 }
 
-int
-dwarf_open(Dwarf *dwarf, char *file) {
-   Elf *elf = calloc(1, sizeof(Elf));
-   Elf_Scn dbg_info_data;
-   Elf_Scn dbg_abbrev_data;
-   Elf_Scn dbg_line_data;
-   Elf_Scn dbg_str_data;
-   Elf_Scn dbg_aranges_data;
-   volatile int rc = 0;
+/*
+ * Clears dwarf for a file read with alloc and returns a new Elf whose 
+ * memory comes from dwarf too.
+ */
+static Elf *
+dwarf_elf_new(Dwarf *dwarf, const dwarf_allocator *alloc) {
+   Elf *elf;
 
-   if ((rc = elf_open(elf, file))) {
-      return rc;
-   }
+   memset(dwarf, 0, sizeof(*dwarf));
+   dwarf->alloc = alloc ? *alloc : dwarf_libc_allocator;
+   elf = dwarf_mem_calloc(dwarf, 1, sizeof(Elf));
+   elf->mem.fn = dwarf_mem_elf_fn;
+   elf->mem.ctx = dwarf;
 
-   memset(dwarf, 0, sizeof(dwarf));
+   return elf;
+}
 
-   if (elf_get_scn(elf, &dbg_info_data, ".debug_info") ||
-         elf_get_scn(elf, &dbg_abbrev_data, ".debug_abbrev") ||
-         elf_get_scn(elf, &dbg_line_data, ".debug_line") ||
-         elf_get_scn(elf, &dbg_aranges_data, ".debug_aranges")) {
-      asprintf(&dwarf->error, "File contains no debug data\n"); 
+static int
+dwarf_load(Dwarf *dwarf, Elf *elf) {
+   Elf_Scn dbg_str_data;
+   dwarf_allocator alloc;
+   dwarf_mem_stats stats;
+   char *error;
+
+   if (elf_get_scn(elf, &dwarf->info, ".debug_info") ||
+         elf_get_scn(elf, &dwarf->abbrev, ".debug_abbrev") ||
+         elf_get_scn(elf, &dwarf->line, ".debug_line")) {
+      dwarf->error = dwarf_mem_strdup(dwarf, "File contains no debug data\n"); 
+      elf_close(elf);
+      dwarf_mem_free(dwarf, elf);
       return -2;
    }
 
+   dwarf->elf = elf;
+
+   if (setjmp(dwarf->env)) {
+      /* the units read so far are dropped with the rest, but not the error */
+      error = dwarf->error;
+      dwarf->error = NULL;
+      dwarf_free(dwarf);
+      alloc = dwarf->alloc;
+      stats = dwarf->mem_stats;
+      memset(dwarf, 0, sizeof(*dwarf));
+      dwarf->alloc = alloc;
+      dwarf->mem_stats = stats;
+      dwarf->error = error;
+      return -3;
+   }
 
-   if (!setjmp(dwarf->env)) {
-      dwarf->abbrevs = dwarf_read_abbrev(dbg_abbrev_data.buf, 
-            dbg_abbrev_data.size);
-      dwarf->cu = dwarf_read_cu(dwarf, dbg_info_data.buf, dbg_info_data.size);
-      dwarf->sprog = dwarf_read_sprog(dwarf, dbg_line_data.buf, 
-            dbg_line_data.size);
-
-      if (!elf_get_scn(elf, &dbg_str_data, ".debug_str")) {
-         dwarf->str = dwarf_read_str(dbg_str_data.buf, dbg_str_data.size);
-      } else {
-         dwarf->str = NULL; 
-      }
+   /* 
+    * Only unit headers are read here. Abbreviation tables, line program 
+    * prologues and address ranges are read when first needed.
+    */
+   elf_scn_advise(elf, &dwarf->abbrev, ELF_ADV_RANDOM);
+   dwarf->cu = dwarf_read_cu(dwarf, dwarf->info.buf, dwarf->info.size);
+   dwarf->sprog = dwarf_read_sprog(dwarf, dwarf->line.buf, dwarf->line.size);
 
-      dwarf->aranges = dwarf_read_aranges(dwarf, dbg_aranges_data.buf, 
-            dbg_aranges_data.size);
-      dwarf->elf = elf;
+   if (!elf_get_scn(elf, &dbg_str_data, ".debug_str")) {
+      dwarf->str = dwarf_read_str(dwarf, dbg_str_data.buf, dbg_str_data.size);
+   } else {
+      dwarf->str = NULL; 
    }
 
+   /* location and range lists are only read when queried */
+   elf_get_scn(elf, &dwarf->loc, ".debug_loc");
+   elf_get_scn(elf, &dwarf->ranges, ".debug_ranges");
+
    return 0;
 }
 
-static void
-dwarf_free_aranges(dwarf_aranges *aranges) {
-   dwarf_aranges *tmp_aranges;
-   dwarf_arange *tmp_arange, *arange;
+int
+dwarf_open_ex(Dwarf *dwarf, char *file, const dwarf_allocator *alloc) {
+   Elf *elf = dwarf_elf_new(dwarf, alloc);
+   int rc;
 
-   while (aranges) {
-      tmp_aranges = aranges->next_ars;
-      arange = aranges->arange;
-      while (arange) {
-         tmp_arange = arange->next_ar; 
-         free(arange); 
-         arange = tmp_arange;
-      }
-      free(aranges);
-      aranges = tmp_aranges;
+   if ((rc = elf_open(elf, file))) {
+      elf_close(elf);
+      dwarf_mem_free(dwarf, elf);
+      return rc;
    }
-}
 
-static void
-dwarf_free_pro_incl_dirs(dwarf_sprog_dir *dir) {
-   dwarf_sprog_dir *tmp;
+   return dwarf_load(dwarf, elf);
+}
+
+int
+dwarf_open(Dwarf *dwarf, char *file) {
+   return dwarf_open_ex(dwarf, file, NULL);
+}
+
+int
+dwarf_open_pread(Dwarf *dwarf, char *file) {
+   Elf *elf = dwarf_elf_new(dwarf, NULL);
+   int rc;
+
+   if ((rc = elf_open_pread(elf, file))) {
+      elf_close(elf);
+      dwarf_mem_free(dwarf, elf);
+      return rc;
+   }
+
+   return dwarf_load(dwarf, elf);
+}
+
+int
+dwarf_open_fd(Dwarf *dwarf, int fd) {
+   Elf *elf = dwarf_elf_new(dwarf, NULL);
+   int rc;
+
+   if ((rc = elf_open_fd(elf, fd))) {
+      elf_close(elf);
+      dwarf_mem_free(dwarf, elf);
+      return rc;
+   }
+
+   return dwarf_load(dwarf, elf);
+}
+
+int
+dwarf_open_mem(Dwarf *dwarf, char *buf, size_t size) {
+   Elf *elf = dwarf_elf_new(dwarf, NULL);
+   int rc;
+
+   if ((rc = elf_open_mem(elf, buf, size))) {
+      dwarf_mem_free(dwarf, elf);
+      return rc;
+   }
+
+   return dwarf_load(dwarf, elf);
+}
+
+static void
+dwarf_free_aranges(Dwarf *dwarf, dwarf_aranges *aranges) {
+   dwarf_aranges *tmp_aranges;
+   dwarf_arange *tmp_arange, *arange;
+
+   while (aranges) {
+      tmp_aranges = aranges->next_ars;
+      arange = aranges->arange;
+      while (arange) {
+         tmp_arange = arange->next_ar; 
+         dwarf_mem_free(dwarf, arange); 
+         arange = tmp_arange;
+      }
+      dwarf_mem_free(dwarf, aranges);
+      aranges = tmp_aranges;
+   }
+}
+
+static void
+dwarf_free_pro_incl_dirs(Dwarf *dwarf, dwarf_sprog_dir *dir) {
+   dwarf_sprog_dir *tmp;
 
    while (dir) {
       tmp = dir->next;
-      free(dir);
+      dwarf_mem_free(dwarf, dir);
       dir = tmp;
    }
 }
 
 static void
-dwarf_free_pro_files(dwarf_sprog_file *file) {
+dwarf_free_pro_files(Dwarf *dwarf, dwarf_sprog_file *file) {
    dwarf_sprog_file *tmp;
 
    while (file) {
       tmp = file->next;
-      free(file);
+      dwarf_mem_free(dwarf, file);
       file = tmp;
    }
 }
 
 static void
-dwarf_free_sprog_pro(dwarf_sprog_pro *prologue) {
-   free(prologue->std_opcode_len);
-   dwarf_free_pro_incl_dirs(prologue->incl_dirs);
-   dwarf_free_pro_files(prologue->files);
-   free(prologue);
+dwarf_free_sprog_pro(Dwarf *dwarf, dwarf_sprog_pro *prologue) {
+   dwarf_mem_free(dwarf, prologue->std_opcode_len);
+   dwarf_free_pro_incl_dirs(dwarf, prologue->incl_dirs);
+   dwarf_free_pro_files(dwarf, prologue->files);
+   dwarf_mem_free(dwarf, prologue);
 }
 
 static void
-dwarf_free_sprog_sm_regs(dwarf_sm_regs *sm_regs) {
+dwarf_free_sprog_sm_regs(Dwarf *dwarf, dwarf_sm_regs *sm_regs) {
    dwarf_sm_regs *tmp;
 
    while (sm_regs) {
       tmp = sm_regs->next;
-      free(sm_regs);
+      dwarf_mem_free(dwarf, sm_regs);
       sm_regs = tmp;
    }
 }
 
 static void
-dwarf_free_sprog(dwarf_sprog *sprog) {
+dwarf_free_sprog(Dwarf *dwarf, dwarf_sprog *sprog) {
    dwarf_sprog *tmp_sprog;
 
    while (sprog) {
       tmp_sprog = sprog->next;
-      dwarf_free_sprog_pro(sprog->prologue);
-      dwarf_free_sprog_sm_regs(sprog->sm_regs);
-      free(sprog);
+
+      if (sprog->prologue) {
+         dwarf_free_sprog_pro(dwarf, sprog->prologue);
+      }
+
+      dwarf_free_sprog_sm_regs(dwarf, sprog->sm_regs);
+      dwarf_mem_free(dwarf, sprog->file_ids);
+      dwarf_mem_free(dwarf, sprog);
       sprog = tmp_sprog;
    }
 }
 
 static void
-dwarf_free_die_att(dwarf_die_att *att) {
-   dwarf_die_att *tmp_att;
-
-   while (att) {
-      tmp_att = att->next_att;
+dwarf_free_die_atts(Dwarf *dwarf, dwarf_die_att *atts, uint32_t count) {
+   uint32_t i;
 
-      switch (att->att_spec->form->id) {
+   for (i = 0; i < count; i++) {
+      switch (atts[i].att_spec->form->id) {
          case DW_FORM_block: 
          case DW_FORM_block1: 
          case DW_FORM_block2: 
          case DW_FORM_block4: 
-            free(att->value.b_val);
+            dwarf_mem_free(dwarf, atts[i].value.b_val);
             break;
          default:
             break;
       }
-
-      free(att);
-      att = tmp_att;
    }
 
+   dwarf_mem_free(dwarf, atts);
 }
 
+/* Frees a DIE returned by dwarf_read_die(). */
 static void
-dwarf_free_die(dwarf_die *die) {
-   dwarf_die *tmp_die;
-
-   while (die) {
-      tmp_die = die->sibling;
-      dwarf_free_die_att(die->att);
-      dwarf_free_die(die->child); 
-      free(die);
-      die = tmp_die;
+dwarf_free_die(Dwarf *dwarf, dwarf_die *die) {
+   if (die) {
+      dwarf_free_die_atts(dwarf, die->att, die->att_count);
+      dwarf_mem_free(dwarf, die);
    }
+}
 
+static void
+dwarf_free_cu_dies(Dwarf *dwarf, dwarf_cu *cu) {
+   dwarf_free_die_atts(dwarf, cu->atts, cu->att_count);
+   dwarf_mem_free(dwarf, cu->dies);
+   cu->die = NULL;
+   cu->dies = NULL;
+   cu->die_count = 0;
+   cu->atts = NULL;
+   cu->att_count = 0;
 }
 
 static void
-dwarf_free_cu(dwarf_cu *cu) {
+dwarf_free_cu(Dwarf *dwarf, dwarf_cu *cu) {
    dwarf_cu *tmp_cu;
 
    while (cu) {
       tmp_cu = cu->next_cu;
-      dwarf_free_die(cu->die);
-      free(cu);
+      dwarf_free_cu_dies(dwarf, cu);
+      dwarf_mem_free(dwarf, cu);
       cu = tmp_cu;
    }
 }
 
 static void
-dwarf_free_att_spec(dwarf_att_spec *atts) {
+dwarf_free_att_spec(Dwarf *dwarf, dwarf_att_spec *atts) {
    dwarf_att_spec *tmp_atts;
 
    while (atts) {
       tmp_atts = atts->next;
-      free(atts);
+      dwarf_mem_free(dwarf, atts);
       atts = tmp_atts;
    }
 }
 
 static void
-dwarf_free_abbrev_tab(dwarf_abbrev_tab *tab) {
+dwarf_free_abbrev_tab(Dwarf *dwarf, dwarf_abbrev_tab *tab) {
    dwarf_abbrev_tab *tmp_tab;
 
    while (tab) {
       tmp_tab = tab->next;
-      dwarf_free_att_spec(tab->atts);
-      free(tab);
+      dwarf_free_att_spec(dwarf, tab->atts);
+      dwarf_mem_free(dwarf, tab);
       tab = tmp_tab;
    }
 }
 
 static void
-dwarf_free_abbrevs(dwarf_abbrevs *abbrevs) {
+dwarf_free_abbrevs(Dwarf *dwarf, dwarf_abbrevs *abbrevs) {
    dwarf_abbrevs *tmp_abbrevs;
 
    while (abbrevs) {
       tmp_abbrevs = abbrevs->next;
-      dwarf_free_abbrev_tab(abbrevs->tab);
-      free(abbrevs);
+      dwarf_free_abbrev_tab(dwarf, abbrevs->tab);
+      dwarf_mem_free(dwarf, abbrevs);
       abbrevs = tmp_abbrevs;
    }
 }
 
+#define dwarf_cache_owner(ent, type) \
+   ((type *)((char *)(ent) - offsetof(type, cache)))
+
+static size_t
+dwarf_cu_mem_size(dwarf_cu *cu) {
+   size_t size = cu->die_count * sizeof(dwarf_die) + 
+      cu->att_count * sizeof(dwarf_die_att);
+   uint32_t i;
+
+   for (i = 0; i < cu->att_count; i++) {
+      switch (cu->atts[i].att_spec->form->id) {
+         case DW_FORM_block: 
+         case DW_FORM_block1: 
+         case DW_FORM_block2: 
+         case DW_FORM_block4: 
+            size += sizeof(dwarf_block);
+            break;
+         default:
+            break;
+      }
+   }
+
+   return size;
+}
+
+static size_t
+dwarf_sm_regs_mem_size(dwarf_sm_regs *regs) {
+   size_t size = 0;
+
+   for (; regs != NULL; regs = regs->next) {
+      size += sizeof(dwarf_sm_regs);
+   }
+
+   return size;
+}
+
+static void
+dwarf_cache_unlink(dwarf_cache *cache, dwarf_cache_ent *ent) {
+   if (ent->prev) {
+      ent->prev->next = ent->next;
+   } else {
+      cache->head = ent->next;
+   }
+
+   if (ent->next) {
+      ent->next->prev = ent->prev;
+   } else {
+      cache->tail = ent->prev;
+   }
+
+   ent->prev = ent->next = NULL;
+}
+
+static void
+dwarf_cache_link(dwarf_cache *cache, dwarf_cache_ent *ent) {
+   ent->prev = NULL;
+   ent->next = cache->head;
+
+   if (cache->head) {
+      cache->head->prev = ent;
+   } else {
+      cache->tail = ent;
+   }
+
+   cache->head = ent;
+}
+
+static void
+dwarf_cache_release(Dwarf *dwarf, dwarf_cache_ent *ent) {
+   dwarf_cache *cache = &dwarf->cache;
+   dwarf_cu *cu;
+   dwarf_sprog *sprog;
+
+   dwarf_cache_unlink(cache, ent);
+   cache->used -= ent->size;
+   ent->size = 0;
+
+   if (ent->kind == DWARF_CACHE_CU) {
+      cu = dwarf_cache_owner(ent, dwarf_cu);
+      dwarf_free_cu_dies(dwarf, cu);
+   } else {
+      sprog = dwarf_cache_owner(ent, dwarf_sprog);
+      dwarf_free_sprog_sm_regs(dwarf, sprog->sm_regs);
+      sprog->sm_regs = NULL;
+   }
+}
+
+/*
+ * Evicts least recently used entries until the budget is met. The most 
+ * recently used entry is never evicted, so the caller's result stays valid.
+ */
+static void
+dwarf_cache_trim(Dwarf *dwarf) {
+   dwarf_cache *cache = &dwarf->cache;
+
+   while (cache->budget && cache->used > cache->budget && 
+         cache->tail != cache->head) {
+      dwarf_cache_release(dwarf, cache->tail);
+      cache->evictions++;
+   }
+}
+
+static void
+dwarf_cache_touch(dwarf_cache *cache, dwarf_cache_ent *ent) {
+   dwarf_cache_unlink(cache, ent);
+   dwarf_cache_link(cache, ent);
+   cache->hits++;
+}
+
+static void
+dwarf_cache_insert(Dwarf *dwarf, dwarf_cache_ent *ent, size_t size) {
+   dwarf_cache *cache = &dwarf->cache;
+
+   ent->size = size;
+   cache->used += size;
+   dwarf_cache_link(cache, ent);
+   cache->misses++;
+   dwarf_cache_trim(dwarf);
+}
+
+/*
+ * The getters below are also called with the handler of another public 
+ * function armed. They keep that handler aside while they read and put 
+ * it back before returning, so a later error still unwinds to it.
+ */
+static void
+dwarf_env_save(Dwarf *dwarf, jmp_buf saved) {
+   memcpy(saved, dwarf->env, sizeof(jmp_buf));
+}
+
+static void
+dwarf_env_restore(Dwarf *dwarf, jmp_buf saved) {
+   memcpy(dwarf->env, saved, sizeof(jmp_buf));
+}
+
+dwarf_die *
+dwarf_cu_get_die(Dwarf *dwarf, dwarf_cu *cu) {
+   jmp_buf saved;
+
+   if (cu->die) {
+      dwarf_cache_touch(&dwarf->cache, &cu->cache);
+      return cu->die;
+   }
+
+   dwarf_env_save(dwarf, saved);
+
+   if (setjmp(dwarf->env)) {
+      dwarf_env_restore(dwarf, saved);
+      dwarf_free_cu_dies(dwarf, cu);
+      return NULL;
+   }
+
+   dwarf_read_cu_body(dwarf, cu);
+   dwarf_cache_insert(dwarf, &cu->cache, dwarf_cu_mem_size(cu));
+   dwarf_env_restore(dwarf, saved);
+
+   return cu->die;
+}
+
+dwarf_sm_regs *
+dwarf_sprog_get_regs(Dwarf *dwarf, dwarf_sprog *sprog) {
+   jmp_buf saved;
+
+   if (sprog->sm_regs) {
+      dwarf_cache_touch(&dwarf->cache, &sprog->cache);
+      return sprog->sm_regs;
+   }
+
+   dwarf_env_save(dwarf, saved);
+
+   if (setjmp(dwarf->env)) {
+      dwarf_env_restore(dwarf, saved);
+      return NULL;
+   }
+
+   dwarf_load_sprog_pro(dwarf, sprog);
+   sprog->sm_regs = dwarf_read_sprog_sm(dwarf, sprog->sm, sprog->sm_len, 
+         sprog->prologue);
+   dwarf_cache_insert(dwarf, &sprog->cache, 
+         dwarf_sm_regs_mem_size(sprog->sm_regs));
+   dwarf_env_restore(dwarf, saved);
+
+   return sprog->sm_regs;
+}
+
+dwarf_sprog_pro *
+dwarf_sprog_get_pro(Dwarf *dwarf, dwarf_sprog *sprog) {
+   jmp_buf saved;
+
+   if (sprog->prologue) {
+      return sprog->prologue;
+   }
+
+   dwarf_env_save(dwarf, saved);
+
+   if (setjmp(dwarf->env)) {
+      dwarf_env_restore(dwarf, saved);
+      return NULL;
+   }
+
+   dwarf_load_sprog_pro(dwarf, sprog);
+   dwarf_env_restore(dwarf, saved);
+
+   return sprog->prologue;
+}
+
 void
-dwarf_free(Dwarf *dwarf) {
-   dwarf_free_aranges(dwarf->aranges);
-   free(dwarf->str);
-   dwarf_free_sprog(dwarf->sprog);
-   dwarf_free_cu(dwarf->cu);
-   dwarf_free_abbrevs(dwarf->abbrevs);
-   free(dwarf->elf);
+dwarf_set_cache_budget(Dwarf *dwarf, size_t budget) {
+   dwarf->cache.budget = budget;
+   dwarf_cache_trim(dwarf);
+}
+
+typedef struct {
+   void *unit;                /* dwarf_cu or dwarf_sprog */
+   void *data;                /* its DIE tree or line rows */
+   char *buf;
+   size_t len;
+   bool resident;             /* was cached before the dump */
+   bool done;
+} dwarf_dump_unit;
+
+typedef struct {
+   Dwarf *dwarf;
+   bool info;                 /* CUs, otherwise line programs */
+   dwarf_dump_unit *units;    /* ring of window entries */
+   uint32_t window;
+   uint32_t count;
+   uint32_t parsed;           /* units handed out by the main thread */
+   uint32_t next;             /* next unit to format */
+   pthread_mutex_t lock;
+   pthread_cond_t cond;
+} dwarf_dump_job;
+
+static void
+dwarf_dump_format(dwarf_dump_job *job, dwarf_dump_unit *unit) {
+   dwarf_sprog *sprog = unit->unit;
+   FILE *out = open_memstream(&unit->buf, &unit->len);
+
+   if (!out) {
+      return;
+   }
+
+   if (job->info) {
+      dwarf_cu_dump(job->dwarf, out, unit->unit);
+   } else if (sprog->prologue) {
+      dwarf_sprog_pro_dump(job->dwarf, out, sprog->prologue); 
+      dwarf_sprog_sm_dump(out, sprog->prologue, unit->data);
+   }
+
+   fclose(out);
+}
+
+/*
+ * Workers only read the DIE trees and line rows the main thread parsed for 
+ * them, as parsing goes through the cache and dwarf->env.
+ */
+static void *
+dwarf_dump_worker(void *arg) {
+   dwarf_dump_job *job = arg;
+   dwarf_dump_unit *unit;
+
+   pthread_mutex_lock(&job->lock);
+
+   while (true) {
+      while (job->next == job->parsed && job->next < job->count) {
+         pthread_cond_wait(&job->cond, &job->lock);
+      }
+
+      if (job->next == job->count) {
+         break;
+      }
+
+      unit = &job->units[job->next++ % job->window];
+      pthread_mutex_unlock(&job->lock);
+
+      dwarf_dump_format(job, unit);
+
+      pthread_mutex_lock(&job->lock);
+      unit->done = true;
+      pthread_cond_broadcast(&job->cond);
+   }
+
+   pthread_mutex_unlock(&job->lock);
+
+   return NULL;
+}
+
+static void
+dwarf_dump_parse(dwarf_dump_job *job, dwarf_dump_unit *unit, uint32_t idx) {
+   Dwarf *dwarf = job->dwarf;
+   dwarf_sprog *sprog;
+   dwarf_cu *cu;
+
+   memset(unit, 0, sizeof(dwarf_dump_unit));
+
+   if (job->info) {
+      cu = dwarf->cus[idx];
+      unit->unit = cu;
+      unit->resident = cu->die != NULL;
+      unit->data = dwarf_cu_get_die(dwarf, cu);
+   } else {
+      sprog = dwarf->sprogs[idx];
+      unit->unit = sprog;
+      unit->resident = sprog->sm_regs != NULL;
+
+      if (dwarf_sprog_get_pro(dwarf, sprog)) {
+         unit->data = dwarf_sprog_get_regs(dwarf, sprog);
+      }
+   }
+}
+
+static void
+dwarf_dump_release(Dwarf *dwarf, bool info, dwarf_dump_unit *unit) {
+   dwarf_sprog *sprog = unit->unit;
+   dwarf_cu *cu = unit->unit;
+
+   if (unit->resident) {
+      return;
+   }
+
+   if (info && cu->die) {
+      dwarf_cache_release(dwarf, &cu->cache);
+   } else if (!info && sprog->sm_regs) {
+      dwarf_cache_release(dwarf, &sprog->cache);
+   }
+}
+
+/*
+ * Formats CUs or line programs on nthreads workers and writes them to 
+ * stdout in section order. At most two units per worker are parsed or 
+ * buffered at a time. Returns false if no worker could be started.
+ */
+static bool
+dwarf_dump_parallel(Dwarf *dwarf, bool info, int nthreads) {
+   size_t budget = dwarf->cache.budget;
+   dwarf_dump_job job;
+   dwarf_dump_unit *unit;
+   pthread_t *threads;
+   uint32_t written = 0;
+   int started;
+
+   memset(&job, 0, sizeof(job));
+   job.dwarf = dwarf;
+   job.info = info;
+   job.count = info ? dwarf->cu_count : dwarf->sprog_count;
+   job.window = 2 * nthreads;
+   job.units = dwarf_mem_calloc(dwarf, job.window, sizeof(dwarf_dump_unit));
+   pthread_mutex_init(&job.lock, NULL);
+   pthread_cond_init(&job.cond, NULL);
+
+   threads = dwarf_mem_calloc(dwarf, nthreads, sizeof(pthread_t));
+
+   for (started = 0; started < nthreads; started++) {
+      if (pthread_create(&threads[started], NULL, dwarf_dump_worker, &job)) {
+         break;
+      }
+   }
+
+   if (!started) {
+      dwarf_mem_free(dwarf, threads);
+      dwarf_mem_free(dwarf, job.units);
+      pthread_mutex_destroy(&job.lock);
+      pthread_cond_destroy(&job.cond);
+      return false;
+   }
+
+   /* units in flight are released explicitly once written */
+   dwarf->cache.budget = 0;
+
+   if (info) {
+      printf("Section: .debug_info\n");
+   } else {
+      printf("Section: .debug_line\n");
+   }
+
+   while (written < job.count) {
+      if (job.parsed < job.count && job.parsed - written < job.window) {
+         dwarf_dump_parse(&job, &job.units[job.parsed % job.window], 
+               job.parsed);
+
+         pthread_mutex_lock(&job.lock);
+         job.parsed++;
+         pthread_cond_broadcast(&job.cond);
+         pthread_mutex_unlock(&job.lock);
+         continue;
+      }
+
+      unit = &job.units[written % job.window];
+
+      pthread_mutex_lock(&job.lock);
+      while (!unit->done) {
+         pthread_cond_wait(&job.cond, &job.lock);
+      }
+      pthread_mutex_unlock(&job.lock);
+
+      fwrite(unit->buf, 1, unit->len, stdout);
+      /* open_memstream() buffers come from the C library */
+      free(unit->buf);
+      dwarf_dump_release(dwarf, info, unit);
+      written++;
+   }
+
+   while (started--) {
+      pthread_join(threads[started], NULL);
+   }
+
+   dwarf_mem_free(dwarf, threads);
+   dwarf_mem_free(dwarf, job.units);
+   pthread_mutex_destroy(&job.lock);
+   pthread_cond_destroy(&job.cond);
+   dwarf_set_cache_budget(dwarf, budget);
+
+   return true;
+}
+
+void
+dwarf_dump_sects(Dwarf *dwarf, uint32_t sects, dwarf_cu *cu, int nthreads) {
+   /* a single CU is a few random reads, not a pass */
+   if (!cu) {
+      dwarf_advise(dwarf, ELF_ADV_SEQUENTIAL);
+   }
+
+   if (sects & DWARF_DUMP_ARANGES) {
+      dwarf_aranges_dump(dwarf, cu);
+      printf("\n");
+   }
+   if (sects & DWARF_DUMP_ABBREV) {
+      dwarf_abbrev_dump(dwarf, cu);
+      printf("\n");
+   }
+   if (sects & DWARF_DUMP_INFO) {
+      if (cu || nthreads <= 1 || !dwarf_dump_parallel(dwarf, true, nthreads)) {
+         dwarf_info_dump(dwarf, stdout, cu);
+      }
+      printf("\n");
+   }
+   if (sects & DWARF_DUMP_LINE) {
+      if (cu || nthreads <= 1 || !dwarf_dump_parallel(dwarf, false, nthreads)) {
+         dwarf_line_dump(dwarf, stdout, cu);
+      }
+      printf("\n");
+   }
+   if (sects & DWARF_DUMP_STR) {
+      dwarf_str_dump(dwarf);
+      printf("\n");
+   }
+
+   if (!cu) {
+      dwarf_advise(dwarf, ELF_ADV_RANDOM);
+   }
+}
+
+void
+dwarf_dump(Dwarf *dwarf) {
+   dwarf_dump_sects(dwarf, DWARF_DUMP_ALL, NULL, 1);
+}
+
+/* Returns the index of the CU containing offset, or cu_count. */
+static uint32_t
+dwarf_cu_index(Dwarf *dwarf, uint64_t offset) {
+   uint32_t lo = 0;
+   uint32_t hi = dwarf->cu_count;
+   uint32_t mid;
+   dwarf_cu *cu;
+
+   while (lo < hi) {
+      mid = lo + ((hi - lo) >> 1);
+      cu = dwarf->cus[mid];
+
+      if (offset < cu->offset) {
+         hi = mid;
+      } else if (offset >= cu->offset + cu->hdr.size + cu->body_len) {
+         lo = mid + 1;
+      } else {
+         return mid;
+      }
+   }
+
+   return dwarf->cu_count;
+}
+
+dwarf_cu *
+dwarf_get_cu(Dwarf *dwarf, uint64_t offset) {
+   uint32_t i = dwarf_cu_index(dwarf, offset);
+
+   return i < dwarf->cu_count ? dwarf->cus[i] : NULL;
+}
+
+static dwarf_sprog *
+dwarf_sprog_at(Dwarf *dwarf, uint64_t offset) {
+   uint32_t lo = 0;
+   uint32_t hi = dwarf->sprog_count;
+   uint32_t mid;
+
+   while (lo < hi) {
+      mid = lo + ((hi - lo) >> 1);
+
+      if (dwarf->sprogs[mid]->offset < offset) {
+         lo = mid + 1;
+      } else if (dwarf->sprogs[mid]->offset > offset) {
+         hi = mid;
+      } else {
+         return dwarf->sprogs[mid];
+      }
+   }
+
+   return NULL;
+}
+
+static dwarf_sprog *
+dwarf_cu_get_sprog_root(Dwarf *dwarf, dwarf_die *root) {
+   dwarf_die_att *att;
+
+   if (!(att = dwarf_die_get_att(root, DW_AT_stmt_list))) {
+      return NULL;
+   }
+
+   return dwarf_sprog_at(dwarf, att->value.ul_val);
+}
+
+dwarf_sprog *
+dwarf_cu_get_sprog(Dwarf *dwarf, dwarf_cu *cu) {
+   dwarf_sprog *sprog;
+   dwarf_die *root;
+   jmp_buf saved;
+
+   if (cu->die) {
+      return dwarf_cu_get_sprog_root(dwarf, cu->die);
+   }
+
+   dwarf_env_save(dwarf, saved);
+
+   if (setjmp(dwarf->env) || !(root = dwarf_read_cu_root(dwarf, cu))) {
+      dwarf_env_restore(dwarf, saved);
+      return NULL;
+   }
+
+   sprog = dwarf_cu_get_sprog_root(dwarf, root);
+   dwarf_free_die(dwarf, root);
+   dwarf_env_restore(dwarf, saved);
+
+   return sprog;
+}
+
+static bool
+dwarf_name_matches(const char *name, const char *query) {
+   size_t name_len = strlen(name);
+   size_t query_len = strlen(query);
+
+   if (name_len < query_len || strcmp(name + name_len - query_len, query)) {
+      return false;
+   }
+
+   return name_len == query_len || name[name_len - query_len - 1] == '/';
+}
+
+dwarf_cu *
+dwarf_cu_find(Dwarf *dwarf, const char *name) {
+   dwarf_die *volatile root = NULL;
+   dwarf_cu *cu;
+   char *cu_name;
+   uint32_t i;
+
+   if (setjmp(dwarf->env)) {
+      dwarf_free_die(dwarf, root);
+      return NULL;
+   }
+
+   for (i = 0; i < dwarf->cu_count; i++) {
+      cu = dwarf->cus[i];
+      root = cu->die ? cu->die : dwarf_read_cu_root(dwarf, cu);
+
+      if (!root) {
+         continue;
+      }
+
+      cu_name = dwarf_die_get_name(dwarf, root);
+
+      if (root != cu->die) {
+         dwarf_free_die(dwarf, root);
+      }
+
+      root = NULL;
+
+      if (cu_name && dwarf_name_matches(cu_name, name)) {
+         return cu;
+      }
+   }
+
+   return NULL;
+}
+
+static dwarf_die *
+dwarf_cu_find_die(dwarf_cu *cu, uint64_t offset) {
+   uint32_t lo = 0;
+   uint32_t hi = cu->die_count;
+   uint32_t mid;
+
+   while (lo < hi) {
+      mid = lo + ((hi - lo) >> 1);
+
+      if (offset < cu->dies[mid].offset) {
+         hi = mid;
+      } else if (offset > cu->dies[mid].offset) {
+         lo = mid + 1;
+      } else {
+         return &cu->dies[mid];
+      }
+   }
+
+   return NULL;
+}
+
+dwarf_die *
+dwarf_get_die(Dwarf *dwarf, uint64_t offset) {
+   dwarf_cu *cu = dwarf_get_cu(dwarf, offset);
+
+   if (!cu || !dwarf_cu_get_die(dwarf, cu)) {
+      return NULL;
+   }
+
+   return dwarf_cu_find_die(cu, offset);
+}
+
+dwarf_die_att *
+dwarf_die_get_att(dwarf_die *die, dwarf_att_id att_id) {
+   uint32_t i;
+
+   for (i = 0; i < die->att_count; i++) {
+      if (die->att[i].att_spec->id == att_id) {
+         return &die->att[i];
+      }
+   }
+
+   return NULL;
+}
+
+dwarf_die *
+dwarf_die_get_parent(dwarf_cu *cu, dwarf_die *die) {
+   return die->parent != DWARF_DIE_NONE ? &cu->dies[die->parent] : NULL;
+}
+
+static bool
+dwarf_ref_offset(Dwarf *dwarf, dwarf_die *die, dwarf_die_att *att, 
+      uint64_t *offset) {
+   dwarf_cu *cu;
+
+   switch (att->att_spec->form->id) {
+      case DW_FORM_ref_addr:
+         *offset = att->value.ul_val;
+         return true;
+      case DW_FORM_ref1:
+      case DW_FORM_ref2:
+      case DW_FORM_ref4:
+      case DW_FORM_ref8:
+      case DW_FORM_ref_udata:
+         if (!(cu = dwarf_get_cu(dwarf, die->offset))) {
+            return false;
+         }
+         *offset = cu->offset + att->value.ul_val;
+         return true;
+      default:
+         return false;
+   }
+}
+
+dwarf_die *
+dwarf_die_get_ref(Dwarf *dwarf, dwarf_die *die, dwarf_att_id att_id) {
+   dwarf_die_att *att = dwarf_die_get_att(die, att_id);
+   uint64_t offset;
+
+   if (!att || !dwarf_ref_offset(dwarf, die, att, &offset)) {
+      return NULL;
+   }
+
+   return dwarf_get_die(dwarf, offset);
+}
+
+struct dwarf_type_tab {
+   uint64_t *keys;            /* DIE offsets, 0 marks a free slot */
+   dwarf_type **vals;
+   uint32_t size;             /* power of two */
+   uint32_t count;
+   dwarf_type *types;         /* owned descriptors */
+   pthread_mutex_t lock;
+   bool parallel;             /* workers of dwarf_types_build() running */
+};
+
+typedef struct {
+   Dwarf *dwarf;
+   uint32_t next_cu;
+} dwarf_types_job;
+
+/*
+ * Maps type DIE offsets to the offset of the first structurally equal 
+ * type DIE, as computed by dwarf_types_dedup().
+ */
+struct dwarf_canon_tab {
+   uint64_t *keys;
+   uint64_t *vals;
+   uint32_t size;             /* power of two */
+   uint32_t count;
+   uint32_t distinct;         /* number of canonical types */
+};
+
+typedef struct {
+   dwarf_die *a;
+   dwarf_die *b;
+} dwarf_type_pair;
+
+/*
+ * Pairs of DIEs assumed to be equal while comparing two type graphs, 
+ * which terminates the comparison of recursive types.
+ */
+typedef struct {
+   dwarf_type_pair *pairs;
+   uint32_t count;
+   uint32_t len;
+} dwarf_type_hyp;
+
+static inline dwarf_tag_id
+dwarf_die_tag_id(const dwarf_tag *tag) {
+   return tag ? tag->id : 0;
+}
+
+static inline dwarf_tag_id
+dwarf_die_tag(dwarf_die *die) {
+   return dwarf_die_tag_id(die->tag);
+}
+
+char *
+dwarf_die_get_str(Dwarf *dwarf, dwarf_die *die, dwarf_att_id att_id) {
+   dwarf_die_att *att = dwarf_die_get_att(die, att_id);
+
+   if (!att) {
+      return NULL;
+   }
+
+   switch (att->att_spec->form->id) {
+      case DW_FORM_string:
+         return att->value.s_val;
+      case DW_FORM_strp:
+         return dwarf_str_at(dwarf, att->value.ul_val);
+      default:
+         return NULL;
+   }
+}
+
+char *
+dwarf_die_get_name(Dwarf *dwarf, dwarf_die *die) {
+   return dwarf_die_get_str(dwarf, die, DW_AT_name);
+}
+
+static bool
+dwarf_die_get_udata(dwarf_die *die, dwarf_att_id att_id, uint64_t *val) {
+   dwarf_die_att *att = dwarf_die_get_att(die, att_id);
+   char *pos;
+
+   if (!att) {
+      return false;
+   }
+
+   switch (att->att_spec->form->id) {
+      case DW_FORM_data1:
+      case DW_FORM_data2:
+      case DW_FORM_data4:
+      case DW_FORM_data8:
+      case DW_FORM_udata:
+      case DW_FORM_sdata:
+         *val = att->value.ul_val;
+         return true;
+      case DW_FORM_block:
+      case DW_FORM_block1:
+      case DW_FORM_block2:
+      case DW_FORM_block4:
+         /* DW_OP_plus_uconst as used by DW_AT_data_member_location */
+         if (att->value.b_val->len > 1 && 
+               (uint8_t)att->value.b_val->buf[0] == 0x23) {
+            pos = att->value.b_val->buf + 1;
+            return dwarf_read_uleb(&pos, pos + att->value.b_val->len - 1, 
+                  val);
+         }
+         return false;
+      default:
+         return false;
+   }
+}
+
+/*
+ * Follows DW_AT_type. DIEs of resident CUs are looked up without touching 
+ * the cache, so the parallel build never modifies shared state here. While 
+ * it runs, references into CUs that could not be loaded beforehand are not 
+ * followed, as loading them would change the cache and dwarf->env.
+ */
+static dwarf_die *
+dwarf_type_ref(Dwarf *dwarf, dwarf_die *die) {
+   dwarf_die_att *att = dwarf_die_get_att(die, DW_AT_type);
+   dwarf_cu *cu;
+   uint64_t offset;
+
+   if (!att || !dwarf_ref_offset(dwarf, die, att, &offset) || 
+         !(cu = dwarf_get_cu(dwarf, offset))) {
+      return NULL;
+   }
+
+   if (!cu->die && dwarf->types && dwarf->types->parallel) {
+      return NULL;
+   }
+
+   if (!cu->die && !dwarf_cu_get_die(dwarf, cu)) {
+      return NULL;
+   }
+
+   return dwarf_cu_find_die(cu, offset);
+}
+
+static inline uint32_t
+dwarf_offset_hash(uint64_t offset) {
+   return (uint32_t)(offset ^ (offset >> 32)) * 2654435761u;
+}
+
+static inline uint32_t
+dwarf_canon_slot(struct dwarf_canon_tab *tab, uint64_t offset) {
+   uint32_t i = dwarf_offset_hash(offset) & (tab->size - 1);
+
+   while (tab->keys[i] && tab->keys[i] != offset) {
+      i = (i + 1) & (tab->size - 1);
+   }
+
+   return i;
+}
+
+static uint64_t
+dwarf_canon_get(Dwarf *dwarf, uint64_t offset) {
+   struct dwarf_canon_tab *tab = dwarf->canon;
+   uint32_t slot;
+
+   if (!tab) {
+      return offset;
+   }
+
+   slot = dwarf_canon_slot(tab, offset);
+
+   return tab->keys[slot] ? tab->vals[slot] : offset;
+}
+
+static void
+dwarf_canon_put(Dwarf *dwarf, struct dwarf_canon_tab *tab, uint64_t offset, 
+      uint64_t canon) {
+   uint64_t *keys = tab->keys;
+   uint64_t *vals = tab->vals;
+   uint32_t size = tab->size;
+   uint32_t i, slot;
+
+   if (++tab->count > (tab->size >> 1) + (tab->size >> 2)) {
+      tab->size <<= 1;
+      tab->keys = dwarf_mem_calloc(dwarf, tab->size, sizeof(uint64_t));
+      tab->vals = dwarf_mem_calloc(dwarf, tab->size, sizeof(uint64_t));
+
+      for (i = 0; i < size; i++) {
+         if (keys[i]) {
+            slot = dwarf_canon_slot(tab, keys[i]);
+            tab->keys[slot] = keys[i];
+            tab->vals[slot] = vals[i];
+         }
+      }
+
+      dwarf_mem_free(dwarf, keys);
+      dwarf_mem_free(dwarf, vals);
+   }
+
+   slot = dwarf_canon_slot(tab, offset);
+   tab->keys[slot] = offset;
+   tab->vals[slot] = canon;
+}
+
+uint64_t
+dwarf_type_canonical(Dwarf *dwarf, dwarf_die *die) {
+   return dwarf_canon_get(dwarf, die->offset);
+}
+
+static struct dwarf_type_tab *
+dwarf_type_tab_init(Dwarf *dwarf) {
+   struct dwarf_type_tab *tab = dwarf->types;
+
+   if (!tab) {
+      tab = dwarf->types = dwarf_mem_calloc(dwarf, 1, 
+            sizeof(struct dwarf_type_tab));
+      tab->size = 256;
+      tab->keys = dwarf_mem_calloc(dwarf, tab->size, sizeof(uint64_t));
+      tab->vals = dwarf_mem_calloc(dwarf, tab->size, sizeof(dwarf_type *));
+      pthread_mutex_init(&tab->lock, NULL);
+   }
+
+   return tab;
+}
+
+static inline uint32_t
+dwarf_type_tab_slot(struct dwarf_type_tab *tab, uint64_t offset) {
+   uint32_t i = dwarf_offset_hash(offset) & (tab->size - 1);
+
+   while (tab->keys[i] && tab->keys[i] != offset) {
+      i = (i + 1) & (tab->size - 1);
+   }
+
+   return i;
+}
+
+static void
+dwarf_type_tab_grow(Dwarf *dwarf, struct dwarf_type_tab *tab) {
+   uint64_t *keys = tab->keys;
+   dwarf_type **vals = tab->vals;
+   uint32_t size = tab->size;
+   uint32_t i, slot;
+
+   tab->size <<= 1;
+   tab->keys = dwarf_mem_calloc(dwarf, tab->size, sizeof(uint64_t));
+   tab->vals = dwarf_mem_calloc(dwarf, tab->size, sizeof(dwarf_type *));
+
+   for (i = 0; i < size; i++) {
+      if (keys[i]) {
+         slot = dwarf_type_tab_slot(tab, keys[i]);
+         tab->keys[slot] = keys[i];
+         tab->vals[slot] = vals[i];
+      }
+   }
+
+   dwarf_mem_free(dwarf, keys);
+   dwarf_mem_free(dwarf, vals);
+}
+
+static dwarf_type *
+dwarf_type_memo_get(struct dwarf_type_tab *tab, uint64_t offset) {
+   dwarf_type *type;
+
+   pthread_mutex_lock(&tab->lock);
+   type = tab->vals[dwarf_type_tab_slot(tab, offset)];
+   pthread_mutex_unlock(&tab->lock);
+
+   return type;
+}
+
+static void
+dwarf_free_type(Dwarf *dwarf, dwarf_type *type) {
+   uint32_t i;
+
+   for (i = 0; i < type->member_count; i++) {
+      dwarf_mem_free(dwarf, type->members[i].type_name);
+   }
+
+   dwarf_mem_free(dwarf, type->members);
+   dwarf_mem_free(dwarf, type->name);
+   dwarf_mem_free(dwarf, type);
+}
+
+/*
+ * Memoizes type for offset. If another thread got there first, its 
+ * descriptor is returned and an owned duplicate is freed.
+ */
+static dwarf_type *
+dwarf_type_memo_put(Dwarf *dwarf, struct dwarf_type_tab *tab, uint64_t offset, 
+      dwarf_type *type, bool owned) {
+   dwarf_type *cur;
+   uint32_t slot;
+
+   pthread_mutex_lock(&tab->lock);
+   slot = dwarf_type_tab_slot(tab, offset);
+
+   if ((cur = tab->vals[slot])) {
+      pthread_mutex_unlock(&tab->lock);
+      if (owned) {
+         dwarf_free_type(dwarf, type);
+      }
+      return cur;
+   }
+
+   tab->keys[slot] = offset;
+   tab->vals[slot] = type;
+
+   if (owned) {
+      type->next_type = tab->types;
+      tab->types = type;
+   }
+
+   if (++tab->count > (tab->size >> 1) + (tab->size >> 2)) {
+      dwarf_type_tab_grow(dwarf, tab);
+   }
+
+   pthread_mutex_unlock(&tab->lock);
+
+   return type;
+}
+
+static uint64_t
+dwarf_array_count(dwarf_die *die) {
+   dwarf_die *sub;
+   uint64_t count = 1;
+   uint64_t val;
+
+   for (sub = die->child; sub != NULL; sub = sub->sibling) {
+      if (dwarf_die_tag(sub) != DW_TAG_subrange_type) {
+         continue;
+      }
+
+      if (dwarf_die_get_udata(sub, DW_AT_count, &val)) {
+         count *= val;
+      } else if (dwarf_die_get_udata(sub, DW_AT_upper_bound, &val)) {
+         count *= val + 1;
+      } else {
+         count = 0;
+      }
+   }
+
+   return count;
+}
+
+static char *
+dwarf_type_name(Dwarf *dwarf, dwarf_die *die) {
+   char *name;
+   char *ref_name = NULL;
+   char *res = NULL;
+
+   if (!die) {
+      return dwarf_mem_strdup(dwarf, "void");
+   }
+
+   name = dwarf_die_get_name(dwarf, die);
+
+   switch (dwarf_die_tag(die)) {
+      case DW_TAG_structure_type:
+         res = dwarf_mem_asprintf(dwarf, "struct %s", 
+               name ? name : "<anonymous>");
+         break;
+      case DW_TAG_class_type:
+         res = dwarf_mem_asprintf(dwarf, "class %s", 
+               name ? name : "<anonymous>");
+         break;
+      case DW_TAG_union_type:
+         res = dwarf_mem_asprintf(dwarf, "union %s", 
+               name ? name : "<anonymous>");
+         break;
+      case DW_TAG_enumeration_type:
+         res = dwarf_mem_asprintf(dwarf, "enum %s", 
+               name ? name : "<anonymous>");
+         break;
+      case DW_TAG_pointer_type:
+         ref_name = dwarf_type_name(dwarf, dwarf_type_ref(dwarf, die));
+         res = dwarf_mem_asprintf(dwarf, 
+               ref_name[strlen(ref_name) - 1] == '*' ? "%s*" : "%s *", 
+               ref_name);
+         break;
+      case DW_TAG_reference_type:
+         ref_name = dwarf_type_name(dwarf, dwarf_type_ref(dwarf, die));
+         res = dwarf_mem_asprintf(dwarf, "%s &", ref_name);
+         break;
+      case DW_TAG_const_type:
+         ref_name = dwarf_type_name(dwarf, dwarf_type_ref(dwarf, die));
+         res = dwarf_mem_asprintf(dwarf, "const %s", ref_name);
+         break;
+      case DW_TAG_volatile_type:
+         ref_name = dwarf_type_name(dwarf, dwarf_type_ref(dwarf, die));
+         res = dwarf_mem_asprintf(dwarf, "volatile %s", ref_name);
+         break;
+      case DW_TAG_array_type:
+         ref_name = dwarf_type_name(dwarf, dwarf_type_ref(dwarf, die));
+         res = dwarf_mem_asprintf(dwarf, "%s[%" PRIu64 "]", ref_name, 
+               dwarf_array_count(die));
+         break;
+      case DW_TAG_subroutine_type:
+         res = dwarf_mem_strdup(dwarf, "<function>");
+         break;
+      default:
+         res = dwarf_mem_strdup(dwarf, name ? name : "<unknown>");
+         break;
+   }
+
+   dwarf_mem_free(dwarf, ref_name);
+
+   return res;
+}
+
+static dwarf_type *
+dwarf_type_resolve(Dwarf *dwarf, dwarf_die *die);
+
+static void
+dwarf_type_add_member(Dwarf *dwarf, dwarf_type *type, dwarf_die *die, 
+      uint32_t *members_len) {
+   dwarf_die *ref = dwarf_type_ref(dwarf, die);
+   dwarf_type_member *member;
+   uint64_t val;
+
+   if (type->member_count == *members_len) {
+      *members_len = *members_len ? *members_len << 1 : 8;
+      type->members = dwarf_mem_realloc(dwarf, type->members, 
+            *members_len * sizeof(dwarf_type_member));
+   }
+
+   member = &type->members[type->member_count++];
+   memset(member, 0, sizeof(dwarf_type_member));
+   member->name = dwarf_die_get_name(dwarf, die);
+   member->type_name = dwarf_type_name(dwarf, ref);
+   member->type = ref ? dwarf_type_resolve(dwarf, ref) : NULL;
+   member->size = member->type ? member->type->size : 0;
+
+   if (dwarf_die_get_udata(die, DW_AT_data_member_location, &val)) {
+      member->offset = val;
+   }
+
+   if (dwarf_die_get_udata(die, DW_AT_byte_size, &val)) {
+      member->size = val;
+   }
+
+   member->bit_offset = member->offset * 8;
+
+   if (dwarf_die_get_udata(die, DW_AT_bit_size, &val)) {
+      member->bit_size = val;
+
+      if (dwarf_die_get_udata(die, DW_AT_data_bit_offset, &val)) {
+         member->bit_offset = val;
+         member->offset = val / 8;
+      } else if (dwarf_die_get_udata(die, DW_AT_bit_offset, &val)) {
+         /* counted from the most significant bit of the storage unit */
+         member->bit_offset += member->size * 8 - val - member->bit_size;
+      }
+   }
+}
+
+static void
+dwarf_type_holes(dwarf_type *type) {
+   dwarf_type_member *member;
+   uint64_t end = 0;
+   uint64_t member_end;
+   uint64_t next;
+   uint32_t i;
+
+   if (dwarf_die_tag_id(type->tag) == DW_TAG_union_type) {
+      return;
+   }
+
+   for (i = 0; i < type->member_count; i++) {
+      member = &type->members[i];
+      member_end = member->bit_size ? member->bit_offset + member->bit_size :
+         (member->offset + member->size) * 8;
+
+      if (member_end > end) {
+         end = member_end;
+      }
+
+      next = i + 1 < type->member_count ? member[1].bit_offset : 
+         type->size * 8;
+      member->hole = next > end ? (next - end) / 8 : 0;
+      type->padding += member->hole;
+   }
+}
+
+static dwarf_type *
+dwarf_type_build(Dwarf *dwarf, dwarf_die *die) {
+   dwarf_type *type = dwarf_mem_calloc(dwarf, 1, sizeof(dwarf_type));
+   dwarf_type *elem;
+   dwarf_die *child;
+   dwarf_die *ref;
+   dwarf_cu *cu;
+   uint32_t members_len = 0;
+   uint64_t val;
+
+   type->offset = die->offset;
+   type->tag = die->tag;
+   type->name = dwarf_type_name(dwarf, die);
+
+   if (dwarf_die_get_udata(die, DW_AT_byte_size, &val)) {
+      type->size = val;
+   }
+
+   switch (dwarf_die_tag(die)) {
+      case DW_TAG_pointer_type:
+      case DW_TAG_reference_type:
+      case DW_TAG_ptr_to_member_type:
+         if (!type->size && (cu = dwarf_get_cu(dwarf, die->offset))) {
+            type->size = cu->hdr.addr_size;
+         }
+         break;
+      case DW_TAG_array_type:
+         if ((ref = dwarf_type_ref(dwarf, die)) && 
+               (elem = dwarf_type_resolve(dwarf, ref))) {
+            type->size = elem->size * dwarf_array_count(die);
+         }
+         break;
+      case DW_TAG_structure_type:
+      case DW_TAG_class_type:
+      case DW_TAG_union_type:
+         for (child = die->child; child != NULL; child = child->sibling) {
+            switch (dwarf_die_tag(child)) {
+               case DW_TAG_member:
+               case DW_TAG_inheritance:
+                  /* static data members are declarations of the own type */
+                  if (!dwarf_die_get_att(child, DW_AT_declaration)) {
+                     dwarf_type_add_member(dwarf, type, child, &members_len);
+                  }
+                  break;
+               default:
+                  break;
+            }
+         }
+         dwarf_type_holes(type);
+         break;
+      default:
+         break;
+   }
+
+   return type;
+}
+
+static dwarf_type *
+dwarf_type_resolve(Dwarf *dwarf, dwarf_die *die) {
+   struct dwarf_type_tab *tab = dwarf->types;
+   uint64_t offset = dwarf_canon_get(dwarf, die->offset);
+   dwarf_type *type;
+   dwarf_die *ref;
+
+   /* deduplicated types share the descriptor of their canonical DIE */
+   if ((type = dwarf_type_memo_get(tab, offset))) {
+      return type;
+   }
+
+   switch (dwarf_die_tag(die)) {
+      case DW_TAG_typedef:
+      case DW_TAG_const_type:
+      case DW_TAG_volatile_type:
+      case DW_TAG_packed_type:
+         if (!(ref = dwarf_type_ref(dwarf, die)) || 
+               !(type = dwarf_type_resolve(dwarf, ref))) {
+            return NULL;
+         }
+         return dwarf_type_memo_put(dwarf, tab, offset, type, false);
+      default:
+         type = dwarf_type_build(dwarf, die);
+         type->offset = offset;
+         return dwarf_type_memo_put(dwarf, tab, offset, type, true);
+   }
+}
+
+dwarf_type *
+dwarf_type_get(Dwarf *dwarf, dwarf_die *die) {
+   size_t budget = dwarf->cache.budget;
+   dwarf_type *type;
+
+   dwarf_type_tab_init(dwarf);
+
+   /* following references must not evict the trees being walked */
+   dwarf->cache.budget = 0;
+   type = dwarf_type_resolve(dwarf, die);
+   dwarf_set_cache_budget(dwarf, budget);
+
+   return type;
+}
+
+dwarf_type *
+dwarf_type_find(Dwarf *dwarf, const char *name) {
+   dwarf_cu *cu;
+   dwarf_die *die;
+   char *die_name;
+   uint32_t i;
+
+   for (cu = dwarf->cu; cu != NULL; cu = cu->next_cu) {
+      if (!dwarf_cu_get_die(dwarf, cu)) {
+         continue;
+      }
+
+      for (i = 0; i < cu->die_count; i++) {
+         die = &cu->dies[i];
+
+         switch (dwarf_die_tag(die)) {
+            case DW_TAG_structure_type:
+            case DW_TAG_class_type:
+            case DW_TAG_union_type:
+            case DW_TAG_enumeration_type:
+            case DW_TAG_typedef:
+            case DW_TAG_base_type:
+               break;
+            default:
+               continue;
+         }
+
+         if (!dwarf_die_get_att(die, DW_AT_declaration) && 
+               (die_name = dwarf_die_get_name(dwarf, die)) && 
+               !strcmp(die_name, name)) {
+            return dwarf_type_get(dwarf, die);
+         }
+      }
+   }
+
+   return NULL;
+}
+
+static void *
+dwarf_types_worker(void *arg) {
+   dwarf_types_job *job = arg;
+   Dwarf *dwarf = job->dwarf;
+   dwarf_cu *cu;
+   dwarf_die *die;
+   uint32_t idx;
+   uint32_t i;
+
+   while ((idx = __atomic_fetch_add(&job->next_cu, 1, __ATOMIC_RELAXED)) < 
+         dwarf->cu_count) {
+      cu = dwarf->cus[idx];
+
+      for (i = 0; i < cu->die_count; i++) {
+         die = &cu->dies[i];
+
+         switch (dwarf_die_tag(die)) {
+            case DW_TAG_structure_type:
+            case DW_TAG_class_type:
+            case DW_TAG_union_type:
+               if (!dwarf_die_get_att(die, DW_AT_declaration)) {
+                  dwarf_type_resolve(dwarf, die);
+               }
+               break;
+            default:
+               break;
+         }
+      }
+   }
+
+   return NULL;
+}
+
+int
+dwarf_types_build(Dwarf *dwarf, int nthreads) {
+   size_t budget = dwarf->cache.budget;
+   dwarf_types_job job = { dwarf, 0 };
+   pthread_t *threads;
+   uint32_t i;
+   int started;
+
+   dwarf_type_tab_init(dwarf);
+
+   /* the workers only read DIE trees, so all CUs are materialized first */
+   dwarf->cache.budget = 0;
+   dwarf_advise(dwarf, ELF_ADV_SEQUENTIAL);
+
+   for (i = 0; i < dwarf->cu_count; i++) {
+      dwarf_cu_get_die(dwarf, dwarf->cus[i]);
+   }
+
+   if (nthreads < 1) {
+      nthreads = 1;
+   }
+
+   threads = dwarf_mem_calloc(dwarf, nthreads, sizeof(pthread_t));
+   dwarf->types->parallel = true;
+
+   for (started = 0; started < nthreads; started++) {
+      if (pthread_create(&threads[started], NULL, dwarf_types_worker, &job)) {
+         break;
+      }
+   }
+
+   /* picks up any remaining CUs if threads could not be started */
+   dwarf_types_worker(&job);
+
+   while (started--) {
+      pthread_join(threads[started], NULL);
+   }
+
+   dwarf->types->parallel = false;
+
+   dwarf_mem_free(dwarf, threads);
+   dwarf_set_cache_budget(dwarf, budget);
+   dwarf_advise(dwarf, ELF_ADV_RANDOM);
+
+   return 0;
+}
+
+static bool
+dwarf_die_is_type(dwarf_die *die) {
+   switch (dwarf_die_tag(die)) {
+      case DW_TAG_array_type:
+      case DW_TAG_class_type:
+      case DW_TAG_enumeration_type:
+      case DW_TAG_pointer_type:
+      case DW_TAG_reference_type:
+      case DW_TAG_string_type:
+      case DW_TAG_structure_type:
+      case DW_TAG_subroutine_type:
+      case DW_TAG_typedef:
+      case DW_TAG_union_type:
+      case DW_TAG_ptr_to_member_type:
+      case DW_TAG_set_type:
+      case DW_TAG_base_type:
+      case DW_TAG_const_type:
+      case DW_TAG_file_type:
+      case DW_TAG_packed_type:
+      case DW_TAG_volatile_type:
+         return true;
+      default:
+         return false;
+   }
+}
+
+/*
+ * Children that are part of the structure of a type. 
+ */
+static bool
+dwarf_die_is_type_part(dwarf_die *die) {
+   switch (dwarf_die_tag(die)) {
+      case DW_TAG_member:
+      case DW_TAG_inheritance:
+      case DW_TAG_enumerator:
+      case DW_TAG_subrange_type:
+      case DW_TAG_formal_parameter:
+      case DW_TAG_unspecified_parameters:
+      case DW_TAG_template_type_param:
+      case DW_TAG_template_value_param:
+         return true;
+      default:
+         return false;
+   }
+}
+
+static const dwarf_att_id dwarf_type_hash_atts[] = {
+   DW_AT_byte_size, DW_AT_bit_size, DW_AT_bit_offset, DW_AT_data_bit_offset,
+   DW_AT_data_member_location, DW_AT_encoding, DW_AT_const_value,
+   DW_AT_upper_bound, DW_AT_lower_bound, DW_AT_count, DW_AT_prototyped, 
+   DW_AT_declaration
+};
+
+#define DWARF_TYPE_HASH_ATTS \
+   (sizeof(dwarf_type_hash_atts) / sizeof(dwarf_type_hash_atts[0]))
+
+static inline uint64_t
+dwarf_hash_mix(uint64_t hash, uint64_t val) {
+   hash ^= val + 0x9e3779b97f4a7c15ull + (hash << 6) + (hash >> 2);
+   return hash;
+}
+
+static uint64_t
+dwarf_hash_str(uint64_t hash, const char *str) {
+   /* FNV-1a */
+   uint64_t h = 0xcbf29ce484222325ull;
+
+   if (str) {
+      while (*str) {
+         h = (h ^ (uint8_t)*str++) * 0x100000001b3ull;
+      }
+   }
+
+   return dwarf_hash_mix(hash, h);
+}
+
+/*
+ * Hashes a buffer eight bytes at a time. It is meant for whole units, 
+ * where FNV-1a's byte loop would dominate, not for table keys.
+ */
+static uint64_t
+dwarf_hash_bytes(uint64_t hash, const char *buf, size_t len) {
+   uint64_t h = 0xcbf29ce484222325ull ^ len;
+   uint64_t word;
+
+   for (; len >= 8; buf += 8, len -= 8) {
+      memcpy(&word, buf, 8);
+      h = (h ^ word) * 0x9e3779b97f4a7c15ull;
+      h ^= h >> 32;
+   }
+
+   word = 0;
+   memcpy(&word, buf, len);
+   h = (h ^ word) * 0x9e3779b97f4a7c15ull;
+   h ^= h >> 29;
+
+   return dwarf_hash_mix(hash, h);
+}
+
+static uint64_t
+dwarf_die_hash_atts(Dwarf *dwarf, dwarf_die *die, uint64_t hash) {
+   uint64_t val;
+   size_t i;
+
+   hash = dwarf_hash_mix(hash, dwarf_die_tag(die));
+   hash = dwarf_hash_str(hash, dwarf_die_get_name(dwarf, die));
+
+   for (i = 0; i < DWARF_TYPE_HASH_ATTS; i++) {
+      val = 0;
+      if (dwarf_die_get_udata(die, dwarf_type_hash_atts[i], &val) || 
+            dwarf_die_get_att(die, dwarf_type_hash_atts[i])) {
+         hash = dwarf_hash_mix(hash, ((uint64_t)i << 56) ^ val);
+      }
+   }
+
+   return hash;
+}
+
+/*
+ * Hashes a type without following references out of aggregates, so the 
+ * hash is finite for recursive types. Equal types hash equally; equality 
+ * is established by dwarf_type_equal().
+ */
+static uint64_t
+dwarf_type_hash(Dwarf *dwarf, dwarf_die *die, int depth) {
+   uint64_t hash = dwarf_die_hash_atts(dwarf, die, 0);
+   dwarf_die *child;
+   dwarf_die *ref;
+
+   for (child = die->child; child != NULL; child = child->sibling) {
+      if (dwarf_die_is_type_part(child)) {
+         hash = dwarf_die_hash_atts(dwarf, child, hash);
+      }
+   }
+
+   switch (dwarf_die_tag(die)) {
+      case DW_TAG_structure_type:
+      case DW_TAG_class_type:
+      case DW_TAG_union_type:
+      case DW_TAG_enumeration_type:
+         break;
+      default:
+         if (depth < 16 && (ref = dwarf_type_ref(dwarf, die))) {
+            hash = dwarf_hash_mix(hash, dwarf_type_hash(dwarf, ref, depth + 1));
+         }
+         break;
+   }
+
+   return hash;
+}
+
+static bool
+dwarf_die_same_atts(Dwarf *dwarf, dwarf_die *a, dwarf_die *b) {
+   char *a_name = dwarf_die_get_name(dwarf, a);
+   char *b_name = dwarf_die_get_name(dwarf, b);
+   bool a_has, b_has;
+   uint64_t a_val, b_val;
+   size_t i;
+
+   if (dwarf_die_tag(a) != dwarf_die_tag(b) || (!a_name) != (!b_name) || 
+         (a_name && strcmp(a_name, b_name))) {
+      return false;
+   }
+
+   for (i = 0; i < DWARF_TYPE_HASH_ATTS; i++) {
+      a_val = b_val = 0;
+      a_has = dwarf_die_get_udata(a, dwarf_type_hash_atts[i], &a_val) || 
+         dwarf_die_get_att(a, dwarf_type_hash_atts[i]);
+      b_has = dwarf_die_get_udata(b, dwarf_type_hash_atts[i], &b_val) || 
+         dwarf_die_get_att(b, dwarf_type_hash_atts[i]);
+
+      if (a_has != b_has || a_val != b_val) {
+         return false;
+      }
+   }
+
+   return true;
+}
+
+static bool
+dwarf_type_equal(Dwarf *dwarf, dwarf_die *a, dwarf_die *b, 
+      dwarf_type_hyp *hyp);
+
+static bool
+dwarf_type_ref_equal(Dwarf *dwarf, dwarf_die *a, dwarf_die *b, 
+      dwarf_type_hyp *hyp) {
+   dwarf_die *a_ref = dwarf_type_ref(dwarf, a);
+   dwarf_die *b_ref = dwarf_type_ref(dwarf, b);
+
+   if (!a_ref || !b_ref) {
+      return a_ref == b_ref;
+   }
+
+   return dwarf_type_equal(dwarf, a_ref, b_ref, hyp);
+}
+
+static bool
+dwarf_type_equal(Dwarf *dwarf, dwarf_die *a, dwarf_die *b, 
+      dwarf_type_hyp *hyp) {
+   dwarf_die *a_child = a->child;
+   dwarf_die *b_child = b->child;
+   uint32_t i;
+
+   if (a == b || dwarf_canon_get(dwarf, a->offset) == 
+         dwarf_canon_get(dwarf, b->offset)) {
+      return true;
+   }
+
+   for (i = 0; i < hyp->count; i++) {
+      if (hyp->pairs[i].a == a && hyp->pairs[i].b == b) {
+         return true;
+      }
+   }
+
+   if (!dwarf_die_same_atts(dwarf, a, b)) {
+      return false;
+   }
+
+   if (hyp->count == hyp->len) {
+      hyp->len = hyp->len ? hyp->len << 1 : 16;
+      hyp->pairs = dwarf_mem_realloc(dwarf, hyp->pairs, 
+            hyp->len * sizeof(dwarf_type_pair));
+   }
+
+   hyp->pairs[hyp->count].a = a;
+   hyp->pairs[hyp->count].b = b;
+   hyp->count++;
+
+   if (!dwarf_type_ref_equal(dwarf, a, b, hyp)) {
+      return false;
+   }
+
+   while (true) {
+      while (a_child && !dwarf_die_is_type_part(a_child)) {
+         a_child = a_child->sibling;
+      }
+
+      while (b_child && !dwarf_die_is_type_part(b_child)) {
+         b_child = b_child->sibling;
+      }
+
+      if (!a_child || !b_child) {
+         return a_child == b_child;
+      }
+
+      if (!dwarf_die_same_atts(dwarf, a_child, b_child) || 
+            !dwarf_type_ref_equal(dwarf, a_child, b_child, hyp)) {
+         return false;
+      }
+
+      a_child = a_child->sibling;
+      b_child = b_child->sibling;
+   }
+}
+
+int
+dwarf_types_dedup(Dwarf *dwarf) {
+   size_t budget = dwarf->cache.budget;
+   struct dwarf_canon_tab *canon;
+   dwarf_type_hyp hyp = { NULL, 0, 0 };
+   uint64_t *buckets;         /* hash of the first candidate per slot */
+   uint32_t *heads;           /* index + 1 of the first candidate */
+   dwarf_die **cands = NULL;
+   uint32_t *next = NULL;
+   uint32_t cand_count = 0;
+   uint32_t cands_len = 0;
+   uint32_t size = 1024;
+   uint32_t slot, c, i, j;
+   uint64_t hash;
+   dwarf_cu *cu;
+   dwarf_die *die;
+
+   if (dwarf->canon) {
+      return dwarf->canon->distinct;
+   }
+
+   /* candidates are compared across CUs, so all of them must be resident */
+   dwarf->cache.budget = 0;
+   dwarf_advise(dwarf, ELF_ADV_SEQUENTIAL);
+
+   for (i = 0; i < dwarf->cu_count; i++) {
+      dwarf_cu_get_die(dwarf, dwarf->cus[i]);
+   }
+
+   canon = dwarf_mem_calloc(dwarf, 1, sizeof(struct dwarf_canon_tab));
+   canon->size = 1024;
+   canon->keys = dwarf_mem_calloc(dwarf, canon->size, sizeof(uint64_t));
+   canon->vals = dwarf_mem_calloc(dwarf, canon->size, sizeof(uint64_t));
+   buckets = dwarf_mem_calloc(dwarf, size, sizeof(uint64_t));
+   heads = dwarf_mem_calloc(dwarf, size, sizeof(uint32_t));
+
+   /* mappings are only added for proven equality, so the comparison can 
+    * already use them as a shortcut */
+   dwarf->canon = canon;
+
+   for (i = 0; i < dwarf->cu_count; i++) {
+      cu = dwarf->cus[i];
+
+      for (j = 0; j < cu->die_count; j++) {
+         die = &cu->dies[j];
+
+         if (!dwarf_die_is_type(die)) {
+            continue;
+         }
+
+         hash = dwarf_type_hash(dwarf, die, 0);
+         slot = hash & (size - 1);
+
+         while (heads[slot] && buckets[slot] != hash) {
+            slot = (slot + 1) & (size - 1);
+         }
+
+         for (c = heads[slot]; c; c = next[c - 1]) {
+            hyp.count = 0;
+            if (dwarf_type_equal(dwarf, die, cands[c - 1], &hyp)) {
+               break;
+            }
+         }
+
+         if (c) {
+            dwarf_canon_put(dwarf, canon, die->offset, cands[c - 1]->offset);
+            continue;
+         }
+
+         if (cand_count == cands_len) {
+            cands_len = cands_len ? cands_len << 1 : 1024;
+            cands = dwarf_mem_realloc(dwarf, cands, 
+                  cands_len * sizeof(dwarf_die *));
+            next = dwarf_mem_realloc(dwarf, next, cands_len * sizeof(uint32_t));
+         }
+
+         cands[cand_count] = die;
+         next[cand_count] = heads[slot];
+         buckets[slot] = hash;
+         heads[slot] = ++cand_count;
+         dwarf_canon_put(dwarf, canon, die->offset, die->offset);
+
+         /* keep the bucket table at most half full */
+         if (cand_count > size >> 1) {
+            uint64_t *old_buckets = buckets;
+            uint32_t *old_heads = heads;
+            uint32_t old_size = size;
+            uint32_t k;
+
+            size <<= 1;
+            buckets = dwarf_mem_calloc(dwarf, size, sizeof(uint64_t));
+            heads = dwarf_mem_calloc(dwarf, size, sizeof(uint32_t));
+
+            for (k = 0; k < old_size; k++) {
+               if (old_heads[k]) {
+                  slot = old_buckets[k] & (size - 1);
+                  while (heads[slot]) {
+                     slot = (slot + 1) & (size - 1);
+                  }
+                  buckets[slot] = old_buckets[k];
+                  heads[slot] = old_heads[k];
+               }
+            }
+
+            dwarf_mem_free(dwarf, old_buckets);
+            dwarf_mem_free(dwarf, old_heads);
+         }
+      }
+   }
+
+   canon->distinct = cand_count;
+
+   dwarf_mem_free(dwarf, hyp.pairs);
+   dwarf_mem_free(dwarf, cands);
+   dwarf_mem_free(dwarf, next);
+   dwarf_mem_free(dwarf, buckets);
+   dwarf_mem_free(dwarf, heads);
+   dwarf_set_cache_budget(dwarf, budget);
+   dwarf_advise(dwarf, ELF_ADV_RANDOM);
+
+   return cand_count;
+}
+
+void
+dwarf_type_dump(dwarf_type *type) {
+   dwarf_type_member *member;
+   char offset[32];
+   char name[256];
+   uint32_t i;
+
+   printf("%s\n", type->name);
+   printf("%-30s: 0x%08" PRIx64 "\n", "die_offset", type->offset);
+   printf("%-30s: %" PRIu64 "\n", "size", type->size);
+   printf("%-30s: %" PRIu64 "\n", "padding", type->padding);
+
+   if (type->member_count) {
+      printf("%-10s %6s %-30s %s\n", "offset", "size", "member", "type");
+   }
+
+   for (i = 0; i < type->member_count; i++) {
+      member = &type->members[i];
+
+      if (member->bit_size) {
+         snprintf(offset, sizeof(offset), "%" PRIu64 ":%" PRIu64, 
+               member->bit_offset / 8, member->bit_offset % 8);
+         snprintf(name, sizeof(name), "%s:%d", 
+               member->name ? member->name : "<anonymous>", member->bit_size);
+      } else {
+         snprintf(offset, sizeof(offset), "%" PRIu64, member->offset);
+         snprintf(name, sizeof(name), "%s", 
+               member->name ? member->name : "<anonymous>");
+      }
+
+      printf("%-10s %6" PRIu64 " %-30s %s\n", offset, member->size, name, 
+            member->type_name);
+
+      if (member->hole) {
+         printf("%-10s %6s /* %" PRIu64 " bytes %s */\n", "", "", 
+               member->hole, i + 1 < type->member_count ? "hole" : "padding");
+      }
+   }
+
+   printf("\n");
+}
+
+static int
+dwarf_type_cmp(const void *a, const void *b) {
+   const dwarf_type *ta = *(const dwarf_type **)a;
+   const dwarf_type *tb = *(const dwarf_type **)b;
+
+   return ta->offset < tb->offset ? -1 : ta->offset > tb->offset;
+}
+
+void
+dwarf_types_dump(Dwarf *dwarf) {
+   dwarf_type **types;
+   dwarf_type *type;
+   size_t count = 0;
+   size_t i;
+
+   if (!dwarf->types) {
+      return;
+   }
+
+   types = dwarf_mem_calloc(dwarf, dwarf->types->count, sizeof(dwarf_type *));
+
+   for (type = dwarf->types->types; type != NULL; type = type->next_type) {
+      switch (dwarf_die_tag_id(type->tag)) {
+         case DW_TAG_structure_type:
+         case DW_TAG_class_type:
+         case DW_TAG_union_type:
+            types[count++] = type;
+            break;
+         default:
+            break;
+      }
+   }
+
+   qsort(types, count, sizeof(dwarf_type *), dwarf_type_cmp);
+
+   for (i = 0; i < count; i++) {
+      dwarf_type_dump(types[i]);
+   }
+
+   dwarf_mem_free(dwarf, types);
+}
+
+static void
+dwarf_free_canon(Dwarf *dwarf, struct dwarf_canon_tab *tab) {
+   if (tab) {
+      dwarf_mem_free(dwarf, tab->keys);
+      dwarf_mem_free(dwarf, tab->vals);
+      dwarf_mem_free(dwarf, tab);
+   }
+}
+
+static void
+dwarf_free_types(Dwarf *dwarf, struct dwarf_type_tab *tab) {
+   dwarf_type *tmp_type;
+
+   if (!tab) {
+      return;
+   }
+
+   while (tab->types) {
+      tmp_type = tab->types->next_type;
+      dwarf_free_type(dwarf, tab->types);
+      tab->types = tmp_type;
+   }
+
+   pthread_mutex_destroy(&tab->lock);
+   dwarf_mem_free(dwarf, tab->keys);
+   dwarf_mem_free(dwarf, tab->vals);
+   dwarf_mem_free(dwarf, tab);
+}
+
+struct dwarf_path_node {
+   uint32_t parent;
+   uint32_t comp_len;
+   const char *comp;          /* points into the first path through the node */
+   uint32_t *ids;             /* paths ending in the components up to here */
+   uint32_t id_count;
+   uint32_t id_len;
+};
+
+struct dwarf_path_tab {
+   char **paths;
+   uint32_t count;
+   uint32_t len;
+   uint32_t *slots;           /* path hash -> ID + 1 */
+   uint32_t slot_len;
+   struct dwarf_path_node *nodes;   /* suffix trie, node 0 is the root */
+   uint32_t node_count;
+   uint32_t node_len;
+   uint32_t *edges;           /* (parent, component) hash -> node + 1 */
+   uint32_t edge_len;
+};
+
+static uint64_t
+dwarf_path_comp_hash(uint32_t parent, const char *comp, uint32_t len) {
+   uint64_t h = 0xcbf29ce484222325ull;
+
+   while (len--) {
+      h = (h ^ (uint8_t)*comp++) * 0x100000001b3ull;
+   }
+
+   return dwarf_hash_mix(parent, h);
+}
+
+/*
+ * Joins name to dir and comp_dir as far as it is relative and resolves 
+ * empty, "." and ".." components lexically.
+ */
+static char *
+dwarf_path_normalize(Dwarf *dwarf, const char *comp_dir, const char *dir, 
+      const char *name) {
+   const char *parts[3];
+   const char *src;
+   const char *comp;
+   char *path;
+   char *dst;
+   char *last;
+   size_t len = 0;
+   uint32_t count = 0;
+   uint32_t i;
+   bool absolute;
+
+   if (name[0] != '/' && dir && dir[0] != '/' && comp_dir) {
+      parts[count++] = comp_dir;
+   }
+   if (name[0] != '/' && dir) {
+      parts[count++] = dir;
+   } else if (name[0] != '/' && comp_dir) {
+      parts[count++] = comp_dir;
+   }
+   parts[count++] = name;
+
+   for (i = 0; i < count; i++) {
+      len += strlen(parts[i]) + 1;
+   }
+
+   path = dwarf_mem_alloc(dwarf, len + 2);
+   absolute = parts[0][0] == '/';
+   dst = path;
+
+   if (absolute) {
+      *dst++ = '/';
+   }
+
+   /* components are written with a trailing slash */
+   for (i = 0; i < count; i++) {
+      for (src = parts[i]; *src; ) {
+         while (*src == '/') {
+            src++;
+         }
+
+         for (comp = src; *src && *src != '/'; src++);
+         len = src - comp;
+
+         if (!len || (len == 1 && comp[0] == '.')) {
+            continue;
+         }
+
+         if (len == 2 && comp[0] == '.' && comp[1] == '.') {
+            for (last = dst - 1; last > path && last[-1] != '/'; last--);
+
+            if (dst > path + absolute && strncmp(last, "../", 3)) {
+               dst = last;
+               continue;
+            } else if (absolute) {
+               continue;
+            }
+         }
+
+         memcpy(dst, comp, len);
+         dst += len;
+         *dst++ = '/';
+      }
+   }
+
+   if (dst > path + absolute) {
+      dst--;
+   } else if (!absolute) {
+      *dst++ = '.';
+   }
+
+   *dst = '\0';
+
+   return path;
+}
+
+static uint32_t
+dwarf_path_lookup(struct dwarf_path_tab *tab, const char *path) {
+   uint32_t mask = tab->slot_len - 1;
+   uint32_t i;
+
+   if (!tab->slot_len) {
+      return DWARF_PATH_NONE;
+   }
+
+   for (i = dwarf_hash_str(0, path) & mask; tab->slots[i]; 
+         i = (i + 1) & mask) {
+      if (!strcmp(tab->paths[tab->slots[i] - 1], path)) {
+         return tab->slots[i] - 1;
+      }
+   }
+
+   return DWARF_PATH_NONE;
+}
+
+static uint32_t
+dwarf_path_child(struct dwarf_path_tab *tab, uint32_t parent, 
+      const char *comp, uint32_t len) {
+   uint32_t mask = tab->edge_len - 1;
+   struct dwarf_path_node *node;
+   uint32_t i;
+
+   if (!tab->edge_len) {
+      return 0;
+   }
+
+   for (i = dwarf_path_comp_hash(parent, comp, len) & mask; tab->edges[i]; 
+         i = (i + 1) & mask) {
+      node = &tab->nodes[tab->edges[i] - 1];
+
+      if (node->parent == parent && node->comp_len == len && 
+            !memcmp(node->comp, comp, len)) {
+         return tab->edges[i] - 1;
+      }
+   }
+
+   return 0;
+}
+
+static void
+dwarf_path_grow_edges(Dwarf *dwarf, struct dwarf_path_tab *tab) {
+   uint32_t len = tab->edge_len ? tab->edge_len << 1 : 256;
+   struct dwarf_path_node *node;
+   uint32_t i, j;
+
+   dwarf_mem_free(dwarf, tab->edges);
+   tab->edges = dwarf_mem_calloc(dwarf, len, sizeof(uint32_t));
+   tab->edge_len = len;
+
+   for (i = 1; i < tab->node_count; i++) {
+      node = &tab->nodes[i];
+
+      for (j = dwarf_path_comp_hash(node->parent, node->comp, node->comp_len) 
+            & (len - 1); tab->edges[j]; j = (j + 1) & (len - 1));
+
+      tab->edges[j] = i + 1;
+   }
+}
+
+static uint32_t
+dwarf_path_add_node(Dwarf *dwarf, struct dwarf_path_tab *tab, uint32_t parent, 
+      const char *comp, uint32_t len) {
+   uint32_t node = dwarf_path_child(tab, parent, comp, len);
+   uint32_t i;
+
+   if (node) {
+      return node;
+   }
+
+   if (tab->node_count == tab->node_len) {
+      tab->node_len <<= 1;
+      tab->nodes = dwarf_mem_realloc(dwarf, tab->nodes, 
+            tab->node_len * sizeof(struct dwarf_path_node));
+   }
+
+   node = tab->node_count++;
+   memset(&tab->nodes[node], 0, sizeof(struct dwarf_path_node));
+   tab->nodes[node].parent = parent;
+   tab->nodes[node].comp = comp;
+   tab->nodes[node].comp_len = len;
+
+   if (2 * tab->node_count > tab->edge_len) {
+      dwarf_path_grow_edges(dwarf, tab);
+   } else {
+      for (i = dwarf_path_comp_hash(parent, comp, len) & (tab->edge_len - 1); 
+            tab->edges[i]; i = (i + 1) & (tab->edge_len - 1));
+
+      tab->edges[i] = node + 1;
+   }
+
+   return node;
+}
+
+static void
+dwarf_path_node_add_id(Dwarf *dwarf, struct dwarf_path_node *node, 
+      uint32_t id) {
+   if (node->id_count == node->id_len) {
+      node->id_len = node->id_len ? node->id_len << 1 : 2;
+      node->ids = dwarf_mem_realloc(dwarf, node->ids, 
+            node->id_len * sizeof(uint32_t));
+   }
+
+   node->ids[node->id_count++] = id;
+}
+
+/* Takes ownership of path. */
+static uint32_t
+dwarf_path_intern(Dwarf *dwarf, struct dwarf_path_tab *tab, char *path) {
+   uint32_t id = dwarf_path_lookup(tab, path);
+   uint32_t node = 0;
+   uint32_t i, j;
+   char *end;
+   char *comp;
+
+   if (id != DWARF_PATH_NONE) {
+      dwarf_mem_free(dwarf, path);
+      return id;
+   }
+
+   if (tab->count == tab->len) {
+      tab->len = tab->len ? tab->len << 1 : 64;
+      tab->paths = dwarf_mem_realloc(dwarf, tab->paths, 
+            tab->len * sizeof(char *));
+   }
+
+   id = tab->count++;
+   tab->paths[id] = path;
+
+   if (2 * tab->count > tab->slot_len) {
+      dwarf_mem_free(dwarf, tab->slots);
+      tab->slot_len = tab->slot_len ? tab->slot_len << 1 : 128;
+      tab->slots = dwarf_mem_calloc(dwarf, tab->slot_len, sizeof(uint32_t));
+
+      for (i = 0; i < tab->count; i++) {
+         for (j = dwarf_hash_str(0, tab->paths[i]) & (tab->slot_len - 1); 
+               tab->slots[j]; j = (j + 1) & (tab->slot_len - 1));
+
+         tab->slots[j] = i + 1;
+      }
+   } else {
+      for (j = dwarf_hash_str(0, path) & (tab->slot_len - 1); tab->slots[j]; 
+            j = (j + 1) & (tab->slot_len - 1));
+
+      tab->slots[j] = id + 1;
+   }
+
+   /* the path is recorded at every node on its way from the last component */
+   for (end = path + strlen(path); end > path; end = comp) {
+      for (comp = end; comp > path && comp[-1] != '/'; comp--);
+
+      if (end > comp) {
+         node = dwarf_path_add_node(dwarf, tab, node, comp, end - comp);
+         dwarf_path_node_add_id(dwarf, &tab->nodes[node], id);
+      }
+
+      if (comp > path) {
+         comp--;
+      }
+   }
+
+   return id;
+}
+
+static void
+dwarf_sprog_add_paths(Dwarf *dwarf, struct dwarf_path_tab *tab, 
+      dwarf_sprog *sprog, const char *comp_dir) {
+   dwarf_sprog_file *file;
+   uint32_t count = 0;
+   const char *dir;
+
+   dwarf_load_sprog_pro(dwarf, sprog);
+
+   for (file = sprog->prologue->files; file != NULL; file = file->next) {
+      count++;
+   }
+
+   sprog->file_ids = dwarf_mem_alloc(dwarf, 
+         (count ? count : 1) * sizeof(uint32_t));
+   sprog->file_count = count;
+
+   for (file = sprog->prologue->files, count = 0; file != NULL; 
+         file = file->next, count++) {
+      dir = file->dir_idx ? 
+         dwarf_get_dir(sprog->prologue, file->dir_idx) : NULL;
+      sprog->file_ids[count] = dwarf_path_intern(dwarf, tab, 
+            dwarf_path_normalize(dwarf, comp_dir, dir, file->name));
+   }
+}
+
+static void
+dwarf_free_paths(Dwarf *dwarf, struct dwarf_path_tab *tab) {
+   uint32_t i;
+
+   if (!tab) {
+      return;
+   }
+
+   for (i = 0; i < tab->count; i++) {
+      dwarf_mem_free(dwarf, tab->paths[i]);
+   }
+
+   for (i = 0; i < tab->node_count; i++) {
+      dwarf_mem_free(dwarf, tab->nodes[i].ids);
+   }
+
+   dwarf_mem_free(dwarf, tab->paths);
+   dwarf_mem_free(dwarf, tab->slots);
+   dwarf_mem_free(dwarf, tab->nodes);
+   dwarf_mem_free(dwarf, tab->edges);
+   dwarf_mem_free(dwarf, tab);
+}
+
+int
+dwarf_paths_build(Dwarf *dwarf) {
+   struct dwarf_path_tab *tab;
+   dwarf_sprog *sprog;
+   dwarf_die *volatile root = NULL;
+   dwarf_cu *cu;
+   uint32_t i;
+
+   if (dwarf->paths) {
+      return 0;
+   }
+
+   tab = dwarf_mem_calloc(dwarf, 1, sizeof(struct dwarf_path_tab));
+   tab->node_len = 64;
+   tab->node_count = 1;
+   tab->nodes = dwarf_mem_calloc(dwarf, tab->node_len, 
+         sizeof(struct dwarf_path_node));
+
+   if (setjmp(dwarf->env)) {
+      dwarf_free_die(dwarf, root);
+      dwarf_free_paths(dwarf, tab);
+
+      for (i = 0; i < dwarf->sprog_count; i++) {
+         dwarf_mem_free(dwarf, dwarf->sprogs[i]->file_ids);
+         dwarf->sprogs[i]->file_ids = NULL;
+         dwarf->sprogs[i]->file_count = 0;
+      }
+
+      return -1;
+   }
+
+   /* only the root DIEs are needed for the compilation directories */
+   for (i = 0; i < dwarf->cu_count; i++) {
+      cu = dwarf->cus[i];
+      root = cu->die ? cu->die : dwarf_read_cu_root(dwarf, cu);
+
+      if (root && (sprog = dwarf_cu_get_sprog_root(dwarf, root)) && 
+            !sprog->file_ids) {
+         dwarf_sprog_add_paths(dwarf, tab, sprog, 
+               dwarf_die_get_str(dwarf, root, DW_AT_comp_dir));
+      }
+
+      if (root != cu->die) {
+         dwarf_free_die(dwarf, root);
+      }
+
+      root = NULL;
+   }
+
+   for (i = 0; i < dwarf->sprog_count; i++) {
+      if (!dwarf->sprogs[i]->file_ids) {
+         dwarf_sprog_add_paths(dwarf, tab, dwarf->sprogs[i], NULL);
+      }
+   }
+
+   dwarf->paths = tab;
+
+   return 0;
+}
+
+uint32_t
+dwarf_path_count(Dwarf *dwarf) {
+   if (dwarf_paths_build(dwarf)) {
+      return 0;
+   }
+
+   return dwarf->paths->count;
+}
+
+const char *
+dwarf_path(Dwarf *dwarf, uint32_t id) {
+   if (dwarf_paths_build(dwarf) || id >= dwarf->paths->count) {
+      return NULL;
+   }
+
+   return dwarf->paths->paths[id];
+}
+
+uint32_t
+dwarf_sprog_file_id(Dwarf *dwarf, dwarf_sprog *sprog, uint32_t file_idx) {
+   if (dwarf_paths_build(dwarf) || !file_idx || 
+         file_idx > sprog->file_count) {
+      return DWARF_PATH_NONE;
+   }
+
+   return sprog->file_ids[file_idx - 1];
+}
+
+uint32_t
+dwarf_paths_find(Dwarf *dwarf, const char *suffix, uint32_t *ids, 
+      uint32_t max) {
+   struct dwarf_path_tab *tab;
+   struct dwarf_path_node *node;
+   const char *end;
+   const char *comp;
+   uint32_t cur = 0;
+   uint32_t id;
+   char *path;
+
+   if (dwarf_paths_build(dwarf)) {
+      return 0;
+   }
+
+   tab = dwarf->paths;
+
+   /* an absolute path can only match itself */
+   if (suffix[0] == '/') {
+      path = dwarf_path_normalize(dwarf, NULL, NULL, suffix);
+      id = dwarf_path_lookup(tab, path);
+      dwarf_mem_free(dwarf, path);
+
+      if (id == DWARF_PATH_NONE) {
+         return 0;
+      }
+      if (max) {
+         ids[0] = id;
+      }
+
+      return 1;
+   }
+
+   for (end = suffix + strlen(suffix); end > suffix; end = comp) {
+      for (comp = end; comp > suffix && comp[-1] != '/'; comp--);
+
+      if (end > comp && !(end - comp == 1 && comp[0] == '.')) {
+         if (!(cur = dwarf_path_child(tab, cur, comp, end - comp))) {
+            return 0;
+         }
+      }
+
+      if (comp > suffix) {
+         comp--;
+      }
+   }
+
+   if (!cur) {
+      return 0;
+   }
+
+   node = &tab->nodes[cur];
+
+   if (max) {
+      memcpy(ids, node->ids, 
+            (node->id_count < max ? node->id_count : max) * sizeof(uint32_t));
+   }
+
+   return node->id_count;
+}
+
+/* The address of a row starting a line, see dwarf_line_addrs(). */
+typedef struct {
+   uint64_t address;
+   uint32_t file_id;
+   uint32_t line;
+} dwarf_line_start;
+
+struct dwarf_line_index {
+   dwarf_line *rows;          /* sorted by address */
+   uint32_t count;
+   dwarf_line_start *by_line; /* sorted by path, line and address */
+   uint32_t by_line_count;
+};
+
+static void
+dwarf_free_lines(Dwarf *dwarf, struct dwarf_line_index *index) {
+   if (!index) {
+      return;
+   }
+
+   dwarf_mem_free(dwarf, index->rows);
+   dwarf_mem_free(dwarf, index->by_line);
+   dwarf_mem_free(dwarf, index);
+}
+
+static int
+dwarf_line_addr_cmp(const void *a, const void *b) {
+   const dwarf_line *la = a;
+   const dwarf_line *lb = b;
+
+   return la->address < lb->address ? -1 : la->address > lb->address;
+}
+
+static int
+dwarf_line_line_cmp(const void *a, const void *b) {
+   const dwarf_line_start *la = a;
+   const dwarf_line_start *lb = b;
+
+   if (la->file_id != lb->file_id) {
+      return la->file_id < lb->file_id ? -1 : 1;
+   }
+   if (la->line != lb->line) {
+      return la->line < lb->line ? -1 : 1;
+   }
+
+   return la->address < lb->address ? -1 : la->address > lb->address;
+}
+
+/*
+ * Adds the rows of a line program to index. Rows are only kept for 
+ * addresses they cover, while the starts of lines, unless starts_len is 
+ * NULL, are taken from all rows: a row followed by one at the same address 
+ * covers nothing, but its line still begins there.
+ */
+static void
+dwarf_lines_add(Dwarf *dwarf, struct dwarf_line_index *index, 
+      dwarf_sprog *sprog, uint32_t *rows_len, uint32_t *starts_len) {
+   dwarf_sm_regs *regs = dwarf_sprog_get_regs(dwarf, sprog);
+   dwarf_sm_regs *prev = NULL;
+   dwarf_line_start *start;
+   dwarf_line *row;
+
+   for (; regs != NULL; regs = regs->next) {
+      /* registers are recorded after every opcode, not only for rows */
+      if (regs->opcode != DW_LNS_copy && !regs->end_sequence &&
+            regs->opcode < sprog->prologue->opcode_base) {
+         continue;
+      }
+
+      if (prev && (uint64_t)regs->address > (uint64_t)prev->address) {
+         if (index->count == *rows_len) {
+            *rows_len = *rows_len ? *rows_len << 1 : 1024;
+            index->rows = dwarf_mem_realloc(dwarf, index->rows, 
+                  *rows_len * sizeof(dwarf_line));
+         }
+
+         row = &index->rows[index->count++];
+         row->address = prev->address;
+         row->size = (uint64_t)regs->address - (uint64_t)prev->address;
+         row->file_id = dwarf_sprog_file_id(dwarf, sprog, prev->file);
+         row->line = prev->line;
+      }
+
+      /* a line split into several rows by column or view is found once */
+      if (starts_len && !regs->end_sequence && (!prev || 
+               prev->file != regs->file || prev->line != regs->line)) {
+         if (index->by_line_count == *starts_len) {
+            *starts_len = *starts_len ? *starts_len << 1 : 1024;
+            index->by_line = dwarf_mem_realloc(dwarf, index->by_line, 
+                  *starts_len * sizeof(dwarf_line_start));
+         }
+
+         start = &index->by_line[index->by_line_count++];
+         start->address = regs->address;
+         start->file_id = dwarf_sprog_file_id(dwarf, sprog, regs->file);
+         start->line = regs->line;
+      }
+
+      prev = regs->end_sequence ? NULL : regs;
+   }
+}
+
+/*
+ * Reads the rows of all line programs into index, sorted by address, and 
+ * the starts of lines if starts is set.
+ */
+static void
+dwarf_lines_collect(Dwarf *dwarf, struct dwarf_line_index *index, 
+      bool starts) {
+   uint32_t starts_len = 0;
+   uint32_t rows_len = 0;
+   uint32_t i;
+
+   dwarf_advise(dwarf, ELF_ADV_SEQUENTIAL);
+
+   for (i = 0; i < dwarf->sprog_count; i++) {
+      dwarf_lines_add(dwarf, index, dwarf->sprogs[i], &rows_len, 
+            starts ? &starts_len : NULL);
+   }
+
+   dwarf_advise(dwarf, ELF_ADV_RANDOM);
+   qsort(index->rows, index->count, sizeof(dwarf_line), dwarf_line_addr_cmp);
+}
+
+int
+dwarf_lines_build(Dwarf *dwarf) {
+   struct dwarf_line_index *index;
+   dwarf_line_start *starts;
+   uint32_t count;
+   uint32_t i;
+
+   if (dwarf->lines) {
+      return 0;
+   }
+
+   if (dwarf_paths_build(dwarf)) {
+      return -1;
+   }
+
+   index = dwarf_mem_calloc(dwarf, 1, sizeof(struct dwarf_line_index));
+   dwarf_lines_collect(dwarf, index, true);
+
+   starts = index->by_line;
+   qsort(starts, index->by_line_count, sizeof(dwarf_line_start), 
+         dwarf_line_line_cmp);
+
+   /* sequences emitted more than once give the same start again */
+   for (i = 0, count = 0; i < index->by_line_count; i++) {
+      if (!count || dwarf_line_line_cmp(&starts[count - 1], &starts[i])) {
+         starts[count++] = starts[i];
+      }
+   }
+
+   index->by_line_count = count;
+   dwarf->lines = index;
+
+   return 0;
+}
+
+const dwarf_line *
+dwarf_line_at(Dwarf *dwarf, uint64_t pc) {
+   struct dwarf_line_index *index;
+   uint32_t lo = 0;
+   uint32_t hi;
+   uint32_t mid;
+
+   if (dwarf_lines_build(dwarf)) {
+      return NULL;
+   }
+
+   index = dwarf->lines;
+   hi = index->count;
+
+   /* find the last row starting at or before pc */
+   while (lo < hi) {
+      mid = lo + ((hi - lo) >> 1);
+
+      if (index->rows[mid].address <= pc) {
+         lo = mid + 1;
+      } else {
+         hi = mid;
+      }
+   }
+
+   if (lo && pc - index->rows[lo - 1].address < index->rows[lo - 1].size) {
+      return &index->rows[lo - 1];
+   }
+
+   return NULL;
+}
+
+uint32_t
+dwarf_line_addrs(Dwarf *dwarf, uint32_t file_id, uint32_t line, 
+      uint64_t *addrs, uint32_t max) {
+   struct dwarf_line_index *index;
+   dwarf_line_start *row;
+   uint32_t count = 0;
+   uint32_t lo = 0;
+   uint32_t hi;
+   uint32_t mid;
+
+   if (dwarf_lines_build(dwarf)) {
+      return 0;
+   }
+
+   index = dwarf->lines;
+   hi = index->by_line_count;
+
+   while (lo < hi) {
+      mid = lo + ((hi - lo) >> 1);
+      row = &index->by_line[mid];
+
+      if (row->file_id < file_id || 
+            (row->file_id == file_id && row->line < line)) {
+         lo = mid + 1;
+      } else {
+         hi = mid;
+      }
+   }
+
+   for (; lo < index->by_line_count; lo++) {
+      row = &index->by_line[lo];
+
+      if (row->file_id != file_id || row->line != line) {
+         break;
+      }
+
+      if (count < max) {
+         addrs[count] = row->address;
+      }
+      count++;
+   }
+
+   return count;
+}
+
+/*
+ * A row of a compressed block takes one byte if it starts where the last 
+ * row ended, in the same file, with a size of 1 to 16 and a line delta of 
+ * -4 to 3: the size - 1 in the low and the delta + 4 in the high bits. 
+ * Other rows start with DWARF_LINE_LONG and flags, then the size, the line 
+ * delta and, if flagged, the gap to the last row and the file.
+ */
+#define DWARF_LINE_LONG 0x80
+#define DWARF_LINE_GAP 0x01
+#define DWARF_LINE_FILE 0x02
+#define DWARF_LINE_ROW_MAX (1 + 4 * DWARF_LEB_MAX)
+
+typedef struct {
+   uint64_t address;          /* of the first row */
+   uint32_t file_id;
+   uint32_t line;
+   uint64_t offset;           /* of the encoded rows in data */
+} dwarf_line_block;
+
+struct dwarf_line_blocks {
+   dwarf_line_block *blocks;  /* DWARF_LINE_BLOCK_ROWS rows each */
+   uint32_t block_count;
+   uint32_t count;
+   uint8_t *data;
+   uint64_t size;
+};
+
+static void
+dwarf_free_line_blocks(Dwarf *dwarf, struct dwarf_line_blocks *blocks) {
+   if (!blocks) {
+      return;
+   }
+
+   dwarf_mem_free(dwarf, blocks->blocks);
+   dwarf_mem_free(dwarf, blocks->data);
+   dwarf_mem_free(dwarf, blocks);
+}
+
+static uint32_t
+dwarf_put_uleb(uint8_t *buf, uint64_t val) {
+   uint32_t len = 0;
+
+   do {
+      buf[len] = val & 0x7f;
+      val >>= 7;
+      buf[len++] |= val ? 0x80 : 0;
+   } while (val);
+
+   return len;
+}
+
+static uint32_t
+dwarf_put_sleb(uint8_t *buf, int64_t val) {
+   uint32_t len = 0;
+   bool more;
+   uint8_t byte;
+
+   do {
+      byte = val & 0x7f;
+      val >>= 7;
+      more = !((val == 0 && !(byte & 0x40)) || (val == -1 && (byte & 0x40)));
+      buf[len++] = byte | (more ? 0x80 : 0);
+   } while (more);
+
+   return len;
+}
+
+static void
+dwarf_line_encode(struct dwarf_line_blocks *blocks, dwarf_line *row, 
+      dwarf_line *last) {
+   uint8_t *pos = blocks->data + blocks->size;
+   uint8_t *flags;
+   int64_t gap = row->address - (last->address + last->size);
+   int64_t delta = (int64_t)row->line - last->line;
+
+   if (!gap && row->file_id == last->file_id && row->size <= 16 && 
+         delta >= -4 && delta <= 3) {
+      *pos++ = (row->size - 1) | (delta + 4) << 4;
+   } else {
+      flags = pos++;
+      *flags = DWARF_LINE_LONG;
+      pos += dwarf_put_uleb(pos, row->size);
+      pos += dwarf_put_sleb(pos, delta);
+
+      if (gap) {
+         *flags |= DWARF_LINE_GAP;
+         pos += dwarf_put_sleb(pos, gap);
+      }
+
+      if (row->file_id != last->file_id) {
+         *flags |= DWARF_LINE_FILE;
+         pos += dwarf_put_uleb(pos, row->file_id);
+      }
+   }
+
+   blocks->size = pos - blocks->data;
+}
+
+int
+dwarf_lines_compress(Dwarf *dwarf) {
+   struct dwarf_line_index rows = {0};
+   struct dwarf_line_index *index = dwarf->lines;
+   struct dwarf_line_blocks *blocks;
+   dwarf_line_block *block;
+   dwarf_line last = {0};
+   dwarf_line *row;
+   uint64_t data_len = 0;
+   uint32_t i;
+
+   if (dwarf->line_blocks) {
+      return 0;
+   }
+
+   if (!index) {
+      if (dwarf_paths_build(dwarf)) {
+         return -1;
+      }
+
+      dwarf_lines_collect(dwarf, &rows, false);
+      index = &rows;
+   }
+
+   blocks = dwarf_mem_calloc(dwarf, 1, sizeof(struct dwarf_line_blocks));
+   blocks->count = index->count;
+   blocks->block_count = (index->count + DWARF_LINE_BLOCK_ROWS - 1) / 
+      DWARF_LINE_BLOCK_ROWS;
+   blocks->blocks = dwarf_mem_alloc(dwarf, 
+         (blocks->block_count ? blocks->block_count : 1) * 
+         sizeof(dwarf_line_block));
+
+   for (i = 0; i < index->count; i++) {
+      row = &index->rows[i];
+
+      /* the first row of a block is encoded against the block header */
+      if (i % DWARF_LINE_BLOCK_ROWS == 0) {
+         block = &blocks->blocks[i / DWARF_LINE_BLOCK_ROWS];
+         block->address = row->address;
+         block->file_id = row->file_id;
+         block->line = row->line;
+         block->offset = blocks->size;
+         last = *row;
+         last.size = 0;
+      }
+
+      if (blocks->size + DWARF_LINE_ROW_MAX > data_len) {
+         data_len = data_len ? data_len << 1 : 4096;
+         blocks->data = dwarf_mem_realloc(dwarf, blocks->data, data_len);
+      }
+
+      dwarf_line_encode(blocks, row, &last);
+      last = *row;
+   }
+
+   blocks->data = dwarf_mem_realloc(dwarf, blocks->data, 
+         blocks->size ? blocks->size : 1);
+   dwarf_mem_free(dwarf, rows.rows);
+   dwarf->line_blocks = blocks;
+
+   return 0;
+}
+
+bool
+dwarf_line_find(Dwarf *dwarf, uint64_t pc, dwarf_line *line) {
+   struct dwarf_line_blocks *blocks;
+   dwarf_line_block *block;
+   dwarf_line row;
+   dwarf_line next;
+   dwarf_cursor cur;
+   uint32_t lo = 0;
+   uint32_t hi;
+   uint32_t mid;
+   uint32_t count;
+   uint32_t i;
+   uint8_t flags;
+
+   if (dwarf_lines_compress(dwarf)) {
+      return false;
+   }
+
+   blocks = dwarf->line_blocks;
+   hi = blocks->block_count;
+
+   /* find the last block starting at or before pc */
+   while (lo < hi) {
+      mid = lo + ((hi - lo) >> 1);
+
+      if (blocks->blocks[mid].address <= pc) {
+         lo = mid + 1;
+      } else {
+         hi = mid;
+      }
+   }
+
+   if (!lo) {
+      return false;
+   }
+
+   block = &blocks->blocks[lo - 1];
+   count = blocks->count - (lo - 1) * DWARF_LINE_BLOCK_ROWS;
+   count = count < DWARF_LINE_BLOCK_ROWS ? count : DWARF_LINE_BLOCK_ROWS;
+
+   /* the data was written by us, so it is read without checks */
+   dwarf_cur_init(&cur, dwarf, "line table", (char *)blocks->data, 
+         (char *)blocks->data + block->offset, 
+         (char *)blocks->data + blocks->size);
+   row.address = block->address;
+   row.size = 0;
+   row.file_id = block->file_id;
+   row.line = block->line;
+
+   for (i = 0; i < count; i++) {
+      next = row;
+      next.address += row.size;
+      flags = dwarf_cur_u8(&cur, false);
+
+      if (!(flags & DWARF_LINE_LONG)) {
+         next.size = (flags & 0xf) + 1;
+         next.line += (flags >> 4) - 4;
+      } else {
+         next.size = dwarf_cur_uleb(&cur, false);
+         next.line += dwarf_cur_sleb(&cur, false);
+
+         if (flags & DWARF_LINE_GAP) {
+            next.address += dwarf_cur_sleb(&cur, false);
+         }
+
+         if (flags & DWARF_LINE_FILE) {
+            next.file_id = dwarf_cur_uleb(&cur, false);
+         }
+      }
+
+      if (next.address > pc) {
+         break;
+      }
+
+      row = next;
+   }
+
+   if (pc - row.address >= row.size) {
+      return false;
+   }
+
+   *line = row;
+
+   return true;
+}
+
+struct dwarf_func_index {
+   dwarf_func *funcs;         /* sorted by low_pc */
+   uint32_t count;
+   dwarf_func **by_name;      /* named functions sorted by name */
+   uint32_t name_count;
+};
+
+#define DWARF_EXPR_STACK 64
+#define DWARF_EXPR_STEPS 65536
+
+static dwarf_expr *
+dwarf_expr_new(Elf_Mem *mem, char *buf, uint32_t len, uint8_t addr_size) {
+   dwarf_expr *expr = elf_mem_calloc(mem, 1, sizeof(dwarf_expr) + 
+         len * sizeof(dwarf_expr_op));
+   uint32_t *op_idx = elf_mem_calloc(mem, len + 1, sizeof(uint32_t));
+   char *pos = buf;
+   char *end = buf + len;
+   dwarf_expr_op *op;
+   int64_t sval;
+   uint64_t val;
+   bool ok = true;
+   uint32_t i;
+
+   expr->data = buf;
+
+   while (ok && pos < end) {
+      /* index + 1 of the instruction starting at each byte offset */
+      op_idx[pos - buf] = expr->op_count + 1;
+      op = &expr->ops[expr->op_count++];
+      op->raw_op = op->op = (uint8_t)*pos++;
+
+      switch (op->raw_op) {
+         case DW_OP_addr:
+            ok = dwarf_read_fixed(&pos, end, addr_size, &op->arg1);
+            break;
+         case DW_OP_const1u:
+         case DW_OP_const2u:
+         case DW_OP_const4u:
+         case DW_OP_const8u:
+            op->op = DW_OP_constu;
+            ok = dwarf_read_fixed(&pos, end, 
+                  1 << ((op->raw_op - DW_OP_const1u) >> 1), &op->arg1);
+            break;
+         case DW_OP_const1s:
+         case DW_OP_const2s:
+         case DW_OP_const4s:
+         case DW_OP_const8s:
+            op->op = DW_OP_consts;
+            ok = dwarf_read_fixed_signed(&pos, end, 
+                  1 << ((op->raw_op - DW_OP_const1s) >> 1), &op->arg1);
+            break;
+         case DW_OP_constu:
+         case DW_OP_plus_uconst:
+         case DW_OP_regx:
+         case DW_OP_piece:
+            ok = dwarf_read_uleb(&pos, end, &op->arg1);
+            break;
+         case DW_OP_consts:
+         case DW_OP_fbreg:
+            ok = dwarf_read_sleb(&pos, end, &sval);
+            op->arg1 = sval;
+            break;
+         case DW_OP_bregx:
+            ok = dwarf_read_uleb(&pos, end, &op->arg1) && 
+               dwarf_read_sleb(&pos, end, &sval);
+            op->arg2 = sval;
+            break;
+         case DW_OP_pick:
+            ok = dwarf_read_fixed(&pos, end, 1, &op->arg1);
+            break;
+         case DW_OP_deref_size:
+         case DW_OP_xderef_size:
+            /* the value is read into a 64-bit stack entry */
+            ok = dwarf_read_fixed(&pos, end, 1, &op->arg1) && 
+               op->arg1 && op->arg1 <= addr_size && op->arg1 <= 8;
+            break;
+         case DW_OP_skip:
+         case DW_OP_bra:
+            /* byte offset of the target, resolved below */
+            ok = dwarf_read_fixed_signed(&pos, end, 2, &val);
+            op->arg1 = (pos - buf) + (int64_t)val;
+            break;
+         case DW_OP_call2:
+            ok = dwarf_read_fixed(&pos, end, 2, &op->arg1);
+            break;
+         case DW_OP_call4:
+         case DW_OP_call_ref:
+            ok = dwarf_read_fixed(&pos, end, 4, &op->arg1);
+            break;
+         case DW_OP_bit_piece:
+            ok = dwarf_read_uleb(&pos, end, &op->arg1) && 
+               dwarf_read_uleb(&pos, end, &op->arg2);
+            break;
+         case DW_OP_implicit_value:
+            ok = dwarf_read_uleb(&pos, end, &op->arg1) && 
+               op->arg1 <= (uint64_t)(end - pos);
+            op->arg2 = pos - buf;
+            pos += ok ? op->arg1 : 0;
+            break;
+         case DW_OP_deref:
+         case DW_OP_dup:
+         case DW_OP_drop:
+         case DW_OP_over:
+         case DW_OP_swap:
+         case DW_OP_rot:
+         case DW_OP_xderef:
+         case DW_OP_abs:
+         case DW_OP_and:
+         case DW_OP_div:
+         case DW_OP_minus:
+         case DW_OP_mod:
+         case DW_OP_mul:
+         case DW_OP_neg:
+         case DW_OP_not:
+         case DW_OP_or:
+         case DW_OP_plus:
+         case DW_OP_shl:
+         case DW_OP_shr:
+         case DW_OP_shra:
+         case DW_OP_xor:
+         case DW_OP_eq:
+         case DW_OP_ge:
+         case DW_OP_gt:
+         case DW_OP_le:
+         case DW_OP_lt:
+         case DW_OP_ne:
+         case DW_OP_nop:
+         case DW_OP_push_object_address:
+         case DW_OP_form_tls_address:
+         case DW_OP_call_frame_cfa:
+         case DW_OP_stack_value:
+         case DW_OP_GNU_push_tls_address:
+            break;
+         default:
+            if (op->raw_op >= DW_OP_lit0 && op->raw_op <= DW_OP_lit31) {
+               op->op = DW_OP_constu;
+               op->arg1 = op->raw_op - DW_OP_lit0;
+            } else if (op->raw_op >= DW_OP_reg0 && op->raw_op <= DW_OP_reg31) {
+               op->op = DW_OP_regx;
+               op->arg1 = op->raw_op - DW_OP_reg0;
+            } else if (op->raw_op >= DW_OP_breg0 && 
+                  op->raw_op <= DW_OP_breg31) {
+               op->op = DW_OP_bregx;
+               op->arg1 = op->raw_op - DW_OP_breg0;
+               ok = dwarf_read_sleb(&pos, end, &sval);
+               op->arg2 = sval;
+            } else {
+               ok = false;
+            }
+            break;
+      }
+   }
+
+   op_idx[len] = expr->op_count + 1;
+
+   for (i = 0; ok && i < expr->op_count; i++) {
+      op = &expr->ops[i];
+
+      if (op->op == DW_OP_skip || op->op == DW_OP_bra) {
+         if (op->arg1 > len || !op_idx[op->arg1]) {
+            ok = false;
+         } else {
+            op->arg1 = op_idx[op->arg1] - 1;
+         }
+      }
+   }
+
+   elf_mem_free(mem, op_idx);
+
+   if (!ok) {
+      elf_mem_free(mem, expr);
+      return NULL;
+   }
+
+   return elf_mem_realloc(mem, expr, sizeof(dwarf_expr) + 
+         expr->op_count * sizeof(dwarf_expr_op));
+}
+
+dwarf_expr *
+dwarf_expr_compile(char *buf, uint32_t len, uint8_t addr_size) {
+   Elf_Mem mem = { NULL, NULL };
+
+   return dwarf_expr_new(&mem, buf, len, addr_size);
+}
+
+#define EXPR_PUSH(val) do { \
+   uint64_t _val = (val); \
+   if (sp == DWARF_EXPR_STACK) return -1; \
+   stack[sp++] = _val; \
+} while (0)
+
+#define EXPR_POP(val) do { \
+   if (sp == 0) return -1; \
+   (val) = stack[--sp]; \
+} while (0)
+
+#define EXPR_NEED(n) do { \
+   if (sp < (n)) return -1; \
+} while (0)
+
+int
+dwarf_expr_eval(dwarf_expr *expr, dwarf_expr_ctx *ctx, 
+      dwarf_expr_result *res) {
+   uint64_t stack[DWARF_EXPR_STACK];
+   uint32_t sp = 0;
+   uint32_t pc = 0;
+   uint32_t steps = 0;
+   dwarf_expr_op *op;
+   uint64_t a, b;
+   uint64_t val;
+
+   res->kind = DWARF_LOC_ADDR;
+   res->data = NULL;
+   res->len = 0;
+
+   if (ctx->push_cfa) {
+      EXPR_PUSH(ctx->cfa);
+   }
+
+   while (pc < expr->op_count) {
+      if (++steps > DWARF_EXPR_STEPS) {
+         return -1;
+      }
+
+      op = &expr->ops[pc++];
+
+      switch (op->op) {
+         case DW_OP_addr:
+         case DW_OP_constu:
+         case DW_OP_consts:
+            EXPR_PUSH(op->arg1);
+            break;
+         case DW_OP_dup:
+            EXPR_NEED(1);
+            EXPR_PUSH(stack[sp - 1]);
+            break;
+         case DW_OP_drop:
+            EXPR_POP(a);
+            break;
+         case DW_OP_over:
+            EXPR_NEED(2);
+            EXPR_PUSH(stack[sp - 2]);
+            break;
+         case DW_OP_pick:
+            EXPR_NEED(op->arg1 + 1);
+            EXPR_PUSH(stack[sp - 1 - op->arg1]);
+            break;
+         case DW_OP_swap:
+            EXPR_NEED(2);
+            a = stack[sp - 1];
+            stack[sp - 1] = stack[sp - 2];
+            stack[sp - 2] = a;
+            break;
+         case DW_OP_rot:
+            EXPR_NEED(3);
+            a = stack[sp - 1];
+            stack[sp - 1] = stack[sp - 2];
+            stack[sp - 2] = stack[sp - 3];
+            stack[sp - 3] = a;
+            break;
+         case DW_OP_deref:
+         case DW_OP_deref_size:
+            EXPR_POP(a);
+            val = 0;
+            b = op->op == DW_OP_deref ? ctx->addr_size : op->arg1;
+            if (!ctx->read_mem || b > sizeof(val) || 
+                  !ctx->read_mem(ctx->arg, a, &val, b)) {
+               return -1;
+            }
+            EXPR_PUSH(val);
+            break;
+         case DW_OP_abs:
+            EXPR_POP(a);
+            EXPR_PUSH((int64_t)a < 0 ? -a : a);
+            break;
+         case DW_OP_neg:
+            EXPR_POP(a);
+            EXPR_PUSH(-a);
+            break;
+         case DW_OP_not:
+            EXPR_POP(a);
+            EXPR_PUSH(~a);
+            break;
+         case DW_OP_plus_uconst:
+            EXPR_POP(a);
+            EXPR_PUSH(a + op->arg1);
+            break;
+         case DW_OP_and:
+         case DW_OP_div:
+         case DW_OP_minus:
+         case DW_OP_mod:
+         case DW_OP_mul:
+         case DW_OP_or:
+         case DW_OP_plus:
+         case DW_OP_shl:
+         case DW_OP_shr:
+         case DW_OP_shra:
+         case DW_OP_xor:
+         case DW_OP_eq:
+         case DW_OP_ge:
+         case DW_OP_gt:
+         case DW_OP_le:
+         case DW_OP_lt:
+         case DW_OP_ne:
+            EXPR_POP(b);
+            EXPR_POP(a);
+
+            switch (op->op) {
+               case DW_OP_and: val = a & b; break;
+               case DW_OP_minus: val = a - b; break;
+               case DW_OP_mul: val = a * b; break;
+               case DW_OP_or: val = a | b; break;
+               case DW_OP_plus: val = a + b; break;
+               case DW_OP_shl: val = b < 64 ? a << b : 0; break;
+               case DW_OP_shr: val = b < 64 ? a >> b : 0; break;
+               case DW_OP_shra: val = (int64_t)a >> (b < 64 ? b : 63); break;
+               case DW_OP_xor: val = a ^ b; break;
+               case DW_OP_eq: val = a == b; break;
+               case DW_OP_ge: val = (int64_t)a >= (int64_t)b; break;
+               case DW_OP_gt: val = (int64_t)a > (int64_t)b; break;
+               case DW_OP_le: val = (int64_t)a <= (int64_t)b; break;
+               case DW_OP_lt: val = (int64_t)a < (int64_t)b; break;
+               case DW_OP_ne: val = a != b; break;
+               case DW_OP_div:
+                  if (!b || (a == (uint64_t)INT64_MIN && 
+                           (int64_t)b == -1)) {
+                     return -1;
+                  }
+                  val = (int64_t)a / (int64_t)b;
+                  break;
+               default: /* DW_OP_mod */
+                  if (!b) {
+                     return -1;
+                  }
+                  val = a % b;
+                  break;
+            }
+
+            EXPR_PUSH(val);
+            break;
+         case DW_OP_skip:
+            pc = op->arg1;
+            break;
+         case DW_OP_bra:
+            EXPR_POP(a);
+            if (a) {
+               pc = op->arg1;
+            }
+            break;
+         case DW_OP_regx:
+            res->kind = DWARF_LOC_REG;
+            res->value = op->arg1;
+            return 0;
+         case DW_OP_bregx:
+            if (!ctx->read_reg || !ctx->read_reg(ctx->arg, op->arg1, &val)) {
+               return -1;
+            }
+            EXPR_PUSH(val + op->arg2);
+            break;
+         case DW_OP_fbreg:
+            EXPR_PUSH(ctx->frame_base + op->arg1);
+            break;
+         case DW_OP_call_frame_cfa:
+            EXPR_PUSH(ctx->cfa);
+            break;
+         case DW_OP_stack_value:
+            EXPR_POP(res->value);
+            res->kind = DWARF_LOC_VALUE;
+            return 0;
+         case DW_OP_implicit_value:
+            res->kind = DWARF_LOC_IMPLICIT;
+            res->data = expr->data + op->arg2;
+            res->len = op->arg1;
+            return 0;
+         case DW_OP_nop:
+            break;
+         default:
+            /* pieces, calls, TLS and object addresses are not supported */
+            return -1;
+      }
+   }
+
+   EXPR_POP(res->value);
+
+   return 0;
+}
+
+void
+dwarf_expr_dump(FILE *out, dwarf_expr *expr) {
+   const dwarf_op *op_name;
+   dwarf_expr_op *op;
+   uint32_t i;
+
+   for (i = 0; i < expr->op_count; i++) {
+      op = &expr->ops[i];
+
+      if (i) {
+         fprintf(out, "; ");
+      }
+
+      if (op->raw_op >= DW_OP_lit0 && op->raw_op <= DW_OP_lit31) {
+         fprintf(out, "DW_OP_lit%d", op->raw_op - DW_OP_lit0);
+         continue;
+      } else if (op->raw_op >= DW_OP_reg0 && op->raw_op <= DW_OP_reg31) {
+         fprintf(out, "DW_OP_reg%d", op->raw_op - DW_OP_reg0);
+         continue;
+      } else if (op->raw_op >= DW_OP_breg0 && op->raw_op <= DW_OP_breg31) {
+         fprintf(out, "DW_OP_breg%d %" PRId64, op->raw_op - DW_OP_breg0, 
+               (int64_t)op->arg2);
+         continue;
+      }
+
+      op_name = get_op(op->raw_op);
+      fprintf(out, "%s", op_name ? op_name->name : "DW_OP_unknown");
+
+      switch (op->raw_op) {
+         case DW_OP_addr:
+            fprintf(out, " 0x%" PRIx64, op->arg1);
+            break;
+         case DW_OP_const1s:
+         case DW_OP_const2s:
+         case DW_OP_const4s:
+         case DW_OP_const8s:
+         case DW_OP_consts:
+         case DW_OP_fbreg:
+            fprintf(out, " %" PRId64, (int64_t)op->arg1);
+            break;
+         case DW_OP_const1u:
+         case DW_OP_const2u:
+         case DW_OP_const4u:
+         case DW_OP_const8u:
+         case DW_OP_constu:
+         case DW_OP_plus_uconst:
+         case DW_OP_regx:
+         case DW_OP_piece:
+         case DW_OP_pick:
+         case DW_OP_deref_size:
+         case DW_OP_xderef_size:
+         case DW_OP_call2:
+         case DW_OP_call4:
+         case DW_OP_call_ref:
+            fprintf(out, " %" PRIu64, op->arg1);
+            break;
+         case DW_OP_bregx:
+            fprintf(out, " %" PRIu64 " %" PRId64, op->arg1, (int64_t)op->arg2);
+            break;
+         case DW_OP_bit_piece:
+            fprintf(out, " %" PRIu64 " %" PRIu64, op->arg1, op->arg2);
+            break;
+         case DW_OP_skip:
+         case DW_OP_bra:
+            fprintf(out, " <%" PRIu64 ">", op->arg1);
+            break;
+         case DW_OP_implicit_value:
+            fprintf(out, " %" PRIu64 " bytes", op->arg1);
+            break;
+         default:
+            break;
+      }
+   }
+}
+
+static bool
+dwarf_die_get_addr(dwarf_die *die, dwarf_att_id att_id, uint64_t *addr) {
+   dwarf_die_att *att = dwarf_die_get_att(die, att_id);
+
+   if (!att || att->att_spec->form->id != DW_FORM_addr) {
+      return false;
+   }
+
+   *addr = att->value.ul_val;
+
+   return true;
+}
+
+static bool
+dwarf_die_get_pc_range(dwarf_die *die, uint64_t *low_pc, uint64_t *high_pc) {
+   uint64_t val;
+
+   if (!dwarf_die_get_addr(die, DW_AT_low_pc, low_pc)) {
+      return false;
+   }
+
+   if (dwarf_die_get_addr(die, DW_AT_high_pc, high_pc)) {
+      return true;
+   }
+
+   /* since DWARF 4 high_pc may be an offset from low_pc */
+   if (dwarf_die_get_udata(die, DW_AT_high_pc, &val)) {
+      *high_pc = *low_pc + val;
+      return true;
+   }
+
+   return false;
+}
+
+/*
+ * Stores the address ranges of a DIE as low/high pairs in *ranges, either 
+ * from DW_AT_low_pc and DW_AT_high_pc or from DW_AT_ranges. The caller 
+ * frees *ranges.
+ */
+static uint32_t
+dwarf_die_get_ranges(Dwarf *dwarf, dwarf_die *die, uint8_t addr_size, 
+      uint64_t base, uint64_t **ranges) {
+   dwarf_die_att *att;
+   uint64_t max_addr = addr_size < 8 ? 
+      ((uint64_t)1 << (addr_size * 8)) - 1 : UINT64_MAX;
+   uint64_t begin, end;
+   uint32_t count = 0;
+   uint32_t len = 0;
+   char *pos, *sec_end;
+
+   *ranges = NULL;
+
+   if (dwarf_die_get_pc_range(die, &begin, &end)) {
+      *ranges = dwarf_mem_alloc(dwarf, 2 * sizeof(uint64_t));
+      (*ranges)[0] = begin;
+      (*ranges)[1] = end;
+      return 1;
+   }
+
+   if (!(att = dwarf_die_get_att(die, DW_AT_ranges)) || 
+         att->value.ul_val >= dwarf->ranges.size) {
+      return 0;
+   }
+
+   pos = dwarf->ranges.buf + att->value.ul_val;
+   sec_end = dwarf->ranges.buf + dwarf->ranges.size;
+
+   while (dwarf_read_fixed(&pos, sec_end, addr_size, &begin) &&
+         dwarf_read_fixed(&pos, sec_end, addr_size, &end)) {
+      if (!begin && !end) {
+         break;
+      }
+
+      if (begin == max_addr) {
+         base = end;
+         continue;
+      }
+
+      if (begin == end) {
+         continue;
+      }
+
+      if (count == len) {
+         len = len ? len << 1 : 4;
+         *ranges = dwarf_mem_realloc(dwarf, *ranges, 
+               2 * len * sizeof(uint64_t));
+      }
+
+      (*ranges)[2 * count] = base + begin;
+      (*ranges)[2 * count + 1] = base + end;
+      count++;
+   }
+
+   return count;
+}
+
+dwarf_cu *
+dwarf_cu_at_addr(Dwarf *dwarf, uint64_t addr) {
+   dwarf_aranges *aranges = dwarf_get_aranges(dwarf);
+   dwarf_die *volatile root = NULL;
+   dwarf_arange *arange;
+   dwarf_cu *cu;
+   uint64_t *ranges;
+   uint64_t base;
+   uint32_t count;
+   uint32_t i, j;
+
+   for (; aranges != NULL; aranges = aranges->next_ars) {
+      for (arange = aranges->arange; arange != NULL; arange = arange->next_ar) {
+         if (addr >= arange->address && 
+               addr - arange->address < arange->length) {
+            return dwarf_get_cu(dwarf, aranges->hdr.info_off);
+         }
+      }
+   }
+
+   if (setjmp(dwarf->env)) {
+      dwarf_free_die(dwarf, root);
+      return NULL;
+   }
+
+   /* not every producer emits aranges for every CU */
+   for (i = 0; i < dwarf->cu_count; i++) {
+      cu = dwarf->cus[i];
+      root = cu->die ? cu->die : dwarf_read_cu_root(dwarf, cu);
+
+      if (!root) {
+         continue;
+      }
+
+      if (!dwarf_die_get_addr(root, DW_AT_low_pc, &base)) {
+         base = 0;
+      }
+
+      count = dwarf_die_get_ranges(dwarf, root, cu->hdr.addr_size, base, 
+            &ranges);
+
+      if (root != cu->die) {
+         dwarf_free_die(dwarf, root);
+      }
+
+      root = NULL;
+
+      for (j = 0; j < count; j++) {
+         if (addr >= ranges[2 * j] && addr < ranges[2 * j + 1]) {
+            dwarf_mem_free(dwarf, ranges);
+            return cu;
+         }
+      }
+
+      dwarf_mem_free(dwarf, ranges);
+   }
+
+   return NULL;
+}
+
+static void
+dwarf_loc_append(Dwarf *dwarf, dwarf_loc **locs, uint32_t *count, 
+      uint64_t low_pc, 
+      uint64_t high_pc, dwarf_expr *expr) {
+   if (!expr) {
+      return;
+   }
+
+   *locs = dwarf_mem_realloc(dwarf, *locs, (*count + 1) * sizeof(dwarf_loc));
+   (*locs)[*count].low_pc = low_pc;
+   (*locs)[*count].high_pc = high_pc;
+   (*locs)[*count].expr = expr;
+   (*count)++;
+}
+
+/*
+ * Compiles a location description, which is either a single expression or 
+ * an offset into .debug_loc.
+ */
+static uint32_t
+dwarf_read_locs(Dwarf *dwarf, dwarf_die *die, dwarf_att_id att_id, 
+      uint8_t addr_size, uint64_t base, dwarf_loc **locs) {
+   dwarf_die_att *att = dwarf_die_get_att(die, att_id);
+   uint64_t max_addr = addr_size < 8 ? 
+      ((uint64_t)1 << (addr_size * 8)) - 1 : UINT64_MAX;
+   uint64_t begin, end, len;
+   uint32_t count = 0;
+   char *pos, *sec_end;
+
+   *locs = NULL;
+
+   if (!att) {
+      return 0;
+   }
+
+   switch (att->att_spec->form->id) {
+      case DW_FORM_block:
+      case DW_FORM_block1:
+      case DW_FORM_block2:
+      case DW_FORM_block4:
+         dwarf_loc_append(dwarf, locs, &count, 0, UINT64_MAX, 
+               dwarf_expr_new(&dwarf->elf->mem, att->value.b_val->buf, 
+                  att->value.b_val->len, addr_size));
+         return count;
+      case DW_FORM_data4:
+      case DW_FORM_data8:
+         break;
+      default:
+         return 0;
+   }
+
+   if (att->value.ul_val >= dwarf->loc.size) {
+      return 0;
+   }
+
+   pos = dwarf->loc.buf + att->value.ul_val;
+   sec_end = dwarf->loc.buf + dwarf->loc.size;
+
+   while (dwarf_read_fixed(&pos, sec_end, addr_size, &begin) &&
+         dwarf_read_fixed(&pos, sec_end, addr_size, &end)) {
+      if (!begin && !end) {
+         break;
+      }
+
+      if (begin == max_addr) {
+         base = end;
+         continue;
+      }
+
+      if (!dwarf_read_fixed(&pos, sec_end, 2, &len) || 
+            len > (uint64_t)(sec_end - pos)) {
+         break;
+      }
+
+      dwarf_loc_append(dwarf, locs, &count, base + begin, base + end, 
+            dwarf_expr_new(&dwarf->elf->mem, pos, len, addr_size));
+      pos += len;
+   }
+
+   return count;
+}
+
+static dwarf_expr *
+dwarf_loc_find(dwarf_loc *locs, uint32_t count, uint64_t pc) {
+   uint32_t i;
+
+   for (i = 0; i < count; i++) {
+      if (pc >= locs[i].low_pc && pc < locs[i].high_pc) {
+         return locs[i].expr;
+      }
+   }
+
+   return NULL;
+}
+
+static char *
+dwarf_die_get_origin_name(Dwarf *dwarf, dwarf_die *die) {
+   char *name = dwarf_die_get_name(dwarf, die);
+   dwarf_die *origin;
+
+   if (!name && (origin = dwarf_die_get_ref(dwarf, die, 
+               DW_AT_abstract_origin))) {
+      name = dwarf_die_get_origin_name(dwarf, origin);
+   }
+
+   if (!name && (origin = dwarf_die_get_ref(dwarf, die, 
+               DW_AT_specification))) {
+      name = dwarf_die_get_origin_name(dwarf, origin);
+   }
+
+   return name;
+}
+
+static void
+dwarf_func_add_vars(Dwarf *dwarf, dwarf_func *func, dwarf_die *die, 
+      uint64_t low_pc, uint64_t high_pc, uint64_t base, uint32_t *vars_len) {
+   dwarf_die *child;
+   dwarf_var *var;
+   uint64_t block_low, block_high;
+
+   for (child = die->child; child != NULL; child = child->sibling) {
+      switch (dwarf_die_tag(child)) {
+         case DW_TAG_formal_parameter:
+         case DW_TAG_variable:
+            if (func->var_count == *vars_len) {
+               *vars_len = *vars_len ? *vars_len << 1 : 8;
+               func->vars = dwarf_mem_realloc(dwarf, func->vars, 
+                     *vars_len * sizeof(dwarf_var));
+            }
+
+            var = &func->vars[func->var_count];
+            memset(var, 0, sizeof(dwarf_var));
+            var->loc_count = dwarf_read_locs(dwarf, child, DW_AT_location, 
+                  func->addr_size, base, &var->locs);
+
+            /* variables without a location are optimized out */
+            if (var->loc_count) {
+               var->name = dwarf_die_get_origin_name(dwarf, child);
+               var->offset = child->offset;
+               var->is_param = 
+                  dwarf_die_tag(child) == DW_TAG_formal_parameter;
+               var->low_pc = low_pc;
+               var->high_pc = high_pc;
+               func->var_count++;
+            }
+            break;
+         case DW_TAG_lexical_block:
+            if (dwarf_die_get_pc_range(child, &block_low, &block_high)) {
+               dwarf_func_add_vars(dwarf, func, child, block_low, block_high, 
+                     base, vars_len);
+            } else {
+               dwarf_func_add_vars(dwarf, func, child, low_pc, high_pc, 
+                     base, vars_len);
+            }
+            break;
+         default:
+            break;
+      }
+   }
+}
+
+static int
+dwarf_func_cmp(const void *a, const void *b) {
+   const dwarf_func *fa = a;
+   const dwarf_func *fb = b;
+
+   return fa->low_pc < fb->low_pc ? -1 : fa->low_pc > fb->low_pc;
+}
+
+static int
+dwarf_func_name_cmp(const void *a, const void *b) {
+   const dwarf_func *fa = *(dwarf_func * const *)a;
+   const dwarf_func *fb = *(dwarf_func * const *)b;
+   int rc = strcmp(fa->name, fb->name);
+
+   return rc ? rc : dwarf_func_cmp(fa, fb);
+}
+
+static struct dwarf_func_index *
+dwarf_func_index_build(Dwarf *dwarf) {
+   struct dwarf_func_index *index = dwarf_mem_calloc(dwarf, 1, 
+         sizeof(struct dwarf_func_index));
+   size_t budget = dwarf->cache.budget;
+   uint32_t funcs_len = 0;
+   uint32_t vars_len;
+   uint32_t range_count;
+   uint32_t i, j, k;
+   uint64_t *ranges;
+   uint64_t base;
+   dwarf_func *func;
+   dwarf_die *root;
+   dwarf_die *die;
+   dwarf_cu *cu;
+
+   /* origins may live in other CUs, which must not evict this one */
+   dwarf->cache.budget = 0;
+   dwarf_advise(dwarf, ELF_ADV_SEQUENTIAL);
+
+   for (i = 0; i < dwarf->cu_count; i++) {
+      cu = dwarf->cus[i];
+
+      if (!(root = dwarf_cu_get_die(dwarf, cu))) {
+         continue;
+      }
+
+      if (!dwarf_die_get_addr(root, DW_AT_low_pc, &base)) {
+         base = 0;
+      }
+
+      for (j = 0; j < cu->die_count; j++) {
+         die = &cu->dies[j];
+
+         if (dwarf_die_tag(die) != DW_TAG_subprogram) {
+            continue;
+         }
+
+         /* functions split into hot and cold parts get an entry per range */
+         range_count = dwarf_die_get_ranges(dwarf, die, cu->hdr.addr_size, 
+               base, &ranges);
+
+         for (k = 0; k < range_count; k++) {
+            if (index->count == funcs_len) {
+               funcs_len = funcs_len ? funcs_len << 1 : 64;
+               index->funcs = dwarf_mem_realloc(dwarf, index->funcs, 
+                     funcs_len * sizeof(dwarf_func));
+            }
+
+            func = &index->funcs[index->count];
+            memset(func, 0, sizeof(dwarf_func));
+            func->low_pc = ranges[2 * k];
+            func->high_pc = ranges[2 * k + 1];
+            func->name = dwarf_die_get_origin_name(dwarf, die);
+            func->offset = die->offset;
+            func->addr_size = cu->hdr.addr_size;
+            func->frame_base_count = dwarf_read_locs(dwarf, die, 
+                  DW_AT_frame_base, func->addr_size, base, 
+                  &func->frame_base);
+            vars_len = 0;
+            dwarf_func_add_vars(dwarf, func, die, func->low_pc, 
+                  func->high_pc, base, &vars_len);
+            index->count++;
+         }
+
+         dwarf_mem_free(dwarf, ranges);
+      }
+   }
+
+   qsort(index->funcs, index->count, sizeof(dwarf_func), dwarf_func_cmp);
+
+   index->by_name = dwarf_mem_alloc(dwarf, (index->count ? index->count : 1) * 
+         sizeof(dwarf_func *));
+
+   for (i = 0; i < index->count; i++) {
+      if (index->funcs[i].name) {
+         index->by_name[index->name_count++] = &index->funcs[i];
+      }
+   }
+
+   qsort(index->by_name, index->name_count, sizeof(dwarf_func *), 
+         dwarf_func_name_cmp);
+   dwarf_set_cache_budget(dwarf, budget);
+   dwarf_advise(dwarf, ELF_ADV_RANDOM);
+
+   return index;
+}
+
+int
+dwarf_funcs_build(Dwarf *dwarf) {
+   if (!dwarf->funcs) {
+      dwarf->funcs = dwarf_func_index_build(dwarf);
+   }
+
+   return 0;
+}
+
+dwarf_func *
+dwarf_func_at(Dwarf *dwarf, uint64_t pc) {
+   struct dwarf_func_index *index;
+   uint32_t lo = 0;
+   uint32_t hi;
+   uint32_t mid;
+
+   dwarf_funcs_build(dwarf);
+   index = dwarf->funcs;
+   hi = index->count;
+
+   /* find the last function starting at or before pc */
+   while (lo < hi) {
+      mid = lo + ((hi - lo) >> 1);
+
+      if (index->funcs[mid].low_pc <= pc) {
+         lo = mid + 1;
+      } else {
+         hi = mid;
+      }
+   }
+
+   if (lo && pc < index->funcs[lo - 1].high_pc) {
+      return &index->funcs[lo - 1];
+   }
+
+   return NULL;
+}
+
+dwarf_func *
+dwarf_func_find(Dwarf *dwarf, const char *name) {
+   struct dwarf_func_index *index;
+   uint32_t lo = 0;
+   uint32_t hi;
+   uint32_t mid;
+
+   dwarf_funcs_build(dwarf);
+   index = dwarf->funcs;
+   hi = index->name_count;
+
+   while (lo < hi) {
+      mid = lo + ((hi - lo) >> 1);
+
+      if (strcmp(index->by_name[mid]->name, name) < 0) {
+         lo = mid + 1;
+      } else {
+         hi = mid;
+      }
+   }
+
+   if (lo < index->name_count && !strcmp(index->by_name[lo]->name, name)) {
+      return index->by_name[lo];
+   }
+
+   return NULL;
+}
+
+#define DWARF_BATCH_SLICE 16384    /* sorted addresses swept per task */
+
+typedef struct {
+   uint64_t addr;
+   uint32_t idx;              /* position in the caller's arrays */
+} dwarf_batch_ent;
+
+typedef struct {
+   Dwarf *dwarf;
+   dwarf_batch_ent *ents;     /* sorted by address */
+   uint32_t count;
+   dwarf_addr_info *results;
+   uint32_t next_slice;
+} dwarf_batch_job;
+
+/*
+ * Sorts by address, one byte per pass from the lowest. Passes over bytes 
+ * that are equal in all addresses, such as the high bytes of user space 
+ * addresses, are skipped.
+ */
+static dwarf_batch_ent *
+dwarf_batch_sort(Dwarf *dwarf, dwarf_batch_ent *ents, dwarf_batch_ent *tmp, 
+      uint32_t n) {
+   uint32_t (*counts)[256] = dwarf_mem_calloc(dwarf, 8, sizeof(*counts));
+   dwarf_batch_ent *swap;
+   uint32_t pos;
+   uint32_t sum;
+   uint32_t i;
+   uint32_t pass;
+   uint8_t digit;
+
+   for (i = 0; i < n; i++) {
+      for (pass = 0; pass < 8; pass++) {
+         counts[pass][(ents[i].addr >> (pass << 3)) & 0xff]++;
+      }
+   }
+
+   for (pass = 0; pass < 8; pass++) {
+      if (counts[pass][(ents[0].addr >> (pass << 3)) & 0xff] == n) {
+         continue;
+      }
+
+      for (i = 0, sum = 0; i < 256; i++) {
+         pos = counts[pass][i];
+         counts[pass][i] = sum;
+         sum += pos;
+      }
+
+      for (i = 0; i < n; i++) {
+         digit = (ents[i].addr >> (pass << 3)) & 0xff;
+         tmp[counts[pass][digit]++] = ents[i];
+      }
+
+      swap = ents;
+      ents = tmp;
+      tmp = swap;
+   }
+
+   dwarf_mem_free(dwarf, counts);
+
+   return ents;
+}
+
+/*
+ * Returns the number of keys not above pc in a sorted array of count keys 
+ * stride bytes apart, given that the first from keys are not. Gallops 
+ * forward from there, so the cost depends on the distance moved.
+ */
+static uint32_t
+dwarf_batch_seek(const char *keys, size_t stride, uint32_t count, 
+      uint32_t from, uint64_t pc) {
+   uint32_t lo = from;
+   uint32_t hi = from;
+   uint32_t step = 1;
+   uint32_t mid;
+
+   while (hi < count && *(uint64_t *)(keys + hi * stride) <= pc) {
+      lo = hi + 1;
+      hi = count - hi > step ? hi + step : count;
+      step <<= 1;
+   }
+
+   while (lo < hi) {
+      mid = lo + ((hi - lo) >> 1);
+
+      if (*(uint64_t *)(keys + mid * stride) <= pc) {
+         lo = mid + 1;
+      } else {
+         hi = mid;
+      }
+   }
+
+   return lo;
+}
+
+static void
+dwarf_batch_sweep(dwarf_batch_job *job, uint32_t start, uint32_t end) {
+   struct dwarf_line_index *lines = job->dwarf->lines;
+   struct dwarf_func_index *funcs = job->dwarf->funcs;
+   dwarf_addr_info *res;
+   dwarf_line *row;
+   dwarf_func *func;
+   uint32_t r = 0;
+   uint32_t f = 0;
+   uint64_t pc;
+   uint32_t i;
+
+   for (i = start; i < end; i++) {
+      pc = job->ents[i].addr;
+      res = &job->results[job->ents[i].idx];
+      r = dwarf_batch_seek((char *)lines->rows + offsetof(dwarf_line, address), 
+            sizeof(dwarf_line), lines->count, r, pc);
+      f = dwarf_batch_seek((char *)funcs->funcs + offsetof(dwarf_func, low_pc), 
+            sizeof(dwarf_func), funcs->count, f, pc);
+
+      row = r ? &lines->rows[r - 1] : NULL;
+      func = f ? &funcs->funcs[f - 1] : NULL;
+      res->line = row && pc - row->address < row->size ? row : NULL;
+      res->func = func && pc < func->high_pc ? func : NULL;
+   }
+}
+
+static void *
+dwarf_batch_worker(void *arg) {
+   dwarf_batch_job *job = arg;
+   uint32_t slices = (job->count + DWARF_BATCH_SLICE - 1) / DWARF_BATCH_SLICE;
+   uint32_t start;
+   uint32_t idx;
+
+   while ((idx = __atomic_fetch_add(&job->next_slice, 1, __ATOMIC_RELAXED)) < 
+         slices) {
+      start = idx * DWARF_BATCH_SLICE;
+      dwarf_batch_sweep(job, start, job->count - start > DWARF_BATCH_SLICE ? 
+            start + DWARF_BATCH_SLICE : job->count);
+   }
+
+   return NULL;
+}
+
+int
+dwarf_addr2line_batch(Dwarf *dwarf, const uint64_t *addrs, uint32_t n, 
+      dwarf_addr_info *results, int nthreads) {
+   dwarf_batch_job job = { dwarf, NULL, n, results, 0 };
+   dwarf_batch_ent *ents;
+   dwarf_batch_ent *tmp;
+   pthread_t *threads;
+   uint32_t i;
+   int started;
+
+   /* the workers only read the indexes */
+   if (dwarf_lines_build(dwarf) || dwarf_funcs_build(dwarf)) {
+      return -1;
+   }
+
+   if (!n) {
+      return 0;
+   }
+
+   ents = dwarf_mem_alloc(dwarf, n * sizeof(dwarf_batch_ent));
+   tmp = dwarf_mem_alloc(dwarf, n * sizeof(dwarf_batch_ent));
+
+   for (i = 0; i < n; i++) {
+      ents[i].addr = addrs[i];
+      ents[i].idx = i;
+   }
+
+   job.ents = dwarf_batch_sort(dwarf, ents, tmp, n);
+
+   if (nthreads < 1) {
+      nthreads = 1;
+   }
+
+   threads = dwarf_mem_calloc(dwarf, nthreads, sizeof(pthread_t));
+
+   for (started = 0; started < nthreads - 1 && 
+         (uint32_t)started * DWARF_BATCH_SLICE < n; started++) {
+      if (pthread_create(&threads[started], NULL, dwarf_batch_worker, 
+               &job)) {
+         break;
+      }
+   }
+
+   dwarf_batch_worker(&job);
+
+   while (started--) {
+      pthread_join(threads[started], NULL);
+   }
+
+   dwarf_mem_free(dwarf, threads);
+   dwarf_mem_free(dwarf, ents);
+   dwarf_mem_free(dwarf, tmp);
+
+   return 0;
+}
+
+dwarf_expr *
+dwarf_func_frame_base(dwarf_func *func, uint64_t pc) {
+   return dwarf_loc_find(func->frame_base, func->frame_base_count, pc);
+}
+
+uint32_t
+dwarf_vars_at(Dwarf *dwarf, uint64_t pc, dwarf_live_var *vars, 
+      uint32_t max) {
+   dwarf_func *func = dwarf_func_at(dwarf, pc);
+   dwarf_expr *expr;
+   uint32_t count = 0;
+   uint32_t i;
+
+   if (!func) {
+      return 0;
+   }
+
+   for (i = 0; i < func->var_count; i++) {
+      if (pc < func->vars[i].low_pc || pc >= func->vars[i].high_pc) {
+         continue;
+      }
+
+      if ((expr = dwarf_loc_find(func->vars[i].locs, func->vars[i].loc_count, 
+                  pc))) {
+         if (count < max) {
+            vars[count].var = &func->vars[i];
+            vars[count].expr = expr;
+         }
+         count++;
+      }
+   }
+
+   return count;
+}
+
+static void
+dwarf_free_locs(Dwarf *dwarf, dwarf_loc *locs, uint32_t count) {
+   uint32_t i;
+
+   for (i = 0; i < count; i++) {
+      dwarf_mem_free(dwarf, locs[i].expr);
+   }
+
+   dwarf_mem_free(dwarf, locs);
+}
+
+static void
+dwarf_free_funcs(Dwarf *dwarf, struct dwarf_func_index *index) {
+   dwarf_func *func;
+   uint32_t i, j;
+
+   if (!index) {
+      return;
+   }
+
+   for (i = 0; i < index->count; i++) {
+      func = &index->funcs[i];
+      dwarf_free_locs(dwarf, func->frame_base, func->frame_base_count);
+
+      for (j = 0; j < func->var_count; j++) {
+         dwarf_free_locs(dwarf, func->vars[j].locs, func->vars[j].loc_count);
+      }
+
+      dwarf_mem_free(dwarf, func->vars);
+   }
+
+   dwarf_mem_free(dwarf, index->funcs);
+   dwarf_mem_free(dwarf, index->by_name);
+   dwarf_mem_free(dwarf, index);
+}
+
+/*
+ * Skips the value of an attribute, bounded by end. The value of 
+ * DW_AT_sibling, a CU relative offset, is stored in *sibling. Multi-byte 
+ * values are byte swapped if swap is set.
+ */
+static bool
+dwarf_iter_skip_att(char **pos, char *end, dwarf_att_spec *spec, 
+      dwarf_cu_header *hdr, bool swap, uint64_t *sibling) {
+   uint32_t size = dwarf_form_size(spec->form, hdr);
+   uint64_t val;
+
+   if (size != DWARF_SIZE_VARIABLE) {
+      if (!dwarf_read_fixed(pos, end, size, &val)) {
+         return false;
+      }
+      if (spec->id == DW_AT_sibling) {
+         *sibling = swap ? elf_bswap(val, size) : val;
+      }
+      return true;
+   }
+
+   if (!spec->form) {
+      return false;
+   }
+
+   switch (spec->form->id) {
+      case DW_FORM_string: 
+         if (!(*pos = memchr(*pos, '\0', end - *pos))) {
+            return false;
+         }
+         (*pos)++;
+         return true;
+      case DW_FORM_sdata: // fall through
+      case DW_FORM_udata: // fall through
+      case DW_FORM_ref_udata: 
+         if (!dwarf_read_uleb(pos, end, &val)) {
+            return false;
+         }
+         if (spec->id == DW_AT_sibling) {
+            *sibling = val;
+         }
+         return true;
+      case DW_FORM_block: 
+         if (!dwarf_read_uleb(pos, end, &val)) {
+            return false;
+         }
+         break;
+      case DW_FORM_block1: 
+         if (!dwarf_read_fixed(pos, end, 1, &val)) {
+            return false;
+         }
+         break;
+      case DW_FORM_block2: 
+         if (!dwarf_read_fixed(pos, end, 2, &val)) {
+            return false;
+         }
+         val = swap ? elf_bswap(val, 2) : val;
+         break;
+      case DW_FORM_block4: 
+         if (!dwarf_read_fixed(pos, end, 4, &val)) {
+            return false;
+         }
+         val = swap ? elf_bswap(val, 4) : val;
+         break;
+      default:
+         return false;
+   }
+
+   if ((uint64_t)(end - *pos) < val) {
+      return false;
+   }
+
+   *pos += val;
+
+   return true;
+}
+
+/*
+ * Skips the attributes of a DIE. Abbreviations without variable sized 
+ * values are skipped in one step unless the sibling offset is wanted.
+ */
+static bool
+dwarf_iter_skip_atts(dwarf_die_iter *iter, dwarf_abbrev_tab *tab, 
+      bool want_sibling, uint64_t *sibling) {
+   dwarf_att_spec *spec;
+   uint64_t size;
+   bool swap = iter->dwarf->elf && iter->dwarf->elf->swap;
+
+   *sibling = 0;
+
+   if (tab->fixed_size != DWARF_SIZE_VARIABLE && !want_sibling) {
+      size = tab->fixed_size + 
+         (uint64_t)tab->addr_count * iter->cu->hdr.addr_size + 
+         (uint64_t)tab->offset_count * iter->cu->hdr.offset_size + 
+         (uint64_t)tab->ref_addr_count * iter->cu->hdr.ref_addr_size;
+
+      if ((uint64_t)(iter->end - iter->pos) < size) {
+         return false;
+      }
+
+      iter->pos += size;
+      return true;
+   }
+
+   for (spec = tab->atts; spec; spec = spec->next) {
+      if (!dwarf_iter_skip_att(&iter->pos, iter->end, spec, &iter->cu->hdr, 
+               swap, sibling)) {
+         return false;
+      }
+   }
+
+   return true;
+}
+
+/*
+ * Continues after the subtree of the DIE just read if its DW_AT_sibling 
+ * points forward within the CU.
+ */
+static bool
+dwarf_iter_jump(dwarf_die_iter *iter, uint64_t sibling) {
+   char *cu_start = iter->cu->body - iter->cu->hdr.size;
+
+   if (sibling <= (uint64_t)(iter->pos - cu_start) || 
+         sibling > (uint64_t)(iter->end - cu_start)) {
+      return false;
+   }
+
+   iter->pos = cu_start + sibling;
+
+   return true;
+}
+
+static bool
+dwarf_iter_skip_children(dwarf_die_iter *iter, uint64_t sibling) {
+   dwarf_abbrev_tab *tab;
+   uint32_t level = 1;
+   uint64_t code;
+
+   if (dwarf_iter_jump(iter, sibling)) {
+      return true;
+   }
+
+   while (level) {
+      /* subtrees that are not terminated end with the CU */
+      if (iter->pos >= iter->end) {
+         return true;
+      }
+
+      if (!dwarf_read_uleb(&iter->pos, iter->end, &code)) {
+         return false;
+      }
+
+      if (!code) {
+         level--;
+         continue;
+      }
+
+      if (!(tab = dwarf_get_abbrev_tab(iter->cu->atab, code)) || 
+            !dwarf_iter_skip_atts(iter, tab, tab->has_children == yes, 
+               &sibling)) {
+         return false;
+      }
+
+      if (tab->has_children == yes && !dwarf_iter_jump(iter, sibling)) {
+         level++;
+      }
+   }
+
+   return true;
+}
+
+/*
+ * Moves to the next CU in range. Abbreviation tables are loaded here, so a 
+ * scan of CUs whose tables are loaded does not modify dwarf.
+ */
+static int
+dwarf_iter_next_cu(dwarf_die_iter *iter) {
+   Dwarf *dwarf = iter->dwarf;
+   dwarf_cu *cu;
+
+   if (iter->cu_idx >= iter->cu_end) {
+      return 0;
+   }
+
+   cu = dwarf->cus[iter->cu_idx++];
+
+   if (!cu->atab) {
+      if (setjmp(dwarf->env)) {
+         return -1;
+      }
+      cu->atab = dwarf_get_abbrevs(dwarf, cu->hdr.abbrev_off)->tab;
+   }
+
+   iter->cu = cu;
+   iter->pos = cu->body;
+   iter->end = cu->body + cu->body_len;
+   iter->depth = 0;
+
+   return 1;
+}
+
+static bool
+dwarf_iter_matches(dwarf_die_filter *filter, dwarf_tag_id tag) {
+   uint32_t i;
+
+   if (!filter->tags) {
+      return true;
+   }
+
+   for (i = 0; i < filter->tag_count; i++) {
+      if (filter->tags[i] == tag) {
+         return true;
+      }
+   }
+
+   return false;
+}
+
+void
+dwarf_die_iter_init(dwarf_die_iter *iter, Dwarf *dwarf, dwarf_cu *cu, 
+      const dwarf_die_filter *filter) {
+   memset(iter, 0, sizeof(dwarf_die_iter));
+   iter->dwarf = dwarf;
+   iter->filter = *filter;
+   iter->cu_end = dwarf->cu_count;
+
+   if (cu) {
+      while (iter->cu_idx < dwarf->cu_count && 
+            dwarf->cus[iter->cu_idx] != cu) {
+         iter->cu_idx++;
+      }
+      iter->cu_end = iter->cu_idx < dwarf->cu_count ? iter->cu_idx + 1 : 0;
+   }
+}
+
+int
+dwarf_die_iter_next(dwarf_die_iter *iter, dwarf_die_entry *entry) {
+   dwarf_die_filter *filter = &iter->filter;
+   dwarf_abbrev_tab *tab;
+   uint64_t code;
+   uint64_t sibling;
+   uint64_t offset;
+   char *die_pos;
+   bool match;
+   bool descend;
+   int ret;
+
+   dwarf_free_die(iter->dwarf, iter->die);
+   iter->die = NULL;
+   iter->die_tab = NULL;
+
+   while (true) {
+      if (!iter->cu || iter->pos >= iter->end) {
+         if ((ret = dwarf_iter_next_cu(iter)) <= 0) {
+            return ret;
+         }
+         continue;
+      }
+
+      offset = iter->cu->offset + iter->cu->hdr.size + 
+         (iter->pos - iter->cu->body);
+
+      if (!dwarf_read_uleb(&iter->pos, iter->end, &code)) {
+         return -1;
+      }
+
+      if (!code) {
+         if (iter->depth) {
+            iter->depth--;
+         }
+         continue;
+      }
+
+      if (!(tab = dwarf_get_abbrev_tab(iter->cu->atab, code))) {
+         return -1;
+      }
+
+      match = dwarf_iter_matches(filter, tab->tag_id) && 
+         (!filter->depth_limit || iter->depth < filter->depth_limit);
+      descend = tab->has_children == yes && 
+         (!filter->depth_limit || iter->depth + 1 < filter->depth_limit) && 
+         !(match && filter->skip_children);
+      die_pos = iter->pos;
+
+      if (!dwarf_iter_skip_atts(iter, tab, 
+               tab->has_children == yes && !descend, &sibling)) {
+         return -1;
+      }
+
+      if (match) {
+         entry->offset = offset;
+         entry->tag = tab->tag_id;
+         entry->depth = iter->depth;
+         entry->cu = iter->cu;
+         iter->die_off = offset;
+         iter->die_pos = die_pos;
+         iter->die_tab = tab;
+      }
+
+      if (descend) {
+         iter->depth++;
+      } else if (tab->has_children == yes && 
+            !dwarf_iter_skip_children(iter, sibling)) {
+         return -1;
+      }
+
+      if (match) {
+         return 1;
+      }
+   }
+}
+
+dwarf_die *
+dwarf_die_iter_get_die(dwarf_die_iter *iter) {
+   Dwarf *dwarf = iter->dwarf;
+   dwarf_cursor cur;
+
+   if (iter->die || !iter->die_tab) {
+      return iter->die;
+   }
+
+   if (setjmp(dwarf->env)) {
+      return NULL;
+   }
+
+   dwarf_cur_init(&cur, dwarf, ".debug_info", dwarf->info.buf, iter->die_pos, 
+         iter->end);
+   iter->die = dwarf_read_die(&cur, iter->die_tab, &iter->cu->hdr);
+   iter->die->offset = iter->die_off;
+   iter->die->abbrev_code = iter->die_tab->id;
+
+   return iter->die;
+}
+
+void
+dwarf_die_iter_free(dwarf_die_iter *iter) {
+   dwarf_free_die(iter->dwarf, iter->die);
+   iter->die = NULL;
+   iter->die_tab = NULL;
+}
+
+typedef struct {
+   dwarf_die_entry *entries;
+   uint32_t count;
+   int ret;
+} dwarf_collect_cu;
+
+typedef struct {
+   Dwarf *dwarf;
+   const dwarf_die_filter *filter;
+   dwarf_collect_cu *cus;
+   uint32_t next_cu;
+} dwarf_collect_job;
+
+static void *
+dwarf_collect_worker(void *arg) {
+   dwarf_collect_job *job = arg;
+   Dwarf *dwarf = job->dwarf;
+   dwarf_collect_cu *res;
+   dwarf_die_iter iter;
+   dwarf_die_entry entry;
+   uint32_t len;
+   uint32_t idx;
+
+   while ((idx = __atomic_fetch_add(&job->next_cu, 1, __ATOMIC_RELAXED)) < 
+         dwarf->cu_count) {
+      res = &job->cus[idx];
+      len = 0;
+      dwarf_die_iter_init(&iter, dwarf, dwarf->cus[idx], job->filter);
+
+      while ((res->ret = dwarf_die_iter_next(&iter, &entry)) > 0) {
+         if (res->count == len) {
+            len = len ? len << 1 : 64;
+            res->entries = dwarf_mem_realloc(dwarf, res->entries, 
+                  len * sizeof(dwarf_die_entry));
+         }
+         res->entries[res->count++] = entry;
+      }
+
+      dwarf_die_iter_free(&iter);
+   }
+
+   return NULL;
+}
+
+int
+dwarf_dies_collect(Dwarf *dwarf, const dwarf_die_filter *filter, 
+      int nthreads, dwarf_die_entry **entries, uint32_t *count) {
+   dwarf_collect_job job = { dwarf, filter, NULL, 0 };
+   pthread_t *threads;
+   dwarf_cu *cu;
+   volatile uint32_t total = 0;
+   uint32_t i;
+   int started;
+   volatile int ret = 0;
+
+   *entries = NULL;
+   *count = 0;
+
+   if (nthreads < 1) {
+      nthreads = 1;
+   }
+
+   if (setjmp(dwarf->env)) {
+      return -1;
+   }
+
+   /* the workers must not read abbreviation tables concurrently */
+   for (i = 0; i < dwarf->cu_count; i++) {
+      cu = dwarf->cus[i];
+      if (!cu->atab) {
+         cu->atab = dwarf_get_abbrevs(dwarf, cu->hdr.abbrev_off)->tab;
+      }
+   }
+
+   job.cus = dwarf_mem_calloc(dwarf, dwarf->cu_count ? dwarf->cu_count : 1, 
+         sizeof(dwarf_collect_cu));
+   threads = dwarf_mem_calloc(dwarf, nthreads, sizeof(pthread_t));
+   dwarf_advise(dwarf, ELF_ADV_SEQUENTIAL);
+
+   for (started = 0; started < nthreads - 1; started++) {
+      if (pthread_create(&threads[started], NULL, dwarf_collect_worker, 
+               &job)) {
+         break;
+      }
+   }
+
+   dwarf_collect_worker(&job);
+
+   while (started--) {
+      pthread_join(threads[started], NULL);
+   }
+
+   dwarf_mem_free(dwarf, threads);
+   dwarf_advise(dwarf, ELF_ADV_RANDOM);
+
+   for (i = 0; i < dwarf->cu_count; i++) {
+      total += job.cus[i].count;
+      if (job.cus[i].ret < 0) {
+         ret = -1;
+      }
+   }
+
+   if (!ret && total) {
+      *entries = dwarf_mem_alloc(dwarf, total * sizeof(dwarf_die_entry));
+
+      for (i = 0; i < dwarf->cu_count; i++) {
+         memcpy(*entries + *count, job.cus[i].entries, 
+               job.cus[i].count * sizeof(dwarf_die_entry));
+         *count += job.cus[i].count;
+      }
+   }
+
+   for (i = 0; i < dwarf->cu_count; i++) {
+      dwarf_mem_free(dwarf, job.cus[i].entries);
+   }
+
+   dwarf_mem_free(dwarf, job.cus);
+
+   return ret;
+}
+
+/*
+ * Size report. Bytes of DIEs and abbreviation declarations are counted by 
+ * tag, attribute values by tag, attribute and form, and line program 
+ * opcodes by the file they are in. Strings count for the first attribute 
+ * referring to them, as identical strings are merged by the linker.
+ */
+enum {
+   DWARF_SIZE_INFO,
+   DWARF_SIZE_ABBREV,
+   DWARF_SIZE_LINE,
+   DWARF_SIZE_STR,
+   DWARF_SIZE_SECTS
+};
+
+static const char *const dwarf_size_sect_names[] = {
+   ".debug_info", ".debug_abbrev", ".debug_line", ".debug_str"
+};
+
+typedef struct {
+   dwarf_tag_id tag_id;
+   const dwarf_tag *tag;
+   const dwarf_att_spec *spec;  /* NULL for the DIEs of the tag */
+   uint64_t count;
+   uint64_t bytes[DWARF_SIZE_SECTS];
+} dwarf_size_row;
+
+typedef struct {
+   dwarf_cu *cu;
+   const char *name;          /* DW_AT_name of the root DIE */
+   uint64_t stmt_list;        /* UINT64_MAX if the CU has no line program */
+   uint64_t bytes[DWARF_SIZE_SECTS];
+} dwarf_size_unit;
+
+typedef struct {
+   Dwarf *dwarf;
+   bool swap;
+   dwarf_size_row *rows;
+   uint32_t row_count;
+   uint32_t rows_len;
+   uint32_t *row_tab;         /* row index + 1, 0 if empty */
+   uint32_t row_tab_size;
+   dwarf_size_unit *units;
+   uint64_t *files;           /* line program bytes by path ID */
+   uint32_t file_count;       /* the last entry is for unknown files */
+   uint8_t *str_seen;         /* bit per byte of .debug_str counted */
+   uint64_t headers[DWARF_SIZE_SECTS];
+   uint64_t nulls[DWARF_SIZE_SECTS];
+   uint64_t used[DWARF_SIZE_SECTS];
+} dwarf_size_state;
+
+static uint64_t
+dwarf_size_key_hash(dwarf_tag_id tag_id, const dwarf_att_spec *spec) {
+   uint64_t hash = dwarf_hash_mix(0, tag_id);
+
+   if (spec) {
+      hash = dwarf_hash_mix(hash, spec->id);
+      hash = dwarf_hash_mix(hash, spec->form ? spec->form->id : 0);
+   }
+
+   return hash;
+}
+
+static bool
+dwarf_size_row_is(dwarf_size_row *row, dwarf_tag_id tag_id, 
+      const dwarf_att_spec *spec) {
+   if (row->tag_id != tag_id || !row->spec != !spec) {
+      return false;
+   }
+
+   return !spec || (row->spec->id == spec->id && 
+         row->spec->form == spec->form);
+}
+
+static void
+dwarf_size_tab_grow(dwarf_size_state *rep) {
+   uint32_t size = rep->row_tab_size ? rep->row_tab_size << 1 : 256;
+   dwarf_size_row *row;
+   uint32_t slot;
+   uint32_t i;
+
+   dwarf_mem_free(rep->dwarf, rep->row_tab);
+   rep->row_tab = dwarf_mem_calloc(rep->dwarf, size, sizeof(uint32_t));
+   rep->row_tab_size = size;
+
+   for (i = 0; i < rep->row_count; i++) {
+      row = &rep->rows[i];
+      for (slot = dwarf_size_key_hash(row->tag_id, row->spec) & (size - 1); 
+            rep->row_tab[slot]; slot = (slot + 1) & (size - 1));
+      rep->row_tab[slot] = i + 1;
+   }
+}
+
+/* Returns the row of a tag, or of an attribute and form of the tag. */
+static dwarf_size_row *
+dwarf_size_row_get(dwarf_size_state *rep, dwarf_tag_id tag_id, 
+      const dwarf_tag *tag, const dwarf_att_spec *spec) {
+   uint32_t mask = rep->row_tab_size - 1;
+   dwarf_size_row *row;
+   uint32_t slot;
+
+   for (slot = dwarf_size_key_hash(tag_id, spec) & mask; 
+         rep->row_tab[slot]; slot = (slot + 1) & mask) {
+      row = &rep->rows[rep->row_tab[slot] - 1];
+
+      if (dwarf_size_row_is(row, tag_id, spec)) {
+         return row;
+      }
+   }
+
+   if (rep->row_count == rep->rows_len) {
+      rep->rows_len = rep->rows_len ? rep->rows_len << 1 : 256;
+      rep->rows = dwarf_mem_realloc(rep->dwarf, rep->rows, 
+            rep->rows_len * sizeof(dwarf_size_row));
+   }
+
+   row = &rep->rows[rep->row_count++];
+   memset(row, 0, sizeof(dwarf_size_row));
+   row->tag_id = tag_id;
+   row->tag = tag;
+   row->spec = spec;
+   rep->row_tab[slot] = rep->row_count;
+
+   if (rep->row_count * 2 > rep->row_tab_size) {
+      dwarf_size_tab_grow(rep);
+      /* the row array may have moved */
+      row = &rep->rows[rep->row_count - 1];
+   }
+
+   return row;
+}
+
+/*
+ * Counts the bytes of the string at off that no earlier reference counted. 
+ * A string may be the tail of another one, so counting stops at the first 
+ * byte already seen.
+ */
+static uint64_t
+dwarf_size_str(dwarf_size_state *rep, uint64_t off) {
+   dwarf_str *str = rep->dwarf->str;
+   uint64_t start = off;
+
+   if (!str) {
+      return 0;
+   }
+
+   while (off < str->length && 
+         !(rep->str_seen[off >> 3] & (1 << (off & 7)))) {
+      rep->str_seen[off >> 3] |= 1 << (off & 7);
+
+      if (!str->table[off++]) {
+         break;
+      }
+   }
+
+   rep->used[DWARF_SIZE_STR] += off - start;
+
+   return off - start;
+}
+
+/* Reads the offset of a DW_FORM_strp or DW_AT_stmt_list value. */
+static uint64_t
+dwarf_att_offset(char *pos, char *end, bool swap) {
+   uint32_t size = end - pos;
+   uint64_t val;
+
+   if ((size != 4 && size != 8) || !dwarf_read_fixed(&pos, end, size, &val)) {
+      return UINT64_MAX;
+   }
+
+   return swap ? elf_bswap(val, size) : val;
+}
+
+/*
+ * Walks the DIEs of a unit without decoding their values, measuring each 
+ * value with the same code the DIE iterator uses to skip it.
+ */
+static bool
+dwarf_size_info(dwarf_size_state *rep, dwarf_size_unit *unit) {
+   dwarf_cu *cu = unit->cu;
+   char *pos = cu->body;
+   char *end = cu->body + cu->body_len;
+   dwarf_abbrev_tab *tab;
+   dwarf_att_spec *spec;
+   dwarf_size_row *row;
+   bool root = true;
+   uint64_t sibling;
+   uint64_t code;
+   uint64_t str;
+   char *start;
+
+   unit->bytes[DWARF_SIZE_INFO] = cu->hdr.size + cu->body_len;
+   rep->headers[DWARF_SIZE_INFO] += cu->hdr.size;
+   rep->used[DWARF_SIZE_INFO] += cu->hdr.size + cu->body_len;
+
+   while (pos < end) {
+      start = pos;
+
+      if (!dwarf_read_uleb(&pos, end, &code)) {
+         return false;
+      }
+
+      if (!code) {
+         rep->nulls[DWARF_SIZE_INFO] += pos - start;
+         continue;
+      }
+
+      if (!(tab = dwarf_get_abbrev_tab(cu->atab, code))) {
+         return false;
+      }
+
+      row = dwarf_size_row_get(rep, tab->tag_id, tab->tag, NULL);
+      row->count++;
+      row->bytes[DWARF_SIZE_INFO] += pos - start;
+
+      for (spec = tab->atts; spec; spec = spec->next) {
+         start = pos;
+
+         if (!dwarf_iter_skip_att(&pos, end, spec, &cu->hdr, rep->swap, 
+                  &sibling)) {
+            return false;
+         }
+
+         row = dwarf_size_row_get(rep, tab->tag_id, tab->tag, spec);
+         row->count++;
+         row->bytes[DWARF_SIZE_INFO] += pos - start;
+
+         if (spec->form->id == DW_FORM_strp) {
+            code = dwarf_att_offset(start, pos, rep->swap);
+            str = dwarf_size_str(rep, code);
+            row->bytes[DWARF_SIZE_STR] += str;
+            unit->bytes[DWARF_SIZE_STR] += str;
+
+            if (root && spec->id == DW_AT_name) {
+               unit->name = dwarf_str_at(rep->dwarf, code);
+            }
+         } else if (root && spec->form->id == DW_FORM_string && 
+               spec->id == DW_AT_name) {
+            unit->name = start;
+         } else if (root && spec->id == DW_AT_stmt_list) {
+            unit->stmt_list = dwarf_att_offset(start, pos, rep->swap);
+         }
+      }
+
+      root = false;
+   }
+
+   return true;
+}
+
+static int
+dwarf_size_unit_abbrev_cmp(const void *a, const void *b) {
+   const dwarf_size_unit *unit_a = *(const dwarf_size_unit **)a;
+   const dwarf_size_unit *unit_b = *(const dwarf_size_unit **)b;
+
+   if (unit_a->cu->hdr.abbrev_off != unit_b->cu->hdr.abbrev_off) {
+      return unit_a->cu->hdr.abbrev_off < unit_b->cu->hdr.abbrev_off ? -1 : 1;
+   }
+
+   return unit_a < unit_b ? -1 : unit_a > unit_b;
+}
+
+/*
+ * Counts each abbreviation table once, for the first unit using it. The 
+ * tables were read when the units were walked.
+ */
+static void
+dwarf_size_abbrev(dwarf_size_state *rep) {
+   Dwarf *dwarf = rep->dwarf;
+   dwarf_size_unit **units = dwarf_mem_alloc(dwarf, 
+         dwarf->cu_count * sizeof(void *));
+   dwarf_abbrev_tab *tab;
+   dwarf_abbrevs *abbrevs;
+   dwarf_size_row *row;
+   uint64_t decls;
+   uint32_t i;
+
+   for (i = 0; i < dwarf->cu_count; i++) {
+      units[i] = &rep->units[i];
+   }
+
+   qsort(units, dwarf->cu_count, sizeof(void *), dwarf_size_unit_abbrev_cmp);
+
+   for (i = 0; i < dwarf->cu_count; i++) {
+      if (i && units[i]->cu->hdr.abbrev_off == 
+            units[i - 1]->cu->hdr.abbrev_off) {
+         continue;
+      }
+
+      for (abbrevs = dwarf->abbrevs; abbrevs && 
+            abbrevs->offset != units[i]->cu->hdr.abbrev_off; 
+            abbrevs = abbrevs->next);
+
+      if (!abbrevs) {
+         continue;
+      }
+
+      for (tab = abbrevs->tab, decls = 0; tab; tab = tab->next) {
+         row = dwarf_size_row_get(rep, tab->tag_id, tab->tag, NULL);
+         row->bytes[DWARF_SIZE_ABBREV] += tab->decl_size;
+         decls += tab->decl_size;
+      }
+
+      units[i]->bytes[DWARF_SIZE_ABBREV] += abbrevs->size;
+      rep->used[DWARF_SIZE_ABBREV] += abbrevs->size;
+      rep->nulls[DWARF_SIZE_ABBREV] += abbrevs->size - decls;
+   }
+
+   dwarf_mem_free(dwarf, units);
+}
+
+static uint32_t
+dwarf_size_sprog_idx(Dwarf *dwarf, uint64_t offset) {
+   uint32_t lo = 0;
+   uint32_t hi = dwarf->sprog_count;
+   uint32_t mid;
+
+   while (lo < hi) {
+      mid = lo + ((hi - lo) >> 1);
+
+      if (dwarf->sprogs[mid]->offset < offset) {
+         lo = mid + 1;
+      } else if (dwarf->sprogs[mid]->offset > offset) {
+         hi = mid;
+      } else {
+         return mid;
+      }
+   }
+
+   return UINT32_MAX;
+}
+
+static void
+dwarf_size_file(dwarf_size_state *rep, dwarf_sprog *sprog, uint64_t file, 
+      uint64_t bytes) {
+   uint32_t id = file > UINT32_MAX ? DWARF_PATH_NONE : 
+      dwarf_sprog_file_id(rep->dwarf, sprog, file);
+
+   rep->files[id < rep->file_count - 1 ? id : rep->file_count - 1] += bytes;
+}
+
+/*
+ * Counts the opcodes of a line program for the file register in effect 
+ * after each, so DW_LNS_set_file counts for the file it selects.
+ */
+static bool
+dwarf_size_line(dwarf_size_state *rep, dwarf_sprog *sprog, 
+      dwarf_size_unit *unit) {
+   dwarf_sprog_pro *pro = dwarf_sprog_get_pro(rep->dwarf, sprog);
+   char *end = sprog->sm + sprog->sm_len;
+   char *pos = sprog->sm;
+   uint64_t file = 1;
+   uint64_t val;
+   uint8_t opcode;
+   char *start;
+   int i;
+
+   rep->used[DWARF_SIZE_LINE] += sprog->unit_len;
+
+   if (unit) {
+      unit->bytes[DWARF_SIZE_LINE] += sprog->unit_len;
+   }
+
+   if (!pro) {
+      return false;
+   }
+
+   rep->headers[DWARF_SIZE_LINE] += sprog->unit_len - sprog->sm_len;
+
+   while (pos < end) {
+      start = pos;
+      opcode = *pos++;
+
+      if (!opcode) {
+         if (!dwarf_read_uleb(&pos, end, &val) || 
+               val > (uint64_t)(end - pos)) {
+            return false;
+         }
+         pos += val;
+      } else if (opcode == DW_LNS_set_file) {
+         if (!dwarf_read_uleb(&pos, end, &file)) {
+            return false;
+         }
+      } else if (opcode == DW_LNS_fixed_advance_pc) {
+         if (!dwarf_read_fixed(&pos, end, 2, &val)) {
+            return false;
+         }
+      } else if (opcode < pro->opcode_base) {
+         for (i = 0; i < pro->std_opcode_len[opcode]; i++) {
+            if (!dwarf_read_uleb(&pos, end, &val)) {
+               return false;
+            }
+         }
+      }
+
+      dwarf_size_file(rep, sprog, file, pos - start);
+   }
+
+   return true;
+}
+
+typedef struct {
+   uint64_t total;
+   uint32_t idx;
+} dwarf_size_order;
+
+static int
+dwarf_size_order_cmp(const void *a, const void *b) {
+   const dwarf_size_order *order_a = a;
+   const dwarf_size_order *order_b = b;
+
+   if (order_a->total != order_b->total) {
+      return order_a->total > order_b->total ? -1 : 1;
+   }
+
+   return order_a->idx < order_b->idx ? -1 : order_a->idx > order_b->idx;
+}
+
+static uint64_t
+dwarf_size_sum(const uint64_t *bytes) {
+   return bytes[DWARF_SIZE_INFO] + bytes[DWARF_SIZE_ABBREV] + 
+      bytes[DWARF_SIZE_LINE] + bytes[DWARF_SIZE_STR];
+}
+
+static const char *
+dwarf_size_tag_name(dwarf_size_row *row, char *buf, size_t len) {
+   if (row->tag) {
+      return row->tag->name;
+   }
+
+   snprintf(buf, len, "DW_TAG_<0x%x>", row->tag_id);
+   return buf;
+}
+
+static void
+dwarf_size_print_sects(dwarf_size_state *rep, FILE *out) {
+   Dwarf *dwarf = rep->dwarf;
+   uint64_t sizes[DWARF_SIZE_SECTS] = {
+      dwarf->info.size, dwarf->abbrev.size, dwarf->line.size, 
+      dwarf->str ? dwarf->str->length : 0
+   };
+   uint64_t used;
+   int i;
+
+   fprintf(out, "%12s %12s %12s %12s %12s  %s\n", "Size", "Data", 
+         "Headers", "Nulls", "Unused", "Section");
+
+   for (i = 0; i < DWARF_SIZE_SECTS; i++) {
+      used = rep->used[i] < sizes[i] ? rep->used[i] : sizes[i];
+      fprintf(out, "%12" PRIu64 " %12" PRIu64 " %12" PRIu64 " %12" PRIu64 
+            " %12" PRIu64 "  %s\n", sizes[i], 
+            used - rep->headers[i] - rep->nulls[i], rep->headers[i], 
+            rep->nulls[i], sizes[i] - used, dwarf_size_sect_names[i]);
+   }
+}
+
+static void
+dwarf_size_print_units(dwarf_size_state *rep, FILE *out) {
+   uint32_t count = rep->dwarf->cu_count;
+   dwarf_size_order *order = dwarf_mem_alloc(rep->dwarf, 
+         count * sizeof(dwarf_size_order));
+   dwarf_size_unit *unit;
+   uint32_t i;
+
+   for (i = 0; i < count; i++) {
+      order[i].total = dwarf_size_sum(rep->units[i].bytes);
+      order[i].idx = i;
+   }
+
+   qsort(order, count, sizeof(dwarf_size_order), dwarf_size_order_cmp);
+
+   fprintf(out, "\n%12s %12s %12s %12s %12s  %s\n", "Total", "Info", 
+         "Abbrev", "Line", "Str", "Unit");
+
+   for (i = 0; i < count; i++) {
+      unit = &rep->units[order[i].idx];
+      fprintf(out, "%12" PRIu64 " %12" PRIu64 " %12" PRIu64 " %12" PRIu64 
+            " %12" PRIu64 "  0x%" PRIx64 " %s\n", order[i].total, 
+            unit->bytes[DWARF_SIZE_INFO], unit->bytes[DWARF_SIZE_ABBREV], 
+            unit->bytes[DWARF_SIZE_LINE], unit->bytes[DWARF_SIZE_STR], 
+            unit->cu->offset, unit->name ? unit->name : "");
+   }
+
+   dwarf_mem_free(rep->dwarf, order);
+}
+
+/*
+ * Tags count their DIEs, declarations and attribute values. Attributes 
+ * are listed per tag and form.
+ */
+static void
+dwarf_size_print_tags(dwarf_size_state *rep, FILE *out) {
+   dwarf_size_order *order = dwarf_mem_alloc(rep->dwarf, 
+         rep->row_count * sizeof(dwarf_size_order));
+   uint64_t (*totals)[DWARF_SIZE_SECTS];
+   dwarf_size_row *row;
+   dwarf_size_row *tag;
+   uint32_t count = 0;
+   uint32_t i;
+   char buf[32];
+   int j;
+
+   totals = dwarf_mem_calloc(rep->dwarf, rep->row_count, sizeof(*totals));
+
+   for (i = 0; i < rep->row_count; i++) {
+      row = &rep->rows[i];
+      tag = row->spec ? dwarf_size_row_get(rep, row->tag_id, row->tag, NULL) : 
+         row;
+
+      for (j = 0; j < DWARF_SIZE_SECTS; j++) {
+         totals[tag - rep->rows][j] += row->bytes[j];
+      }
+   }
+
+   for (i = 0; i < rep->row_count; i++) {
+      if (!rep->rows[i].spec) {
+         order[count].total = dwarf_size_sum(totals[i]);
+         order[count++].idx = i;
+      }
+   }
+
+   qsort(order, count, sizeof(dwarf_size_order), dwarf_size_order_cmp);
+
+   fprintf(out, "\n%12s %12s %12s %12s %12s  %s\n", "Total", "Info", 
+         "Abbrev", "Str", "Count", "Tag");
+
+   for (i = 0; i < count; i++) {
+      row = &rep->rows[order[i].idx];
+      fprintf(out, "%12" PRIu64 " %12" PRIu64 " %12" PRIu64 " %12" PRIu64 
+            " %12" PRIu64 "  %s\n", order[i].total, 
+            totals[order[i].idx][DWARF_SIZE_INFO], 
+            totals[order[i].idx][DWARF_SIZE_ABBREV], 
+            totals[order[i].idx][DWARF_SIZE_STR], row->count, 
+            dwarf_size_tag_name(row, buf, sizeof(buf)));
+   }
+
+   for (i = 0, count = 0; i < rep->row_count; i++) {
+      if (rep->rows[i].spec) {
+         order[count].total = dwarf_size_sum(rep->rows[i].bytes);
+         order[count++].idx = i;
+      }
+   }
+
+   qsort(order, count, sizeof(dwarf_size_order), dwarf_size_order_cmp);
+
+   fprintf(out, "\n%12s %12s %12s %12s  %s\n", "Total", "Info", "Str", 
+         "Count", "Tag Attribute Form");
+
+   for (i = 0; i < count; i++) {
+      row = &rep->rows[order[i].idx];
+      fprintf(out, "%12" PRIu64 " %12" PRIu64 " %12" PRIu64 " %12" PRIu64 
+            "  %s %s %s\n", order[i].total, row->bytes[DWARF_SIZE_INFO], 
+            row->bytes[DWARF_SIZE_STR], row->count, 
+            dwarf_size_tag_name(row, buf, sizeof(buf)), 
+            dwarf_att_name((dwarf_att_spec *)row->spec), 
+            row->spec->form->name);
+   }
+
+   dwarf_mem_free(rep->dwarf, totals);
+   dwarf_mem_free(rep->dwarf, order);
+}
+
+static void
+dwarf_size_print_files(dwarf_size_state *rep, FILE *out) {
+   dwarf_size_order *order = dwarf_mem_alloc(rep->dwarf, rep->file_count * 
+         sizeof(dwarf_size_order));
+   const char *path;
+   uint32_t count = 0;
+   uint32_t i;
+
+   for (i = 0; i < rep->file_count; i++) {
+      if (rep->files[i]) {
+         order[count].total = rep->files[i];
+         order[count++].idx = i;
+      }
+   }
+
+   qsort(order, count, sizeof(dwarf_size_order), dwarf_size_order_cmp);
+
+   fprintf(out, "\n%12s  %s\n", "Line", "File");
+
+   for (i = 0; i < count; i++) {
+      path = dwarf_path(rep->dwarf, order[i].idx);
+      fprintf(out, "%12" PRIu64 "  %s\n", order[i].total, 
+            path ? path : "<unknown>");
+   }
+
+   dwarf_mem_free(rep->dwarf, order);
+}
+
+int
+dwarf_size_report(Dwarf *dwarf, FILE *out) {
+   dwarf_size_state rep;
+   dwarf_size_unit *volatile units = NULL;
+   uint32_t *sprog_units = NULL;
+   uint32_t idx;
+   uint32_t i;
+   volatile int ret = -1;
+
+   if (dwarf_paths_build(dwarf)) {
+      return -1;
+   }
+
+   memset(&rep, 0, sizeof(rep));
+   rep.dwarf = dwarf;
+   rep.swap = dwarf->elf && dwarf->elf->swap;
+   rep.file_count = dwarf_path_count(dwarf) + 1;
+   rep.files = dwarf_mem_calloc(dwarf, rep.file_count, sizeof(uint64_t));
+   rep.str_seen = dwarf_mem_calloc(dwarf, 
+         dwarf->str ? (dwarf->str->length >> 3) + 1 : 1, 1);
+   rep.units = units = dwarf_mem_calloc(dwarf, dwarf->cu_count, 
+         sizeof(dwarf_size_unit));
+   sprog_units = dwarf_mem_alloc(dwarf, dwarf->sprog_count * sizeof(uint32_t));
+   dwarf_size_tab_grow(&rep);
+
+   if (setjmp(dwarf->env)) {
+      goto out;
+   }
+
+   for (i = 0; i < dwarf->cu_count; i++) {
+      units[i].cu = dwarf->cus[i];
+      units[i].stmt_list = UINT64_MAX;
+
+      if (!dwarf->cus[i]->atab) {
+         dwarf->cus[i]->atab = dwarf_get_abbrevs(dwarf, 
+               dwarf->cus[i]->hdr.abbrev_off)->tab;
+      }
+
+      if (!dwarf_size_info(&rep, &units[i])) {
+         goto out;
+      }
+   }
+
+   dwarf_size_abbrev(&rep);
+
+   memset(sprog_units, 0xff, dwarf->sprog_count * sizeof(uint32_t));
+
+   for (i = 0; i < dwarf->cu_count; i++) {
+      if ((idx = dwarf_size_sprog_idx(dwarf, units[i].stmt_list)) != 
+            UINT32_MAX && sprog_units[idx] == UINT32_MAX) {
+         sprog_units[idx] = i;
+      }
+   }
+
+   for (i = 0; i < dwarf->sprog_count; i++) {
+      if (!dwarf_size_line(&rep, dwarf->sprogs[i], sprog_units[i] == 
+               UINT32_MAX ? NULL : &units[sprog_units[i]])) {
+         goto out;
+      }
+   }
+
+   dwarf_size_print_sects(&rep, out);
+   dwarf_size_print_units(&rep, out);
+   dwarf_size_print_tags(&rep, out);
+   dwarf_size_print_files(&rep, out);
+   ret = ferror(out) ? -1 : 0;
+
+out:
+   dwarf_mem_free(dwarf, sprog_units);
+   dwarf_mem_free(dwarf, units);
+   dwarf_mem_free(dwarf, rep.rows);
+   dwarf_mem_free(dwarf, rep.row_tab);
+   dwarf_mem_free(dwarf, rep.files);
+   dwarf_mem_free(dwarf, rep.str_seen);
+
+   return ret;
+}
+
+#define DWARF_CFI_RULES 128        /* registers tracked while evaluating */
+
+typedef struct {
+   dwarf_cfi_rule cfa;
+   dwarf_cfi_rule regs[DWARF_CFI_RULES];
+} dwarf_cfi_regs;
+
+typedef struct {
+   char *buf;
+   size_t size;
+   uint64_t addr;
+   bool is_eh;                /* .eh_frame rather than .debug_frame */
+} dwarf_cfi_sec;
+
+typedef struct {
+   dwarf_cfi_sec *sec;
+   uint64_t offset;
+   char *insns;
+   char *insns_end;
+   uint64_t code_align;
+   int64_t data_align;
+   uint16_t ra_reg;
+   uint8_t fde_enc;
+   uint8_t addr_size;
+   bool has_aug_data;
+   dwarf_cfi_regs *init;      /* state after the initial instructions */
+} dwarf_cie;
+
+typedef struct {
+   uint64_t low_pc;
+   uint64_t high_pc;
+   uint32_t cie;
+   char *insns;
+   char *insns_end;
+} dwarf_fde;
+
+struct dwarf_cfi_build {
+   dwarf_cfi *cfi;
+   uint32_t rows_len;
+   uint32_t states_len;
+   uint32_t rules_len;
+   uint32_t exprs_len;
+   uint32_t *state_tab;       /* state index + 1, 0 if empty */
+   uint32_t state_tab_size;
+   dwarf_cie *cies;
+   uint32_t cie_count;
+   uint32_t cies_len;
+   dwarf_fde *fdes;
+   uint32_t fde_count;
+   uint32_t fdes_len;
+   dwarf_cfi_rule rules[DWARF_CFI_RULES];
+};
+
+static bool
+dwarf_cfi_read_ptr(dwarf_cfi_sec *sec, char **pos, char *end, uint8_t enc, 
+      uint8_t addr_size, uint64_t *val) {
+   uint64_t addr = sec->addr + (*pos - sec->buf);
+   int64_t sval;
+   bool ok;
+
+   if (enc == DW_EH_PE_omit) {
+      *val = 0;
+      return true;
+   }
+
+   switch (enc & 0x0f) {
+      case DW_EH_PE_absptr:
+         ok = dwarf_read_fixed(pos, end, addr_size, val);
+         break;
+      case DW_EH_PE_uleb128:
+         ok = dwarf_read_uleb(pos, end, val);
+         break;
+      case DW_EH_PE_udata2:
+         ok = dwarf_read_fixed(pos, end, 2, val);
+         break;
+      case DW_EH_PE_udata4:
+         ok = dwarf_read_fixed(pos, end, 4, val);
+         break;
+      case DW_EH_PE_udata8:
+         ok = dwarf_read_fixed(pos, end, 8, val);
+         break;
+      case DW_EH_PE_sleb128:
+         ok = dwarf_read_sleb(pos, end, &sval);
+         *val = sval;
+         break;
+      case DW_EH_PE_sdata2:
+         ok = dwarf_read_fixed_signed(pos, end, 2, val);
+         break;
+      case DW_EH_PE_sdata4:
+         ok = dwarf_read_fixed_signed(pos, end, 4, val);
+         break;
+      case DW_EH_PE_sdata8:
+         ok = dwarf_read_fixed(pos, end, 8, val);
+         break;
+      default:
+         return false;
+   }
+
+   switch (enc & 0x70) {
+      case DW_EH_PE_absptr:
+         break;
+      case DW_EH_PE_pcrel:
+         *val += addr;
+         break;
+      default:
+         /* text, data and function relative pointers need runtime bases */
+         return false;
+   }
+
+   if (addr_size < 8) {
+      *val &= ((uint64_t)1 << (addr_size * 8)) - 1;
+   }
+
+   return ok;
+}
+
+/*
+ * Reads the length and id of a CIE or FDE. Returns the end of the entry or 
+ * NULL at the end of the section.
+ */
+static char *
+dwarf_cfi_read_hdr(dwarf_cfi_sec *sec, char **pos, uint64_t *id, 
+      bool *is_cie) {
+   char *end = sec->buf + sec->size;
+   uint32_t offset_size = 4;
+   uint64_t len;
+   char *entry_end;
+
+   if (!dwarf_read_fixed(pos, end, 4, &len) || !len) {
+      return NULL;
+   }
+
+   if (len == 0xffffffff) {
+      offset_size = 8;
+
+      if (!dwarf_read_fixed(pos, end, 8, &len)) {
+         return NULL;
+      }
+   }
+
+   if (len > (uint64_t)(end - *pos)) {
+      return NULL;
+   }
+
+   entry_end = *pos + len;
+
+   if (!dwarf_read_fixed(pos, entry_end, sec->is_eh ? 4 : offset_size, id)) {
+      return NULL;
+   }
+
+   if (sec->is_eh) {
+      *is_cie = *id == 0;
+   } else {
+      *is_cie = *id == (offset_size == 4 ? 0xffffffff : UINT64_MAX);
+   }
+
+   return entry_end;
+}
+
+static bool dwarf_cfi_exec(struct dwarf_cfi_build *build, dwarf_cie *cie, 
+      char *pos, char *end, dwarf_cfi_regs *regs, uint64_t loc, 
+      uint64_t end_pc);
+
+static int
+dwarf_cfi_read_cie(struct dwarf_cfi_build *build, dwarf_cfi_sec *sec, 
+      uint64_t offset, uint8_t addr_size) {
+   char *pos = sec->buf + offset;
+   char *end;
+   char *aug;
+   char *aug_end;
+   dwarf_cie *cie;
+   uint64_t id;
+   uint64_t val;
+   uint8_t version;
+   uint8_t enc;
+   bool is_cie;
+   uint32_t i;
+
+   for (i = build->cie_count; i > 0; i--) {
+      if (build->cies[i - 1].sec == sec && build->cies[i - 1].offset == offset) {
+         return i - 1;
+      }
+   }
+
+   if (offset >= sec->size || 
+         !(end = dwarf_cfi_read_hdr(sec, &pos, &id, &is_cie)) || !is_cie) {
+      return -1;
+   }
+
+   if (build->cie_count == build->cies_len) {
+      build->cies_len = build->cies_len ? build->cies_len << 1 : 16;
+      build->cies = elf_mem_realloc(&build->cfi->mem, build->cies, 
+            build->cies_len * sizeof(dwarf_cie));
+   }
+
+   cie = &build->cies[build->cie_count];
+   memset(cie, 0, sizeof(dwarf_cie));
+   cie->sec = sec;
+   cie->offset = offset;
+   cie->addr_size = addr_size;
+   cie->fde_enc = DW_EH_PE_absptr;
+
+   if (!dwarf_read_fixed(&pos, end, 1, &val)) {
+      return -1;
+   }
+
+   version = val;
+   aug = pos;
+
+   if (!(pos = memchr(pos, 0, end - pos))) {
+      return -1;
+   }
+
+   pos++;
+
+   if (!strcmp(aug, "eh")) {
+      pos += addr_size;
+   } else if (*aug && *aug != 'z') {
+      return -1;
+   }
+
+   if (version >= 4) {
+      if (!dwarf_read_fixed(&pos, end, 1, &val)) {
+         return -1;
+      }
+      cie->addr_size = val;
+      pos++;
+   }
+
+   if (!dwarf_read_uleb(&pos, end, &cie->code_align) || 
+         !dwarf_read_sleb(&pos, end, &cie->data_align)) {
+      return -1;
+   }
+
+   if (version == 1) {
+      if (!dwarf_read_fixed(&pos, end, 1, &val)) {
+         return -1;
+      }
+   } else if (!dwarf_read_uleb(&pos, end, &val)) {
+      return -1;
+   }
+
+   cie->ra_reg = val;
+
+   if (*aug == 'z') {
+      if (!dwarf_read_uleb(&pos, end, &val) || val > (uint64_t)(end - pos)) {
+         return -1;
+      }
+
+      cie->has_aug_data = true;
+      aug_end = pos + val;
+
+      for (aug++; *aug; aug++) {
+         if (*aug == 'R' || *aug == 'L') {
+            if (!dwarf_read_fixed(&pos, aug_end, 1, &val)) {
+               return -1;
+            }
+            if (*aug == 'R') {
+               cie->fde_enc = val;
+            }
+         } else if (*aug == 'P') {
+            if (!dwarf_read_fixed(&pos, aug_end, 1, &val)) {
+               return -1;
+            }
+            /* only skipped, so indirection does not matter */
+            enc = val & ~DW_EH_PE_indirect;
+            dwarf_cfi_read_ptr(sec, &pos, aug_end, enc, cie->addr_size, &val);
+         } else if (*aug != 'S' && *aug != 'B') {
+            break;
+         }
+      }
+
+      pos = aug_end;
+   }
+
+   cie->insns = pos;
+   cie->insns_end = end;
+   build->cie_count++;
+
+   /* evaluated after the CIE is added, cies may have moved */
+   cie->init = elf_mem_calloc(&build->cfi->mem, 1, sizeof(dwarf_cfi_regs));
+
+   if (!dwarf_cfi_exec(build, cie, cie->insns, cie->insns_end, cie->init, 
+            0, 0)) {
+      build->cie_count--;
+      elf_mem_free(&build->cfi->mem, cie->init);
+      return -1;
+   }
+
+   return build->cie_count - 1;
+}
+
+static void
+dwarf_cfi_scan(struct dwarf_cfi_build *build, dwarf_cfi_sec *sec) {
+   char *pos = sec->buf;
+   char *entry_end;
+   char *id_pos;
+   dwarf_cie *cie;
+   dwarf_fde *fde;
+   uint64_t cie_off;
+   uint64_t id;
+   uint64_t range;
+   uint64_t val;
+   bool is_cie;
+   int cie_idx;
+
+   while (pos < sec->buf + sec->size) {
+      if (!(entry_end = dwarf_cfi_read_hdr(sec, &pos, &id, &is_cie))) {
+         break;
+      }
+
+      if (is_cie) {
+         pos = entry_end;
+         continue;
+      }
+
+      /* in .eh_frame the CIE pointer is relative to the pointer itself */
+      id_pos = pos - (sec->is_eh ? 4 : 0);
+      cie_off = sec->is_eh ? (uint64_t)(id_pos - sec->buf) - id : id;
+
+      if ((cie_idx = dwarf_cfi_read_cie(build, sec, cie_off, 
+                  build->cfi->addr_size)) < 0) {
+         pos = entry_end;
+         continue;
+      }
+
+      cie = &build->cies[cie_idx];
+
+      if (build->fde_count == build->fdes_len) {
+         build->fdes_len = build->fdes_len ? build->fdes_len << 1 : 256;
+         build->fdes = elf_mem_realloc(&build->cfi->mem, build->fdes, 
+               build->fdes_len * sizeof(dwarf_fde));
+      }
+
+      fde = &build->fdes[build->fde_count];
+      fde->cie = cie_idx;
+
+      if (!dwarf_cfi_read_ptr(sec, &pos, entry_end, cie->fde_enc, 
+               cie->addr_size, &fde->low_pc) ||
+            !dwarf_cfi_read_ptr(sec, &pos, entry_end, cie->fde_enc & 0x0f, 
+               cie->addr_size, &range) ||
+            (cie->has_aug_data && (!dwarf_read_uleb(&pos, entry_end, &val) || 
+                  val > (uint64_t)(entry_end - pos)))) {
+         pos = entry_end;
+         continue;
+      }
+
+      if (cie->has_aug_data) {
+         pos += val;
+      }
+
+      fde->high_pc = fde->low_pc + range;
+      fde->insns = pos;
+      fde->insns_end = entry_end;
+
+      if (range) {
+         build->fde_count++;
+      }
+
+      pos = entry_end;
+   }
+}
+
+static bool
+dwarf_cfi_rule_eq(dwarf_cfi_rule *a, dwarf_cfi_rule *b) {
+   return a->reg == b->reg && a->kind == b->kind && a->value == b->value;
+}
+
+static uint64_t
+dwarf_cfi_rule_hash(uint64_t hash, dwarf_cfi_rule *rule) {
+   hash = dwarf_hash_mix(hash, rule->reg | (uint64_t)rule->kind << 16);
+   return dwarf_hash_mix(hash, rule->value);
+}
+
+static void
+dwarf_cfi_state_tab_grow(struct dwarf_cfi_build *build);
+
+/*
+ * Returns the index of the state matching regs, adding it if it is new.
+ */
+static uint32_t
+dwarf_cfi_intern(struct dwarf_cfi_build *build, dwarf_cie *cie, 
+      dwarf_cfi_regs *regs) {
+   dwarf_cfi *cfi = build->cfi;
+   dwarf_cfi_state *state;
+   uint32_t count = 0;
+   uint64_t hash = 0;
+   uint32_t slot;
+   uint32_t i;
+
+   for (i = 0; i < DWARF_CFI_RULES; i++) {
+      if (regs->regs[i].kind != DWARF_RULE_SAME) {
+         build->rules[count] = regs->regs[i];
+         build->rules[count].reg = i;
+         hash = dwarf_cfi_rule_hash(hash, &build->rules[count]);
+         count++;
+      }
+   }
+
+   hash = dwarf_cfi_rule_hash(hash, &regs->cfa);
+   hash = dwarf_hash_mix(hash, cie->ra_reg);
+
+   if ((cfi->state_count + 1) << 1 > build->state_tab_size) {
+      dwarf_cfi_state_tab_grow(build);
+   }
+
+   for (slot = hash & (build->state_tab_size - 1); build->state_tab[slot]; 
+         slot = (slot + 1) & (build->state_tab_size - 1)) {
+      state = &cfi->states[build->state_tab[slot] - 1];
+
+      if (state->rule_count != count || state->ra_reg != cie->ra_reg || 
+            !dwarf_cfi_rule_eq(&state->cfa, &regs->cfa)) {
+         continue;
+      }
+
+      for (i = 0; i < count; i++) {
+         if (!dwarf_cfi_rule_eq(&cfi->rules[state->rules + i], 
+                  &build->rules[i])) {
+            break;
+         }
+      }
+
+      if (i == count) {
+         return build->state_tab[slot] - 1;
+      }
+   }
+
+   if (cfi->state_count == build->states_len) {
+      build->states_len = build->states_len ? build->states_len << 1 : 64;
+      cfi->states = elf_mem_realloc(&build->cfi->mem, cfi->states, 
+            build->states_len * sizeof(dwarf_cfi_state));
+   }
+
+   if (cfi->rule_count + count > build->rules_len) {
+      while (cfi->rule_count + count > build->rules_len) {
+         build->rules_len = build->rules_len ? build->rules_len << 1 : 256;
+      }
+      cfi->rules = elf_mem_realloc(&build->cfi->mem, cfi->rules, 
+            build->rules_len * sizeof(dwarf_cfi_rule));
+   }
+
+   state = &cfi->states[cfi->state_count];
+   state->cfa = regs->cfa;
+   state->ra_reg = cie->ra_reg;
+   state->rule_count = count;
+   state->rules = cfi->rule_count;
+   memcpy(&cfi->rules[cfi->rule_count], build->rules, 
+         count * sizeof(dwarf_cfi_rule));
+   cfi->rule_count += count;
+   build->state_tab[slot] = ++cfi->state_count;
+
+   return cfi->state_count - 1;
+}
+
+static uint64_t
+dwarf_cfi_state_hash(dwarf_cfi *cfi, dwarf_cfi_state *state) {
+   uint64_t hash = 0;
+   uint32_t i;
+
+   for (i = 0; i < state->rule_count; i++) {
+      hash = dwarf_cfi_rule_hash(hash, &cfi->rules[state->rules + i]);
+   }
+
+   hash = dwarf_cfi_rule_hash(hash, &state->cfa);
+
+   return dwarf_hash_mix(hash, state->ra_reg);
+}
+
+static void
+dwarf_cfi_state_tab_grow(struct dwarf_cfi_build *build) {
+   uint32_t size = build->state_tab_size ? build->state_tab_size << 1 : 256;
+   uint32_t slot;
+   uint32_t i;
+
+   elf_mem_free(&build->cfi->mem, build->state_tab);
+   build->state_tab = elf_mem_calloc(&build->cfi->mem, size, sizeof(uint32_t));
+   build->state_tab_size = size;
+
+   for (i = 0; i < build->cfi->state_count; i++) {
+      for (slot = dwarf_cfi_state_hash(build->cfi, &build->cfi->states[i]) & 
+            (size - 1); build->state_tab[slot]; slot = (slot + 1) & (size - 1));
+      build->state_tab[slot] = i + 1;
+   }
+}
+
+static void
+dwarf_cfi_emit(struct dwarf_cfi_build *build, uint64_t pc, uint32_t state) {
+   dwarf_cfi *cfi = build->cfi;
+   dwarf_cfi_row *last = cfi->row_count ? &cfi->rows[cfi->row_count - 1] : NULL;
+
+   if (last && last->low_pc > pc) {
+      return;
+   }
+
+   if (last && last->low_pc == pc) {
+      last->state = state;
+
+      /* the previous row may now be extended instead */
+      if (cfi->row_count > 1 && last[-1].state == state) {
+         cfi->row_count--;
+      }
+      return;
+   }
+
+   if (last && last->state == state) {
+      return;
+   }
+
+   if (cfi->row_count == build->rows_len) {
+      build->rows_len = build->rows_len ? build->rows_len << 1 : 1024;
+      cfi->rows = elf_mem_realloc(&build->cfi->mem, cfi->rows, 
+            build->rows_len * sizeof(dwarf_cfi_row));
+   }
+
+   cfi->rows[cfi->row_count].low_pc = pc;
+   cfi->rows[cfi->row_count].state = state;
+   cfi->row_count++;
+}
+
+static int64_t
+dwarf_cfi_add_expr(struct dwarf_cfi_build *build, char **pos, char *end, 
+      uint8_t addr_size) {
+   dwarf_cfi *cfi = build->cfi;
+   dwarf_expr *expr;
+   uint64_t len;
+
+   if (!dwarf_read_uleb(pos, end, &len) || len > (uint64_t)(end - *pos)) {
+      return -1;
+   }
+
+   expr = dwarf_expr_new(&build->cfi->mem, *pos, len, addr_size);
+   *pos += len;
+
+   if (!expr) {
+      return -1;
+   }
+
+   if (cfi->expr_count == build->exprs_len) {
+      build->exprs_len = build->exprs_len ? build->exprs_len << 1 : 16;
+      cfi->exprs = elf_mem_realloc(&build->cfi->mem, cfi->exprs, 
+            build->exprs_len * sizeof(dwarf_expr *));
+   }
+
+   cfi->exprs[cfi->expr_count] = expr;
+
+   return cfi->expr_count++;
+}
+
+static inline void
+dwarf_cfi_set_rule(dwarf_cfi_regs *regs, uint64_t reg, dwarf_rule_kind kind, 
+      int64_t value) {
+   /* rules of untracked registers are decoded and dropped */
+   if (reg < DWARF_CFI_RULES) {
+      regs->regs[reg].kind = kind;
+      regs->regs[reg].value = value;
+   }
+}
+
+/*
+ * Runs a CIE or FDE program. Rows are emitted only for FDE programs, which 
+ * are recognized by a non-empty address range.
+ */
+static bool
+dwarf_cfi_exec(struct dwarf_cfi_build *build, dwarf_cie *cie, char *pos, 
+      char *end, dwarf_cfi_regs *regs, uint64_t loc, uint64_t end_pc) {
+   dwarf_cfi_regs *stack = NULL;
+   uint32_t stack_len = 0;
+   uint32_t depth = 0;
+   uint64_t new_loc;
+   uint64_t reg;
+   uint64_t val;
+   int64_t sval;
+   int64_t expr;
+   uint8_t op;
+   bool ok = true;
+   bool emit = end_pc > loc;
+
+   while (ok && pos < end) {
+      op = *pos++;
+      new_loc = loc;
+
+      switch (op & 0xc0) {
+         case DW_CFA_advance_loc:
+            new_loc = loc + (op & 0x3f) * cie->code_align;
+            break;
+         case DW_CFA_offset:
+            ok = dwarf_read_uleb(&pos, end, &val);
+            dwarf_cfi_set_rule(regs, op & 0x3f, DWARF_RULE_OFFSET, 
+                  (int64_t)val * cie->data_align);
+            break;
+         case DW_CFA_restore:
+            reg = op & 0x3f;
+            regs->regs[reg] = cie->init ? cie->init->regs[reg] : 
+               (dwarf_cfi_rule){0};
+            break;
+         default:
+            switch (op) {
+               case DW_CFA_nop:
+               case DW_CFA_GNU_window_save:
+                  break;
+               case DW_CFA_set_loc:
+                  ok = dwarf_cfi_read_ptr(cie->sec, &pos, end, cie->fde_enc, 
+                        cie->addr_size, &new_loc);
+                  break;
+               case DW_CFA_advance_loc1:
+               case DW_CFA_advance_loc2:
+               case DW_CFA_advance_loc4:
+                  ok = dwarf_read_fixed(&pos, end, 
+                        1 << (op - DW_CFA_advance_loc1), &val);
+                  new_loc = loc + val * cie->code_align;
+                  break;
+               case DW_CFA_offset_extended:
+               case DW_CFA_val_offset:
+                  ok = dwarf_read_uleb(&pos, end, &reg) && 
+                     dwarf_read_uleb(&pos, end, &val);
+                  dwarf_cfi_set_rule(regs, reg, op == DW_CFA_val_offset ? 
+                        DWARF_RULE_VAL_OFFSET : DWARF_RULE_OFFSET, 
+                        (int64_t)val * cie->data_align);
+                  break;
+               case DW_CFA_offset_extended_sf:
+               case DW_CFA_val_offset_sf:
+                  ok = dwarf_read_uleb(&pos, end, &reg) && 
+                     dwarf_read_sleb(&pos, end, &sval);
+                  dwarf_cfi_set_rule(regs, reg, op == DW_CFA_val_offset_sf ? 
+                        DWARF_RULE_VAL_OFFSET : DWARF_RULE_OFFSET, 
+                        sval * cie->data_align);
+                  break;
+               case DW_CFA_GNU_negative_offset_extended:
+                  ok = dwarf_read_uleb(&pos, end, &reg) && 
+                     dwarf_read_uleb(&pos, end, &val);
+                  dwarf_cfi_set_rule(regs, reg, DWARF_RULE_OFFSET, 
+                        -(int64_t)val * cie->data_align);
+                  break;
+               case DW_CFA_restore_extended:
+                  ok = dwarf_read_uleb(&pos, end, &reg);
+                  if (ok && reg < DWARF_CFI_RULES) {
+                     regs->regs[reg] = cie->init ? cie->init->regs[reg] : 
+                        (dwarf_cfi_rule){0};
+                  }
+                  break;
+               case DW_CFA_undefined:
+               case DW_CFA_same_value:
+                  ok = dwarf_read_uleb(&pos, end, &reg);
+                  dwarf_cfi_set_rule(regs, reg, op == DW_CFA_undefined ? 
+                        DWARF_RULE_UNDEF : DWARF_RULE_SAME, 0);
+                  break;
+               case DW_CFA_register:
+                  ok = dwarf_read_uleb(&pos, end, &reg) && 
+                     dwarf_read_uleb(&pos, end, &val);
+                  dwarf_cfi_set_rule(regs, reg, DWARF_RULE_REG, val);
+                  break;
+               case DW_CFA_remember_state:
+                  if (depth == stack_len) {
+                     stack_len = stack_len ? stack_len << 1 : 4;
+                     stack = elf_mem_realloc(&build->cfi->mem, stack, 
+                           stack_len * sizeof(dwarf_cfi_regs));
+                  }
+                  stack[depth++] = *regs;
+                  break;
+               case DW_CFA_restore_state:
+                  if ((ok = depth > 0)) {
+                     *regs = stack[--depth];
+                  }
+                  break;
+               case DW_CFA_def_cfa:
+                  ok = dwarf_read_uleb(&pos, end, &reg) && 
+                     dwarf_read_uleb(&pos, end, &val);
+                  regs->cfa.kind = DWARF_RULE_CFA_REG;
+                  regs->cfa.reg = reg;
+                  regs->cfa.value = val;
+                  break;
+               case DW_CFA_def_cfa_sf:
+                  ok = dwarf_read_uleb(&pos, end, &reg) && 
+                     dwarf_read_sleb(&pos, end, &sval);
+                  regs->cfa.kind = DWARF_RULE_CFA_REG;
+                  regs->cfa.reg = reg;
+                  regs->cfa.value = sval * cie->data_align;
+                  break;
+               case DW_CFA_def_cfa_register:
+                  ok = dwarf_read_uleb(&pos, end, &reg);
+                  regs->cfa.kind = DWARF_RULE_CFA_REG;
+                  regs->cfa.reg = reg;
+                  break;
+               case DW_CFA_def_cfa_offset:
+                  ok = dwarf_read_uleb(&pos, end, &val);
+                  regs->cfa.value = val;
+                  break;
+               case DW_CFA_def_cfa_offset_sf:
+                  ok = dwarf_read_sleb(&pos, end, &sval);
+                  regs->cfa.value = sval * cie->data_align;
+                  break;
+               case DW_CFA_def_cfa_expression:
+                  expr = dwarf_cfi_add_expr(build, &pos, end, cie->addr_size);
+                  regs->cfa.kind = DWARF_RULE_CFA_EXPR;
+                  regs->cfa.reg = 0;
+                  regs->cfa.value = expr;
+                  ok = expr >= 0;
+                  break;
+               case DW_CFA_expression:
+               case DW_CFA_val_expression:
+                  ok = dwarf_read_uleb(&pos, end, &reg) && 
+                     (expr = dwarf_cfi_add_expr(build, &pos, end, 
+                        cie->addr_size)) >= 0;
+                  if (ok) {
+                     dwarf_cfi_set_rule(regs, reg, op == DW_CFA_expression ? 
+                           DWARF_RULE_EXPR : DWARF_RULE_VAL_EXPR, expr);
+                  }
+                  break;
+               case DW_CFA_GNU_args_size:
+                  ok = dwarf_read_uleb(&pos, end, &val);
+                  break;
+               default:
+                  ok = false;
+                  break;
+            }
+            break;
+      }
+
+      if (emit && new_loc != loc) {
+         if (new_loc < loc || new_loc > end_pc) {
+            ok = false;
+            break;
+         }
+
+         dwarf_cfi_emit(build, loc, dwarf_cfi_intern(build, cie, regs));
+         loc = new_loc;
+      }
+   }
+
+   if (emit) {
+      if (ok) {
+         dwarf_cfi_emit(build, loc, dwarf_cfi_intern(build, cie, regs));
+      }
+      dwarf_cfi_emit(build, end_pc, DWARF_CFI_NONE);
+   }
+
+   elf_mem_free(&build->cfi->mem, stack);
+
+   return ok;
+}
+
+static int
+dwarf_fde_cmp(const void *a, const void *b) {
+   const dwarf_fde *fa = a;
+   const dwarf_fde *fb = b;
+
+   return fa->low_pc < fb->low_pc ? -1 : fa->low_pc > fb->low_pc;
+}
+
+/*
+ * Reads the FDE count of .eh_frame_hdr, which is only used as a size hint.
+ */
+static uint32_t
+dwarf_cfi_hdr_count(Elf *elf, uint8_t addr_size) {
+   Elf_Scn hdr;
+   dwarf_cfi_sec sec;
+   uint64_t count;
+   char *pos;
+   char *end;
+
+   if (elf_get_scn(elf, &hdr, ".eh_frame_hdr") || hdr.size < 4 || 
+         hdr.buf[0] != 1) {
+      return 0;
+   }
+
+   sec.buf = hdr.buf;
+   sec.size = hdr.size;
+   sec.addr = hdr.addr;
+   sec.is_eh = true;
+   pos = hdr.buf + 4;
+   end = hdr.buf + hdr.size;
+
+   if (!dwarf_cfi_read_ptr(&sec, &pos, end, hdr.buf[1], addr_size, &count) ||
+         !dwarf_cfi_read_ptr(&sec, &pos, end, hdr.buf[2], addr_size, &count)) {
+      return 0;
+   }
+
+   return count < hdr.size ? count : 0;
+}
+
+dwarf_cfi *
+dwarf_cfi_build(Elf *elf) {
+   struct dwarf_cfi_build build;
+   dwarf_cfi_sec secs[2];
+   uint32_t sec_count = 0;
+   Elf_Scn scn;
+   uint16_t machine;
+   uint64_t last_pc = 0;
+   dwarf_fde *fde;
+   dwarf_cfi_regs regs;
+   uint32_t i;
+
+   memset(&build, 0, sizeof(build));
+   build.cfi = elf_mem_calloc(&elf->mem, 1, sizeof(dwarf_cfi));
+   build.cfi->mem = elf->mem;
+
+   if (elf->class == ELFCLASS32) {
+      build.cfi->addr_size = 4;
+      machine = ELF_GET(elf, elf->ehdr.hdr32->e_machine);
+   } else {
+      build.cfi->addr_size = 8;
+      machine = ELF_GET(elf, elf->ehdr.hdr64->e_machine);
+   }
+
+   switch (machine) {
+      case EM_X86_64: build.cfi->sp_reg = 7; break;
+      case EM_386: build.cfi->sp_reg = 4; break;
+      case EM_AARCH64: build.cfi->sp_reg = 31; break;
+      case EM_ARM: build.cfi->sp_reg = 13; break;
+      case EM_PPC:
+      case EM_PPC64: build.cfi->sp_reg = 1; break;
+      case EM_RISCV: build.cfi->sp_reg = 2; break;
+      default: build.cfi->sp_reg = DWARF_CFI_NO_REG; break;
+   }
+
+   if (!elf_get_scn(elf, &scn, ".eh_frame")) {
+      secs[sec_count].buf = scn.buf;
+      secs[sec_count].size = scn.size;
+      secs[sec_count].addr = scn.addr;
+      secs[sec_count++].is_eh = true;
+   }
+
+   if (!elf_get_scn(elf, &scn, ".debug_frame")) {
+      secs[sec_count].buf = scn.buf;
+      secs[sec_count].size = scn.size;
+      secs[sec_count].addr = 0;
+      secs[sec_count++].is_eh = false;
+   }
+
+   if (!sec_count) {
+      elf_mem_free(&elf->mem, build.cfi);
+      return NULL;
+   }
+
+   if ((build.fdes_len = dwarf_cfi_hdr_count(elf, build.cfi->addr_size))) {
+      build.fdes = elf_mem_realloc(&elf->mem, NULL, 
+            build.fdes_len * sizeof(dwarf_fde));
+   }
+
+   for (i = 0; i < sec_count; i++) {
+      dwarf_cfi_scan(&build, &secs[i]);
+   }
+
+   qsort(build.fdes, build.fde_count, sizeof(dwarf_fde), dwarf_fde_cmp);
+
+   for (i = 0; i < build.fde_count; i++) {
+      fde = &build.fdes[i];
+
+      /* functions described by both sections, or overlapping garbage */
+      if (fde->low_pc < last_pc) {
+         continue;
+      }
+
+      regs = *build.cies[fde->cie].init;
+      dwarf_cfi_exec(&build, &build.cies[fde->cie], fde->insns, 
+            fde->insns_end, &regs, fde->low_pc, fde->high_pc);
+      last_pc = fde->high_pc;
+   }
+
+   for (i = 0; i < build.cie_count; i++) {
+      elf_mem_free(&elf->mem, build.cies[i].init);
+   }
+
+   elf_mem_free(&elf->mem, build.cies);
+   elf_mem_free(&elf->mem, build.fdes);
+   elf_mem_free(&elf->mem, build.state_tab);
+
+   return build.cfi;
+}
+
+void
+dwarf_cfi_free(dwarf_cfi *cfi) {
+   Elf_Mem mem;
+   uint32_t i;
+
+   if (!cfi) {
+      return;
+   }
+
+   mem = cfi->mem;
+
+   for (i = 0; i < cfi->expr_count; i++) {
+      elf_mem_free(&mem, cfi->exprs[i]);
+   }
+
+   elf_mem_free(&mem, cfi->exprs);
+   elf_mem_free(&mem, cfi->rows);
+   elf_mem_free(&mem, cfi->states);
+   elf_mem_free(&mem, cfi->rules);
+   elf_mem_free(&mem, cfi);
+}
+
+dwarf_cfi *
+dwarf_get_cfi(Dwarf *dwarf) {
+   if (!dwarf->cfi) {
+      dwarf->cfi = dwarf_cfi_build(dwarf->elf);
+   }
+
+   return dwarf->cfi;
+}
+
+dwarf_cfi_state *
+dwarf_cfi_find(dwarf_cfi *cfi, uint64_t pc) {
+   uint32_t lo = 0;
+   uint32_t hi = cfi->row_count;
+   uint32_t mid;
+
+   while (lo < hi) {
+      mid = lo + ((hi - lo) >> 1);
+
+      if (cfi->rows[mid].low_pc <= pc) {
+         lo = mid + 1;
+      } else {
+         hi = mid;
+      }
+   }
+
+   if (!lo || cfi->rows[lo - 1].state == DWARF_CFI_NONE) {
+      return NULL;
+   }
+
+   return &cfi->states[cfi->rows[lo - 1].state];
+}
+
+struct dwarf_cfi_step_ctx {
+   dwarf_frame *frame;
+   void *arg;
+   bool (*read_mem)(void *arg, uint64_t addr, void *buf, size_t len);
+};
+
+static bool
+dwarf_cfi_read_reg(void *arg, uint32_t reg, uint64_t *val) {
+   struct dwarf_cfi_step_ctx *step = arg;
+
+   if (reg >= DWARF_CFI_REGS) {
+      return false;
+   }
+
+   *val = step->frame->regs[reg];
+
+   return true;
+}
+
+static bool
+dwarf_cfi_read_mem(void *arg, uint64_t addr, void *buf, size_t len) {
+   struct dwarf_cfi_step_ctx *step = arg;
+
+   return step->read_mem(step->arg, addr, buf, len);
+}
+
+int
+dwarf_cfi_step(dwarf_cfi *cfi, dwarf_frame *frame, void *arg,
+      bool (*read_mem)(void *arg, uint64_t addr, void *buf, size_t len)) {
+   struct dwarf_cfi_step_ctx step = { frame, arg, read_mem };
+   dwarf_expr_ctx ctx;
+   dwarf_expr_result res;
+   dwarf_cfi_state *state;
+   dwarf_cfi_rule *rule;
+   uint64_t regs[DWARF_CFI_REGS];
+   uint64_t cfa;
+   uint64_t val;
+   bool ra_undef = false;
+   uint32_t i;
+
+   /* return addresses may point past the end of the calling function */
+   if (!(state = dwarf_cfi_find(cfi, frame->depth ? frame->pc - 1 : 
+               frame->pc))) {
+      return -1;
+   }
+
+   memset(&ctx, 0, sizeof(ctx));
+   ctx.arg = &step;
+   ctx.read_reg = dwarf_cfi_read_reg;
+   ctx.read_mem = dwarf_cfi_read_mem;
+   ctx.addr_size = cfi->addr_size;
+
+   if (state->cfa.kind == DWARF_RULE_CFA_REG) {
+      if (state->cfa.reg >= DWARF_CFI_REGS) {
+         return -1;
+      }
+      cfa = frame->regs[state->cfa.reg] + state->cfa.value;
+   } else if (state->cfa.kind == DWARF_RULE_CFA_EXPR) {
+      if (dwarf_expr_eval(cfi->exprs[state->cfa.value], &ctx, &res) || 
+            res.kind != DWARF_LOC_ADDR) {
+         return -1;
+      }
+      cfa = res.value;
+   } else {
+      return -1;
+   }
+
+   ctx.cfa = cfa;
+   ctx.push_cfa = true;
+   memcpy(regs, frame->regs, sizeof(regs));
+
+   if (cfi->sp_reg < DWARF_CFI_REGS) {
+      regs[cfi->sp_reg] = cfa;
+   }
+
+   for (i = 0; i < state->rule_count; i++) {
+      rule = &cfi->rules[state->rules + i];
+
+      if (rule->reg == state->ra_reg && rule->kind == DWARF_RULE_UNDEF) {
+         ra_undef = true;
+      }
+
+      if (rule->reg >= DWARF_CFI_REGS) {
+         continue;
+      }
+
+      val = 0;
+
+      switch (rule->kind) {
+         case DWARF_RULE_UNDEF:
+            break;
+         case DWARF_RULE_OFFSET:
+            if (!read_mem(arg, cfa + rule->value, &val, cfi->addr_size)) {
+               return -1;
+            }
+            break;
+         case DWARF_RULE_VAL_OFFSET:
+            val = cfa + rule->value;
+            break;
+         case DWARF_RULE_REG:
+            if (rule->value >= DWARF_CFI_REGS) {
+               return -1;
+            }
+            val = frame->regs[rule->value];
+            break;
+         case DWARF_RULE_EXPR:
+         case DWARF_RULE_VAL_EXPR:
+            if (dwarf_expr_eval(cfi->exprs[rule->value], &ctx, &res) || 
+                  res.kind != DWARF_LOC_ADDR) {
+               return -1;
+            }
+            val = res.value;
+            if (rule->kind == DWARF_RULE_EXPR && 
+                  !read_mem(arg, res.value, &val, cfi->addr_size)) {
+               return -1;
+            }
+            break;
+         default:
+            continue;
+      }
+
+      regs[rule->reg] = val;
+   }
+
+   if (ra_undef || state->ra_reg >= DWARF_CFI_REGS) {
+      return 1;
+   }
+
+   memcpy(frame->regs, regs, sizeof(regs));
+   frame->pc = regs[state->ra_reg];
+   frame->cfa = cfa;
+   frame->depth++;
+
+   return frame->pc ? 0 : 1;
+}
+
+static void
+dwarf_cfi_rule_dump(dwarf_cfi *cfi, dwarf_cfi_rule *rule) {
+   switch (rule->kind) {
+      case DWARF_RULE_UNDEF:
+         printf("u");
+         break;
+      case DWARF_RULE_OFFSET:
+         printf("[CFA%+" PRId64 "]", rule->value);
+         break;
+      case DWARF_RULE_VAL_OFFSET:
+         printf("CFA%+" PRId64, rule->value);
+         break;
+      case DWARF_RULE_REG:
+      case DWARF_RULE_CFA_REG:
+         printf("r%" PRId64, rule->kind == DWARF_RULE_REG ? rule->value : 
+               (int64_t)rule->reg);
+         if (rule->kind == DWARF_RULE_CFA_REG) {
+            printf("%+" PRId64, rule->value);
+         }
+         break;
+      default:
+         printf(rule->kind == DWARF_RULE_EXPR ? "[" : "{");
+         dwarf_expr_dump(stdout, cfi->exprs[rule->value]);
+         printf(rule->kind == DWARF_RULE_EXPR ? "]" : "}");
+         break;
+   }
+}
+
+void
+dwarf_cfi_dump(dwarf_cfi *cfi) {
+   dwarf_cfi_state *state;
+   uint32_t i, j;
+
+   printf("Unwind table: %u rows, %u states\n", cfi->row_count, 
+         cfi->state_count);
+
+   for (i = 0; i < cfi->row_count; i++) {
+      printf("0x%016" PRIx64 ": ", cfi->rows[i].low_pc);
+
+      if (cfi->rows[i].state == DWARF_CFI_NONE) {
+         printf("<none>\n");
+         continue;
+      }
+
+      state = &cfi->states[cfi->rows[i].state];
+      printf("CFA=");
+      dwarf_cfi_rule_dump(cfi, &state->cfa);
+
+      for (j = 0; j < state->rule_count; j++) {
+         printf(" r%u=", cfi->rules[state->rules + j].reg);
+         dwarf_cfi_rule_dump(cfi, &cfi->rules[state->rules + j]);
+      }
+
+      printf(" (ra=r%u)\n", state->ra_reg);
+   }
+}
+
+/* Hashes the string at off in .debug_str, without its terminator. */
+static uint64_t
+dwarf_cu_hash_str(Dwarf *dwarf, uint64_t hash, uint64_t off) {
+   dwarf_str *str = dwarf->str;
+
+   if (!str || off >= str->length) {
+      return hash;
+   }
+
+   return dwarf_hash_bytes(hash, str->table + off, 
+         strnlen(str->table + off, str->length - off));
+}
+
+/* Hashes a .debug_ranges list up to and including its end entry. */
+static uint64_t
+dwarf_cu_hash_ranges(Dwarf *dwarf, uint64_t hash, uint64_t off, 
+      uint8_t addr_size) {
+   char *pos, *start, *sec_end;
+   uint64_t begin, end;
+
+   if (off >= dwarf->ranges.size) {
+      return hash;
+   }
+
+   start = pos = dwarf->ranges.buf + off;
+   sec_end = dwarf->ranges.buf + dwarf->ranges.size;
+
+   while (dwarf_read_fixed(&pos, sec_end, addr_size, &begin) &&
+         dwarf_read_fixed(&pos, sec_end, addr_size, &end)) {
+      if (!begin && !end) {
+         break;
+      }
+   }
+
+   return dwarf_hash_bytes(hash, start, pos - start);
+}
+
+/*
+ * Hashes what the records of a unit are built from: its bytes, abbreviation 
+ * table and line program, and the strings and range lists its DIEs refer 
+ * to. The result is stored in locals[idx]. Unless refs is NULL, the hashes 
+ * of the units DW_FORM_ref_addr values point into are mixed into *refs, as 
+ * names may come from abstract origins there.
+ */
+static uint64_t
+dwarf_cu_hash_local(Dwarf *dwarf, uint32_t idx, uint64_t *locals, 
+      uint64_t *refs) {
+   dwarf_cu *cu = dwarf->cus[idx];
+   dwarf_abbrevs *abbrevs = dwarf_get_abbrevs(dwarf, cu->hdr.abbrev_off);
+   bool swap = dwarf->elf && dwarf->elf->swap;
+   char *pos = cu->body;
+   char *end = cu->body + cu->body_len;
+   dwarf_abbrev_tab *tab;
+   dwarf_att_spec *spec;
+   dwarf_sprog *sprog;
+   bool root = true;
+   uint64_t sibling;
+   uint64_t hash;
+   uint64_t code;
+   uint64_t off;
+   uint32_t target;
+   char *start;
+
+   hash = dwarf_hash_bytes(0, cu->body - cu->hdr.size, 
+         cu->hdr.size + cu->body_len);
+   hash = dwarf_hash_bytes(hash, dwarf->abbrev.buf + abbrevs->offset, 
+         abbrevs->size);
+
+   if (!cu->atab) {
+      cu->atab = abbrevs->tab;
+   }
+
+   while (pos < end) {
+      if (!dwarf_read_uleb(&pos, end, &code)) {
+         fail(dwarf, "Invalid DIE in unit at offset %" PRIu64 "\n", 
+               cu->offset);
+      }
+
+      if (!code) {
+         continue;
+      }
+
+      if (!(tab = dwarf_get_abbrev_tab(cu->atab, code))) {
+         fail(dwarf, "Abbreviation table for id %" PRIu64 " missing\n", 
+               code);
+      }
+
+      for (spec = tab->atts; spec; spec = spec->next) {
+         start = pos;
+
+         if (!dwarf_iter_skip_att(&pos, end, spec, &cu->hdr, swap, 
+                  &sibling)) {
+            fail(dwarf, "Invalid DIE in unit at offset %" PRIu64 "\n", 
+                  cu->offset);
+         }
+
+         off = dwarf_att_offset(start, pos, swap);
+
+         if (spec->form->id == DW_FORM_strp) {
+            hash = dwarf_cu_hash_str(dwarf, hash, off);
+         } else if (spec->form->id == DW_FORM_ref_addr) {
+            target = dwarf_cu_index(dwarf, off);
+
+            if (refs && target != idx && target < dwarf->cu_count) {
+               if (!locals[target]) {
+                  dwarf_cu_hash_local(dwarf, target, locals, NULL);
+               }
+
+               *refs = dwarf_hash_mix(*refs, locals[target]);
+            }
+         } else if (spec->id == DW_AT_ranges) {
+            hash = dwarf_cu_hash_ranges(dwarf, hash, off, cu->hdr.addr_size);
+         } else if (root && spec->id == DW_AT_stmt_list && 
+               (sprog = dwarf_sprog_at(dwarf, off))) {
+            hash = dwarf_hash_bytes(hash, sprog->hdr, sprog->unit_len);
+         }
+      }
+
+      root = false;
+   }
+
+   locals[idx] = hash;
+
+   return hash;
+}
+
+int
+dwarf_cu_hashes(Dwarf *dwarf, uint64_t *hashes) {
+   uint64_t *locals;
+   uint64_t refs;
+   uint32_t i;
+
+   locals = dwarf_mem_calloc(dwarf, dwarf->cu_count + 1, sizeof(uint64_t));
+
+   if (setjmp(dwarf->env)) {
+      dwarf_mem_free(dwarf, locals);
+      return -1;
+   }
+
+   for (i = 0; i < dwarf->cu_count; i++) {
+      refs = 0;
+      hashes[i] = dwarf_cu_hash_local(dwarf, i, locals, &refs);
+
+      if (refs) {
+         hashes[i] = dwarf_hash_mix(hashes[i], refs);
+      }
+   }
+
+   dwarf_mem_free(dwarf, locals);
+
+   return 0;
+}
+
+typedef struct {
+   uint64_t low_pc;
+   uint64_t high_pc;
+   dwarf_die *die;
+} dwarf_export_func;
+
+struct dwarf_export_ctx {
+   Dwarf *dwarf;
+   FILE *out;
+   dwarf_sprog *sprog;        /* line program of the CU */
+   uint64_t unit;             /* offset of the CU */
+   uint32_t origin_id;        /* next origin ID */
+   struct dwarf_canon_tab *origins;       /* origin IDs by key */
+   struct dwarf_canon_tab *frag_origins;  /* the same in local mode */
+   uint32_t *origin_map;      /* origin IDs by ID in a cached CU */
+   uint32_t origin_map_len;
+   uint8_t addr_size;
+   uint64_t base;             /* base address of the CU */
+   bool local;                /* keep the numbering of the CU, see below */
+   uint8_t *emitted;          /* path IDs with a FILE record */
+   dwarf_export_func *funcs;
+   uint32_t funcs_len;
+   char *frag;                /* records of the CU for the cache */
+   size_t frag_len;
+   char *cached;              /* a cache file as read */
+   char *path;
+};
+
+typedef struct {
+   uint64_t address;
+   uint64_t size;
+   uint32_t line;
+   uint32_t file;
+} dwarf_export_line;
+
+/*
+ * Cache files hold the records of a CU as written in local mode between 
+ * this header and an END line, which tells that the file was written 
+ * completely.
+ */
+#define DWARF_EXPORT_CACHE_MAGIC "THYRION-CU 2 %016" PRIx64 "\n"
+#define DWARF_EXPORT_CACHE_END "END\n"
+
+static int
+dwarf_export_func_cmp(const void *a, const void *b) {
+   const dwarf_export_func *fa = a;
+   const dwarf_export_func *fb = b;
+
+   return fa->low_pc < fb->low_pc ? -1 : fa->low_pc > fb->low_pc;
+}
+
+static int
+dwarf_export_line_cmp(const void *a, const void *b) {
+   const dwarf_export_line *la = a;
+   const dwarf_export_line *lb = b;
+
+   return la->address < lb->address ? -1 : la->address > lb->address;
+}
+
+static void
+dwarf_export_module(Dwarf *dwarf, FILE *out, const char *name) {
+   Elf *elf = dwarf->elf;
+   const char *base = strrchr(name, '/');
+   const char *arch;
+   uint16_t machine;
+   uint32_t namesz;
+   uint32_t descsz;
+   uint32_t i;
+   Elf_Scn note;
+
+   machine = elf->class == ELFCLASS32 ? 
+      ELF_GET(elf, elf->ehdr.hdr32->e_machine) : 
+      ELF_GET(elf, elf->ehdr.hdr64->e_machine);
+
+   switch (machine) {
+      case EM_X86_64: arch = "x86_64"; break;
+      case EM_386: arch = "x86"; break;
+      case EM_AARCH64: arch = "arm64"; break;
+      case EM_ARM: arch = "arm"; break;
+      case EM_PPC: arch = "ppc"; break;
+      case EM_PPC64: arch = "ppc64"; break;
+      case EM_RISCV: arch = "riscv"; break;
+      default: arch = "unknown"; break;
+   }
+
+   fprintf(out, "MODULE Linux %s ", arch);
+
+   /* the GNU build ID identifies the binary, if it has one */
+   if (!elf_get_scn(elf, &note, ".note.gnu.build-id") && note.size >= 12) {
+      memcpy(&namesz, note.buf, 4);
+      memcpy(&descsz, note.buf + 4, 4);
+      namesz = (ELF_GET(elf, namesz) + 3) & ~3;
+      descsz = ELF_GET(elf, descsz);
+
+      if (12 + (size_t)namesz + descsz <= note.size && descsz) {
+         for (i = 0; i < descsz; i++) {
+            fprintf(out, "%02X", (uint8_t)note.buf[12 + namesz + i]);
+         }
+      } else {
+         fprintf(out, "0");
+      }
+   } else {
+      fprintf(out, "0");
+   }
+
+   fprintf(out, " %s\n", base ? base + 1 : name);
+}
+
+static void
+dwarf_export_files(Dwarf *dwarf, FILE *out, dwarf_sprog *sprog, 
+      uint8_t *emitted) {
+   uint32_t id;
+   uint32_t i;
+
+   /* FILE numbers are path IDs, so files shared by CUs appear once */
+   for (i = 1; i <= sprog->file_count; i++) {
+      id = dwarf_sprog_file_id(dwarf, sprog, i);
+
+      if (!emitted[id]) {
+         fprintf(out, "FILE %u %s\n", id, dwarf_path(dwarf, id));
+         emitted[id] = 1;
+      }
+   }
+}
+
+/* Returns the FILE number of a file register value, or DWARF_PATH_NONE. */
+static uint32_t
+dwarf_export_file_id(struct dwarf_export_ctx *ctx, uint64_t file) {
+   if (!ctx->sprog || file > UINT32_MAX) {
+      return DWARF_PATH_NONE;
+   }
+
+   return dwarf_sprog_file_id(ctx->dwarf, ctx->sprog, file);
+}
+
+/*
+ * Returns the key of the origin of an inlined call: the offset of its 
+ * abstract origin, or its own if it has none. *rel tells whether the key 
+ * was given relative to the unit, which is how cache files store it.
+ */
+static uint64_t
+dwarf_export_origin_key(struct dwarf_export_ctx *ctx, dwarf_die *die, 
+      bool *rel) {
+   dwarf_die_att *att = dwarf_die_get_att(die, DW_AT_abstract_origin);
+   uint64_t key;
+
+   if (!att || !dwarf_ref_offset(ctx->dwarf, die, att, &key)) {
+      *rel = true;
+      return die->offset;
+   }
+
+   *rel = att->att_spec->form->id != DW_FORM_ref_addr;
+
+   return key;
+}
+
+/*
+ * Returns the origin ID of a key, numbering new keys in order. *first tells 
+ * whether the key was new, so that its INLINE_ORIGIN is written once.
+ */
+static uint32_t
+dwarf_export_origin_id(struct dwarf_export_ctx *ctx, 
+      struct dwarf_canon_tab *tab, uint64_t key, bool *first) {
+   uint32_t slot = dwarf_canon_slot(tab, key);
+
+   if (!(*first = !tab->keys[slot])) {
+      return tab->vals[slot];
+   }
+
+   dwarf_canon_put(ctx->dwarf, tab, key, ctx->origin_id);
+
+   return ctx->origin_id++;
+}
+
+static struct dwarf_canon_tab *
+dwarf_export_origins_new(Dwarf *dwarf) {
+   struct dwarf_canon_tab *tab;
+
+   tab = dwarf_mem_calloc(dwarf, 1, sizeof(struct dwarf_canon_tab));
+   tab->size = 256;
+   tab->keys = dwarf_mem_calloc(dwarf, tab->size, sizeof(uint64_t));
+   tab->vals = dwarf_mem_calloc(dwarf, tab->size, sizeof(uint64_t));
+
+   return tab;
+}
+
+static bool
+dwarf_export_in_func(dwarf_export_func *func, uint64_t *ranges, 
+      uint32_t count) {
+   uint32_t i;
+
+   for (i = 0; i < count; i++) {
+      if (ranges[2 * i] < func->high_pc && 
+            ranges[2 * i + 1] > func->low_pc) {
+         return true;
+      }
+   }
+
+   return false;
+}
+
+/*
+ * Writes the inlined calls under the range of func. A call with ranges in 
+ * several parts of a function is written under each of them with the 
+ * ranges in that part.
+ */
+static void
+dwarf_export_inlines(struct dwarf_export_ctx *ctx, dwarf_export_func *func, 
+      dwarf_die *die, uint32_t depth, bool emit) {
+   struct dwarf_canon_tab *tab = ctx->local ? ctx->frag_origins : 
+      ctx->origins;
+   dwarf_die *child;
+   uint64_t *ranges;
+   uint64_t call_file;
+   uint64_t call_line;
+   uint64_t key;
+   uint32_t origin;
+   uint32_t count;
+   uint32_t i;
+   bool first;
+   bool rel;
+   char *name;
+
+   for (child = die->child; child != NULL; child = child->sibling) {
+      switch (dwarf_die_tag(child)) {
+         case DW_TAG_inlined_subroutine:
+            if (!(count = dwarf_die_get_ranges(ctx->dwarf, child, 
+                        ctx->addr_size, ctx->base, &ranges))) {
+               break;
+            }
+
+            /* the first pass numbers the origins the second one uses */
+            key = dwarf_export_origin_key(ctx, child, &rel);
+            origin = dwarf_export_origin_id(ctx, tab, key, &first);
+
+            if (!emit && first) {
+               name = dwarf_die_get_origin_name(ctx->dwarf, child);
+               name = name ? name : "<name omitted>";
+
+               if (!ctx->local) {
+                  fprintf(ctx->out, "INLINE_ORIGIN %u %s\n", origin, name);
+               } else if (rel) {
+                  fprintf(ctx->out, "INLINE_ORIGIN %u +%" PRIx64 " %s\n", 
+                        origin, key - ctx->unit, name);
+               } else {
+                  fprintf(ctx->out, "INLINE_ORIGIN %u %" PRIx64 " %s\n", 
+                        origin, key, name);
+               }
+            } else if (emit && dwarf_export_in_func(func, ranges, count)) {
+               if (!dwarf_die_get_udata(child, DW_AT_call_file, &call_file)) {
+                  call_file = 1;
+               }
+               if (!ctx->local && (call_file = dwarf_export_file_id(ctx, 
+                           call_file)) == DWARF_PATH_NONE) {
+                  call_file = 0;
+               }
+               if (!dwarf_die_get_udata(child, DW_AT_call_line, &call_line)) {
+                  call_line = 0;
+               }
+
+               fprintf(ctx->out, "INLINE %u %" PRIu64 " %" PRIu64 " %u", 
+                     depth, call_line, call_file, origin);
+
+               for (i = 0; i < count; i++) {
+                  if (dwarf_export_in_func(func, &ranges[2 * i], 1)) {
+                     fprintf(ctx->out, " %" PRIx64 " %" PRIx64, 
+                           ranges[2 * i], ranges[2 * i + 1] - ranges[2 * i]);
+                  }
+               }
+
+               fprintf(ctx->out, "\n");
+            }
+
+            dwarf_mem_free(ctx->dwarf, ranges);
+            dwarf_export_inlines(ctx, func, child, depth + 1, emit);
+            break;
+         case DW_TAG_lexical_block:
+            dwarf_export_inlines(ctx, func, child, depth, emit);
+            break;
+         default:
+            break;
+      }
+   }
+}
+
+static uint32_t
+dwarf_export_lines(Dwarf *dwarf, dwarf_sprog *sprog, 
+      dwarf_export_line **lines) {
+   dwarf_sm_regs *regs = dwarf_sprog_get_regs(dwarf, sprog);
+   dwarf_sm_regs *prev = NULL;
+   uint32_t count = 0;
+   uint32_t len = 0;
+
+   *lines = NULL;
+
+   for (; regs != NULL; regs = regs->next) {
+      /* registers are recorded after every opcode, not only for rows */
+      if (regs->opcode != DW_LNS_copy && !regs->end_sequence &&
+            regs->opcode < sprog->prologue->opcode_base) {
+         continue;
+      }
+
+      if (prev && regs->address > prev->address) {
+         if (count == len) {
+            len = len ? len << 1 : 256;
+            *lines = dwarf_mem_realloc(dwarf, *lines, 
+                  len * sizeof(dwarf_export_line));
+         }
+
+         /* a row extends to the next row of its sequence */
+         (*lines)[count].address = prev->address;
+         (*lines)[count].size = regs->address - prev->address;
+         (*lines)[count].line = prev->line;
+         (*lines)[count].file = prev->file;
+         count++;
+      }
+
+      prev = regs->end_sequence ? NULL : regs;
+   }
+
+   if (!count) {
+      return 0;
+   }
+
+   qsort(*lines, count, sizeof(dwarf_export_line), dwarf_export_line_cmp);
+
+   return count;
+}
+
+/*
+ * Writes the functions, inlined calls and line rows of a CU. In local mode 
+ * files keep their line program numbers, origins are numbered from 0 and 
+ * INLINE_ORIGIN records carry their key, so that the records only depend 
+ * on the CU and can be cached.
+ */
+static void
+dwarf_export_cu(struct dwarf_export_ctx *ctx, dwarf_cu *cu, 
+      dwarf_die *root) {
+   Dwarf *dwarf = ctx->dwarf;
+   FILE *out = ctx->out;
+   dwarf_export_line *lines = NULL;
+   dwarf_export_func *func;
+   uint32_t line_count = 0;
+   uint32_t range_count;
+   uint32_t func_count;
+   uint32_t file;
+   uint32_t j, k;
+   uint64_t *ranges;
+   uint64_t address;
+   uint64_t end;
+   dwarf_die *die;
+   char *func_name;
+
+   ctx->addr_size = cu->hdr.addr_size;
+   ctx->unit = cu->offset;
+
+   if (!dwarf_die_get_addr(root, DW_AT_low_pc, &ctx->base)) {
+      ctx->base = 0;
+   }
+
+   if (ctx->sprog) {
+      line_count = dwarf_export_lines(dwarf, ctx->sprog, &lines);
+   }
+
+   for (j = 0, func_count = 0; j < cu->die_count; j++) {
+      die = &cu->dies[j];
+
+      if (dwarf_die_tag(die) != DW_TAG_subprogram) {
+         continue;
+      }
+
+      /* like Breakpad, a FUNC record per range of split functions */
+      range_count = dwarf_die_get_ranges(dwarf, die, ctx->addr_size, 
+            ctx->base, &ranges);
+
+      for (k = 0; k < range_count; k++) {
+         if (ranges[2 * k + 1] <= ranges[2 * k]) {
+            continue;
+         }
+
+         if (func_count == ctx->funcs_len) {
+            ctx->funcs_len = ctx->funcs_len ? ctx->funcs_len << 1 : 64;
+            ctx->funcs = dwarf_mem_realloc(dwarf, ctx->funcs, 
+                  ctx->funcs_len * sizeof(dwarf_export_func));
+         }
+
+         func = &ctx->funcs[func_count++];
+         func->die = die;
+         func->low_pc = ranges[2 * k];
+         func->high_pc = ranges[2 * k + 1];
+      }
+
+      dwarf_mem_free(dwarf, ranges);
+   }
+
+   qsort(ctx->funcs, func_count, sizeof(dwarf_export_func), 
+         dwarf_export_func_cmp);
+
+   for (j = 0, k = 0; j < func_count; j++) {
+      func = &ctx->funcs[j];
+      func_name = dwarf_die_get_origin_name(dwarf, func->die);
+
+      dwarf_export_inlines(ctx, func, func->die, 0, false);
+
+      fprintf(out, "FUNC %" PRIx64 " %" PRIx64 " 0 %s\n", func->low_pc, 
+            func->high_pc - func->low_pc, 
+            func_name ? func_name : "<name omitted>");
+
+      dwarf_export_inlines(ctx, func, func->die, 0, true);
+
+      while (k < line_count && lines[k].address + lines[k].size <= 
+            func->low_pc) {
+         k++;
+      }
+
+      /* rows are clipped to the function */
+      for (; k < line_count && lines[k].address < func->high_pc; k++) {
+         address = lines[k].address < func->low_pc ? func->low_pc : 
+            lines[k].address;
+         end = lines[k].address + lines[k].size > func->high_pc ? 
+            func->high_pc : lines[k].address + lines[k].size;
+         file = lines[k].file;
+
+         if (!ctx->local && (file = dwarf_export_file_id(ctx, file)) == 
+               DWARF_PATH_NONE) {
+            continue;
+         }
+
+         fprintf(out, "%" PRIx64 " %" PRIx64 " %u %u\n", address, 
+               end - address, lines[k].line, file);
+      }
+
+      /* the last row may continue into the next function */
+      if (k && lines[k - 1].address + lines[k - 1].size > func->high_pc) {
+         k--;
+      }
+   }
+
+   dwarf_mem_free(dwarf, lines);
+}
+
+/*
+ * Writes records of a CU written in local mode, renumbering its files and 
+ * origins as dwarf_export_cu() would have. The lines of buf are split in 
+ * place.
+ */
+static void
+dwarf_export_replay(struct dwarf_export_ctx *ctx, char *buf, char *end) {
+   uint64_t address, size;
+   uint64_t call_line;
+   uint64_t call_file;
+   uint64_t key;
+   uint32_t origin;
+   uint32_t depth;
+   uint32_t count = 0;
+   uint32_t line;
+   uint32_t file;
+   bool first;
+   bool rel;
+   char *next;
+   char *pos;
+   int rest;
+
+   for (; buf < end && (next = memchr(buf, '\n', end - buf)); 
+         buf = next + 1) {
+      *next = '\0';
+
+      if (!strncmp(buf, "FUNC ", 5)) {
+         fprintf(ctx->out, "%s\n", buf);
+      } else if (sscanf(buf, "INLINE_ORIGIN %u %n", &origin, &rest) == 1) {
+         /* keys relative to the unit start with a sign */
+         rel = buf[rest] == '+';
+         pos = buf + rest;
+
+         if (origin != count || 
+               sscanf(pos, "%" SCNx64 "%n", &key, &rest) != 1) {
+            continue;
+         }
+
+         if (count == ctx->origin_map_len) {
+            ctx->origin_map_len = count ? count << 1 : 64;
+            ctx->origin_map = dwarf_mem_realloc(ctx->dwarf, ctx->origin_map, 
+                  ctx->origin_map_len * sizeof(uint32_t));
+         }
+
+         ctx->origin_map[count++] = origin = dwarf_export_origin_id(ctx, 
+               ctx->origins, rel ? ctx->unit + key : key, &first);
+
+         if (first) {
+            fprintf(ctx->out, "INLINE_ORIGIN %u%s\n", origin, pos + rest);
+         }
+      } else if (sscanf(buf, "INLINE %u %" SCNu64 " %" SCNu64 " %u%n", 
+                  &depth, &call_line, &call_file, &origin, &rest) == 4 && 
+            origin < count) {
+         if ((file = dwarf_export_file_id(ctx, call_file)) == 
+               DWARF_PATH_NONE) {
+            file = 0;
+         }
+
+         fprintf(ctx->out, "INLINE %u %" PRIu64 " %u %u%s\n", depth, 
+               call_line, file, ctx->origin_map[origin], buf + rest);
+      } else if (sscanf(buf, "%" SCNx64 " %" SCNx64 " %u %u", &address, 
+                  &size, &line, &file) == 4 && 
+            (file = dwarf_export_file_id(ctx, file)) != DWARF_PATH_NONE) {
+         fprintf(ctx->out, "%" PRIx64 " %" PRIx64 " %u %u\n", address, size, 
+               line, file);
+      }
+   }
+}
+
+/*
+ * Reads the cache file at ctx->path into ctx->cached and sets *body and 
+ * *end to its records. Returns false if it is missing, incomplete or was 
+ * written for another hash.
+ */
+static bool
+dwarf_export_cache_read(struct dwarf_export_ctx *ctx, uint64_t hash, 
+      char **body, char **end) {
+   size_t end_len = strlen(DWARF_EXPORT_CACHE_END);
+   char magic[64];
+   size_t magic_len;
+   struct stat st;
+   FILE *file;
+   bool ok;
+
+   magic_len = snprintf(magic, sizeof(magic), DWARF_EXPORT_CACHE_MAGIC, 
+         hash);
+
+   if (!(file = fopen(ctx->path, "r"))) {
+      return false;
+   }
+
+   if (fstat(fileno(file), &st) || (size_t)st.st_size < magic_len + end_len) {
+      fclose(file);
+      return false;
+   }
+
+   ctx->cached = dwarf_mem_alloc(ctx->dwarf, st.st_size);
+   ok = fread(ctx->cached, 1, st.st_size, file) == (size_t)st.st_size && 
+      !memcmp(ctx->cached, magic, magic_len) && 
+      !memcmp(ctx->cached + st.st_size - end_len, DWARF_EXPORT_CACHE_END, 
+            end_len);
+   fclose(file);
+
+   *body = ctx->cached + magic_len;
+   *end = ctx->cached + st.st_size - end_len;
+
+   return ok;
+}
+
+/*
+ * Writes ctx->frag to ctx->path. The file is renamed into place, so that 
+ * exports sharing the directory never read a partial one. The cache is 
+ * only an optimization, so failing to write it is not an error.
+ */
+static void
+dwarf_export_cache_write(struct dwarf_export_ctx *ctx, uint64_t hash) {
+   char *tmp = dwarf_mem_asprintf(ctx->dwarf, "%s.%d", ctx->path, 
+         (int)getpid());
+   FILE *file;
+   bool ok;
+
+   if ((file = fopen(tmp, "w"))) {
+      fprintf(file, DWARF_EXPORT_CACHE_MAGIC, hash);
+      fwrite(ctx->frag, 1, ctx->frag_len, file);
+      fputs(DWARF_EXPORT_CACHE_END, file);
+      ok = !ferror(file);
+
+      if (fclose(file) || !ok || rename(tmp, ctx->path)) {
+         unlink(tmp);
+      }
+   }
+
+   dwarf_mem_free(ctx->dwarf, tmp);
+}
+
+/*
+ * Writes a CU from its cache file, or writes its records in local mode to 
+ * the cache and then replays them, so both give the same output.
+ */
+static void
+dwarf_export_cu_cached(struct dwarf_export_ctx *ctx, dwarf_cu *cu, 
+      const char *cache_dir, uint64_t hash) {
+   Dwarf *dwarf = ctx->dwarf;
+   uint32_t origin_id = ctx->origin_id;
+   FILE *out = ctx->out;
+   dwarf_die *root;
+   char *body;
+   char *end;
+
+   ctx->path = dwarf_mem_asprintf(dwarf, "%s/%016" PRIx64, cache_dir, hash);
+
+   if (dwarf_export_cache_read(ctx, hash, &body, &end)) {
+      ctx->sprog = dwarf_cu_get_sprog(dwarf, cu);
+   } else if ((root = dwarf_cu_get_die(dwarf, cu))) {
+      ctx->sprog = dwarf_cu_get_sprog(dwarf, cu);
+      ctx->local = true;
+      ctx->origin_id = 0;
+      ctx->frag_origins->count = 0;
+      memset(ctx->frag_origins->keys, 0, 
+            ctx->frag_origins->size * sizeof(uint64_t));
+      ctx->out = open_memstream(&ctx->frag, &ctx->frag_len);
+      dwarf_export_cu(ctx, cu, root);
+      fclose(ctx->out);
+      ctx->out = out;
+      ctx->local = false;
+      ctx->origin_id = origin_id;
+
+      dwarf_export_cache_write(ctx, hash);
+      body = ctx->frag;
+      end = ctx->frag + ctx->frag_len;
+   } else {
+      body = end = NULL;
+   }
+
+   if (body) {
+      if (ctx->sprog) {
+         dwarf_export_files(dwarf, out, ctx->sprog, ctx->emitted);
+      }
+
+      ctx->unit = cu->offset;
+      dwarf_export_replay(ctx, body, end);
+   }
+
+   /* open_memstream() buffers come from the C library */
+   free(ctx->frag);
+   ctx->frag = NULL;
+   dwarf_mem_free(dwarf, ctx->cached);
+   ctx->cached = NULL;
+   dwarf_mem_free(dwarf, ctx->path);
+   ctx->path = NULL;
+}
+
+int
+dwarf_export(Dwarf *dwarf, FILE *out, const char *name) {
+   return dwarf_export_cached(dwarf, out, name, NULL);
+}
+
+int
+dwarf_export_cached(Dwarf *dwarf, FILE *out, const char *name, 
+      const char *cache_dir) {
+   struct dwarf_export_ctx ctx;
+   size_t budget = dwarf->cache.budget;
+   uint64_t *volatile hashes = NULL;
+   dwarf_die *root;
+   dwarf_cu *cu;
+   uint32_t i;
+
+   if (dwarf_paths_build(dwarf)) {
+      return -1;
+   }
+
+   if (cache_dir) {
+      hashes = dwarf_mem_alloc(dwarf, 
+            (dwarf->cu_count + 1) * sizeof(uint64_t));
+
+      if (dwarf_cu_hashes(dwarf, hashes)) {
+         dwarf_mem_free(dwarf, hashes);
+         return -1;
+      }
+   }
+
+   memset(&ctx, 0, sizeof(ctx));
+   ctx.dwarf = dwarf;
+   ctx.out = out;
+   ctx.emitted = dwarf_mem_calloc(dwarf, dwarf->paths->count + 1, 1);
+   ctx.origins = dwarf_export_origins_new(dwarf);
+   ctx.frag_origins = dwarf_export_origins_new(dwarf);
+
+   if (setjmp(dwarf->env)) {
+      if (ctx.out != out) {
+         fclose(ctx.out);
+      }
+
+      free(ctx.frag);
+      dwarf_mem_free(dwarf, ctx.cached);
+      dwarf_mem_free(dwarf, ctx.path);
+      dwarf_mem_free(dwarf, ctx.emitted);
+      dwarf_mem_free(dwarf, ctx.funcs);
+      dwarf_mem_free(dwarf, ctx.origin_map);
+      dwarf_free_canon(dwarf, ctx.origins);
+      dwarf_free_canon(dwarf, ctx.frag_origins);
+      dwarf_mem_free(dwarf, hashes);
+      dwarf_set_cache_budget(dwarf, budget);
+      dwarf_advise(dwarf, ELF_ADV_RANDOM);
+      return -1;
+   }
+
+   dwarf_export_module(dwarf, out, name);
+   dwarf_advise(dwarf, ELF_ADV_SEQUENTIAL);
+
+   for (i = 0; i < dwarf->cu_count; i++) {
+      cu = dwarf->cus[i];
+
+      /* references into other CUs must not evict this one */
+      dwarf->cache.budget = 0;
+
+      if (cache_dir) {
+         dwarf_export_cu_cached(&ctx, cu, cache_dir, hashes[i]);
+      } else if ((root = dwarf_cu_get_die(dwarf, cu))) {
+         ctx.sprog = dwarf_cu_get_sprog(dwarf, cu);
+
+         if (ctx.sprog) {
+            dwarf_export_files(dwarf, out, ctx.sprog, ctx.emitted);
+         }
+
+         dwarf_export_cu(&ctx, cu, root);
+      }
+
+      /* keep at most the CU that was just written */
+      dwarf_set_cache_budget(dwarf, 1);
+   }
+
+   dwarf_mem_free(dwarf, ctx.emitted);
+   dwarf_mem_free(dwarf, ctx.funcs);
+   dwarf_mem_free(dwarf, ctx.origin_map);
+   dwarf_free_canon(dwarf, ctx.origins);
+   dwarf_free_canon(dwarf, ctx.frag_origins);
+   dwarf_mem_free(dwarf, hashes);
+   dwarf_set_cache_budget(dwarf, budget);
+   dwarf_advise(dwarf, ELF_ADV_RANDOM);
+
+   return ferror(out) ? -1 : 0;
+}
+
+/*
+ * A file mapped by dwarf_scan(). Each of its items holds a reference, and 
+ * the main thread unmaps it once the output of the last one is written.
+ */
+typedef struct {
+   char *path;
+   char *buf;
+   size_t size;
+   uint32_t refs;
+} dwarf_scan_file;
+
+typedef struct {
+   dwarf_scan_file *file;
+   char *member;              /* archive member name, NULL for files */
+   char *buf;                 /* ELF image */
+   size_t size;
+   int rc;                    /* error reading the file, or 0 */
+   char *out;
+   size_t len;
+   bool done;
+} dwarf_scan_item;
+
+typedef struct {
+   dwarf_scan_fn fn;
+   void *arg;
+   FILE *out;
+   dwarf_scan_item *items;    /* ring of window entries */
+   uint32_t window;
+   uint32_t added;            /* items handed out by the main thread */
+   uint32_t next;             /* next item to process */
+   uint32_t written;
+   bool finished;             /* no more items will be added */
+   pthread_mutex_t lock;
+   pthread_cond_t cond;
+} dwarf_scan_job;
+
+static void
+dwarf_scan_process(dwarf_scan_job *job, dwarf_scan_item *item) {
+   FILE *out = open_memstream(&item->out, &item->len);
+   int rc = item->rc;
+   Dwarf dwarf;
+
+   if (!out) {
+      return;
+   }
+
+   /* the error is only set if the file is an ELF file */
+   memset(&dwarf, 0, sizeof(Dwarf));
+
+   if (!rc) {
+      rc = dwarf_open_mem(&dwarf, item->buf, item->size);
+   }
+
+   job->fn(&dwarf, rc, item->file->path, item->member, out, job->arg);
+
+   if (!rc) {
+      dwarf_free(&dwarf);
+   } else {
+      dwarf_mem_free(&dwarf, dwarf.error);
+   }
+
+   fclose(out);
+}
+
+static void *
+dwarf_scan_worker(void *arg) {
+   dwarf_scan_job *job = arg;
+   dwarf_scan_item *item;
+
+   pthread_mutex_lock(&job->lock);
+
+   while (true) {
+      while (job->next == job->added && !job->finished) {
+         pthread_cond_wait(&job->cond, &job->lock);
+      }
+
+      if (job->next == job->added) {
+         break;
+      }
+
+      item = &job->items[job->next++ % job->window];
+      pthread_mutex_unlock(&job->lock);
+
+      dwarf_scan_process(job, item);
+
+      pthread_mutex_lock(&job->lock);
+      item->done = true;
+      pthread_cond_broadcast(&job->cond);
+   }
+
+   pthread_mutex_unlock(&job->lock);
+
+   return NULL;
+}
+
+static dwarf_scan_file *
+dwarf_scan_file_new(const char *path) {
+   dwarf_scan_file *file = calloc(1, sizeof(dwarf_scan_file));
+
+   file->path = strdup(path);
+   file->refs = 1;
+
+   return file;
+}
+
+static void
+dwarf_scan_file_release(dwarf_scan_file *file) {
+   if (--file->refs) {
+      return;
+   }
+
+   if (file->buf) {
+      munmap(file->buf, file->size);
+   }
+
+   free(file->path);
+   free(file);
+}
+
+/* Writes the output of the oldest item once it is processed. */
+static void
+dwarf_scan_write(dwarf_scan_job *job) {
+   dwarf_scan_item *item = &job->items[job->written % job->window];
+
+   pthread_mutex_lock(&job->lock);
+   while (!item->done) {
+      pthread_cond_wait(&job->cond, &job->lock);
+   }
+   pthread_mutex_unlock(&job->lock);
+
+   if (item->out) {
+      fwrite(item->out, 1, item->len, job->out);
+   }
+
+   free(item->out);
+   free(item->member);
+   dwarf_scan_file_release(item->file);
+   job->written++;
+}
+
+static void
+dwarf_scan_add(dwarf_scan_job *job, dwarf_scan_file *file, char *member, 
+      char *buf, size_t size, int rc) {
+   dwarf_scan_item *item;
+
+   if (job->added - job->written == job->window) {
+      dwarf_scan_write(job);
+   }
+
+   item = &job->items[job->added % job->window];
+   memset(item, 0, sizeof(dwarf_scan_item));
+   item->file = file;
+   item->member = member;
+   item->buf = buf;
+   item->size = size;
+   item->rc = rc;
+   file->refs++;
+
+   pthread_mutex_lock(&job->lock);
+   job->added++;
+   pthread_cond_broadcast(&job->cond);
+   pthread_mutex_unlock(&job->lock);
+}
+
+static bool
+dwarf_scan_is_object(char *buf, size_t size) {
+   return (size >= SELFMAG && !memcmp(buf, ELFMAG, SELFMAG)) || 
+      elf_is_ar(buf, size);
+}
+
+static void
+dwarf_scan_fail(dwarf_scan_job *job, const char *path, int rc) {
+   dwarf_scan_file *file = dwarf_scan_file_new(path);
+
+   dwarf_scan_add(job, file, NULL, NULL, 0, rc);
+   dwarf_scan_file_release(file);
+}
+
+/*
+ * Maps a regular file and adds it, or each of its members if it is an 
+ * archive. Files found in directories are skipped unless they are ELF 
+ * files or archives.
+ */
+static void
+dwarf_scan_open(dwarf_scan_job *job, const char *path, size_t size, 
+      bool walked) {
+   dwarf_scan_file *file = dwarf_scan_file_new(path);
+   Elf_Ar_Member member;
+   Elf_Ar ar;
+   int rc = 0;
+   int fd;
+
+   if ((fd = open(path, O_RDONLY)) < 0) {
+      rc = EELFOPEN;
+   } else if (!size) {
+      rc = EELFFMT;
+   } else if ((file->buf = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0)) 
+         == MAP_FAILED) {
+      file->buf = NULL;
+      rc = EELFOPEN;
+   } else {
+      file->size = size;
+   }
+
+   if (fd >= 0) {
+      close(fd);
+   }
+
+   if (walked && (rc || !dwarf_scan_is_object(file->buf, size))) {
+      dwarf_scan_file_release(file);
+      return;
+   }
+
+   if (rc || elf_ar_init(&ar, file->buf, file->size)) {
+      dwarf_scan_add(job, file, NULL, file->buf, file->size, rc);
+      dwarf_scan_file_release(file);
+      return;
+   }
+
+   while (!(rc = elf_ar_next(&ar, &member))) {
+      dwarf_scan_add(job, file, strndup(member.name, member.name_len), 
+            member.buf, member.size, 0);
+   }
+
+   /* a malformed archive is reported after the members read so far */
+   if (rc != ELF_AR_END) {
+      dwarf_scan_add(job, file, NULL, NULL, 0, rc);
+   }
+
+   dwarf_scan_file_release(file);
+}
+
+/*
+ * Adds a path given to dwarf_scan(), or a file found below it. Entries of 
+ * a directory are visited in name order. Symbolic links to directories 
+ * are not followed, so the walk cannot loop.
+ */
+static void
+dwarf_scan_path(dwarf_scan_job *job, const char *path, bool walked) {
+   struct dirent **names;
+   struct stat sb;
+   char *child;
+   int count;
+   int i;
+
+   if (walked && (lstat(path, &sb) || 
+            (S_ISLNK(sb.st_mode) && (stat(path, &sb) || S_ISDIR(sb.st_mode))))) {
+      return;
+   }
+
+   if (!walked && stat(path, &sb)) {
+      dwarf_scan_fail(job, path, EELFOPEN);
+      return;
+   }
+
+   if (S_ISREG(sb.st_mode)) {
+      dwarf_scan_open(job, path, sb.st_size, walked);
+      return;
+   }
+
+   if (!S_ISDIR(sb.st_mode) || (count = scandir(path, &names, NULL, 
+               alphasort)) < 0) {
+      if (!walked) {
+         dwarf_scan_fail(job, path, EELFOPEN);
+      }
+      return;
+   }
+
+   for (i = 0; i < count; i++) {
+      if (strcmp(names[i]->d_name, ".") && strcmp(names[i]->d_name, "..") && 
+            asprintf(&child, "%s%s%s", path, 
+               path[strlen(path) - 1] == '/' ? "" : "/", 
+               names[i]->d_name) >= 0) {
+         dwarf_scan_path(job, child, true);
+         free(child);
+      }
+      free(names[i]);
+   }
+
+   free(names);
+}
+
+int
+dwarf_scan(char **paths, uint32_t count, int nthreads, dwarf_scan_fn fn, 
+      void *arg, FILE *out) {
+   dwarf_scan_job job;
+   pthread_t *threads;
+   int started;
+   uint32_t i;
+
+   if (nthreads < 1) {
+      nthreads = 1;
+   }
+
+   memset(&job, 0, sizeof(job));
+   job.fn = fn;
+   job.arg = arg;
+   job.out = out;
+   job.window = 4 * nthreads;
+   job.items = calloc(job.window, sizeof(dwarf_scan_item));
+   pthread_mutex_init(&job.lock, NULL);
+   pthread_cond_init(&job.cond, NULL);
+
+   threads = calloc(nthreads, sizeof(pthread_t));
+
+   for (started = 0; started < nthreads; started++) {
+      if (pthread_create(&threads[started], NULL, dwarf_scan_worker, &job)) {
+         break;
+      }
+   }
+
+   if (!started) {
+      free(threads);
+      free(job.items);
+      pthread_mutex_destroy(&job.lock);
+      pthread_cond_destroy(&job.cond);
+      return -1;
+   }
+
+   for (i = 0; i < count; i++) {
+      dwarf_scan_path(&job, paths[i], false);
+   }
+
+   pthread_mutex_lock(&job.lock);
+   job.finished = true;
+   pthread_cond_broadcast(&job.cond);
+   pthread_mutex_unlock(&job.lock);
+
+   while (job.written < job.added) {
+      dwarf_scan_write(&job);
+   }
+
+   while (started--) {
+      pthread_join(threads[started], NULL);
+   }
+
+   free(threads);
+   free(job.items);
+   pthread_mutex_destroy(&job.lock);
+   pthread_cond_destroy(&job.cond);
+
+   return ferror(out) ? -1 : 0;
+}
+
+void
+dwarf_free(Dwarf *dwarf) {
+   dwarf_free_aranges(dwarf, dwarf->aranges);
+   dwarf_mem_free(dwarf, dwarf->str);
+   dwarf_free_sprog(dwarf, dwarf->sprog);
+   dwarf_free_cu(dwarf, dwarf->cu);
+   dwarf_mem_free(dwarf, dwarf->cus);
+   dwarf_mem_free(dwarf, dwarf->sprogs);
+   dwarf_free_abbrevs(dwarf, dwarf->abbrevs);
+   dwarf_free_types(dwarf, dwarf->types);
+   dwarf_free_canon(dwarf, dwarf->canon);
+   dwarf_free_funcs(dwarf, dwarf->funcs);
+   dwarf_free_lines(dwarf, dwarf->lines);
+   dwarf_free_line_blocks(dwarf, dwarf->line_blocks);
+   dwarf_free_paths(dwarf, dwarf->paths);
+   dwarf_cfi_free(dwarf->cfi);
+   dwarf_mem_free(dwarf, dwarf->error);
+
+   if (dwarf->elf) {
+      elf_close(dwarf->elf);
+      dwarf_mem_free(dwarf, dwarf->elf);
+   }
 }
@@ -28,6 +28,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <setjmp.h>
+#include <stdio.h>
 #include <sys/types.h>
 
 #include "elf_util.h"
@@ -38,6 +39,7 @@
 #define MK_TAG(tag) {tag, #tag}
 #define MK_ATT(att) {att, #att}
 #define MK_FORM(form) {form, #form}
+#define MK_OP(op) {op, #op}
 
 typedef unsigned long   u_long;
 typedef signed long     s_long;
@@ -242,6 +244,125 @@ typedef enum {
    DW_LNE_set_discriminator
 } dwarf_ext_opcodes;
 
+typedef enum {
+   DW_OP_addr = 0x03,
+   DW_OP_deref = 0x06,
+   DW_OP_const1u = 0x08,
+   DW_OP_const1s = 0x09,
+   DW_OP_const2u = 0x0a,
+   DW_OP_const2s = 0x0b,
+   DW_OP_const4u = 0x0c,
+   DW_OP_const4s = 0x0d,
+   DW_OP_const8u = 0x0e,
+   DW_OP_const8s = 0x0f,
+   DW_OP_constu = 0x10,
+   DW_OP_consts = 0x11,
+   DW_OP_dup = 0x12,
+   DW_OP_drop = 0x13,
+   DW_OP_over = 0x14,
+   DW_OP_pick = 0x15,
+   DW_OP_swap = 0x16,
+   DW_OP_rot = 0x17,
+   DW_OP_xderef = 0x18,
+   DW_OP_abs = 0x19,
+   DW_OP_and = 0x1a,
+   DW_OP_div = 0x1b,
+   DW_OP_minus = 0x1c,
+   DW_OP_mod = 0x1d,
+   DW_OP_mul = 0x1e,
+   DW_OP_neg = 0x1f,
+   DW_OP_not = 0x20,
+   DW_OP_or = 0x21,
+   DW_OP_plus = 0x22,
+   DW_OP_plus_uconst = 0x23,
+   DW_OP_shl = 0x24,
+   DW_OP_shr = 0x25,
+   DW_OP_shra = 0x26,
+   DW_OP_xor = 0x27,
+   DW_OP_bra = 0x28,
+   DW_OP_eq = 0x29,
+   DW_OP_ge = 0x2a,
+   DW_OP_gt = 0x2b,
+   DW_OP_le = 0x2c,
+   DW_OP_lt = 0x2d,
+   DW_OP_ne = 0x2e,
+   DW_OP_skip = 0x2f,
+   DW_OP_lit0 = 0x30,
+   DW_OP_lit31 = 0x4f,
+   DW_OP_reg0 = 0x50,
+   DW_OP_reg31 = 0x6f,
+   DW_OP_breg0 = 0x70,
+   DW_OP_breg31 = 0x8f,
+   DW_OP_regx = 0x90,
+   DW_OP_fbreg = 0x91,
+   DW_OP_bregx = 0x92,
+   DW_OP_piece = 0x93,
+   DW_OP_deref_size = 0x94,
+   DW_OP_xderef_size = 0x95,
+   DW_OP_nop = 0x96,
+   DW_OP_push_object_address = 0x97,
+   DW_OP_call2 = 0x98,
+   DW_OP_call4 = 0x99,
+   DW_OP_call_ref = 0x9a,
+   DW_OP_form_tls_address = 0x9b,
+   DW_OP_call_frame_cfa = 0x9c,
+   DW_OP_bit_piece = 0x9d,
+   DW_OP_implicit_value = 0x9e,
+   DW_OP_stack_value = 0x9f,
+   DW_OP_GNU_push_tls_address = 0xe0
+} dwarf_op_id;
+
+typedef enum {
+   DW_CFA_nop = 0x00,
+   DW_CFA_set_loc = 0x01,
+   DW_CFA_advance_loc1 = 0x02,
+   DW_CFA_advance_loc2 = 0x03,
+   DW_CFA_advance_loc4 = 0x04,
+   DW_CFA_offset_extended = 0x05,
+   DW_CFA_restore_extended = 0x06,
+   DW_CFA_undefined = 0x07,
+   DW_CFA_same_value = 0x08,
+   DW_CFA_register = 0x09,
+   DW_CFA_remember_state = 0x0a,
+   DW_CFA_restore_state = 0x0b,
+   DW_CFA_def_cfa = 0x0c,
+   DW_CFA_def_cfa_register = 0x0d,
+   DW_CFA_def_cfa_offset = 0x0e,
+   DW_CFA_def_cfa_expression = 0x0f,
+   DW_CFA_expression = 0x10,
+   DW_CFA_offset_extended_sf = 0x11,
+   DW_CFA_def_cfa_sf = 0x12,
+   DW_CFA_def_cfa_offset_sf = 0x13,
+   DW_CFA_val_offset = 0x14,
+   DW_CFA_val_offset_sf = 0x15,
+   DW_CFA_val_expression = 0x16,
+   DW_CFA_GNU_window_save = 0x2d,
+   DW_CFA_GNU_args_size = 0x2e,
+   DW_CFA_GNU_negative_offset_extended = 0x2f,
+   DW_CFA_advance_loc = 0x40,    /* high two bits, operand in the low six */
+   DW_CFA_offset = 0x80,
+   DW_CFA_restore = 0xc0
+} dwarf_cfa_id;
+
+typedef enum {
+   DW_EH_PE_absptr = 0x00,
+   DW_EH_PE_uleb128 = 0x01,
+   DW_EH_PE_udata2 = 0x02,
+   DW_EH_PE_udata4 = 0x03,
+   DW_EH_PE_udata8 = 0x04,
+   DW_EH_PE_sleb128 = 0x09,
+   DW_EH_PE_sdata2 = 0x0a,
+   DW_EH_PE_sdata4 = 0x0b,
+   DW_EH_PE_sdata8 = 0x0c,
+   DW_EH_PE_pcrel = 0x10,
+   DW_EH_PE_textrel = 0x20,
+   DW_EH_PE_datarel = 0x30,
+   DW_EH_PE_funcrel = 0x40,
+   DW_EH_PE_aligned = 0x50,
+   DW_EH_PE_indirect = 0x80,
+   DW_EH_PE_omit = 0xff
+} dwarf_eh_pe;
+
 typedef struct {
    dwarf_tag_id id;
    char *name;
@@ -257,46 +378,70 @@ typedef struct {
    char *name;
 } dwarf_form;
 
+typedef struct {
+   dwarf_op_id id;
+   char *name;
+} dwarf_op;
+
 typedef struct dwarf_att_spec {
-  const dwarf_att *att;
+  dwarf_att_id id;
+  const dwarf_att *att;      /* NULL for vendor attributes we don't know */
   const dwarf_form *form;
+  uint32_t rest_size;        /* largest encoding of the values after this */
   struct dwarf_att_spec *next;
 } dwarf_att_spec;
 
+#define DWARF_SIZE_VARIABLE UINT32_MAX
+
 typedef struct dwarf_abbrev_tab {
    uint32_t id;
-   const dwarf_tag *tag;
+   dwarf_tag_id tag_id;
+   const dwarf_tag *tag;      /* NULL for vendor tags we don't know */
    dwarf_children has_children;
    struct dwarf_att_spec *atts;
+   uint32_t fixed_size;       /* bytes of other values or DWARF_SIZE_VARIABLE */
+   uint32_t addr_count;       /* number of DW_FORM_addr values */
+   uint32_t offset_count;     /* number of DW_FORM_strp values */
+   uint32_t ref_addr_count;   /* number of DW_FORM_ref_addr values */
+   uint32_t att_count;
+   uint32_t max_size;         /* largest encoding without strings and blocks */
+   uint32_t decl_size;        /* bytes of the declaration in .debug_abbrev */
    struct dwarf_abbrev_tab *next;
 } dwarf_abbrev_tab;
 
 typedef struct dwarf_abbrevs {
-   uint32_t offset;
+   uint64_t offset;
+   uint32_t size;
    dwarf_abbrev_tab *tab;
    struct dwarf_abbrevs *next;
 } dwarf_abbrevs;
 
-#pragma pack(push)
-#pragma pack(1)
-
+/*
+ * Unit headers as decoded from the section. In the 64-bit DWARF format the 
+ * length is escaped by 0xffffffff and section offsets take 8 bytes, so 
+ * offset_size records which format a unit uses.
+ */
 typedef struct {
-   uint32_t length;
+   uint64_t length;           /* excluding the initial length field */
    uint16_t version;
-   uint32_t abbrev_off;
+   uint64_t abbrev_off;
    uint8_t addr_size;
+   uint8_t offset_size;
+   uint8_t ref_addr_size;     /* addr_size before DWARF 3, else offset_size */
+   uint8_t size;              /* of the encoded header */
+   uint8_t enc;               /* DIE decoder for the sizes and byte order */
 } dwarf_cu_header;
 
 typedef struct {
-   uint32_t length;
+   uint64_t length;
    uint16_t version;
-   uint32_t info_off;
+   uint64_t info_off;
    uint8_t addr_size;
    uint8_t seg_size;
+   uint8_t offset_size;
+   uint8_t size;
 } dwarf_ar_header;
 
-#pragma pack(pop)
-
 typedef struct {
    uint32_t len;
    char *buf;
@@ -304,8 +449,8 @@ typedef struct {
 
 typedef union {
    char *s_val;
-   uint32_t ul_val;
-   int32_t sl_val;
+   uint64_t ul_val;
+   int64_t sl_val;
    dwarf_block *b_val;
 } dwarf_value;
 
@@ -315,17 +460,64 @@ typedef struct dwarf_die_att {
    struct dwarf_die_att *next_att;
 } dwarf_die_att;
 
+#define DWARF_DIE_NONE UINT32_MAX
+
+/*
+ * The DIEs of a CU are stored in preorder in dwarf_cu.dies. A subtree is 
+ * the size DIEs starting at its root, so die + die->size is the first DIE 
+ * after it. parent and next are indices into the same array. child and 
+ * sibling point into it as well.
+ */
 typedef struct dwarf_die {
+   uint64_t offset;           /* offset in .debug_info */
    uint32_t abbrev_code;
    const dwarf_tag *tag;
-   dwarf_die_att *att;
+   dwarf_die_att *att;        /* att_count entries in dwarf_cu.atts */
    struct dwarf_die *child;
    struct dwarf_die *sibling;
+   uint32_t parent;           /* DWARF_DIE_NONE for top level DIEs */
+   uint32_t next;             /* next sibling or DWARF_DIE_NONE */
+   uint32_t size;
+   uint32_t att_count;
 } dwarf_die;
 
+typedef enum {
+   DWARF_CACHE_CU,
+   DWARF_CACHE_SPROG
+} dwarf_cache_kind;
+
+/* 
+ * Entry in the LRU list of materialized CU DIE trees and line tables. 
+ */
+typedef struct dwarf_cache_ent {
+   dwarf_cache_kind kind;
+   size_t size;
+   struct dwarf_cache_ent *prev;
+   struct dwarf_cache_ent *next;
+} dwarf_cache_ent;
+
+typedef struct {
+   size_t budget;             /* 0 means unlimited */
+   size_t used;
+   dwarf_cache_ent *head;     /* most recently used */
+   dwarf_cache_ent *tail;     /* least recently used */
+   uint64_t hits;
+   uint64_t misses;
+   uint64_t evictions;
+} dwarf_cache;
+
 typedef struct dwarf_cu {
+   uint64_t offset;           /* offset of the header in .debug_info */
    dwarf_cu_header hdr;
-   dwarf_die *die; 
+   dwarf_die *die;            /* use dwarf_cu_get_die() */
+   dwarf_die *dies;           /* all DIEs in preorder, i.e. by offset */
+   uint32_t die_count;
+   dwarf_die_att *atts;       /* attributes of all DIEs in the same order */
+   uint32_t att_count;
+   char *body;
+   uint64_t body_len;
+   dwarf_abbrev_tab *atab;    /* read with the body */
+   dwarf_cache_ent cache;
    struct dwarf_cu *next_cu;
 } dwarf_cu;
 
@@ -374,50 +566,755 @@ typedef struct dwarf_sprog_file {
 } dwarf_sprog_file;
 
 typedef struct {
-   uint32_t total_len;
+   uint64_t total_len;
    uint16_t version;
-   uint32_t prologue_len;
+   uint64_t prologue_len;
+   uint8_t offset_size;
    uint8_t min_inst_len;
+   uint8_t max_ops;           /* operations per instruction, from DWARF 4 */
    uint8_t dflt_is_stmt;
    int8_t line_base;
-   int8_t line_range;
-   int8_t opcode_base;
+   uint8_t line_range;
+   uint8_t opcode_base;
    int8_t *std_opcode_len;
    dwarf_sprog_dir *incl_dirs;
    dwarf_sprog_file *files;
 } dwarf_sprog_pro;
 
 typedef struct dwarf_sprog {
-   dwarf_sprog_pro *prologue;
+   uint64_t offset;           /* offset in .debug_line */
+   char *hdr;
+   uint64_t unit_len;         /* including the initial length field */
+   dwarf_sprog_pro *prologue; /* use dwarf_sprog_get_pro() */
    size_t sm_len;
    char *sm;
-   dwarf_sm_regs *sm_regs;
+   dwarf_sm_regs *sm_regs;    /* use dwarf_sprog_get_regs() */
+   uint32_t file_count;
+   uint32_t *file_ids;        /* interned path of each file, see dwarf_paths_build() */
+   dwarf_cache_ent cache;
    struct dwarf_sprog *next;
 } dwarf_sprog;
 
 typedef struct {
    char *table;
-   uint32_t length;
+   uint64_t length;
 } dwarf_str;
 
+typedef struct dwarf_type_member {
+   char *name;
+   char *type_name;
+   struct dwarf_type *type;
+   uint64_t offset;           /* byte offset of the storage unit */
+   uint64_t size;
+   uint64_t bit_offset;       /* bit offset from the start of the type */
+   uint32_t bit_size;         /* 0 if not a bitfield */
+   uint64_t hole;             /* padding bytes following this member */
+} dwarf_type_member;
+
+/*
+ * Flattened layout of a type. Typedefs and cv-qualifiers resolve to the 
+ * layout of the underlying type. Descriptors reference only the mapped 
+ * sections and survive eviction of the DIE trees they were built from.
+ */
+typedef struct dwarf_type {
+   uint64_t offset;           /* offset of the type DIE in .debug_info */
+   const dwarf_tag *tag;
+   char *name;
+   uint64_t size;
+   uint32_t member_count;
+   dwarf_type_member *members;
+   uint64_t padding;          /* total bytes of holes and tail padding */
+   struct dwarf_type *next_type;
+} dwarf_type;
+
+/*
+ * Compiled DWARF expression. Operands are decoded, DW_OP_lit*, DW_OP_reg* 
+ * and DW_OP_breg* are folded into DW_OP_constu, DW_OP_regx and DW_OP_bregx 
+ * and branch targets are instruction indices.
+ */
+typedef struct {
+   uint8_t op;                /* normalized opcode */
+   uint8_t raw_op;            /* opcode as encoded */
+   uint64_t arg1;
+   uint64_t arg2;
+} dwarf_expr_op;
+
+typedef struct dwarf_expr {
+   uint32_t op_count;
+   char *data;                /* DW_OP_implicit_value contents */
+   dwarf_expr_op ops[];
+} dwarf_expr;
+
+typedef enum {
+   DWARF_LOC_ADDR,            /* value is the address of the object */
+   DWARF_LOC_REG,             /* value is a register number */
+   DWARF_LOC_VALUE,           /* value is the object itself */
+   DWARF_LOC_IMPLICIT         /* object is stored in the expression */
+} dwarf_loc_kind;
+
+typedef struct {
+   dwarf_loc_kind kind;
+   uint64_t value;
+   char *data;
+   uint64_t len;
+} dwarf_expr_result;
+
+typedef struct {
+   void *arg;
+   bool (*read_reg)(void *arg, uint32_t reg, uint64_t *val);
+   bool (*read_mem)(void *arg, uint64_t addr, void *buf, size_t len);
+   uint64_t frame_base;
+   uint64_t cfa;
+   bool push_cfa;             /* start with the CFA on the stack */
+   uint8_t addr_size;
+} dwarf_expr_ctx;
+
+typedef struct {
+   uint64_t low_pc;
+   uint64_t high_pc;          /* exclusive */
+   dwarf_expr *expr;
+} dwarf_loc;
+
+typedef struct dwarf_var {
+   char *name;
+   uint64_t offset;           /* offset of the DIE in .debug_info */
+   bool is_param;
+   uint64_t low_pc;           /* range of the enclosing scope */
+   uint64_t high_pc;
+   uint32_t loc_count;
+   dwarf_loc *locs;
+} dwarf_var;
+
+typedef struct dwarf_func {
+   char *name;
+   uint64_t offset;           /* offset of the DIE in .debug_info */
+   uint64_t low_pc;
+   uint64_t high_pc;          /* exclusive */
+   uint8_t addr_size;
+   uint32_t frame_base_count;
+   dwarf_loc *frame_base;
+   uint32_t var_count;
+   dwarf_var *vars;
+} dwarf_func;
+
+typedef struct {
+   dwarf_var *var;
+   dwarf_expr *expr;
+} dwarf_live_var;
+
+struct dwarf_func_index;
+
+/*
+ * Address range of a line table row. A row extends to the next row of its 
+ * sequence, rows without code are dropped.
+ */
+typedef struct {
+   uint64_t address;
+   uint64_t size;
+   uint32_t file_id;          /* interned path, see dwarf_path() */
+   uint32_t line;
+} dwarf_line;
+
+struct dwarf_line_index;
+struct dwarf_line_blocks;
+
+#define DWARF_LINE_BLOCK_ROWS 64   /* rows per block of a compressed table */
+
+typedef struct {
+   const dwarf_line *line;    /* NULL if no row covers the address */
+   dwarf_func *func;          /* NULL if no function covers the address */
+} dwarf_addr_info;
+
+/*
+ * Call frame information is evaluated ahead of time into rows sorted by 
+ * address. Each row refers to an interned unwind state, which holds the 
+ * CFA rule and the rules of all registers not keeping their value.
+ */
+#define DWARF_CFI_REGS 64          /* registers restored by dwarf_cfi_step */
+#define DWARF_CFI_NONE UINT32_MAX  /* state of rows not covered by an FDE */
+#define DWARF_CFI_NO_REG 0xffff
+
+typedef enum {
+   DWARF_RULE_SAME,           /* register keeps its value */
+   DWARF_RULE_UNDEF,          /* register cannot be recovered */
+   DWARF_RULE_OFFSET,         /* saved at CFA + value */
+   DWARF_RULE_VAL_OFFSET,     /* is CFA + value */
+   DWARF_RULE_REG,            /* saved in register value */
+   DWARF_RULE_EXPR,           /* saved at the address computed by exprs[value] */
+   DWARF_RULE_VAL_EXPR,       /* is computed by exprs[value] */
+   DWARF_RULE_CFA_REG,        /* CFA is register reg + value */
+   DWARF_RULE_CFA_EXPR        /* CFA is computed by exprs[value] */
+} dwarf_rule_kind;
+
+typedef struct {
+   uint16_t reg;
+   uint8_t kind;              /* dwarf_rule_kind */
+   int64_t value;
+} dwarf_cfi_rule;
+
+typedef struct {
+   dwarf_cfi_rule cfa;
+   uint16_t ra_reg;           /* return address column */
+   uint16_t rule_count;
+   uint32_t rules;            /* index of the first rule in dwarf_cfi.rules */
+} dwarf_cfi_state;
+
+typedef struct {
+   uint64_t low_pc;           /* the row extends to the next row */
+   uint32_t state;
+} dwarf_cfi_row;
+
+typedef struct {
+   uint8_t addr_size;
+   uint16_t sp_reg;           /* set to the CFA when unwinding */
+   uint32_t row_count;
+   dwarf_cfi_row *rows;
+   uint32_t state_count;
+   dwarf_cfi_state *states;
+   uint32_t rule_count;
+   dwarf_cfi_rule *rules;
+   uint32_t expr_count;
+   dwarf_expr **exprs;
+   Elf_Mem mem;               /* that of the Elf it was built from */
+} dwarf_cfi;
+
+typedef struct {
+   uint64_t pc;
+   uint64_t cfa;
+   uint64_t regs[DWARF_CFI_REGS];
+   uint32_t depth;            /* 0 for the frame that was interrupted */
+} dwarf_frame;
+
+struct dwarf_type_tab;
+struct dwarf_canon_tab;
+struct dwarf_path_tab;
+
+#define DWARF_PATH_NONE UINT32_MAX
+
+/*
+ * Functions for all memory of a Dwarf, called with ctx. They are called 
+ * from worker threads too, so they must be thread-safe. alloc and realloc 
+ * must not fail: allocations are not unwound like parse errors, and a 
+ * NULL result aborts the process.
+ */
+typedef struct {
+   void *(*alloc)(void *ctx, size_t size);
+   void *(*realloc)(void *ctx, void *ptr, size_t size);
+   void (*free)(void *ctx, void *ptr);
+   void *ctx;
+} dwarf_allocator;
+
+/* Counts of the calls to the allocator of a Dwarf, see dwarf_open_ex(). */
+typedef struct {
+   uint64_t allocs;           /* including reallocs of NULL */
+   uint64_t reallocs;
+   uint64_t frees;
+   uint64_t bytes;            /* requested by alloc and realloc in total */
+} dwarf_mem_stats;
+
 typedef struct Dwarf {
    dwarf_abbrevs *abbrevs;
    dwarf_cu *cu;
+   dwarf_cu **cus;            /* CUs sorted by offset */
+   uint32_t cu_count;
    dwarf_sprog *sprog;
+   dwarf_sprog **sprogs;      /* line programs sorted by offset */
+   uint32_t sprog_count;
    dwarf_str *str;
    dwarf_aranges *aranges;
+   dwarf_cache cache;
+   struct dwarf_type_tab *types;
+   struct dwarf_canon_tab *canon;
+   struct dwarf_func_index *funcs;
+   struct dwarf_line_index *lines;
+   struct dwarf_line_blocks *line_blocks; /* see dwarf_lines_compress() */
+   struct dwarf_path_tab *paths;
+   dwarf_cfi *cfi;
+   Elf_Scn info;
+   Elf_Scn abbrev;
+   Elf_Scn line;
+   Elf_Scn arange;            /* read by dwarf_get_aranges() */
+   Elf_Scn loc;               /* .debug_loc, size 0 if absent */
+   Elf_Scn ranges;            /* .debug_ranges, size 0 if absent */
    char *error;
    jmp_buf env;
    Elf *elf;
+   dwarf_allocator alloc;
+   dwarf_mem_stats mem_stats;
 } Dwarf;
 
+/*
+ * Selects the DIEs returned by dwarf_die_iter_next(). The depth of the 
+ * root DIE of a CU is 0, so file scope declarations have depth 1.
+ */
+typedef struct {
+   const dwarf_tag_id *tags;  /* NULL to match all tags */
+   uint32_t tag_count;
+   uint32_t depth_limit;      /* visit only depths below this, 0 for all */
+   bool skip_children;        /* don't visit the subtrees of matching DIEs */
+} dwarf_die_filter;
+
+typedef struct {
+   uint64_t offset;           /* offset of the DIE in .debug_info */
+   dwarf_tag_id tag;
+   uint32_t depth;
+   dwarf_cu *cu;
+} dwarf_die_entry;
+
+/*
+ * Scans .debug_info without building DIE trees. Attributes are skipped 
+ * unless dwarf_die_iter_get_die() is called, and subtrees that cannot 
+ * match are jumped over using DW_AT_sibling where present.
+ */
+typedef struct {
+   Dwarf *dwarf;
+   dwarf_die_filter filter;
+   dwarf_cu *cu;
+   uint32_t cu_idx;           /* next CU to scan */
+   uint32_t cu_end;
+   char *pos;
+   char *end;
+   uint32_t depth;
+   uint64_t die_off;          /* last DIE returned */
+   char *die_pos;
+   dwarf_abbrev_tab *die_tab;
+   dwarf_die *die;
+} dwarf_die_iter;
+
+typedef enum {
+   DWARF_DUMP_ARANGES = 1 << 0,
+   DWARF_DUMP_ABBREV = 1 << 1,
+   DWARF_DUMP_INFO = 1 << 2,
+   DWARF_DUMP_LINE = 1 << 3,
+   DWARF_DUMP_STR = 1 << 4,
+   DWARF_DUMP_ALL = 0x1f
+} dwarf_dump_sect;
+
 void
 dwarf_dump(Dwarf *dwarf);
 
+/*
+ * Dumps the sections selected by sects, a mask of dwarf_dump_sect. If cu 
+ * is not NULL, only its DIEs, line program, abbreviation table and address 
+ * ranges are read and printed. Otherwise CUs and line programs are 
+ * formatted on nthreads threads, with the output still in section order.
+ */
+void
+dwarf_dump_sects(Dwarf *dwarf, uint32_t sects, dwarf_cu *cu, int nthreads);
+
+/*
+ * Writes how many bytes of .debug_info, .debug_abbrev, .debug_line and 
+ * .debug_str each CU, tag, attribute and form and each source file take, 
+ * largest first. Returns 0, or -1 if a section is malformed.
+ */
+int
+dwarf_size_report(Dwarf *dwarf, FILE *out);
+
+/*
+ * Returns 0 on success, -2 if the file has no debug sections and -3 if the 
+ * unit headers in them are malformed, with the reason in dwarf->error.
+ */
 int
 dwarf_open(Dwarf *dwarf, char *file);
 
+/*
+ * Like dwarf_open(), but reads the sections it needs with pread() instead 
+ * of mapping the file, which is faster on some network file systems.
+ */
+int
+dwarf_open_pread(Dwarf *dwarf, char *file);
+
+/*
+ * Opens the ELF file behind fd. The descriptor is not closed by dwarf_free().
+ */
+int
+dwarf_open_fd(Dwarf *dwarf, int fd);
+
+/*
+ * Opens an ELF image that is already in memory without copying it. The 
+ * buffer must remain valid until dwarf_free() is called.
+ */
+int
+dwarf_open_mem(Dwarf *dwarf, char *buf, size_t size);
+
+/*
+ * Like dwarf_open(), but all memory of dwarf, including its error message, 
+ * is allocated with alloc, or with the C library if alloc is NULL. The 
+ * calls are counted in dwarf->mem_stats, which stays valid after 
+ * dwarf_free() so leaks show as allocs differing from frees.
+ */
+int
+dwarf_open_ex(Dwarf *dwarf, char *file, const dwarf_allocator *alloc);
+
 void
 dwarf_free(Dwarf *dwarf);
 
+/*
+ * Frees memory that a function returned to the caller to free, such as 
+ * the entries of dwarf_dies_collect().
+ */
+void
+dwarf_mem_free(Dwarf *dwarf, void *ptr);
+
+/* Copies the allocator counts of dwarf, which may be in use on threads. */
+void
+dwarf_get_mem_stats(Dwarf *dwarf, dwarf_mem_stats *stats);
+
+/*
+ * CU bodies and line programs are parsed on first access. Pointers returned 
+ * by the following functions stay valid until the next call to one of them 
+ * if a cache budget is set, since older entries may then be evicted.
+ */
+dwarf_die *
+dwarf_cu_get_die(Dwarf *dwarf, dwarf_cu *cu);
+
+dwarf_sm_regs *
+dwarf_sprog_get_regs(Dwarf *dwarf, dwarf_sprog *sprog);
+
+dwarf_sprog_pro *
+dwarf_sprog_get_pro(Dwarf *dwarf, dwarf_sprog *sprog);
+
+void
+dwarf_set_cache_budget(Dwarf *dwarf, size_t budget);
+
+dwarf_cu *
+dwarf_get_cu(Dwarf *dwarf, uint64_t offset);
+
+/*
+ * Returns the CU whose DW_AT_name is name or ends in "/" name. Only the 
+ * root DIEs of the CUs are read.
+ */
+dwarf_cu *
+dwarf_cu_find(Dwarf *dwarf, const char *name);
+
+/*
+ * Returns the CU that covers addr according to .debug_aranges, or to the 
+ * address ranges of the root DIEs if the section is missing.
+ */
+dwarf_cu *
+dwarf_cu_at_addr(Dwarf *dwarf, uint64_t addr);
+
+dwarf_aranges *
+dwarf_get_aranges(Dwarf *dwarf);
+
+/*
+ * Returns the line program referenced by the DW_AT_stmt_list of a CU.
+ */
+dwarf_sprog *
+dwarf_cu_get_sprog(Dwarf *dwarf, dwarf_cu *cu);
+
+/*
+ * Returns the DIE at the given .debug_info offset. 
+ */
+dwarf_die *
+dwarf_get_die(Dwarf *dwarf, uint64_t offset);
+
+dwarf_die_att *
+dwarf_die_get_att(dwarf_die *die, dwarf_att_id att);
+
+dwarf_die *
+dwarf_die_get_parent(dwarf_cu *cu, dwarf_die *die);
+
+/*
+ * Starts a scan of the DIEs of cu, or of all CUs if cu is NULL.
+ */
+void
+dwarf_die_iter_init(dwarf_die_iter *iter, Dwarf *dwarf, dwarf_cu *cu, 
+      const dwarf_die_filter *filter);
+
+/*
+ * Stores the next matching DIE in entry. Returns 1 if there was one, 0 at 
+ * the end of the scan and -1 if .debug_info is malformed.
+ */
+int
+dwarf_die_iter_next(dwarf_die_iter *iter, dwarf_die_entry *entry);
+
+/*
+ * Decodes the attributes of the DIE last returned by the iterator. The 
+ * DIE is freed by the next call to dwarf_die_iter_next().
+ */
+dwarf_die *
+dwarf_die_iter_get_die(dwarf_die_iter *iter);
+
+void
+dwarf_die_iter_free(dwarf_die_iter *iter);
+
+/*
+ * Scans the CUs on nthreads threads and stores all matching DIEs in 
+ * .debug_info order in *entries, which the caller frees with 
+ * dwarf_mem_free().
+ */
+int
+dwarf_dies_collect(Dwarf *dwarf, const dwarf_die_filter *filter, 
+      int nthreads, dwarf_die_entry **entries, uint32_t *count);
+
+/*
+ * Follows a reference attribute such as DW_AT_type, DW_AT_abstract_origin 
+ * or DW_AT_specification. Returns NULL if the DIE has no such attribute.
+ */
+dwarf_die *
+dwarf_die_get_ref(Dwarf *dwarf, dwarf_die *die, dwarf_att_id att);
+
+char *
+dwarf_die_get_name(Dwarf *dwarf, dwarf_die *die);
+
+/*
+ * Returns the value of a string attribute of die, or NULL if it has no 
+ * such attribute or it is not a string.
+ */
+char *
+dwarf_die_get_str(Dwarf *dwarf, dwarf_die *die, dwarf_att_id att_id);
+
+/*
+ * Returns the memoized layout of the type described by die. 
+ */
+dwarf_type *
+dwarf_type_get(Dwarf *dwarf, dwarf_die *die);
+
+/*
+ * Returns the layout of the first defined type with the given name.
+ */
+dwarf_type *
+dwarf_type_find(Dwarf *dwarf, const char *name);
+
+/*
+ * Resolves the layouts of all structure, class and union types of the 
+ * binary using nthreads worker threads.
+ */
+int
+dwarf_types_build(Dwarf *dwarf, int nthreads);
+
+/*
+ * Maps structurally equal type DIEs of all CUs to one canonical DIE, so 
+ * that their layouts share one descriptor and equality of dwarf_type 
+ * pointers implies type equality. Returns the number of distinct types.
+ */
+int
+dwarf_types_dedup(Dwarf *dwarf);
+
+/*
+ * Returns the offset of the canonical DIE of a type, or its own offset 
+ * if dwarf_types_dedup() was not run.
+ */
+uint64_t
+dwarf_type_canonical(Dwarf *dwarf, dwarf_die *die);
+
+void
+dwarf_type_dump(dwarf_type *type);
+
+void
+dwarf_types_dump(Dwarf *dwarf);
+
+/*
+ * Compiles a DWARF expression once into validated bytecode, which the 
+ * caller frees with free(). Returns NULL for malformed or unsupported 
+ * expressions.
+ */
+dwarf_expr *
+dwarf_expr_compile(char *buf, uint32_t len, uint8_t addr_size);
+
+int
+dwarf_expr_eval(dwarf_expr *expr, dwarf_expr_ctx *ctx, 
+      dwarf_expr_result *res);
+
+void
+dwarf_expr_dump(FILE *out, dwarf_expr *expr);
+
+/*
+ * Returns the function whose code contains pc, building the per-function 
+ * variable index on first use.
+ */
+dwarf_func *
+dwarf_func_at(Dwarf *dwarf, uint64_t pc);
+
+/*
+ * Builds the function index used by dwarf_func_at() and dwarf_func_find(). 
+ * Functions whose code is split into several address ranges, such as hot 
+ * and cold parts, have an entry per range.
+ */
+int
+dwarf_funcs_build(Dwarf *dwarf);
+
+/*
+ * Returns the function with the lowest address of the given name, building 
+ * the function index on first use.
+ */
+dwarf_func *
+dwarf_func_find(Dwarf *dwarf, const char *name);
+
+dwarf_expr *
+dwarf_func_frame_base(dwarf_func *func, uint64_t pc);
+
+/*
+ * Stores up to max variables of the function containing pc whose scope 
+ * and location cover pc. Returns the number of such variables.
+ */
+uint32_t
+dwarf_vars_at(Dwarf *dwarf, uint64_t pc, dwarf_live_var *vars, 
+      uint32_t max);
+
+/*
+ * Builds the unwind table of an ELF file from .eh_frame and .debug_frame. 
+ * Returns NULL if the file has neither.
+ */
+dwarf_cfi *
+dwarf_cfi_build(Elf *elf);
+
+void
+dwarf_cfi_free(dwarf_cfi *cfi);
+
+/*
+ * Returns the unwind table of the binary, building it on first use.
+ */
+dwarf_cfi *
+dwarf_get_cfi(Dwarf *dwarf);
+
+dwarf_cfi_state *
+dwarf_cfi_find(dwarf_cfi *cfi, uint64_t pc);
+
+/*
+ * Unwinds frame to its caller, reading saved registers through read_mem. 
+ * Returns 0 on success, 1 at the outermost frame and -1 if the frame 
+ * cannot be unwound.
+ */
+int
+dwarf_cfi_step(dwarf_cfi *cfi, dwarf_frame *frame, void *arg,
+      bool (*read_mem)(void *arg, uint64_t addr, void *buf, size_t len));
+
+void
+dwarf_cfi_dump(dwarf_cfi *cfi);
+
+/*
+ * Resolves the file names of all line programs against their include 
+ * directory and the DW_AT_comp_dir of their CU into normalized paths. 
+ * Equal paths share one ID across CUs.
+ */
+int
+dwarf_paths_build(Dwarf *dwarf);
+
+uint32_t
+dwarf_path_count(Dwarf *dwarf);
+
+const char *
+dwarf_path(Dwarf *dwarf, uint32_t id);
+
+/*
+ * Returns the path ID of a file of a line program, where file_idx is the 
+ * 1-based file register value, or DWARF_PATH_NONE.
+ */
+uint32_t
+dwarf_sprog_file_id(Dwarf *dwarf, dwarf_sprog *sprog, uint32_t file_idx);
+
+/*
+ * Stores up to max IDs of the paths whose last components equal those of 
+ * suffix, so "foo.c" and "net/foo.c" both match "/src/net/foo.c". Returns 
+ * the number of matching paths.
+ */
+uint32_t
+dwarf_paths_find(Dwarf *dwarf, const char *suffix, uint32_t *ids, 
+      uint32_t max);
+
+/*
+ * Merges the rows of all line programs into one table sorted by address 
+ * and indexes them by path and line. Once the line, function and path 
+ * indexes are built, dwarf_line_at(), dwarf_line_addrs(), dwarf_func_at(), 
+ * dwarf_func_find(), dwarf_path() and dwarf_paths_find() only read them 
+ * and may be called from several threads.
+ */
+int
+dwarf_lines_build(Dwarf *dwarf);
+
+/*
+ * Returns the line table row covering pc, building the line index on 
+ * first use.
+ */
+const dwarf_line *
+dwarf_line_at(Dwarf *dwarf, uint64_t pc);
+
+/*
+ * Stores up to max start addresses of the code generated for a line of the 
+ * file with path ID file_id in ascending order. Consecutive rows of the 
+ * line count once. Returns the number of such addresses.
+ */
+uint32_t
+dwarf_line_addrs(Dwarf *dwarf, uint32_t file_id, uint32_t line, 
+      uint64_t *addrs, uint32_t max);
+
+/*
+ * Builds the line table of dwarf_lines_build() in compressed form, for 
+ * binaries where the plain table is too large to keep. Rows are delta 
+ * encoded in blocks of DWARF_LINE_BLOCK_ROWS behind a header with the 
+ * address, file and line of the first row. Most rows take one or two 
+ * bytes. The plain table is used as input if it exists and is not freed.
+ */
+int
+dwarf_lines_compress(Dwarf *dwarf);
+
+/*
+ * Copies the row covering pc from the compressed line table to *line, 
+ * building the table on first use. Only the block holding pc is decoded. 
+ * Returns false if no row covers pc. Like dwarf_line_at(), this only 
+ * reads the table once built and may be called from several threads.
+ */
+bool
+dwarf_line_find(Dwarf *dwarf, uint64_t pc, dwarf_line *line);
+
+/*
+ * Looks up the line row and function of each of n addresses and stores 
+ * them in results[i] for addrs[i]. The addresses are sorted and matched 
+ * against the line and function indexes in one sweep, split into slices 
+ * of the sorted addresses among nthreads threads.
+ */
+int
+dwarf_addr2line_batch(Dwarf *dwarf, const uint64_t *addrs, uint32_t n, 
+      dwarf_addr_info *results, int nthreads);
+
+/*
+ * Writes functions, inlined calls and line rows of the binary as a 
+ * Breakpad style symbol file, one CU at a time. The cache budget is 
+ * lowered so that no more than the current CU stays resident.
+ */
+int
+dwarf_export(Dwarf *dwarf, FILE *out, const char *name);
+
+/*
+ * Stores a content hash of each of dwarf->cus in hashes, which has room for 
+ * cu_count values. It covers the bytes of the unit, its abbreviation table 
+ * and line program, and the strings, range lists and other units its DIEs 
+ * refer to, so a unit with an unchanged hash yields the same records.
+ */
+int
+dwarf_cu_hashes(Dwarf *dwarf, uint64_t *hashes);
+
+/*
+ * Same as dwarf_export(), but keeps the records of each CU in cache_dir, 
+ * named by its hash from dwarf_cu_hashes(). CUs whose hash is found there 
+ * are written from the cache without being read, so rebuilding the symbol 
+ * file of a binary after a small change only reads the CUs that changed.
+ */
+int
+dwarf_export_cached(Dwarf *dwarf, FILE *out, const char *name, 
+      const char *cache_dir);
+
+/*
+ * Called by dwarf_scan() on a worker thread for each ELF file or archive 
+ * member, with member NULL for files. rc is the result of opening it as 
+ * with dwarf_open(), and dwarf->error may hold the reason if it failed. 
+ * The Dwarf is freed when fn returns.
+ */
+typedef void (*dwarf_scan_fn)(Dwarf *dwarf, int rc, const char *path, 
+      const char *member, FILE *out, void *arg);
+
+/*
+ * Opens the ELF files and ar archive members under paths on nthreads 
+ * threads and calls fn for each. Directories are walked in name order, 
+ * skipping files that are neither ELF files nor archives. Members are 
+ * read in place from the mapped archive, and the debug sections of 
+ * relocatable objects are relocated. What fn writes to its stream is 
+ * copied to out in the order the objects were found.
+ */
+int
+dwarf_scan(char **paths, uint32_t count, int nthreads, dwarf_scan_fn fn, 
+      void *arg, FILE *out);
+
 #endif // _THYRION_H
@@ -0,0 +1,748 @@
+/*
+ *  Copyright (c) 2013, Adrian Moser
+ *  All rights reserved.
+ * 
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *  * Redistributions of source code must retain the above copyright
+ *  notice, this list of conditions and the following disclaimer.
+ *  * Redistributions in binary form must reproduce the above copyright
+ *  notice, this list of conditions and the following disclaimer in the
+ *  documentation and/or other materials provided with the distribution.
+ *  * Neither the name of the author nor the
+ *  names of its contributors may be used to endorse or promote products
+ *  derived from this software without specific prior written permission.
+ * 
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ *  WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ *  DISCLAIMED. IN NO EVENT SHALL AUTHOR BE LIABLE FOR ANY
+ *  DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ *  (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ *  LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ *  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ *  (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ *  SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Symbolization server. The binaries given on the command line or listed 
+ * in a config file are loaded once and queried by clients connecting to a 
+ * Unix domain socket. Clients send batches of requests, one per line:
+ *
+ *    addr <binary> <address>         <file>:<line> <function>
+ *    line <binary> <file>:<line>     <address>...
+ *    name <binary> <function>        <address> <size>
+ *    stats                           counters and latencies
+ *
+ * A binary is named by its path or the last component of it. A batch ends 
+ * with an empty line or the end of input and is answered with one line per 
+ * request followed by an empty line. "?" answers a lookup without result, 
+ * "!" a malformed request.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "thyrion.h"
+
+#define THYRIOND_SOCKET "/tmp/thyriond.sock"
+#define THYRIOND_QUEUE 64          /* accepted connections waiting for a worker */
+#define THYRIOND_MAX_ADDRS 64      /* addresses returned for a line */
+#define THYRIOND_MAX_FILES 16      /* files searched for a line */
+#define THYRIOND_BUCKETS 40        /* log2 microsecond latency buckets */
+
+typedef enum {
+   OP_ADDR,
+   OP_LINE,
+   OP_NAME,
+   OP_STATS,
+   OP_COUNT
+} thyriond_op;
+
+static const char *op_names[OP_COUNT] = { "addr", "line", "name", "stats" };
+
+typedef struct {
+   char *path;
+   const char *name;
+   Dwarf dwarf;
+} thyriond_binary;
+
+typedef struct {
+   struct timespec start;
+   uint64_t connections;
+   uint64_t batches;
+   uint64_t requests[OP_COUNT];
+   uint64_t misses;
+   uint64_t errors;
+   uint64_t busy_ns;          /* sum of batch latencies */
+   uint64_t max_ns;
+   uint64_t buckets[THYRIOND_BUCKETS];
+   pthread_mutex_t lock;
+} thyriond_stats;
+
+struct thyriond_server;
+
+typedef struct {
+   struct thyriond_server *srv;
+   int fd;                    /* connection being served, -1 if idle */
+   pthread_t thread;
+} thyriond_worker;
+
+typedef struct thyriond_server {
+   thyriond_binary *bins;
+   uint32_t bin_count;
+   thyriond_stats stats;
+   int queue[THYRIOND_QUEUE];
+   uint32_t head;
+   uint32_t count;
+   bool done;
+   thyriond_worker *workers;
+   int nthreads;
+   pthread_mutex_t lock;
+   pthread_cond_t cond;
+} thyriond_server;
+
+static volatile sig_atomic_t stopping;
+
+static void
+usage(char *name) {
+   fprintf(stderr, "usage: %s [-j <threads>] [-s <socket>] [-c <config>] "
+         "[<file>...]\n", name); 
+   exit(1);
+}
+
+static void
+on_signal(int sig) {
+   (void)sig;
+   stopping = 1;
+}
+
+static uint64_t
+elapsed_ns(struct timespec *start) {
+   struct timespec now;
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+
+   return (now.tv_sec - start->tv_sec) * 1000000000ULL + now.tv_nsec - 
+         start->tv_nsec;
+}
+
+static thyriond_binary *
+find_binary(thyriond_server *srv, const char *name) {
+   uint32_t i;
+
+   for (i = 0; i < srv->bin_count; i++) {
+      if (!strcmp(srv->bins[i].name, name) || 
+            !strcmp(srv->bins[i].path, name)) {
+         return &srv->bins[i];
+      }
+   }
+
+   return NULL;
+}
+
+static int
+add_binary(thyriond_server *srv, const char *path) {
+   thyriond_binary *bin;
+   const char *slash;
+
+   srv->bins = realloc(srv->bins, 
+         (srv->bin_count + 1) * sizeof(thyriond_binary));
+   bin = &srv->bins[srv->bin_count];
+
+   if (dwarf_open(&bin->dwarf, (char *)path)) {
+      fprintf(stderr, "Failed to read DWARF of %s\n", path); 
+      return -1;
+   }
+
+   /* only the indexes are used, so the DIE trees can go once they're built */
+   dwarf_set_cache_budget(&bin->dwarf, 1);
+
+   if (dwarf_paths_build(&bin->dwarf) || dwarf_funcs_build(&bin->dwarf) || 
+         dwarf_lines_build(&bin->dwarf)) {
+      fprintf(stderr, "Failed to index %s\n", path); 
+      dwarf_free(&bin->dwarf);
+      return -1;
+   }
+
+   bin->path = strdup(path);
+   bin->name = (slash = strrchr(bin->path, '/')) ? slash + 1 : bin->path;
+   srv->bin_count++;
+
+   return 0;
+}
+
+/*
+ * Loads the binaries listed in a config file, one path per line. Empty 
+ * lines and lines starting with '#' are skipped.
+ */
+static int
+read_config(thyriond_server *srv, const char *file) {
+   FILE *in = fopen(file, "r");
+   char *line = NULL;
+   size_t len = 0;
+   ssize_t n;
+   int rc = 0;
+
+   if (!in) {
+      fprintf(stderr, "Failed to open %s\n", file); 
+      return -1;
+   }
+
+   while (!rc && (n = getline(&line, &len, in)) >= 0) {
+      while (n && (line[n - 1] == '\n' || line[n - 1] == ' ')) {
+         line[--n] = '\0';
+      }
+
+      if (n && line[0] != '#') {
+         rc = add_binary(srv, line);
+      }
+   }
+
+   free(line);
+   fclose(in);
+
+   return rc;
+}
+
+static void
+write_stats(thyriond_server *srv, FILE *out) {
+   thyriond_stats *stats = &srv->stats;
+   uint64_t total = 0;
+   uint64_t seen = 0;
+   uint64_t p50 = 0;
+   uint64_t p99 = 0;
+   double uptime;
+   uint32_t i;
+
+   pthread_mutex_lock(&stats->lock);
+
+   for (i = 0; i < OP_COUNT; i++) {
+      total += stats->requests[i];
+   }
+
+   /* percentiles are reported as the upper bound of their bucket */
+   for (i = 0; i < THYRIOND_BUCKETS; i++) {
+      seen += stats->buckets[i];
+
+      if (!p50 && seen * 2 >= stats->batches && stats->batches) {
+         p50 = 1ULL << i;
+      }
+      if (!p99 && seen * 100 >= stats->batches * 99 && stats->batches) {
+         p99 = 1ULL << i;
+      }
+   }
+
+   uptime = elapsed_ns(&stats->start) / 1e9;
+
+   fprintf(out, "uptime=%.1fs connections=%" PRIu64 " batches=%" PRIu64 
+         " requests=%" PRIu64, uptime, stats->connections, stats->batches, 
+         total);
+
+   for (i = 0; i < OP_COUNT; i++) {
+      fprintf(out, " %s=%" PRIu64, op_names[i], stats->requests[i]);
+   }
+
+   /* busy is the share of worker time spent answering batches */
+   fprintf(out, " misses=%" PRIu64 " errors=%" PRIu64 " requests/s=%.1f "
+         "busy=%.1f%%", stats->misses, stats->errors, total / uptime, 
+         stats->busy_ns / 1e7 / uptime / srv->nthreads);
+   fprintf(out, " batch_us.mean=%.1f batch_us.p50<=%" PRIu64 
+         " batch_us.p99<=%" PRIu64 " batch_us.max=%.1f\n", 
+         stats->batches ? stats->busy_ns / 1e3 / stats->batches : 0.0, 
+         p50, p99, stats->max_ns / 1e3);
+
+   pthread_mutex_unlock(&stats->lock);
+}
+
+static void
+record_batch(thyriond_stats *stats, uint64_t *requests, uint64_t misses, 
+      uint64_t errors, uint64_t ns) {
+   uint32_t bucket = 0;
+   uint64_t us = ns / 1000;
+   uint32_t i;
+
+   while (us && bucket < THYRIOND_BUCKETS - 1) {
+      us >>= 1;
+      bucket++;
+   }
+
+   pthread_mutex_lock(&stats->lock);
+
+   for (i = 0; i < OP_COUNT; i++) {
+      stats->requests[i] += requests[i];
+   }
+
+   stats->batches++;
+   stats->misses += misses;
+   stats->errors += errors;
+   stats->busy_ns += ns;
+   stats->buckets[bucket]++;
+
+   if (ns > stats->max_ns) {
+      stats->max_ns = ns;
+   }
+
+   pthread_mutex_unlock(&stats->lock);
+}
+
+static int
+lookup_addr(thyriond_binary *bin, const char *arg, FILE *out) {
+   const dwarf_line *row;
+   dwarf_func *func;
+   unsigned long long pc;
+   char *end;
+
+   pc = strtoull(arg, &end, 16);
+
+   if (*end || end == arg) {
+      fprintf(out, "! bad address %s\n", arg);
+      return -1;
+   }
+
+   if (!(row = dwarf_line_at(&bin->dwarf, pc))) {
+      fprintf(out, "?\n");
+      return 0;
+   }
+
+   func = dwarf_func_at(&bin->dwarf, pc);
+   fprintf(out, "%s:%u %s\n", dwarf_path(&bin->dwarf, row->file_id), 
+         row->line, func && func->name ? func->name : "??");
+
+   return 1;
+}
+
+static int
+lookup_line(thyriond_binary *bin, char *arg, FILE *out) {
+   uint64_t addrs[THYRIOND_MAX_ADDRS];
+   uint32_t ids[THYRIOND_MAX_FILES];
+   uint32_t id_count;
+   uint32_t count = 0;
+   uint32_t line;
+   uint32_t i;
+   char *colon;
+   char *end;
+
+   if (!(colon = strrchr(arg, ':')) || 
+         !(line = strtoul(colon + 1, &end, 10)) || *end) {
+      fprintf(out, "! bad line %s\n", arg);
+      return -1;
+   }
+
+   *colon = '\0';
+   id_count = dwarf_paths_find(&bin->dwarf, arg, ids, THYRIOND_MAX_FILES);
+   *colon = ':';
+
+   if (id_count > THYRIOND_MAX_FILES) {
+      id_count = THYRIOND_MAX_FILES;
+   }
+
+   /* an ambiguous suffix answers for all files it matches */
+   for (i = 0; i < id_count && count < THYRIOND_MAX_ADDRS; i++) {
+      count += dwarf_line_addrs(&bin->dwarf, ids[i], line, addrs + count, 
+            THYRIOND_MAX_ADDRS - count);
+   }
+
+   if (!count) {
+      fprintf(out, "?\n");
+      return 0;
+   }
+
+   if (count > THYRIOND_MAX_ADDRS) {
+      count = THYRIOND_MAX_ADDRS;
+   }
+
+   for (i = 0; i < count; i++) {
+      fprintf(out, i ? " 0x%" PRIx64 : "0x%" PRIx64, addrs[i]);
+   }
+   fputc('\n', out);
+
+   return 1;
+}
+
+static int
+lookup_name(thyriond_binary *bin, const char *arg, FILE *out) {
+   dwarf_func *func;
+
+   if (!(func = dwarf_func_find(&bin->dwarf, arg))) {
+      fprintf(out, "?\n");
+      return 0;
+   }
+
+   fprintf(out, "0x%" PRIx64 " %" PRIu64 "\n", func->low_pc, 
+         func->high_pc - func->low_pc);
+
+   return 1;
+}
+
+/*
+ * Answers one request. Returns 1 if it was answered, 0 if the lookup found 
+ * nothing and -1 if the request was malformed.
+ */
+static int
+serve_request(thyriond_server *srv, char *req, FILE *out, 
+      uint64_t *requests) {
+   thyriond_binary *bin;
+   char *op;
+   char *name;
+   char *arg;
+   int i;
+
+   if (!(op = strtok_r(req, " \t", &arg))) {
+      fprintf(out, "! empty request\n");
+      return -1;
+   }
+
+   for (i = 0; i < OP_COUNT && strcmp(op, op_names[i]); i++);
+
+   if (i == OP_COUNT) {
+      fprintf(out, "! unknown request %s\n", op);
+      return -1;
+   }
+
+   requests[i]++;
+
+   if (i == OP_STATS) {
+      write_stats(srv, out);
+      return 1;
+   }
+
+   if (!(name = strtok_r(NULL, " \t", &arg)) || !*arg) {
+      fprintf(out, "! usage: %s <binary> <arg>\n", op);
+      return -1;
+   }
+
+   while (*arg == ' ' || *arg == '\t') {
+      arg++;
+   }
+
+   if (!(bin = find_binary(srv, name))) {
+      fprintf(out, "! unknown binary %s\n", name);
+      return -1;
+   }
+
+   switch (i) {
+      case OP_ADDR:
+         return lookup_addr(bin, arg, out);
+      case OP_LINE:
+         return lookup_line(bin, arg, out);
+      default:
+         return lookup_name(bin, arg, out);
+   }
+}
+
+static void
+serve_client(thyriond_server *srv, int fd) {
+   uint64_t requests[OP_COUNT];
+   struct timespec start;
+   uint64_t misses = 0;
+   uint64_t errors = 0;
+   uint32_t pending = 0;
+   char *line = NULL;
+   size_t len = 0;
+   ssize_t n;
+   FILE *in;
+   FILE *out;
+   int out_fd;
+
+   if ((out_fd = dup(fd)) < 0 || !(out = fdopen(out_fd, "w"))) {
+      if (out_fd >= 0) {
+         close(out_fd);
+      }
+      close(fd);
+      return;
+   }
+
+   if (!(in = fdopen(fd, "r"))) {
+      close(fd);
+      fclose(out);
+      return;
+   }
+
+   memset(requests, 0, sizeof(requests));
+
+   while (true) {
+      n = getline(&line, &len, in);
+
+      while (n > 0 && (line[n - 1] == '\n' || line[n - 1] == '\r')) {
+         line[--n] = '\0';
+      }
+
+      if (n > 0) {
+         if (!pending++) {
+            clock_gettime(CLOCK_MONOTONIC, &start);
+         }
+
+         switch (serve_request(srv, line, out, requests)) {
+            case 0:
+               misses++;
+               break;
+            case -1:
+               errors++;
+               break;
+         }
+         continue;
+      }
+
+      if (pending) {
+         fputc('\n', out);
+         fflush(out);
+         record_batch(&srv->stats, requests, misses, errors, 
+               elapsed_ns(&start));
+         memset(requests, 0, sizeof(requests));
+         misses = errors = pending = 0;
+      }
+
+      if (n < 0 || ferror(out)) {
+         break;
+      }
+   }
+
+   free(line);
+   fclose(in);
+   fclose(out);
+}
+
+static void *
+worker_main(void *arg) {
+   thyriond_worker *worker = arg;
+   thyriond_server *srv = worker->srv;
+   int fd;
+
+   while (true) {
+      pthread_mutex_lock(&srv->lock);
+
+      while (!srv->count && !srv->done) {
+         pthread_cond_wait(&srv->cond, &srv->lock);
+      }
+
+      if (!srv->count) {
+         pthread_mutex_unlock(&srv->lock);
+         break;
+      }
+
+      fd = srv->queue[srv->head];
+      srv->head = (srv->head + 1) % THYRIOND_QUEUE;
+      srv->count--;
+      worker->fd = fd;
+      pthread_cond_broadcast(&srv->cond);
+      pthread_mutex_unlock(&srv->lock);
+
+      serve_client(srv, fd);
+
+      pthread_mutex_lock(&srv->lock);
+      worker->fd = -1;
+      pthread_mutex_unlock(&srv->lock);
+   }
+
+   return NULL;
+}
+
+static int
+open_socket(const char *path) {
+   struct sockaddr_un addr;
+   int fd;
+
+   if (strlen(path) >= sizeof(addr.sun_path)) {
+      fprintf(stderr, "Socket path %s is too long\n", path); 
+      return -1;
+   }
+
+   memset(&addr, 0, sizeof(addr));
+   addr.sun_family = AF_UNIX;
+   strcpy(addr.sun_path, path);
+
+   if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) {
+      perror("socket");
+      return -1;
+   }
+
+   /* a socket left behind by a previous run would make bind fail */
+   unlink(path);
+
+   if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) || 
+         listen(fd, SOMAXCONN)) {
+      fprintf(stderr, "Failed to listen on %s: %s\n", path, strerror(errno)); 
+      close(fd);
+      return -1;
+   }
+
+   return fd;
+}
+
+static void
+serve(thyriond_server *srv, int listen_fd) {
+   sigset_t block, saved;
+   int started;
+   int fd;
+   int i;
+
+   srv->workers = calloc(srv->nthreads, sizeof(thyriond_worker));
+
+   /* workers inherit the mask, so only accept() is interrupted on stop */
+   sigemptyset(&block);
+   sigaddset(&block, SIGINT);
+   sigaddset(&block, SIGTERM);
+   pthread_sigmask(SIG_BLOCK, &block, &saved);
+
+   for (started = 0; started < srv->nthreads; started++) {
+      srv->workers[started].srv = srv;
+      srv->workers[started].fd = -1;
+
+      if (pthread_create(&srv->workers[started].thread, NULL, worker_main, 
+               &srv->workers[started])) {
+         break;
+      }
+   }
+
+   pthread_sigmask(SIG_SETMASK, &saved, NULL);
+
+   if (!started) {
+      fprintf(stderr, "Failed to start worker threads\n"); 
+      free(srv->workers);
+      return;
+   }
+
+   srv->nthreads = started;
+
+   while (!stopping) {
+      if ((fd = accept(listen_fd, NULL, NULL)) < 0) {
+         if (errno != EINTR && errno != ECONNABORTED) {
+            perror("accept");
+            break;
+         }
+         continue;
+      }
+
+      pthread_mutex_lock(&srv->stats.lock);
+      srv->stats.connections++;
+      pthread_mutex_unlock(&srv->stats.lock);
+
+      pthread_mutex_lock(&srv->lock);
+
+      while (srv->count == THYRIOND_QUEUE && !stopping) {
+         pthread_cond_wait(&srv->cond, &srv->lock);
+      }
+
+      srv->queue[(srv->head + srv->count++) % THYRIOND_QUEUE] = fd;
+      pthread_cond_broadcast(&srv->cond);
+      pthread_mutex_unlock(&srv->lock);
+   }
+
+   /* connections still queued are dropped, active ones see end of input */
+   pthread_mutex_lock(&srv->lock);
+   srv->done = true;
+
+   while (srv->count) {
+      close(srv->queue[srv->head]);
+      srv->head = (srv->head + 1) % THYRIOND_QUEUE;
+      srv->count--;
+   }
+
+   for (i = 0; i < started; i++) {
+      if (srv->workers[i].fd >= 0) {
+         shutdown(srv->workers[i].fd, SHUT_RDWR);
+      }
+   }
+
+   pthread_cond_broadcast(&srv->cond);
+   pthread_mutex_unlock(&srv->lock);
+
+   while (started--) {
+      pthread_join(srv->workers[started].thread, NULL);
+   }
+
+   free(srv->workers);
+}
+
+int
+main(int argc, char **argv) {
+   thyriond_server srv;
+   struct sigaction sa;
+   char *socket_path = THYRIOND_SOCKET;
+   char *config = NULL;
+   int listen_fd;
+   int rc = 0;
+   int i;
+
+   memset(&srv, 0, sizeof(srv));
+   srv.nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+
+   for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+      if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+         srv.nthreads = atoi(argv[++i]);
+      } else if (!strcmp(argv[i], "-s") && i + 1 < argc) {
+         socket_path = argv[++i];
+      } else if (!strcmp(argv[i], "-c") && i + 1 < argc) {
+         config = argv[++i];
+      } else {
+         usage(argv[0]);
+      }
+   }
+
+   if ((i == argc && !config) || srv.nthreads < 1) {
+      usage(argv[0]);
+   }
+
+   if (config) {
+      rc = read_config(&srv, config);
+   }
+
+   for (; !rc && i < argc; i++) {
+      rc = add_binary(&srv, argv[i]);
+   }
+
+   if (!rc && !srv.bin_count) {
+      fprintf(stderr, "No binaries to serve\n"); 
+      rc = -1;
+   }
+
+   if (!rc && (listen_fd = open_socket(socket_path)) < 0) {
+      rc = -1;
+   }
+
+   if (!rc) {
+      /* no SA_RESTART, so that accept returns when asked to stop */
+      memset(&sa, 0, sizeof(sa));
+      sa.sa_handler = on_signal;
+      sigaction(SIGINT, &sa, NULL);
+      sigaction(SIGTERM, &sa, NULL);
+      signal(SIGPIPE, SIG_IGN);
+
+      pthread_mutex_init(&srv.lock, NULL);
+      pthread_cond_init(&srv.cond, NULL);
+      pthread_mutex_init(&srv.stats.lock, NULL);
+      clock_gettime(CLOCK_MONOTONIC, &srv.stats.start);
+
+      fprintf(stderr, "Serving %u binaries on %s with %d threads\n", 
+            srv.bin_count, socket_path, srv.nthreads); 
+
+      serve(&srv, listen_fd);
+
+      close(listen_fd);
+      unlink(socket_path);
+      write_stats(&srv, stderr);
+
+      pthread_mutex_destroy(&srv.lock);
+      pthread_cond_destroy(&srv.cond);
+      pthread_mutex_destroy(&srv.stats.lock);
+   }
+
+   for (i = 0; i < (int)srv.bin_count; i++) {
+      dwarf_free(&srv.bins[i].dwarf);
+      free(srv.bins[i].path);
+   }
+
+   free(srv.bins);
+
+   return rc;
+}